@@ -0,0 +1,103 @@
+/**
+ * @file bench_ecc.cpp
+ * @brief Times the mask/table ECC kernels against the bit-serial loops they replaced, and each
+ * batch kernel against encoding or checking one word at a time.
+ */
+
+#include "../test/ecc_reference.h"
+#include "ecc/ecc_utils.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+constexpr size_t kIterations = 1 << 20;
+
+template <typename Body>
+double TimeNs(Body &&body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / kIterations;
+}
+
+} // namespace
+
+int main() {
+  std::vector<uint32_t> words = RandomWords(4096);
+  uint64_t sink = 0;
+
+  double compute = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) sink += ecc::compute_ecc(words[i % words.size()] + i);
+  });
+  double compute_reference = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) sink += ReferenceComputeEcc(words[i % words.size()] + i);
+  });
+  double check = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) {
+      sink += ecc::checkError(ecc::compute_ecc(words[i % words.size()]) ^ (1ULL << (i % 39)));
+    }
+  });
+  double check_reference = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) {
+      sink += ReferenceCheckError(ecc::compute_ecc(words[i % words.size()]) ^ (1ULL << (i % 39)));
+    }
+  });
+
+  std::cout << "ns/op (mask/table kernel vs bit-serial loop)\n"
+            << "  compute_ecc: " << compute << " vs " << compute_reference << "\n"
+            << "  checkError:  " << check << " vs " << check_reference << "\n"
+            << "  (checksum " << sink << ")\n";
+
+  // Whole pages, as the page fill and the scrubber encode them
+  constexpr size_t kWords = 1 << 16;
+  constexpr int kRounds = 32;
+  std::vector<uint32_t> page = RandomWords(kWords);
+  std::vector<uint8_t> check_bits(kWords);
+  auto per_word_ns = [](auto &&body) {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; ++round) body();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (kRounds * kWords);
+  };
+
+  double per_call = per_word_ns([&] {
+    for (size_t i = 0; i < kWords; ++i) check_bits[i] = ecc::memory_check_byte(page[i]);
+    sink += check_bits[kWords / 2];
+  });
+  std::cout << "ns/word memory check bits\n"
+            << "  memory_check_byte loop: " << per_call << "\n";
+  for (auto kernel : {ecc::BatchKernel::kScalar, ecc::BatchKernel::kAvx2, ecc::BatchKernel::kAvx512}) {
+    if (!ecc::batch_kernel_supported(kernel)) continue;
+    double batch = per_word_ns([&] {
+      ecc::memory_check_batch(page.data(), check_bits.data(), kWords, kernel);
+      sink += check_bits[kWords / 2];
+    });
+    std::cout << "  " << ecc::batch_kernel_name(kernel) << ": " << batch << "\n";
+  }
+
+  std::vector<uint64_t> encoded(kWords);
+  per_call = per_word_ns([&] {
+    for (size_t i = 0; i < kWords; ++i) encoded[i] = ecc::compute_ecc(page[i]);
+    sink += encoded[kWords / 2];
+  });
+  std::cout << "ns/word register encode (check)\n"
+            << "  compute_ecc loop: " << per_call << "\n";
+  for (auto kernel : {ecc::BatchKernel::kScalar, ecc::BatchKernel::kAvx2, ecc::BatchKernel::kAvx512}) {
+    if (!ecc::batch_kernel_supported(kernel)) continue;
+    double encode = per_word_ns([&] {
+      ecc::compute_ecc_batch(page.data(), encoded.data(), kWords, kernel);
+      sink += encoded[kWords / 2];
+    });
+    double check_batch = per_word_ns([&] {
+      sink += ecc::check_batch(encoded.data(), encoded.data(), kWords, kernel);
+    });
+    std::cout << "  " << ecc::batch_kernel_name(kernel) << ": " << encode << " (" << check_batch << ")\n";
+  }
+  std::cout << "  (checksum " << sink << ")\n";
+  return 0;
+}
@@ -0,0 +1,79 @@
+/**
+ * @file bench_memory.cpp
+ * @brief Times the word accessors of Memory against the byte-at-a-time path they replaced.
+ */
+
+#include "vm/main_memory.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+namespace {
+
+constexpr uint64_t kBase = 0x10000000;
+constexpr size_t kIterations = 1 << 20;
+constexpr uint64_t kSpan = 1 << 16;
+
+template <typename Body>
+double TimeNs(Body &&body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / kIterations;
+}
+
+} // namespace
+
+int main() {
+  Memory memory;
+  uint64_t sink = 0;
+
+  double write_word = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) memory.WriteWord(kBase + (i * 4) % kSpan, i);
+  });
+  double write_word_bytes = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) {
+      for (size_t b = 0; b < 4; ++b) memory.WriteByte(kBase + (i * 4) % kSpan + b, i >> (8 * b));
+    }
+  });
+  double read_word = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) sink += memory.ReadWord(kBase + (i * 4) % kSpan);
+  });
+  double read_word_bytes = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) {
+      uint32_t value = 0;
+      for (size_t b = 0; b < 4; ++b) value |= memory.ReadByte(kBase + (i * 4) % kSpan + b) << (8 * b);
+      sink += value;
+    }
+  });
+  double write_double = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) memory.WriteDoubleWord(kBase + (i * 8) % kSpan, i);
+  });
+  double write_double_bytes = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) {
+      for (size_t b = 0; b < 8; ++b) memory.WriteByte(kBase + (i * 8) % kSpan + b, i >> (8 * b));
+    }
+  });
+  double read_double = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) sink += memory.ReadDoubleWord(kBase + (i * 8) % kSpan);
+  });
+  double read_double_bytes = TimeNs([&] {
+    for (size_t i = 0; i < kIterations; ++i) {
+      uint64_t value = 0;
+      for (size_t b = 0; b < 8; ++b) {
+        value |= static_cast<uint64_t>(memory.ReadByte(kBase + (i * 8) % kSpan + b)) << (8 * b);
+      }
+      sink += value;
+    }
+  });
+
+  std::cout << "ns/op (word access vs byte loop)\n"
+            << "  ReadWord:        " << read_word << " vs " << read_word_bytes << "\n"
+            << "  WriteWord:       " << write_word << " vs " << write_word_bytes << "\n"
+            << "  ReadDoubleWord:  " << read_double << " vs " << read_double_bytes << "\n"
+            << "  WriteDoubleWord: " << write_double << " vs " << write_double_bytes << "\n"
+            << "  (checksum " << sink << ")\n";
+  return 0;
+}
@@ -0,0 +1,240 @@
+/**
+ * @file fault_campaign.h
+ * @brief Contains the fault-injection campaign runner.
+ */
+#ifndef CAMPAIGN_FAULT_CAMPAIGN_H
+#define CAMPAIGN_FAULT_CAMPAIGN_H
+
+#include "vm_asm_mw.h"
+#include "vm/rvss/rvss_checkpoint.h"
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+class RVSSVM;
+
+namespace campaign {
+
+class JsonValue;
+
+enum class FaultModel : uint8_t {
+  kRegister, ///< One bit of a GPR (x1-x31).
+  kMemory, ///< One bit of a word of the text or data section.
+  kPc, ///< One bit of the program counter, kept word aligned.
+  kInjectFlip ///< Nothing from outside: the program's own kInjectFlip instructions flip bits, from the run's seed.
+};
+
+enum class Outcome : uint8_t {
+  kMasked, ///< Finished with the golden run's output and final state.
+  kCorrected, ///< As kMasked, but only because ECC corrected something the golden run did not.
+  kSdc, ///< Finished, with different output or final state: silent data corruption.
+  kCrash, ///< Threw (bad address, bad instruction) or left the text somewhere the golden run did not.
+  kHang ///< Still running after hang_factor times the golden run's instruction count.
+};
+
+inline constexpr size_t kOutcomeCount = 5;
+
+const char *FaultModelName(FaultModel model);
+const char *OutcomeName(Outcome outcome);
+
+/**
+ * @brief What to run and how, usually read from a JSON file:
+ *
+ *     {
+ *       "program": "examples/test2.s",
+ *       "runs": 10000,
+ *       "seed": 1,
+ *       "threads": 0,
+ *       "models": ["register", "memory", "pc"],
+ *       "hang_factor": 2.0,
+ *       "snapshot_interval": 0,
+ *       "output": "test2.campaign.csv",
+ *       "config": {"Memory": {"memory_ecc": "true"}}
+ *     }
+ *
+ * Only "program" is required. A relative program path is taken relative to the specification.
+ * "inject_flip" may also be listed in "models". Other runs, and the golden run, execute the
+ * program's kInjectFlip instructions without flipping anything.
+ */
+struct CampaignSpec {
+  std::filesystem::path program;
+  uint64_t runs = 1000;
+  uint64_t seed = 1;
+  size_t threads = 0; ///< 0 uses one thread per hardware thread.
+  std::vector<FaultModel> models = {FaultModel::kRegister, FaultModel::kMemory, FaultModel::kPc};
+  double hang_factor = 2.0;
+  uint64_t snapshot_interval = 0; ///< Instructions between golden snapshots; 0 picks one from the golden run's length.
+  std::filesystem::path output; ///< Defaults to the program path with a .campaign.csv extension.
+  std::vector<std::tuple<std::string, std::string, std::string>> config; ///< Section, key, value.
+
+  /**
+   * @throws std::runtime_error if a field is missing, unknown or of the wrong type.
+   */
+  static CampaignSpec FromJson(const JsonValue &json, const std::filesystem::path &base_directory = {});
+  static CampaignSpec FromFile(const std::filesystem::path &path);
+};
+
+/**
+ * @brief One fault: which model, when (before which instruction) and where.
+ */
+struct FaultPlan {
+  FaultModel model = FaultModel::kRegister;
+  uint64_t instruction = 0;
+  uint64_t target = 0; ///< GPR index or word address; unused for kPc.
+  unsigned bit = 0;
+  uint64_t seed = 0; ///< Seeds the run's alu::FaultContext; only used by FaultModel::kInjectFlip.
+};
+
+/**
+ * @brief What a run ended with, compared against the golden run to classify it.
+ *
+ * A converged run stopped early, with the state the golden run had at one of its snapshots;
+ * its other fields describe the state at that point.
+ */
+struct RunRecord {
+  bool threw = false;
+  bool finished = false; ///< Reached the end of the text, exited or converged.
+  bool converged = false;
+  uint64_t instructions = 0;
+  uint64_t program_counter = 0;
+  std::optional<uint64_t> exit_code;
+  std::string output;
+  std::array<uint64_t, 32> gpr{};
+  std::array<uint64_t, 32> fpr{};
+  uint64_t memory_hash = 0;
+  uint64_t corrections = 0; ///< Register (kCheckError) plus memory ECC corrections.
+};
+
+/**
+ * @brief The golden run's full state at one instruction count, for runs to fork from and to
+ * compare against.
+ */
+struct GoldenSnapshot {
+  Checkpoint state; ///< Registers, CSRs, PC and sample indices; no preserved pages.
+  Memory::Image memory; ///< Shares unchanged pages with the snapshot before it.
+  size_t output_size = 0; ///< Length of the golden output produced so far.
+  uint64_t corrections = 0; ///< Corrections made so far.
+};
+
+/**
+ * @brief Per-run results, stored a column per field; row i is run i whatever thread ran it.
+ */
+struct CampaignResults {
+  std::vector<FaultModel> model;
+  std::vector<uint64_t> instruction;
+  std::vector<uint64_t> target;
+  std::vector<uint8_t> bit;
+  std::vector<Outcome> outcome;
+  std::vector<uint64_t> instructions; ///< Executed by the run, up to where it converged if it did.
+
+  void Resize(size_t runs);
+
+  [[nodiscard]] size_t Size() const {
+    return outcome.size();
+  }
+
+  [[nodiscard]] std::array<uint64_t, kOutcomeCount> Counts() const;
+
+  /**
+   * @brief Writes a header line and one comma-separated line per run.
+   */
+  void WriteCsv(std::ostream &os) const;
+};
+
+/**
+ * @brief Runs a program once without faults (the golden run), then once per fault in parallel.
+ *
+ * Every run has its own RVSSVM, in sandbox mode, and is planned from the campaign seed and its
+ * index alone, so results do not depend on the number of threads or on scheduling. For the same
+ * reason the memory scrubber does not run, whatever Memory.scrub_rate says.
+ *
+ * The golden run keeps a snapshot every snapshot interval. A faulty run forks from the last
+ * snapshot before its fault rather than starting over, and stops as masked (or corrected) as
+ * soon as its state matches the golden run's at a later snapshot.
+ */
+class FaultCampaign {
+ public:
+  FaultCampaign(CampaignSpec spec, AssembledProgram program);
+
+  /**
+   * @brief Runs the golden run and every faulty run.
+   * @throws std::runtime_error if the golden run crashes or does not finish.
+   */
+  CampaignResults Run();
+
+  [[nodiscard]] const RunRecord &Golden() const {
+    return golden_;
+  }
+
+  /**
+   * @brief Plans run number index. Needs the golden run.
+   */
+  [[nodiscard]] FaultPlan Plan(uint64_t index) const;
+
+  [[nodiscard]] const std::vector<GoldenSnapshot> &Snapshots() const {
+    return snapshots_;
+  }
+
+  [[nodiscard]] uint64_t SnapshotInterval() const {
+    return snapshot_interval_;
+  }
+
+  /**
+   * @brief Resets the VM, runs the program from the start with the fault (or none) and records how it ended.
+   */
+  RunRecord Execute(RVSSVM &vm, const FaultPlan *fault, uint64_t budget) const;
+
+  /**
+   * @brief Loads the program into a VM that Fork() is going to use.
+   */
+  void Prepare(RVSSVM &vm) const;
+
+  /**
+   * @brief Runs the program with the fault from the nearest golden snapshot before it, until it
+   * ends, converges or uses up the hang budget. Needs the golden run.
+   * @param vm A VM that went through Prepare() or earlier runs of this campaign.
+   */
+  RunRecord Fork(RVSSVM &vm, const FaultPlan &fault) const;
+
+  [[nodiscard]] Outcome Classify(const RunRecord &run) const;
+
+ private:
+  static constexpr uint64_t kSnapshots = 256; ///< Snapshots an automatic interval aims for.
+  static constexpr uint64_t kMinSnapshotInterval = 16;
+  static constexpr size_t kSpareResidentPages = 16; ///< Stray pages a VM may keep between forks.
+
+  void Load(RVSSVM &vm, std::ostringstream &output) const;
+  void RunGolden(RVSSVM &vm);
+
+  /**
+   * @brief Runs the golden run again, taking a snapshot every snapshot_interval_ instructions.
+   */
+  void TakeSnapshots(RVSSVM &vm);
+
+  [[nodiscard]] bool Matches(const RVSSVM &vm, const std::ostringstream &output, const GoldenSnapshot &snapshot) const;
+
+  CampaignSpec spec_;
+  AssembledProgram program_;
+  RunRecord golden_;
+  uint64_t budget_ = 0; ///< Instructions after which a run counts as hung.
+  uint64_t snapshot_interval_ = 1;
+  std::vector<GoldenSnapshot> snapshots_; ///< Snapshot i is at instruction i * snapshot_interval_.
+};
+
+/**
+ * @brief Entry point of --campaign: runs the campaign a specification describes, writes its
+ * CSV file and prints a summary.
+ * @return The process exit code.
+ */
+int RunCampaignFile(const std::filesystem::path &spec_path);
+
+} // namespace campaign
+
+#endif // CAMPAIGN_FAULT_CAMPAIGN_H
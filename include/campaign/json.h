@@ -0,0 +1,60 @@
+/**
+ * @file json.h
+ * @brief Contains a small JSON reader for campaign specifications.
+ */
+#ifndef CAMPAIGN_JSON_H
+#define CAMPAIGN_JSON_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace campaign {
+
+/**
+ * @brief A parsed JSON document or one of its values.
+ *
+ * Numbers keep their text, so 64-bit seeds survive without going through a double.
+ * Accessors throw std::runtime_error on a type mismatch.
+ */
+class JsonValue {
+ public:
+  enum class Type { kNull, kBool, kNumber, kString, kArray, kObject };
+
+  /**
+   * @brief Parses a complete JSON document.
+   * @throws std::runtime_error with the offset of the first error.
+   */
+  static JsonValue Parse(std::string_view text);
+
+  [[nodiscard]] Type GetType() const {
+    return type_;
+  }
+
+  [[nodiscard]] bool AsBool() const;
+  [[nodiscard]] double AsDouble() const;
+  [[nodiscard]] uint64_t AsUint() const;
+  [[nodiscard]] const std::string &AsString() const;
+  [[nodiscard]] const std::vector<JsonValue> &AsArray() const;
+  [[nodiscard]] const std::vector<std::pair<std::string, JsonValue>> &AsObject() const;
+
+  /**
+   * @brief The member of an object with the given key, or nullptr if there is none.
+   */
+  [[nodiscard]] const JsonValue *Find(std::string_view key) const;
+
+ private:
+  friend class JsonParser;
+
+  Type type_ = Type::kNull;
+  bool boolean_ = false;
+  std::string text_; ///< String contents, or the literal text of a number.
+  std::vector<JsonValue> array_;
+  std::vector<std::pair<std::string, JsonValue>> object_;
+};
+
+} // namespace campaign
+
+#endif // CAMPAIGN_JSON_H
@@ -0,0 +1,59 @@
+/**
+ * @file work_stealing_pool.h
+ * @brief Contains a work-stealing thread pool for running many independent tasks.
+ */
+#ifndef CAMPAIGN_WORK_STEALING_POOL_H
+#define CAMPAIGN_WORK_STEALING_POOL_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace campaign {
+
+/**
+ * @brief Runs a range of task indices on a fixed number of threads.
+ *
+ * Each worker starts with an equal slice of the range and takes indices from the front of its
+ * own slice. A worker that runs out steals the back half of another worker's slice, so runs
+ * that take very different times (a fault that makes the program hang next to one that is
+ * masked right away) still keep every thread busy until the end.
+ */
+class WorkStealingPool {
+ public:
+  /**
+   * @param threads Worker count; 0 uses one per hardware thread.
+   */
+  explicit WorkStealingPool(size_t threads);
+
+  [[nodiscard]] size_t Threads() const {
+    return threads_;
+  }
+
+  /**
+   * @brief Calls task(worker, index) once for every index in [0, count) and waits for all of them.
+   *
+   * worker is in [0, Threads()) and identifies the calling thread, so tasks can keep per-worker
+   * state without locking. If a task throws, the remaining indices are skipped and the first
+   * exception is rethrown here.
+   */
+  void ForEach(size_t count, const std::function<void(size_t worker, size_t index)> &task);
+
+ private:
+  struct Slice {
+    std::mutex mutex;
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  bool Take(size_t worker, size_t &index);
+
+  size_t threads_;
+  std::vector<std::unique_ptr<Slice>> slices_;
+};
+
+} // namespace campaign
+
+#endif // CAMPAIGN_WORK_STEALING_POOL_H
@@ -21,14 +21,20 @@ enum class CommandType {
   STEP,
   UNDO,
   REDO,
+  REVERSE_STEP,
+  REVERSE_CONTINUE,
+  GOTO_INSTRUCTION,
   RESET,
   MODIFY_REGISTER,
   GET_REGISTER,
   MODIFY_MEMORY,
+  INJECT_MEMORY_FLIP,
   DUMP_MEMORY,
   PRINT_MEMORY,
   GET_MEMORY_POINT,
   DUMP_CACHE,
+  DUMP_STATE,
+  DUMP_ECC_STATS,
   ADD_BREAKPOINT,
   REMOVE_BREAKPOINT,
   VM_STDIN,
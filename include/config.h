@@ -7,6 +7,7 @@
 #define CONFIG_H
 
 #include "globals.h"
+#include "vm/cache/cache_hierarchy.h"
 #include <string>
 #include <iostream>
 #include <stdexcept>
@@ -21,7 +22,35 @@
 namespace vm_config {
 enum class VmTypes {
   SINGLE_STAGE,
-  MULTI_STAGE
+  MULTI_STAGE,
+  JIT ///< Single stage, with hot blocks compiled to native code.
+};
+
+/**
+ * @brief Register ECC policies; see ecc_policy.h.
+ */
+enum class EccPolicies {
+  ADAPTIVE,
+  ALWAYS_SECDED,
+  SIGNIFICANCE,
+  FREQUENCY_DECAY,
+  NONE
+};
+
+/**
+ * @brief Geometry and lookup latency of a cache level other than the L1 data cache.
+ */
+struct CacheLevelSettings {
+  uint64_t size = 0; // Bytes; 0 leaves the level out
+  uint64_t block_size = 0; // Bytes per line
+  uint64_t associativity = 0;
+  uint64_t latency = 1; // Cycles
+
+  cache::LevelConfig getLevelConfig(cache::ReplacementPolicy policy) const {
+    cache::LevelConfig level{cache::CacheConfig::FromSizes(size, block_size, associativity), latency};
+    level.cache.replacement_policy = policy;
+    return level;
+  }
 };
 
 struct VmConfig {
@@ -32,8 +61,50 @@ struct VmConfig {
   uint64_t data_section_start = 0x10000000; // Default start address for data section
   uint64_t text_section_start = 0x0; // Default start address for text section
   uint64_t bss_section_start = 0x11000000; // Default start address for BSS section
+  bool memory_ecc = false; // Keep a check byte per memory word and correct single-bit errors on reads
+  uint64_t scrub_rate = 0; // Words per second the background scrubber checks in ECC mode, 0 disables
 
   uint64_t instruction_execution_limit = 100000000;
+  uint64_t undo_history_size = 64 * 1024 * 1024; // Bytes of undo/redo history kept while stepping
+  uint64_t checkpoint_interval = 1000000; // Instructions between checkpoints for reverse execution, 0 disables
+  uint64_t checkpoint_limit = 64; // Checkpoints kept; older ones are dropped
+  bool hazard_detection = true; // Stall the multi_stage pipeline until operands are ready, instead of reading stale ones
+  bool forwarding = true; // Forward results from EX/MEM and MEM/WB, so only a load's users stall
+
+  uint64_t fault_seed = 0; // Seed of the generator kInjectFlip draws from, 0 picks a random one at every reset
+  double flip_probability = 0.1; // Chance that one kInjectFlip flips a bit
+  unsigned flip_bit_min = 0; // Range of bits a kInjectFlip picks from, uniformly
+  unsigned flip_bit_max = 31;
+
+  EccPolicies ecc_policy = EccPolicies::ADAPTIVE; // What checkError and jalr do with protected values
+  uint8_t ecc_significance_threshold = 40; // Lowest significance the significance policy checks (SIG_POINTER)
+  uint16_t ecc_check_period = 16; // Reads between checks under the frequency_decay policy
+  bool ecc_telemetry = true; // Count what register ECC checks find, for dump_ecc_stats
+  bool ecc_shadow_registers = false; // Full 64-bit GPRs with their codes kept alongside, instead of packed into them
+
+  bool cache_enabled = false; // Simulate the cache hierarchy in front of memory, for statistics and stall cycles
+  uint64_t cache_size = 0; // Bytes
+  uint64_t cache_block_size = 0; // Bytes per line
+  uint64_t cache_associativity = 0;
+  cache::ReplacementPolicy cache_replacement_policy = cache::ReplacementPolicy::LRU;
+  cache::WriteHitPolicy cache_write_hit_policy = cache::WriteHitPolicy::WriteBack;
+  cache::WriteMissPolicy cache_write_miss_policy = cache::WriteMissPolicy::WriteAllocate;
+  uint64_t cache_latency = 1; // Cycles of an L1 data cache lookup
+  CacheLevelSettings l1i_cache{0, 0, 0, 1}; // Fetches are not simulated while its size is 0
+  CacheLevelSettings l2_cache{0, 0, 0, 10};
+  CacheLevelSettings l3_cache{0, 0, 0, 40};
+  cache::Inclusion cache_inclusion = cache::Inclusion::Inclusive;
+  uint64_t memory_latency = 100; // Cycles to read a line from main memory
+  cache::PrefetcherType cache_prefetcher = cache::PrefetcherType::None; // Feeds the L1 data cache
+  uint64_t cache_prefetch_degree = 1; // Lines ahead of next_line and stride
+  uint64_t cache_stream_buffers = 4;
+  uint64_t cache_stream_buffer_depth = 4; // Lines each stream buffer runs ahead
+
+  uint64_t cache_sweep_line_size = 64; // Bytes per line of every geometry --cache-sweep tries
+  uint64_t cache_sweep_min_size = 1024; // Bytes
+  uint64_t cache_sweep_max_size = 1024 * 1024; // Bytes
+  uint64_t cache_sweep_max_associativity = 16;
+  size_t cache_sweep_threads = 0; // 0 uses one thread per hardware thread
 
   bool m_extension_enabled = true;
   bool f_extension_enabled = true;
@@ -88,6 +159,22 @@ struct VmConfig {
     return bss_section_start;
   }
 
+  void setMemoryEcc(bool enabled) {
+    memory_ecc = enabled;
+  }
+
+  bool getMemoryEcc() const {
+    return memory_ecc;
+  }
+
+  void setScrubRate(uint64_t rate) {
+    scrub_rate = rate;
+  }
+
+  uint64_t getScrubRate() const {
+    return scrub_rate;
+  }
+
   void setInstructionExecutionLimit(uint64_t limit) {
     instruction_execution_limit = limit;
   }
@@ -96,6 +183,258 @@ struct VmConfig {
     return instruction_execution_limit;
   }
 
+  void setHazardDetection(bool enabled) {
+    hazard_detection = enabled;
+  }
+
+  bool getHazardDetection() const {
+    return hazard_detection;
+  }
+
+  void setForwarding(bool enabled) {
+    forwarding = enabled;
+  }
+
+  bool getForwarding() const {
+    return forwarding;
+  }
+
+  void setUndoHistorySize(uint64_t size) {
+    undo_history_size = size;
+  }
+
+  uint64_t getUndoHistorySize() const {
+    return undo_history_size;
+  }
+
+  void setCheckpointInterval(uint64_t interval) {
+    checkpoint_interval = interval;
+  }
+
+  uint64_t getCheckpointInterval() const {
+    return checkpoint_interval;
+  }
+
+  void setCheckpointLimit(uint64_t limit) {
+    checkpoint_limit = limit;
+  }
+
+  uint64_t getCheckpointLimit() const {
+    return checkpoint_limit;
+  }
+
+  void setFaultSeed(uint64_t seed) {
+    fault_seed = seed;
+  }
+
+  uint64_t getFaultSeed() const {
+    return fault_seed;
+  }
+
+  void setFlipProbability(double probability) {
+    if (!(probability >= 0.0 && probability <= 1.0)) {
+      throw std::invalid_argument("flip_probability must be between 0 and 1");
+    }
+    flip_probability = probability;
+  }
+
+  double getFlipProbability() const {
+    return flip_probability;
+  }
+
+  // Either bound may be set first; FaultContext::Configure() checks that they form a range
+  void setFlipBitMin(unsigned bit) {
+    if (bit > 63) {
+      throw std::invalid_argument("flip_bit_min must be at most 63");
+    }
+    flip_bit_min = bit;
+  }
+
+  void setFlipBitMax(unsigned bit) {
+    if (bit > 63) {
+      throw std::invalid_argument("flip_bit_max must be at most 63");
+    }
+    flip_bit_max = bit;
+  }
+
+  unsigned getFlipBitMin() const {
+    return flip_bit_min;
+  }
+
+  unsigned getFlipBitMax() const {
+    return flip_bit_max;
+  }
+
+  void setEccPolicy(EccPolicies policy) {
+    ecc_policy = policy;
+  }
+
+  EccPolicies getEccPolicy() const {
+    return ecc_policy;
+  }
+
+  void setEccSignificanceThreshold(uint64_t threshold) {
+    if (threshold > 63) {
+      throw std::invalid_argument("significance_threshold must be at most 63");
+    }
+    ecc_significance_threshold = static_cast<uint8_t>(threshold);
+  }
+
+  uint8_t getEccSignificanceThreshold() const {
+    return ecc_significance_threshold;
+  }
+
+  void setEccCheckPeriod(uint64_t period) {
+    if (period < 1 || period > 1023) {
+      throw std::invalid_argument("check_period must be between 1 and 1023");
+    }
+    ecc_check_period = static_cast<uint16_t>(period);
+  }
+
+  uint16_t getEccCheckPeriod() const {
+    return ecc_check_period;
+  }
+
+  void setEccShadowRegisters(bool enabled) {
+    ecc_shadow_registers = enabled;
+  }
+
+  bool getEccShadowRegisters() const {
+    return ecc_shadow_registers;
+  }
+
+  void setEccTelemetry(bool enabled) {
+    ecc_telemetry = enabled;
+  }
+
+  bool getEccTelemetry() const {
+    return ecc_telemetry;
+  }
+
+  void setCacheEnabled(bool enabled) {
+    cache_enabled = enabled;
+  }
+
+  bool getCacheEnabled() const {
+    return cache_enabled;
+  }
+
+  void setCacheSize(uint64_t size) {
+    cache_size = size;
+  }
+
+  void setCacheBlockSize(uint64_t size) {
+    cache_block_size = size;
+  }
+
+  void setCacheAssociativity(uint64_t associativity) {
+    cache_associativity = associativity;
+  }
+
+  void setCacheReplacementPolicy(cache::ReplacementPolicy policy) {
+    cache_replacement_policy = policy;
+  }
+
+  void setCacheWriteHitPolicy(cache::WriteHitPolicy policy) {
+    cache_write_hit_policy = policy;
+  }
+
+  void setCacheWriteMissPolicy(cache::WriteMissPolicy policy) {
+    cache_write_miss_policy = policy;
+  }
+
+  cache::CacheConfig getCacheConfig() const {
+    cache::CacheConfig cache_config = cache::CacheConfig::FromSizes(cache_size, cache_block_size, cache_associativity);
+    cache_config.replacement_policy = cache_replacement_policy;
+    cache_config.write_hit_policy = cache_write_hit_policy;
+    cache_config.write_miss_policy = cache_write_miss_policy;
+    return cache_config;
+  }
+
+  void setCacheLatency(uint64_t latency) {
+    cache_latency = latency;
+  }
+
+  void setCacheLevel(const std::string &level, const std::string &field, uint64_t value) {
+    CacheLevelSettings *settings = level == "l1i" ? &l1i_cache : level == "l2" ? &l2_cache : level == "l3" ? &l3_cache : nullptr;
+    if (!settings) {
+      throw std::invalid_argument("Unknown cache level: " + level);
+    }
+    if (field == "size") {
+      settings->size = value;
+    } else if (field == "block_size") {
+      settings->block_size = value;
+    } else if (field == "associativity") {
+      settings->associativity = value;
+    } else if (field == "latency") {
+      settings->latency = value;
+    } else {
+      throw std::invalid_argument("Unknown key: " + level + "_" + field);
+    }
+  }
+
+  void setCacheInclusion(cache::Inclusion inclusion) {
+    cache_inclusion = inclusion;
+  }
+
+  void setMemoryLatency(uint64_t latency) {
+    memory_latency = latency;
+  }
+
+  void setCachePrefetcher(cache::PrefetcherType type) {
+    cache_prefetcher = type;
+  }
+
+  void setCachePrefetchDegree(uint64_t degree) {
+    cache_prefetch_degree = degree;
+  }
+
+  void setCacheStreamBuffers(uint64_t buffers) {
+    cache_stream_buffers = buffers;
+  }
+
+  void setCacheStreamBufferDepth(uint64_t depth) {
+    cache_stream_buffer_depth = depth;
+  }
+
+  void setCacheSweepLineSize(uint64_t size) {
+    cache_sweep_line_size = size;
+  }
+
+  void setCacheSweepMinSize(uint64_t size) {
+    cache_sweep_min_size = size;
+  }
+
+  void setCacheSweepMaxSize(uint64_t size) {
+    cache_sweep_max_size = size;
+  }
+
+  void setCacheSweepMaxAssociativity(uint64_t associativity) {
+    cache_sweep_max_associativity = associativity;
+  }
+
+  void setCacheSweepThreads(size_t threads) {
+    cache_sweep_threads = threads;
+  }
+
+  cache::SweepConfig getCacheSweepConfig() const {
+    return {cache_sweep_line_size, cache_sweep_min_size, cache_sweep_max_size, cache_sweep_max_associativity,
+            cache_sweep_threads};
+  }
+
+  cache::HierarchyConfig getCacheHierarchyConfig() const {
+    cache::HierarchyConfig hierarchy;
+    hierarchy.levels[static_cast<size_t>(cache::Level::L1I)] = l1i_cache.getLevelConfig(cache_replacement_policy);
+    hierarchy.levels[static_cast<size_t>(cache::Level::L1D)] = {getCacheConfig(), cache_latency};
+    hierarchy.levels[static_cast<size_t>(cache::Level::L2)] = l2_cache.getLevelConfig(cache_replacement_policy);
+    hierarchy.levels[static_cast<size_t>(cache::Level::L3)] = l3_cache.getLevelConfig(cache_replacement_policy);
+    hierarchy.inclusion = cache_inclusion;
+    hierarchy.memory_latency = memory_latency;
+    hierarchy.prefetcher = cache::MakePrefetcher(cache_prefetcher, cache_prefetch_degree, cache_stream_buffers,
+                                                 cache_stream_buffer_depth);
+    return hierarchy;
+  }
+
   void setMExtensionEnabled(bool enabled) {
     m_extension_enabled = enabled;
   }
@@ -127,6 +466,8 @@ struct VmConfig {
           setVmType(VmTypes::SINGLE_STAGE);
         } else if (value == "multi_stage") {
           setVmType(VmTypes::MULTI_STAGE);
+        } else if (value == "jit") {
+          setVmType(VmTypes::JIT);
         } else {
           throw std::invalid_argument("Unknown VM type: " + value);
         }
@@ -134,6 +475,28 @@ struct VmConfig {
         setRunStepDelay(std::stoull(value));
       } else if (key == "instruction_execution_limit") {
         setInstructionExecutionLimit(std::stoull(value));
+      } else if (key == "undo_history_size") {
+        setUndoHistorySize(std::stoull(value));
+      } else if (key == "checkpoint_interval") {
+        setCheckpointInterval(std::stoull(value));
+      } else if (key == "checkpoint_limit") {
+        setCheckpointLimit(std::stoull(value));
+      } else if (key == "hazard_detection") {
+        if (value == "true") {
+          setHazardDetection(true);
+        } else if (value == "false") {
+          setHazardDetection(false);
+        } else {
+          throw std::invalid_argument("Unknown value: " + value);
+        }
+      } else if (key == "forwarding") {
+        if (value == "true") {
+          setForwarding(true);
+        } else if (value == "false") {
+          setForwarding(false);
+        } else {
+          throw std::invalid_argument("Unknown value: " + value);
+        }
       }
       
       else {
@@ -150,6 +513,16 @@ struct VmConfig {
         setTextSectionStart(std::stoull(value, nullptr, 16));
       } else if (key == "bss_section_start") {
         setBssSectionStart(std::stoull(value, nullptr, 16));
+      } else if (key == "memory_ecc") {
+        if (value == "true") {
+          setMemoryEcc(true);
+        } else if (value == "false") {
+          setMemoryEcc(false);
+        } else {
+          throw std::invalid_argument("Unknown value: " + value);
+        }
+      } else if (key == "scrub_rate") {
+        setScrubRate(std::stoull(value));
       }
       
       
@@ -159,6 +532,159 @@ struct VmConfig {
       }
     } 
 
+    else if (section == "FaultInjection") {
+      if (key == "seed") {
+        setFaultSeed(std::stoull(value));
+      } else if (key == "flip_probability") {
+        setFlipProbability(std::stod(value));
+      } else if (key == "flip_bit_min") {
+        setFlipBitMin(static_cast<unsigned>(std::stoul(value)));
+      } else if (key == "flip_bit_max") {
+        setFlipBitMax(static_cast<unsigned>(std::stoul(value)));
+      } else {
+        throw std::invalid_argument("Unknown key: " + key);
+      }
+    }
+
+    else if (section == "RegisterEcc") {
+      if (key == "policy") {
+        if (value == "adaptive") {
+          setEccPolicy(EccPolicies::ADAPTIVE);
+        } else if (value == "always_secded") {
+          setEccPolicy(EccPolicies::ALWAYS_SECDED);
+        } else if (value == "significance") {
+          setEccPolicy(EccPolicies::SIGNIFICANCE);
+        } else if (value == "frequency_decay") {
+          setEccPolicy(EccPolicies::FREQUENCY_DECAY);
+        } else if (value == "none") {
+          setEccPolicy(EccPolicies::NONE);
+        } else {
+          throw std::invalid_argument("Unknown ECC policy: " + value);
+        }
+      } else if (key == "significance_threshold") {
+        setEccSignificanceThreshold(std::stoull(value));
+      } else if (key == "check_period") {
+        setEccCheckPeriod(std::stoull(value));
+      } else if (key == "layout") {
+        if (value == "packed") {
+          setEccShadowRegisters(false);
+        } else if (value == "shadow") {
+          setEccShadowRegisters(true);
+        } else {
+          throw std::invalid_argument("Unknown register ECC layout: " + value);
+        }
+      } else if (key == "telemetry") {
+        if (value == "true") {
+          setEccTelemetry(true);
+        } else if (value == "false") {
+          setEccTelemetry(false);
+        } else {
+          throw std::invalid_argument("Unknown value: " + value);
+        }
+      } else {
+        throw std::invalid_argument("Unknown key: " + key);
+      }
+    }
+
+    else if (section == "Cache") {
+      if (key == "cache_enabled") {
+        if (value == "true") {
+          setCacheEnabled(true);
+        } else if (value == "false") {
+          setCacheEnabled(false);
+        } else {
+          throw std::invalid_argument("Unknown value: " + value);
+        }
+      } else if (key == "cache_size") {
+        setCacheSize(std::stoull(value, nullptr, 0));
+      } else if (key == "cache_block_size") {
+        setCacheBlockSize(std::stoull(value, nullptr, 0));
+      } else if (key == "cache_associativity") {
+        setCacheAssociativity(std::stoull(value, nullptr, 0));
+      } else if (key == "cache_read_miss_policy") {
+        if (value != "read_allocate") {
+          throw std::invalid_argument("Unknown read miss policy: " + value);
+        }
+      } else if (key == "cache_replacement_policy") {
+        if (value == "LRU") {
+          setCacheReplacementPolicy(cache::ReplacementPolicy::LRU);
+        } else if (value == "FIFO") {
+          setCacheReplacementPolicy(cache::ReplacementPolicy::FIFO);
+        } else if (value == "Random") {
+          setCacheReplacementPolicy(cache::ReplacementPolicy::Random);
+        } else {
+          throw std::invalid_argument("Unknown replacement policy: " + value);
+        }
+      } else if (key == "cache_write_hit_policy") {
+        if (value == "write_back") {
+          setCacheWriteHitPolicy(cache::WriteHitPolicy::WriteBack);
+        } else if (value == "write_through") {
+          setCacheWriteHitPolicy(cache::WriteHitPolicy::WriteThrough);
+        } else {
+          throw std::invalid_argument("Unknown write hit policy: " + value);
+        }
+      } else if (key == "cache_write_miss_policy") {
+        if (value == "write_allocate") {
+          setCacheWriteMissPolicy(cache::WriteMissPolicy::WriteAllocate);
+        } else if (value == "no_write_allocate") {
+          setCacheWriteMissPolicy(cache::WriteMissPolicy::NoWriteAllocate);
+        } else {
+          throw std::invalid_argument("Unknown write miss policy: " + value);
+        }
+      } else if (key == "cache_latency") {
+        setCacheLatency(std::stoull(value, nullptr, 0));
+      } else if (key == "cache_inclusion") {
+        if (value == "inclusive") {
+          setCacheInclusion(cache::Inclusion::Inclusive);
+        } else if (value == "exclusive") {
+          setCacheInclusion(cache::Inclusion::Exclusive);
+        } else {
+          throw std::invalid_argument("Unknown inclusion policy: " + value);
+        }
+      } else if (key == "memory_latency") {
+        setMemoryLatency(std::stoull(value, nullptr, 0));
+      } else if (key == "cache_prefetcher") {
+        if (value == "none") {
+          setCachePrefetcher(cache::PrefetcherType::None);
+        } else if (value == "next_line") {
+          setCachePrefetcher(cache::PrefetcherType::NextLine);
+        } else if (value == "stride") {
+          setCachePrefetcher(cache::PrefetcherType::Stride);
+        } else if (value == "stream_buffer") {
+          setCachePrefetcher(cache::PrefetcherType::StreamBuffer);
+        } else {
+          throw std::invalid_argument("Unknown prefetcher: " + value);
+        }
+      } else if (key == "cache_prefetch_degree") {
+        setCachePrefetchDegree(std::stoull(value, nullptr, 0));
+      } else if (key == "cache_stream_buffers") {
+        setCacheStreamBuffers(std::stoull(value, nullptr, 0));
+      } else if (key == "cache_stream_buffer_depth") {
+        setCacheStreamBufferDepth(std::stoull(value, nullptr, 0));
+      } else if (key.starts_with("l1i_") || key.starts_with("l2_") || key.starts_with("l3_")) {
+        const size_t split = key.find('_');
+        setCacheLevel(key.substr(0, split), key.substr(split + 1), std::stoull(value, nullptr, 0));
+      } else {
+        throw std::invalid_argument("Unknown key: " + key);
+      }
+    }
+
+    else if (section == "CacheSweep") {
+      if (key == "line_size") {
+        setCacheSweepLineSize(std::stoull(value, nullptr, 0));
+      } else if (key == "min_size") {
+        setCacheSweepMinSize(std::stoull(value, nullptr, 0));
+      } else if (key == "max_size") {
+        setCacheSweepMaxSize(std::stoull(value, nullptr, 0));
+      } else if (key == "max_associativity") {
+        setCacheSweepMaxAssociativity(std::stoull(value, nullptr, 0));
+      } else if (key == "threads") {
+        setCacheSweepThreads(std::stoull(value, nullptr, 0));
+      } else {
+        throw std::invalid_argument("Unknown key: " + key);
+      }
+    }
+
     else if (section == "Assembler") {
       if (key == "m_extension_enabled") {
         if (value == "true") {
@@ -29,6 +29,22 @@ namespace ecc{
     constexpr uint64_t SIG_MASK = 0x3FULL;
 
 
+    // The metadata byte of a register in the shadow layout (see RegisterFile): the value itself
+    // is a full 64 bits, with its SECDED(72,64) code in a byte of its own.
+    // [0-5] Significance
+    // [6-7] Error History
+    constexpr int SHADOW_HIST_SHIFT = 6;
+
+    constexpr uint8_t shadow_meta(uint8_t sig, uint8_t hist){
+        return static_cast<uint8_t>((sig&SIG_MASK)|((hist&HIST_MASK)<<SHADOW_HIST_SHIFT));
+    }
+    constexpr uint8_t shadow_sig(uint8_t meta){
+        return meta&SIG_MASK;
+    }
+    constexpr uint8_t shadow_hist(uint8_t meta){
+        return (meta>>SHADOW_HIST_SHIFT)&HIST_MASK;
+    }
+
     enum ECCMode{
         MODE_NONE = 0, //00
         MODE_SEC = 1,//01
@@ -0,0 +1,234 @@
+#ifndef ECC_POLICY_H
+#define ECC_POLICY_H
+
+#include <cstdint>
+#include <variant>
+
+#include "ecc_metadata.h"
+#include "ecc_utils.h"
+
+namespace ecc{
+    // What a policy does with a protected value that checkError or jalr reads
+    enum class PolicyAction : uint8_t{
+        kSkip, // use it as it is
+        kCheck // correct a single flipped bit first
+    };
+
+    // What became of one value a policy was given
+    enum class CheckResult : uint8_t{
+        kSkipped,
+        kClean,
+        kCorrected,
+        kUncorrectable // two flipped bits: detected, passed on as it was
+    };
+
+    // The metadata fields of a value, as a policy sees and rewrites them
+    struct Metadata{
+        uint8_t mode = MODE_NONE;
+        uint8_t hist = 0;
+        uint16_t freq = 0;
+        uint8_t sig = 0;
+    };
+
+    struct PolicyStats{
+        uint64_t checked = 0;
+        uint64_t skipped = 0; // checks the policy avoided
+        uint64_t corrected = 0;
+        uint64_t uncorrectable = 0;
+    };
+
+    // Base of the policies, which only decide; reading and writing the metadata bits and counting
+    // is done here, so the whole check inlines into the caller. Derived provides
+    //   PolicyAction decide(const Metadata &m) const  -- m.freq already counts this read
+    //   void settle(Metadata &m, bool corrected) const -- sets the mode (and history) written back
+    template<class Derived>
+    struct Policy{
+        uint64_t check(uint64_t value, PolicyStats &stats, CheckResult &result) const{
+            const Derived &self = static_cast<const Derived &>(*this);
+            Metadata m{get_mode(value), get_hist(value), get_freq(value), get_significance(value)};
+            if(m.freq<FREQ_MASK){
+                m.freq++;
+            }
+
+            uint64_t processed = value;
+            result = CheckResult::kSkipped;
+            if(self.decide(m)==PolicyAction::kCheck){
+                stats.checked++;
+                processed = checkError(value);
+                if((processed&DATA_ECC_MASK)!=(value&DATA_ECC_MASK)){
+                    result = CheckResult::kCorrected;
+                    stats.corrected++;
+                    if(m.hist<HIST_MASK){
+                        m.hist++;
+                    }
+                }
+                else if(hamming_parity(static_cast<uint32_t>(value))!=((value>>32)&0x3F)){
+                    // Overall parity matched but the Hamming bits did not: an even number of flips
+                    result = CheckResult::kUncorrectable;
+                    stats.uncorrectable++;
+                }
+                else{
+                    result = CheckResult::kClean;
+                }
+            }
+            else{
+                stats.skipped++;
+            }
+            self.settle(m, result==CheckResult::kCorrected);
+            return update_metadata(processed, m.mode, m.hist, m.freq, m.sig);
+        }
+
+        // The same for a register of the shadow layout, whose code is always SECDED and whose
+        // metadata byte has no read count: a policy sees every read as due for a check.
+        CheckResult check_shadow(uint64_t &value, uint8_t &check, uint8_t &meta, PolicyStats &stats) const{
+            const Derived &self = static_cast<const Derived &>(*this);
+            Metadata m{MODE_SECDED, shadow_hist(meta), FREQ_MASK, shadow_sig(meta)};
+            if(self.decide(m)==PolicyAction::kSkip){
+                stats.skipped++;
+                return CheckResult::kSkipped;
+            }
+
+            stats.checked++;
+            CheckResult result = CheckResult::kClean;
+            switch(correct_secded64(value, check)){
+                case WordCheck::kClean: break;
+                case WordCheck::kCorrected: {
+                    result = CheckResult::kCorrected;
+                    stats.corrected++;
+                    if(m.hist<HIST_MASK){
+                        m.hist++;
+                    }
+                    break;
+                }
+                case WordCheck::kUncorrectable: {
+                    result = CheckResult::kUncorrectable;
+                    stats.uncorrectable++;
+                    break;
+                }
+            }
+            self.settle(m, result==CheckResult::kCorrected);
+            meta = shadow_meta(m.sig, m.hist);
+            return result;
+        }
+    };
+
+    // Checks everything not marked MODE_NONE; critical values get SECDED, the rest SEC.
+    // freq counts reads, saturating.
+    struct AdaptivePolicy : Policy<AdaptivePolicy>{
+        static constexpr const char *NAME = "adaptive";
+
+        PolicyAction decide(const Metadata &m) const{
+            return m.mode!=MODE_NONE ? PolicyAction::kCheck : PolicyAction::kSkip;
+        }
+        void settle(Metadata &m, bool) const{
+            m.mode = m.sig>=SIG_CRITICAL ? MODE_SECDED : MODE_SEC;
+        }
+    };
+
+    // Checks every value, whatever its metadata says.
+    struct AlwaysSecdedPolicy : Policy<AlwaysSecdedPolicy>{
+        static constexpr const char *NAME = "always_secded";
+
+        PolicyAction decide(const Metadata &) const{
+            return PolicyAction::kCheck;
+        }
+        void settle(Metadata &m, bool) const{
+            m.mode = MODE_SECDED;
+        }
+    };
+
+    // Checks values of at least the threshold significance, and any value that has been corrected
+    // before; the rest are left unprotected.
+    struct SignificanceThresholdPolicy : Policy<SignificanceThresholdPolicy>{
+        static constexpr const char *NAME = "significance";
+
+        uint8_t threshold = SIG_POINTER;
+
+        PolicyAction decide(const Metadata &m) const{
+            return m.sig>=threshold || m.hist>0 ? PolicyAction::kCheck : PolicyAction::kSkip;
+        }
+        void settle(Metadata &m, bool) const{
+            if(m.sig>=SIG_CRITICAL){
+                m.mode = MODE_SECDED;
+            }
+            else{
+                m.mode = m.sig>=threshold ? MODE_SEC : MODE_NONE;
+            }
+        }
+    };
+
+    // Checks a value once every period reads (freq counts reads since its last check) and on every
+    // read while it has an error history, which decays by one with each clean check.
+    struct FrequencyDecayPolicy : Policy<FrequencyDecayPolicy>{
+        static constexpr const char *NAME = "frequency_decay";
+
+        uint16_t period = 16;
+
+        PolicyAction decide(const Metadata &m) const{
+            return m.hist>0 || m.freq>=period ? PolicyAction::kCheck : PolicyAction::kSkip;
+        }
+        void settle(Metadata &m, bool corrected) const{
+            if(m.hist>0 || m.freq>=period){
+                if(!corrected && m.hist>0){
+                    m.hist--;
+                }
+                m.freq = 0;
+            }
+            m.mode = m.hist>0 ? MODE_SECDED : MODE_SEC;
+        }
+    };
+
+    // Checks nothing.
+    struct NoEccPolicy : Policy<NoEccPolicy>{
+        static constexpr const char *NAME = "none";
+
+        PolicyAction decide(const Metadata &) const{
+            return PolicyAction::kSkip;
+        }
+        void settle(Metadata &m, bool) const{
+            m.mode = MODE_NONE;
+        }
+    };
+
+    using AnyPolicy = std::variant<AdaptivePolicy, AlwaysSecdedPolicy, SignificanceThresholdPolicy,
+                                   FrequencyDecayPolicy, NoEccPolicy>;
+
+    // A VM's register ECC policy and what it has done. The policy is fixed when the engine is built;
+    // check() dispatches on it with a switch, not a virtual call.
+    class PolicyEngine{
+    public:
+        PolicyEngine() = default;
+        explicit PolicyEngine(AnyPolicy policy) : policy_(policy){}
+
+        uint64_t check(uint64_t value){
+            CheckResult result;
+            return check(value, result);
+        }
+
+        uint64_t check(uint64_t value, CheckResult &result){
+            return std::visit([&](const auto &policy){ return policy.check(value, stats_, result); }, policy_);
+        }
+
+        CheckResult check_shadow(uint64_t &value, uint8_t &check, uint8_t &meta){
+            return std::visit([&](const auto &policy){ return policy.check_shadow(value, check, meta, stats_); }, policy_);
+        }
+
+        const char *name() const{
+            return std::visit([](const auto &policy){ return policy.NAME; }, policy_);
+        }
+
+        const PolicyStats &stats() const{
+            return stats_;
+        }
+
+        void reset_stats(){
+            stats_ = {};
+        }
+
+    private:
+        AnyPolicy policy_;
+        PolicyStats stats_;
+    };
+}
+
+#endif
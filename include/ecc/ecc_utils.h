@@ -1,18 +1,233 @@
 #ifndef ECC_UTILS_H
 #define ECC_UTILS_H
+#include<array>
+#include<bit>
+#include<cstddef>
 #include<cstdint>
 #include "ecc_metadata.h"
 
 namespace ecc{
-    uint64_t compute_ecc(uint32_t data);
+    // Data bit i sits at Hamming position i+1, and parity bit j covers every position with bit j set.
+    // Instead of walking the 32 data bits, each parity bit is the parity of data & PARITY_MASKS[j].
+    constexpr std::array<uint32_t, 6> make_parity_masks(){
+        std::array<uint32_t, 6> masks{};
+        for(int i=0;i<32;i++){
+            uint32_t pos = i+1;
+            for(int j=0;j<6;j++){
+                if((pos>>j)&1){
+                    masks[j] |= 1U<<i;
+                }
+            }
+        }
+        return masks;
+    }
+
+    constexpr std::array<uint32_t, 6> PARITY_MASKS = make_parity_masks();
+
+    // Data bit to flip for each syndrome; syndromes that do not name a data position correct nothing
+    constexpr std::array<uint32_t, 64> make_correction_table(){
+        std::array<uint32_t, 64> table{};
+        for(int syndrome=1;syndrome<=32;syndrome++){
+            table[syndrome] = 1U<<(syndrome-1);
+        }
+        return table;
+    }
+
+    constexpr std::array<uint32_t, 64> CORRECTION_TABLE = make_correction_table();
+
+    constexpr uint32_t hamming_parity(uint32_t data){
+        uint32_t code = 0;
+        for(int j=0;j<6;j++){
+            code |= static_cast<uint32_t>(std::popcount(data&PARITY_MASKS[j])&1)<<j;
+        }
+        return code;
+    }
 
     //  bits[31:0] = original value
     //  bits[38:32] = 7 bits ecc
     //  other bits = 0;
-    
-    uint64_t checkError(uint64_t encoded);
+    constexpr uint64_t compute_ecc(uint32_t data){
+        uint32_t hamming_code = hamming_parity(data);
+
+        // overall parity over the data and the six Hamming bits
+        uint32_t p_all = (std::popcount(data)+std::popcount(hamming_code))&1;
+        uint32_t final_ecc = (p_all<<6)|hamming_code;
+
+        return (static_cast<uint64_t>(final_ecc)<<32)|static_cast<uint64_t>(data);
+    }
+
+    // Corrects a single flipped data bit and re-encodes; clean values are returned untouched
+    // and uncorrectable ones are returned as they came in.
+    constexpr uint64_t checkError(uint64_t encoded){
+        uint32_t data = static_cast<uint32_t>(encoded & 0xFFFFFFFFULL);
+        uint32_t ecc_received = static_cast<uint32_t>((encoded >> 32) & 0x7F); // 7 bits
+
+        uint32_t syndrome = hamming_parity(data)^(ecc_received&0x3F);
+        uint32_t p_all_computed = (std::popcount(data)+std::popcount(ecc_received&0x3F))&1;
+        bool parity_mismatch = p_all_computed!=((ecc_received>>6)&1);
 
+        if(!parity_mismatch){
+            // no error, or two errors that can not be corrected
+            return encoded;
+        }
+        return compute_ecc(data^CORRECTION_TABLE[syndrome]);
+    }
+
+    // checkError under AdaptivePolicy (ecc_policy.h), for callers without a VM's policy engine
     uint64_t adaptive_check_error(uint64_t reg_val);
+
+    // Check byte of one 32-bit word of ECC memory. This is a standard Hamming(38,32) code with the
+    // data in the positions 3..38 that are not powers of two, plus an overall parity bit (bit 6).
+    // Unlike the register encoding above, a flipped check bit has a syndrome of its own, so any
+    // single flip in the 39 stored bits is corrected and any double flip is detected.
+    constexpr std::array<uint32_t, 6> make_memory_parity_masks(){
+        std::array<uint32_t, 6> masks{};
+        int bit = 0;
+        for(uint32_t pos=1;pos<=38;pos++){
+            if(std::has_single_bit(pos)){
+                continue;
+            }
+            for(int j=0;j<6;j++){
+                if((pos>>j)&1){
+                    masks[j] |= 1U<<bit;
+                }
+            }
+            bit++;
+        }
+        return masks;
+    }
+
+    constexpr std::array<uint32_t, 6> MEMORY_PARITY_MASKS = make_memory_parity_masks();
+
+    // Data bit to flip for each syndrome; zero for syndromes that point at a check bit or past the word
+    constexpr std::array<uint32_t, 64> make_memory_correction_table(){
+        std::array<uint32_t, 64> table{};
+        int bit = 0;
+        for(uint32_t pos=1;pos<=38;pos++){
+            if(!std::has_single_bit(pos)){
+                table[pos] = 1U<<bit++;
+            }
+        }
+        return table;
+    }
+
+    constexpr std::array<uint32_t, 64> MEMORY_CORRECTION_TABLE = make_memory_correction_table();
+
+    constexpr uint8_t memory_check_byte(uint32_t data){
+        uint32_t code = 0;
+        for(int j=0;j<6;j++){
+            code |= static_cast<uint32_t>(std::popcount(data&MEMORY_PARITY_MASKS[j])&1)<<j;
+        }
+        uint32_t p_all = (std::popcount(data)+std::popcount(code))&1;
+        return static_cast<uint8_t>((p_all<<6)|code);
+    }
+
+    enum class WordCheck : uint8_t{
+        kClean,
+        kCorrected,    // one bit was flipped; data and check now hold the corrected word
+        kUncorrectable // two (or more) bits were flipped; data and check are left as they were
+    };
+
+    constexpr WordCheck correct_memory_word(uint32_t &data, uint8_t &check){
+        uint32_t syndrome = (memory_check_byte(data)^check)&0x3F;
+        bool odd = ((std::popcount(data)+std::popcount(static_cast<uint32_t>(check&0x7F)))&1)!=0;
+
+        if(!odd){
+            return syndrome==0 ? WordCheck::kClean : WordCheck::kUncorrectable;
+        }
+        // An odd number of flips is taken to be one: in the data, in a check bit (power-of-two
+        // syndrome) or in the overall parity bit (zero syndrome)
+        if(syndrome!=0 && !std::has_single_bit(syndrome) && MEMORY_CORRECTION_TABLE[syndrome]==0){
+            return WordCheck::kUncorrectable;
+        }
+        data ^= MEMORY_CORRECTION_TABLE[syndrome];
+        check = memory_check_byte(data);
+        return WordCheck::kCorrected;
+    }
+
+    // Check byte of a full 64-bit register in the shadow register layout: SECDED(72,64), a
+    // Hamming(71,64) code with the data in the positions 3..71 that are not powers of two, plus an
+    // overall parity bit (bit 7). Like the memory code, any single flip in the 72 bits is corrected.
+    constexpr std::array<uint64_t, 7> make_secded64_parity_masks(){
+        std::array<uint64_t, 7> masks{};
+        int bit = 0;
+        for(uint32_t pos=1;pos<=71;pos++){
+            if(std::has_single_bit(pos)){
+                continue;
+            }
+            for(int j=0;j<7;j++){
+                if((pos>>j)&1){
+                    masks[j] |= uint64_t{1}<<bit;
+                }
+            }
+            bit++;
+        }
+        return masks;
+    }
+
+    constexpr std::array<uint64_t, 7> SECDED64_PARITY_MASKS = make_secded64_parity_masks();
+
+    // Data bit to flip for each syndrome; zero for syndromes that point at a check bit or past the word
+    constexpr std::array<uint64_t, 128> make_secded64_correction_table(){
+        std::array<uint64_t, 128> table{};
+        int bit = 0;
+        for(uint32_t pos=1;pos<=71;pos++){
+            if(!std::has_single_bit(pos)){
+                table[pos] = uint64_t{1}<<bit++;
+            }
+        }
+        return table;
+    }
+
+    constexpr std::array<uint64_t, 128> SECDED64_CORRECTION_TABLE = make_secded64_correction_table();
+
+    constexpr uint8_t secded64_check_byte(uint64_t data){
+        uint32_t code = 0;
+        for(int j=0;j<7;j++){
+            code |= static_cast<uint32_t>(std::popcount(data&SECDED64_PARITY_MASKS[j])&1)<<j;
+        }
+        uint32_t p_all = (std::popcount(data)+std::popcount(code))&1;
+        return static_cast<uint8_t>((p_all<<7)|code);
+    }
+
+    constexpr WordCheck correct_secded64(uint64_t &data, uint8_t &check){
+        uint32_t syndrome = (secded64_check_byte(data)^check)&0x7F;
+        bool odd = ((std::popcount(data)+std::popcount(static_cast<uint32_t>(check)))&1)!=0;
+
+        if(!odd){
+            return syndrome==0 ? WordCheck::kClean : WordCheck::kUncorrectable;
+        }
+        if(syndrome!=0 && !std::has_single_bit(syndrome) && SECDED64_CORRECTION_TABLE[syndrome]==0){
+            return WordCheck::kUncorrectable;
+        }
+        data ^= SECDED64_CORRECTION_TABLE[syndrome];
+        check = secded64_check_byte(data);
+        return WordCheck::kCorrected;
+    }
+
+    // Implementations of the batch kernels; best_batch_kernel() picks the widest one the CPU supports.
+    enum class BatchKernel{
+        kScalar,
+        kAvx2,  // vpshufb nibble parity, 8 words per step
+        kAvx512 // vpopcntd, 16 words per step
+    };
+
+    bool batch_kernel_supported(BatchKernel kernel);
+    BatchKernel best_batch_kernel();
+    const char *batch_kernel_name(BatchKernel kernel);
+
+    // out[i] = compute_ecc(data[i]) for every i < count.
+    void compute_ecc_batch(const uint32_t *data, uint64_t *out, size_t count);
+    void compute_ecc_batch(const uint32_t *data, uint64_t *out, size_t count, BatchKernel kernel);
+
+    // out[i] = checkError(encoded[i]) for every i < count; encoded and out may be the same array.
+    // Returns how many words were changed (corrected or re-encoded).
+    size_t check_batch(const uint64_t *encoded, uint64_t *out, size_t count);
+    size_t check_batch(const uint64_t *encoded, uint64_t *out, size_t count, BatchKernel kernel);
+
+    // check[i] = memory_check_byte(words[i]) for every i < count.
+    void memory_check_batch(const uint32_t *words, uint8_t *check, size_t count);
+    void memory_check_batch(const uint32_t *words, uint8_t *check, size_t count, BatchKernel kernel);
 }
 
 #endif
@@ -6,6 +6,9 @@
 #ifndef ALU_H
 #define ALU_H
 
+#include "ecc/ecc_policy.h"
+#include "vm/fault_rng.h"
+
 #include <cfenv>
 #include <cmath>
 #include <cstdint>
@@ -280,6 +283,45 @@ inline std::ostream& operator<<(std::ostream& os, const AluOp& op) {
     }
     return os;
 }
+/**
+ * @brief A VM's state behind kInjectFlip and kCheckError.
+ *
+ * Each VM owns one, so VMs on different threads share nothing. kInjectFlip takes one position
+ * of the generator per execution, whether it flips or not, so the position is part of the
+ * architectural state: checkpoints keep it and a run restored from one flips the same bits.
+ */
+struct FaultContext {
+    static constexpr double kDefaultFlipProbability = 0.1;
+
+    FaultRng rng;
+    uint64_t draws = 0; ///< Positions of rng used so far.
+    double flip_probability = kDefaultFlipProbability; ///< Chance that a kInjectFlip flips a bit.
+    unsigned flip_bit_min = 0; ///< Lowest bit a kInjectFlip may flip.
+    unsigned flip_bit_max = 31; ///< Highest bit a kInjectFlip may flip; 32 and up are the value's ECC bits.
+    uint64_t flips = 0; ///< Bits flipped by kInjectFlip.
+    uint64_t corrections = 0; ///< Values kCheckError found a correctable error in.
+    ecc::PolicyEngine ecc_policy; ///< Decides what kCheckError (and jalr) check.
+    ecc::CheckResult last_check = ecc::CheckResult::kSkipped; ///< What the latest kCheckError found.
+
+    /**
+     * @brief Restarts the sequence from a seed and clears the counters.
+     */
+    void Seed(uint64_t seed) {
+        rng.Seed(seed);
+        draws = 0;
+        flips = 0;
+        corrections = 0;
+        ecc_policy.reset_stats();
+    }
+
+    /**
+     * @brief Takes the seed, flip probability and bit range from the FaultInjection config section,
+     * and the ECC policy from RegisterEcc. A seed of 0 means a fresh random seed. A range with
+     * flip_bit_min above flip_bit_max is replaced by bits 0 to 31, with a warning.
+     */
+    void Configure();
+};
+
 /**
  * @brief The alu class is responsible for performing arithmetic and logic operations.
  */
@@ -303,6 +345,33 @@ public:
      */
     [[nodiscard]] static std::pair<uint64_t, bool> execute(AluOp op, uint64_t a, uint64_t b) ;
 
+    /**
+     * @brief execute() for a VM: kInjectFlip draws from the VM's generator and kCheckError
+     * follows the VM's ECC policy and counts its corrections. Without a context, kInjectFlip
+     * flips nothing and kCheckError follows ecc::AdaptivePolicy, uncounted.
+     */
+    [[nodiscard]] static std::pair<uint64_t, bool> execute(AluOp op, uint64_t a, uint64_t b, FaultContext &context) {
+        if (op==AluOp::kInjectFlip) {
+            return injectFlip(a, context);
+        }
+        if (op==AluOp::kCheckError) {
+            uint64_t checked = context.ecc_policy.check(a, context.last_check);
+            bool corrected = context.last_check==ecc::CheckResult::kCorrected;
+            context.corrections += corrected;
+            return {checked, corrected};
+        }
+        return execute(op, a, b);
+    }
+
+    [[nodiscard]] static std::pair<uint64_t, bool> injectFlip(uint64_t value, FaultContext &context);
+
+    /**
+     * @brief execute() for the shadow register layout, where values are plain 64-bit integers:
+     * kAdd, kSub, kMul and kDiv work on all 64 bits as in RV64 and attach no code. Every other
+     * operation is as execute().
+     */
+    [[nodiscard]] static std::pair<uint64_t, bool> executeWide(AluOp op, uint64_t a, uint64_t b);
+
     // TODO: check all the floating point operations
 
     [[nodiscard]] static std::pair<uint64_t, uint8_t> fpexecute(AluOp op, uint64_t ina, uint64_t inb, uint64_t inc, uint8_t rm) ;
@@ -0,0 +1,151 @@
+/**
+ * @file breakpoints.h
+ * @brief Contains the breakpoint set checked by the VMs' debug loops.
+ */
+#ifndef BREAKPOINTS_H
+#define BREAKPOINTS_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+class RegisterFile;
+class MemoryController;
+
+/**
+ * @brief Predicate a breakpoint must satisfy to stop execution.
+ *
+ * Values are compared as unsigned 64-bit integers, exactly as they sit in the register
+ * file or memory (so ECC-protected registers include their check and metadata bits).
+ */
+struct BreakpointCondition {
+  enum class Source : uint8_t {
+    kNone, ///< Unconditional.
+    kGpr, ///< operand is a GPR index.
+    kFpr, ///< operand is an FPR index.
+    kMemory ///< operand is the address of a doubleword.
+  };
+  enum class Compare : uint8_t { kEq, kNe, kLt, kLe, kGt, kGe };
+
+  Source source = Source::kNone;
+  Compare compare = Compare::kEq;
+  uint64_t operand = 0;
+  uint64_t value = 0;
+
+  /**
+   * @brief Parses "<lhs> <op> <value>", where lhs is xN, fN or mem[<hex address>], op is one of
+   * == != < <= > >= and value is hex (0x...) or decimal.
+   * @throws std::invalid_argument if the condition is malformed.
+   */
+  static BreakpointCondition Parse(const std::string &lhs, const std::string &op, const std::string &value);
+
+  [[nodiscard]] bool Evaluate(const RegisterFile &registers, MemoryController &memory) const;
+};
+
+struct Breakpoint {
+  uint64_t address = 0;
+  BreakpointCondition condition;
+  uint64_t ignore_count = 0; ///< Hits to let through before stopping.
+  bool temporary = false; ///< Removed the first time it stops execution.
+  uint64_t hit_count = 0; ///< Times it was reached with its condition true.
+};
+
+/**
+ * @brief Open-addressing hash set of instruction addresses.
+ */
+class FlatAddressSet {
+ public:
+  [[nodiscard]] bool Contains(uint64_t address) const;
+  bool Insert(uint64_t address);
+  bool Erase(uint64_t address);
+  void Clear();
+
+  [[nodiscard]] bool Empty() const {
+    return size_==0;
+  }
+
+ private:
+  static constexpr uint64_t kEmpty = UINT64_MAX; ///< Never a valid address: addresses are word aligned.
+
+  [[nodiscard]] size_t Slot(uint64_t address) const {
+    return (address * 0x9E3779B97F4A7C15ull) >> (64 - bits_);
+  }
+  void Grow();
+
+  std::vector<uint64_t> slots_;
+  size_t size_ = 0;
+  unsigned bits_ = 0;
+};
+
+/**
+ * @brief Breakpoints keyed by instruction address.
+ *
+ * Addresses inside the text section are also marked in a bitmap with one bit per
+ * instruction, and the rest live in a FlatAddressSet, so MaybeHit() is O(1) and
+ * touches no breakpoint data unless an address is marked. Conditions, ignore counts
+ * and temporary breakpoints are only looked at after that, in entries sorted by address
+ * so a hit is found by binary search.
+ */
+class BreakpointSet {
+ public:
+  /**
+   * @brief Sizes the bitmap for a text section of the given length in bytes.
+   */
+  void SetTextSize(uint64_t size);
+
+  /**
+   * @return false if a breakpoint already exists at the address.
+   * @throws std::invalid_argument if the address is not a multiple of 4.
+   */
+  bool Add(const Breakpoint &breakpoint);
+
+  /**
+   * @return false if there is no breakpoint at the address.
+   */
+  bool Remove(uint64_t address);
+
+  void Clear();
+
+  /**
+   * @brief Whether any breakpoint is set at the address, regardless of its condition.
+   */
+  [[nodiscard]] bool MaybeHit(uint64_t address) const {
+    uint64_t slot = address >> 2;
+    if (slot < text_slots_) {
+      return (bitmap_[slot >> 6] >> (slot & 63)) & 1;
+    }
+    return !outside_text_.Empty() && outside_text_.Contains(address);
+  }
+
+  /**
+   * @brief Whether the breakpoint at the address has its condition true. Does not count a hit.
+   */
+  [[nodiscard]] bool Matches(uint64_t address, const RegisterFile &registers, MemoryController &memory) const;
+
+  /**
+   * @brief Counts a hit if the condition holds and decides whether to stop.
+   *
+   * Applies the ignore count and removes temporary breakpoints that stop.
+   */
+  bool ShouldStop(uint64_t address, const RegisterFile &registers, MemoryController &memory);
+
+  [[nodiscard]] const Breakpoint *Find(uint64_t address) const;
+
+  /**
+   * @brief Every breakpoint, sorted by address.
+   */
+  [[nodiscard]] const std::vector<Breakpoint> &Entries() const {
+    return entries_;
+  }
+
+ private:
+  void Mark(uint64_t address, bool set);
+
+  std::vector<Breakpoint> entries_; ///< Sorted by address.
+  std::vector<uint64_t> bitmap_;
+  uint64_t text_slots_ = 0; ///< Instructions covered by the bitmap.
+  FlatAddressSet outside_text_;
+};
+
+#endif // BREAKPOINTS_H
@@ -7,6 +7,8 @@
 #define CACHE_H
 
 #include <cstdint>
+#include <ostream>
+#include <string>
 #include <vector>
 
 namespace cache {
@@ -22,9 +24,9 @@ enum class CacheType {
   Data         ///< Cache for data
 };
 
-enum class CacheLineState {
-  Valid,       ///< Cache line is valid
+enum class CacheLineState : uint8_t {
   Invalid,     ///< Cache line is invalid
+  Valid,       ///< Cache line is valid
   Dirty        ///< Cache line has been modified
 };
 
@@ -38,6 +40,10 @@ enum class WriteMissPolicy {
   WriteAllocate    ///< Allocate on write miss
 };
 
+const char *ReplacementPolicyName(ReplacementPolicy policy);
+const char *WriteHitPolicyName(WriteHitPolicy policy);
+const char *WriteMissPolicyName(WriteMissPolicy policy);
+
 struct CacheConfig {
   unsigned long lines = 0;  ///< Number of lines in the cache
   unsigned long associativity = 0; ///< Associativity of the cache
@@ -47,44 +53,165 @@ struct CacheConfig {
   WriteHitPolicy write_hit_policy = WriteHitPolicy::WriteBack; ///< Write hit policy
   WriteMissPolicy write_miss_policy = WriteMissPolicy::NoWriteAllocate; ///< Write miss policy
   unsigned long size = 0;   ///< Size of the cache in bytes
-};
-
-struct CacheLine {
-  CacheLineState state = CacheLineState::Invalid; ///< State of the cache line
-  unsigned long tag = 0;    ///< Tag for the cache line
-  std::vector<uint8_t> data; ///< Data stored in the cache line
-  
-};
-
-struct CacheStats {
-  unsigned long accesses; ///< Total number of accesses to the cache
-  unsigned long hits;     ///< Total number of hits in the cache
-  unsigned long misses;   ///< Total number of misses in the cache
 
+  /**
+   * @brief Derives lines and words_per_line from the size and a line size in bytes.
+   */
+  static CacheConfig FromSizes(unsigned long size, unsigned long line_size, unsigned long associativity);
 
+  /**
+   * @brief Describes what is wrong with the geometry, or returns an empty string if the cache can
+   * be built: a power-of-two line size of at least a word, and a power-of-two number of sets.
+   */
+  [[nodiscard]] std::string Validate() const;
 };
 
-struct CacheSet {
-  unsigned long associativity; ///< Associativity of the cache set
-  std::vector<CacheLine> lines; ///< Lines in the cache set
-
-  CacheSet(unsigned long assoc)
-    : associativity(assoc), lines(assoc) {}
+struct CacheStats {
+  unsigned long accesses = 0; ///< Total number of accesses to the cache
+  unsigned long hits = 0;     ///< Total number of hits in the cache
+  unsigned long misses = 0;   ///< Total number of misses in the cache
+  unsigned long reads = 0;
+  unsigned long writes = 0;
+  unsigned long read_misses = 0;
+  unsigned long write_misses = 0;
+  unsigned long evictions = 0;   ///< Valid lines replaced by a fill
+  unsigned long writebacks = 0;  ///< Dirty lines written back to memory on eviction
+  unsigned long write_throughs = 0; ///< Writes passed on to memory (write-through, or a miss not allocated)
+
+  [[nodiscard]] double HitRate() const {
+    return accesses ? static_cast<double>(hits) / static_cast<double>(accesses) : 0.0;
+  }
 };
 
+/**
+ * @brief A set-associative cache model that tracks which lines are present and dirty, for
+ * statistics; the data itself always lives in main memory.
+ *
+ * Tags, line states and replacement stamps are kept in flat arrays indexed by
+ * set * associativity + way, so a lookup scans one contiguous run of tags.
+ */
 class Cache {
-  bool enabled; ///< Flag to indicate if the cache is enabled
-  CacheType type; ///< Type of cache (instruction or data)
-  CacheConfig config; ///< Configuration of the cache
-  CacheStats stats; ///< Statistics for the cache
-
-
+ public:
+  /**
+   * @brief What one access did.
+   */
+  struct AccessResult {
+    bool hit = false;
+    bool filled = false;    ///< A miss allocated the line (not a write miss under no-write-allocate).
+    bool evicted = false;   ///< A valid line was replaced to make room.
+    bool writeback = false; ///< The replaced line was dirty.
+    uint64_t victim = 0;    ///< Line address of the replaced line.
+  };
+
+  Cache() = default;
+
+  /**
+   * @brief Rebuilds the cache empty, with zeroed statistics.
+   * @return An empty string, or why the geometry is invalid, in which case the cache stays disabled.
+   */
+  std::string Configure(bool enabled, const CacheConfig &config);
+
+  [[nodiscard]] bool Enabled() const {
+    return enabled_;
+  }
+
+  [[nodiscard]] const CacheConfig &Config() const {
+    return config_;
+  }
+
+  [[nodiscard]] const CacheStats &Stats() const {
+    return stats_;
+  }
+
+  [[nodiscard]] uint64_t LineSize() const {
+    return uint64_t{1} << offset_bits_;
+  }
+
+  /**
+   * @brief Accesses size bytes at address, every line they touch. Does nothing while disabled.
+   */
+  void Access(uint64_t address, uint64_t size, bool write);
+
+  /**
+   * @brief Accesses the line holding address.
+   */
+  AccessResult AccessLine(uint64_t line_address, bool write);
+
+  /**
+   * @brief Writes the line if it is present and otherwise only counts a write miss, whatever the
+   * write miss policy, for a write an exclusive level passes down without allocating.
+   * @return Whether the line was present.
+   */
+  bool WriteIfPresent(uint64_t line_address);
+
+  /**
+   * @brief Places a line handed down by the level above (an exclusive victim) without counting
+   * an access; a line already present only picks up the dirty bit.
+   */
+  AccessResult Insert(uint64_t line_address, bool dirty);
+
+  /**
+   * @brief Looks the line up as a read and, on a hit, removes it, for an exclusive level
+   * promoting the line to the level above.
+   * @return The state the line was in; Invalid on a miss.
+   */
+  CacheLineState Extract(uint64_t line_address);
+
+  /**
+   * @brief Drops the line holding address without counting an access.
+   * @return The state the line was in.
+   */
+  CacheLineState Invalidate(uint64_t address);
+
+  /**
+   * @brief Whether the line holding address is present, without touching any state.
+   */
+  [[nodiscard]] bool Contains(uint64_t address) const;
+
+  /**
+   * @brief Invalidates every line, dropping dirty ones without writing them back, and zeroes the statistics.
+   */
+  void Clear();
+
+  /**
+   * @brief Writes the cache as a JSON object with no trailing newline, every line after the
+   * first prefixed with indent.
+   */
+  void WriteJson(std::ostream &os, const std::string &indent = "") const;
+  void PrintStatus(std::ostream &os, const std::string &name = "Cache") const;
+
+ private:
+  [[nodiscard]] size_t Base(uint64_t line_address) const {
+    return static_cast<size_t>(line_address & set_mask_) * associativity_;
+  }
+
+  /**
+   * @brief The way holding line_address in the set starting at base, or base + associativity.
+   */
+  [[nodiscard]] size_t Find(size_t base, uint64_t line_address) const;
+
+  /**
+   * @brief Replaces a way of the set for line_address, recording what was evicted in result.
+   */
+  size_t Fill(size_t base, uint64_t line_address, AccessResult &result);
+
+  [[nodiscard]] size_t Victim(size_t base);
+
+  bool enabled_ = false;
+  CacheConfig config_;
+  CacheStats stats_;
+
+  unsigned offset_bits_ = 0;
+  uint64_t set_mask_ = 0;
+  size_t associativity_ = 0;
+
+  std::vector<uint64_t> tags_; ///< Line address (address >> offset bits) of each way.
+  std::vector<CacheLineState> states_;
+  std::vector<uint64_t> stamps_; ///< Last use (LRU) or fill (FIFO) of each way.
+  uint64_t clock_ = 0;
+  uint64_t random_state_ = 0;
 };
 
-
-
 } // namespace cache
 
-
-
-#endif // CACHE_H
\ No newline at end of file
+#endif // CACHE_H
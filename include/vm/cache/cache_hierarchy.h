@@ -0,0 +1,222 @@
+/**
+ * @file cache_hierarchy.h
+ * @brief Contains the CacheHierarchy class, split L1 instruction and data caches over shared levels.
+ */
+#ifndef CACHE_HIERARCHY_H
+#define CACHE_HIERARCHY_H
+
+#include "cache.h"
+#include "cache_sweep.h"
+#include "prefetcher.h"
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+namespace cache {
+
+enum class Level : uint8_t {
+  L1I, ///< Level 1 instruction cache, sees fetches
+  L1D, ///< Level 1 data cache, sees loads and stores
+  L2,  ///< Shared by both L1 caches
+  L3   ///< Shared, below L2
+};
+
+constexpr size_t kLevels = 4;
+
+const char *LevelName(Level level);
+
+enum class Inclusion {
+  Inclusive, ///< A shared level holds every line of the levels above it
+  Exclusive  ///< A line lives in one level at a time; L1 victims move down
+};
+
+const char *InclusionName(Inclusion inclusion);
+
+struct LevelConfig {
+  CacheConfig cache;   ///< A size of 0 leaves the level out
+  uint64_t latency = 1; ///< Cycles to look the level up
+
+  [[nodiscard]] bool Present() const {
+    return cache.size!=0;
+  }
+};
+
+struct HierarchyConfig {
+  std::array<LevelConfig, kLevels> levels; ///< Indexed by Level
+  Inclusion inclusion = Inclusion::Inclusive;
+  uint64_t memory_latency = 100; ///< Cycles to read a line from main memory
+  AnyPrefetcher prefetcher;      ///< Feeds the L1 data cache
+
+  /**
+   * @brief Describes what is wrong with the hierarchy, or returns an empty string if it can be
+   * built: the L1 data cache must be present, every present level must have a valid geometry,
+   * lines may only grow going down (inclusive) or must all be the same size (exclusive).
+   */
+  [[nodiscard]] std::string Validate() const;
+};
+
+struct HierarchyStats {
+  uint64_t fetches = 0;
+  uint64_t fetch_cycles = 0;
+  uint64_t data_accesses = 0;
+  uint64_t data_cycles = 0;
+  uint64_t stall_cycles = 0;       ///< Cycles beyond the first of every fetch and data access
+  uint64_t memory_reads = 0;       ///< Lines read from main memory
+  uint64_t memory_writes = 0;      ///< Lines and write-throughs that reached main memory
+  uint64_t back_invalidations = 0; ///< Upper-level lines dropped to keep an inclusive level inclusive
+  PrefetchStats prefetch;
+
+  [[nodiscard]] double FetchAmat() const {
+    return fetches ? static_cast<double>(fetch_cycles) / static_cast<double>(fetches) : 0.0;
+  }
+
+  [[nodiscard]] double DataAmat() const {
+    return data_accesses ? static_cast<double>(data_cycles) / static_cast<double>(data_accesses) : 0.0;
+  }
+
+  [[nodiscard]] double Amat() const {
+    const uint64_t accesses = fetches + data_accesses;
+    return accesses ? static_cast<double>(fetch_cycles + data_cycles) / static_cast<double>(accesses) : 0.0;
+  }
+};
+
+/**
+ * @brief Split L1 instruction and data caches over an optional L2 and L3, with a latency per
+ * level, that estimates how many cycles each fetch and data access takes.
+ *
+ * An access costs the latency of every level it looks up, down to the one that hits, plus the
+ * memory latency if none does. Writebacks and write-throughs are assumed to be absorbed by a
+ * write buffer and cost nothing. Like Cache, only presence is modelled; the data stays in memory.
+ */
+class CacheHierarchy {
+ public:
+  CacheHierarchy() = default;
+
+  /**
+   * @brief Rebuilds every level empty, with zeroed statistics.
+   * @return An empty string, or why the hierarchy is invalid, in which case it stays disabled.
+   */
+  std::string Configure(bool enabled, const HierarchyConfig &config);
+
+  [[nodiscard]] bool Enabled() const {
+    return enabled_;
+  }
+
+  /**
+   * @brief Whether fetches and data accesses need to be reported at all: the caches are enabled
+   * or a trace is being recorded.
+   */
+  [[nodiscard]] bool Active() const {
+    return enabled_ || trace_;
+  }
+
+  /**
+   * @brief Records every fetch and data access into trace from now on, whether or not the caches
+   * are enabled; nullptr stops. Configure leaves the trace alone.
+   */
+  void SetTrace(AccessTrace *trace) {
+    trace_ = trace;
+  }
+
+  [[nodiscard]] bool Present(Level level) const {
+    return caches_[static_cast<size_t>(level)].Enabled();
+  }
+
+  [[nodiscard]] const Cache &GetLevel(Level level) const {
+    return caches_[static_cast<size_t>(level)];
+  }
+
+  [[nodiscard]] const HierarchyConfig &Config() const {
+    return config_;
+  }
+
+  [[nodiscard]] const HierarchyStats &Stats() const {
+    return stats_;
+  }
+
+  [[nodiscard]] const char *PrefetcherName() const {
+    return std::visit([](const auto &prefetcher) { return prefetcher.NAME; }, prefetcher_);
+  }
+
+  /**
+   * @brief Fetches the instruction word at address through the L1 instruction cache, and takes
+   * address as the PC of the data accesses that follow, for the prefetcher.
+   * @return The cycles the fetch took; 0 if there is no L1 instruction cache.
+   */
+  uint64_t Fetch(uint64_t address);
+
+  /**
+   * @brief Loads or stores size bytes at address through the L1 data cache.
+   * @return The cycles the access took.
+   */
+  uint64_t Data(uint64_t address, uint64_t size, bool write);
+
+  /**
+   * @brief Invalidates every level and zeroes the statistics.
+   */
+  void Clear();
+
+  void WriteJson(std::ostream &os) const;
+  void PrintStatus(std::ostream &os) const;
+
+ private:
+  uint64_t AccessL1(size_t level, uint64_t address, uint64_t size, bool write);
+
+  /**
+   * @brief Brings the line holding address up from level (kLevels for memory) into the L1 cache
+   * l1 just filled.
+   * @return The cycles it took.
+   */
+  uint64_t Fill(size_t level, uint64_t address, size_t l1);
+
+  /**
+   * @brief Writes the line holding address into level, or memory, as a writeback or write-through.
+   */
+  void WriteTo(size_t level, uint64_t address);
+
+  /**
+   * @brief Passes a write L1 did not allocate down an exclusive hierarchy: into the level below
+   * that holds the line, if any, and otherwise to memory.
+   */
+  void WriteAround(size_t level, uint64_t address);
+
+  /**
+   * @brief Deals with the line an access or insertion at level replaced.
+   */
+  void Evicted(size_t level, const Cache::AccessResult &result);
+
+  /**
+   * @brief Credits a demand hit on a prefetched line and lets the prefetcher see the access.
+   * @return The cycles the access still waited for a late prefetch.
+   */
+  uint64_t Prefetch(uint64_t address, uint64_t line, const Cache::AccessResult &result);
+
+  /**
+   * @brief Brings line into the L1 data cache ahead of use, starting at cycle now.
+   */
+  void Issue(uint64_t line, uint64_t now);
+
+  /**
+   * @brief The first shared level below level, or kLevels for memory.
+   */
+  [[nodiscard]] size_t Next(size_t level) const;
+
+  bool enabled_ = false;
+  HierarchyConfig config_;
+  HierarchyStats stats_;
+  std::array<Cache, kLevels> caches_;
+  AccessTrace *trace_ = nullptr;
+
+  AnyPrefetcher prefetcher_;
+  bool prefetching_ = false; ///< Not NoPrefetcher, so the common case skips the dispatch
+  std::unordered_map<uint64_t, uint64_t> prefetched_; ///< Line address of unused prefetched lines -> cycle they arrive
+  uint64_t clock_ = 0;    ///< One cycle per fetch, plus every stall
+  uint64_t fetch_pc_ = 0; ///< PC of the instruction fetched last
+};
+
+} // namespace cache
+
+#endif // CACHE_HIERARCHY_H
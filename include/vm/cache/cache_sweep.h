@@ -0,0 +1,130 @@
+/**
+ * @file cache_sweep.h
+ * @brief Contains the single-pass cache sweep: LRU hit rates of many cache geometries from one
+ * recorded address stream.
+ */
+#ifndef CACHE_SWEEP_H
+#define CACHE_SWEEP_H
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace cache {
+
+enum class Stream : uint8_t {
+  Data,       ///< Loads and stores
+  Instruction ///< Fetches
+};
+
+constexpr size_t kStreams = 2;
+
+const char *StreamName(Stream stream);
+
+/**
+ * @brief The line addresses a program touched, in order, with the stream each access came from.
+ */
+class AccessTrace {
+ public:
+  /**
+   * @param line_size A power of two.
+   */
+  explicit AccessTrace(uint64_t line_size)
+      : offset_bits_(static_cast<unsigned>(std::countr_zero(line_size))) {}
+
+  /**
+   * @brief Records size bytes at address, one entry per line they touch.
+   */
+  void Record(uint64_t address, uint64_t size, Stream stream) {
+    const uint64_t last = (address + size - 1) >> offset_bits_;
+    for (uint64_t line = address >> offset_bits_; line <= last; ++line) {
+      entries_.push_back(line << 1 | static_cast<uint64_t>(stream));
+    }
+  }
+
+  [[nodiscard]] uint64_t LineSize() const {
+    return uint64_t{1} << offset_bits_;
+  }
+
+  /**
+   * @brief Line address << 1 | Stream of every access.
+   */
+  [[nodiscard]] const std::vector<uint64_t> &Entries() const {
+    return entries_;
+  }
+
+ private:
+  unsigned offset_bits_;
+  std::vector<uint64_t> entries_;
+};
+
+struct SweepConfig {
+  uint64_t line_size = 64;         ///< Bytes per line, for every geometry
+  uint64_t min_size = 1024;        ///< Smallest cache size, in bytes
+  uint64_t max_size = 1024 * 1024; ///< Largest cache size, in bytes
+  uint64_t max_associativity = 16; ///< Widest set-associative column; a fully associative column is always added
+  size_t threads = 0;              ///< 0 uses one thread per hardware thread
+
+  /**
+   * @brief Describes what is wrong with the ranges, or returns an empty string: every value but
+   * threads must be a power of two, and line_size <= min_size <= max_size.
+   */
+  [[nodiscard]] std::string Validate() const;
+};
+
+/**
+ * @brief LRU stack distances of both streams for one number of sets.
+ */
+struct SetFamily {
+  uint64_t sets = 0;
+  /**
+   * @brief [stream][d]: accesses that found d other lines of their set used since the line's
+   * last use. The last bucket counts first uses and distances too large for any cache swept.
+   */
+  std::array<std::vector<uint64_t>, kStreams> distances;
+
+  /**
+   * @brief Hits of an LRU cache of this many sets and the given ways.
+   */
+  [[nodiscard]] uint64_t Hits(Stream stream, uint64_t ways) const;
+};
+
+struct SweepResult {
+  SweepConfig config;
+  std::array<uint64_t, kStreams> accesses{};
+  std::vector<SetFamily> families; ///< families[i] has 1 << i sets
+
+  /**
+   * @brief The hit rate of an LRU cache of size bytes and the given ways, or a negative value if
+   * no geometry of the sweep matches.
+   */
+  [[nodiscard]] double HitRate(Stream stream, uint64_t size, uint64_t ways) const;
+
+  /**
+   * @brief Writes one row per stream and size, one hit rate column per associativity (powers of
+   * two up to max_associativity, then fully associative); geometries that do not exist are left empty.
+   */
+  void WriteCsv(std::ostream &os) const;
+};
+
+/**
+ * @brief Computes the stack distances of every set count the sweep needs, each on its own
+ * thread, with a Fenwick tree per set over that set's accesses (Mattson et al., in
+ * O(n log n) per set count instead of O(n * ways)).
+ */
+SweepResult Sweep(const AccessTrace &trace, const SweepConfig &config);
+
+/**
+ * @brief Runs the program once while recording its addresses, sweeps them with the [CacheSweep]
+ * configuration, and writes the matrix next to the program with a .cache_sweep.csv extension.
+ * @return The process exit code.
+ */
+int RunCacheSweep(const std::filesystem::path &program_path);
+
+} // namespace cache
+
+#endif // CACHE_SWEEP_H
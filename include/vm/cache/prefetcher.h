@@ -0,0 +1,208 @@
+/**
+ * @file prefetcher.h
+ * @brief Contains the L1 data cache prefetchers, as policy classes the cache hierarchy
+ * dispatches to without virtual calls.
+ */
+#ifndef CACHE_PREFETCHER_H
+#define CACHE_PREFETCHER_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <variant>
+#include <vector>
+
+namespace cache {
+
+enum class PrefetcherType {
+  None,        ///< No prefetching
+  NextLine,    ///< Tagged next-line
+  Stride,      ///< PC-indexed stride table
+  StreamBuffer ///< Sequential stream buffers
+};
+
+/**
+ * @brief One access of the L1 data cache, for a prefetcher to train on.
+ */
+struct PrefetchTrigger {
+  uint64_t pc = 0;      ///< Address of the load or store
+  uint64_t address = 0; ///< Byte address accessed
+  uint64_t line = 0;    ///< Line address (address >> offset bits)
+  bool miss = false;
+  bool prefetch_hit = false; ///< First demand use of a prefetched line
+};
+
+// A prefetcher provides
+//   static constexpr const char *NAME
+//   template<class Issue> void Observe(const PrefetchTrigger &trigger, unsigned offset_bits, Issue &&issue)
+// and calls issue(line) for every line address it wants brought into the L1 data cache.
+
+struct NoPrefetcher {
+  static constexpr const char *NAME = "none";
+
+  template<class Issue>
+  void Observe(const PrefetchTrigger &, unsigned, Issue &&) {}
+};
+
+// Tagged next-line: a miss, or the first use of a line it prefetched, fetches the next degree lines.
+struct NextLinePrefetcher {
+  static constexpr const char *NAME = "next_line";
+
+  uint64_t degree = 1;
+
+  template<class Issue>
+  void Observe(const PrefetchTrigger &trigger, unsigned, Issue &&issue) {
+    if (trigger.miss || trigger.prefetch_hit) {
+      for (uint64_t i = 1; i <= degree; ++i) {
+        issue(trigger.line + i);
+      }
+    }
+  }
+};
+
+// Reference prediction table: the last address and stride of each load or store, indexed by its
+// PC. Once the same stride has been seen twice in a row, i.e. from the third access of an entry
+// on, it fetches the next degree lines along it.
+struct StridePrefetcher {
+  static constexpr const char *NAME = "stride";
+  static constexpr size_t kEntries = 64;
+
+  struct Entry {
+    uint64_t pc = 0;
+    uint64_t last = 0;
+    int64_t stride = 0;
+    uint8_t confidence = 0; ///< Repeats of stride, saturating at 3; prefetches from 1
+    bool valid = false;
+  };
+
+  uint64_t degree = 1;
+  std::array<Entry, kEntries> table{};
+
+  template<class Issue>
+  void Observe(const PrefetchTrigger &trigger, unsigned offset_bits, Issue &&issue) {
+    Entry &entry = table[(trigger.pc >> 2) % kEntries];
+    if (!entry.valid || entry.pc!=trigger.pc) {
+      entry = {trigger.pc, trigger.address, 0, 0, true};
+      return;
+    }
+    const int64_t stride = static_cast<int64_t>(trigger.address - entry.last);
+    entry.last = trigger.address;
+    if (stride!=0 && stride==entry.stride) {
+      entry.confidence = static_cast<uint8_t>(std::min(entry.confidence + 1, 3));
+    } else if (entry.confidence) {
+      entry.confidence--;
+    } else {
+      entry.stride = stride;
+    }
+    if (!entry.confidence) {
+      return;
+    }
+    const uint64_t magnitude = static_cast<uint64_t>(entry.stride < 0 ? -entry.stride : entry.stride);
+    for (uint64_t i = 1; i <= degree; ++i) {
+      if (magnitude >> offset_bits) {
+        issue((trigger.address + static_cast<uint64_t>(entry.stride) * i) >> offset_bits);
+      } else {
+        // Several accesses per line: the next lines in the stride's direction
+        issue(entry.stride < 0 ? trigger.line - i : trigger.line + i);
+      }
+    }
+  }
+};
+
+// Sequential stream buffers: a miss outside every stream starts a new one (replacing the least
+// recently used) that runs depth lines ahead of the accesses following it. The lines go into the
+// L1 data cache itself rather than into separate buffers.
+struct StreamBufferPrefetcher {
+  static constexpr const char *NAME = "stream_buffer";
+
+  struct Stream {
+    uint64_t head = 0; ///< Next line the stream expects an access to
+    uint64_t next = 0; ///< First line not prefetched yet
+    uint64_t stamp = 0;
+    bool valid = false;
+  };
+
+  uint64_t depth = 4;
+  std::vector<Stream> streams = std::vector<Stream>(4);
+  uint64_t clock = 0;
+
+  template<class Issue>
+  void Observe(const PrefetchTrigger &trigger, unsigned, Issue &&issue) {
+    clock++;
+    for (Stream &stream : streams) {
+      if (stream.valid && trigger.line >= stream.head && trigger.line < stream.next) {
+        stream.head = trigger.line + 1;
+        stream.stamp = clock;
+        for (; stream.next < stream.head + depth; ++stream.next) {
+          issue(stream.next);
+        }
+        return;
+      }
+    }
+    if (!trigger.miss || streams.empty()) {
+      return;
+    }
+    Stream &stream = *std::min_element(streams.begin(), streams.end(), [](const Stream &a, const Stream &b) {
+      return a.valid!=b.valid ? !a.valid : a.stamp < b.stamp;
+    });
+    stream = {trigger.line + 1, trigger.line + 1, clock, true};
+    for (; stream.next < stream.head + depth; ++stream.next) {
+      issue(stream.next);
+    }
+  }
+};
+
+using AnyPrefetcher = std::variant<NoPrefetcher, NextLinePrefetcher, StridePrefetcher, StreamBufferPrefetcher>;
+
+/**
+ * @brief Builds a prefetcher; degree is the lines ahead of next-line and stride, streams and
+ * depth configure the stream buffers.
+ */
+inline AnyPrefetcher MakePrefetcher(PrefetcherType type, uint64_t degree, uint64_t streams, uint64_t depth) {
+  switch (type) {
+    case PrefetcherType::None: return NoPrefetcher();
+    case PrefetcherType::NextLine: return NextLinePrefetcher{degree};
+    case PrefetcherType::Stride: {
+      StridePrefetcher stride;
+      stride.degree = degree;
+      return stride;
+    }
+    case PrefetcherType::StreamBuffer: {
+      StreamBufferPrefetcher buffers;
+      buffers.depth = depth;
+      buffers.streams.assign(streams, StreamBufferPrefetcher::Stream());
+      return buffers;
+    }
+  }
+  return NoPrefetcher();
+}
+
+/**
+ * @brief What the prefetcher did; the L1 data cache's own statistics only count demand accesses.
+ */
+struct PrefetchStats {
+  uint64_t issued = 0;    ///< Lines brought into the L1 data cache ahead of use
+  uint64_t redundant = 0; ///< Requests for lines already present, dropped
+  uint64_t useful = 0;    ///< Prefetched lines a load or store then used
+  uint64_t late = 0;      ///< Useful prefetches used before they had arrived
+  uint64_t useless = 0;   ///< Prefetched lines evicted unused
+
+  [[nodiscard]] double Accuracy() const {
+    return issued ? static_cast<double>(useful) / static_cast<double>(issued) : 0.0;
+  }
+
+  /**
+   * @brief Share of the misses there would have been without prefetching that were avoided.
+   */
+  [[nodiscard]] double Coverage(uint64_t demand_misses) const {
+    return useful ? static_cast<double>(useful) / static_cast<double>(useful + demand_misses) : 0.0;
+  }
+
+  [[nodiscard]] double Timeliness() const {
+    return useful ? static_cast<double>(useful - late) / static_cast<double>(useful) : 0.0;
+  }
+};
+
+} // namespace cache
+
+#endif // CACHE_PREFETCHER_H
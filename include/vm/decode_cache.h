@@ -0,0 +1,100 @@
+/**
+ * @file decode_cache.h
+ * @brief Contains the predecoded instruction format and the cache holding the decoded text section.
+ */
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include "alu.h"
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+/**
+ * @brief Execution unit an instruction is dispatched to.
+ */
+enum class ExecClass : uint8_t {
+  kInteger,  ///< RV64 I/M and the custom integer (SIMD, ECC) instructions.
+  kFloat,    ///< RV64 F.
+  kDouble,   ///< RV64 D.
+  kBFloat16, ///< Custom BFloat16 instructions.
+  kSIMDF32,  ///< Custom packed float32 instructions.
+  kCsr,      ///< Zicsr instructions.
+  kSyscall   ///< ecall.
+};
+
+/**
+ * @brief An instruction with all fields and control signals resolved.
+ */
+struct DecodedInstruction {
+  uint32_t instruction = 0; ///< The raw instruction word.
+  int32_t imm = 0; ///< Sign-extended immediate, as produced by VmBase::ImmGenerator.
+  alu::AluOp alu_op = alu::AluOp::kNone; ///< ALU operation resolved by the control unit.
+  ExecClass exec_class = ExecClass::kInteger;
+
+  uint8_t opcode = 0;
+  uint8_t funct3 = 0;
+  uint8_t funct7 = 0;
+  uint8_t rd = 0;
+  uint8_t rs1 = 0;
+  uint8_t rs2 = 0;
+  uint8_t rs3 = 0;
+
+  bool alu_src = false;
+  bool reg_write = false;
+  bool mem_read = false;
+  bool mem_write = false;
+  bool branch = false;
+  bool load_protected = false;
+
+  bool valid = false; ///< Cleared when the backing text word is written.
+};
+
+/**
+ * @brief Holds one decoded entry per word of the text section.
+ *
+ * Entries are filled at program load and invalidated by stores into the text range.
+ * Invalid entries are decoded again from memory on their next fetch.
+ */
+class DecodeCache {
+ public:
+  void Clear() {
+    entries_.clear();
+    end_ = 0;
+  }
+
+  void Resize(uint64_t size_in_bytes) {
+    entries_.assign(size_in_bytes / 4, DecodedInstruction());
+    end_ = entries_.size() * 4;
+  }
+
+  /**
+   * @brief Returns the entry for the given address, or nullptr if it lies outside the text section.
+   */
+  [[nodiscard]] DecodedInstruction *Lookup(uint64_t address) {
+    if (address >= end_ || (address & 0b11)) {
+      return nullptr;
+    }
+    return &entries_[address >> 2];
+  }
+
+  /**
+   * @brief Invalidates every entry overlapping [address, address + size).
+   */
+  void Invalidate(uint64_t address, uint64_t size) {
+    if (address >= end_ || size == 0) {
+      return;
+    }
+    uint64_t last = std::min(address + size - 1, end_ - 1);
+    for (uint64_t i = address >> 2; i <= (last >> 2); ++i) {
+      entries_[i].valid = false;
+    }
+  }
+
+ private:
+  std::vector<DecodedInstruction> entries_;
+  uint64_t end_ = 0;
+};
+
+#endif // DECODE_CACHE_H
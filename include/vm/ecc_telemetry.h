@@ -0,0 +1,135 @@
+/**
+ * @file ecc_telemetry.h
+ * @brief Contains the EccTelemetry class, which counts what register ECC checks find.
+ */
+#ifndef ECC_TELEMETRY_H
+#define ECC_TELEMETRY_H
+
+#include "ecc/ecc_metadata.h"
+#include "ecc/ecc_policy.h"
+#include "memory_scrubber.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Counts the outcome of every register ECC check (kCheckError, jalr) by significance
+ * class, the freq field of the values checked, and corrections per instruction address.
+ *
+ * Only the thread running the VM records, so the counters are bumped with a plain relaxed load
+ * and store instead of an atomic read-modify-write; any other thread can Take() a snapshot at
+ * any time, as dump_ecc_stats does while a program runs. The per-address counts are only
+ * touched when a check finds an error, and take a lock then.
+ */
+class EccTelemetry {
+ public:
+  enum class SignificanceClass : uint8_t {
+    kTemp, ///< Below SIG_DATA.
+    kData, ///< SIG_DATA up to SIG_POINTER.
+    kPointer, ///< SIG_POINTER up to SIG_CRITICAL.
+    kCritical ///< SIG_CRITICAL.
+  };
+
+  static constexpr size_t kClasses = 4;
+  static constexpr size_t kResults = 4; ///< One per ecc::CheckResult.
+  static constexpr size_t kFreqBuckets = 16;
+  static constexpr unsigned kFreqBucketShift = 6; ///< The 10-bit freq field in buckets of 64.
+
+  struct Snapshot {
+    std::string policy;
+    std::array<std::array<uint64_t, kResults>, kClasses> results{}; ///< [class][ecc::CheckResult]
+    std::array<uint64_t, kFreqBuckets> freq{};
+    std::map<uint64_t, std::array<uint64_t, 2>> errors_by_pc; ///< Corrected, uncorrectable.
+    bool memory_ecc = false; ///< Whether memory is in ECC mode; memory is only counted then.
+    Memory::EccStats memory; ///< Filled in by the VM, which owns the memory.
+    bool scrubbing = false; ///< Whether the background scrubber is running.
+    MemoryScrubber::Stats scrub; ///< Since the scrubber was last started.
+
+    [[nodiscard]] uint64_t Total(ecc::CheckResult result) const;
+    [[nodiscard]] uint64_t Checks() const; ///< Checked or skipped.
+
+    void WriteJson(std::ostream &os) const;
+
+    /**
+     * @brief A few lines for the end of --run, for the register checks if there were any and
+     * for memory and its scrubber if memory is in ECC mode.
+     */
+    void PrintSummary(std::ostream &os) const;
+  };
+
+  EccTelemetry() = default;
+  EccTelemetry(const EccTelemetry &) = delete;
+  EccTelemetry &operator=(const EccTelemetry &) = delete;
+
+  static SignificanceClass Classify(uint8_t significance) {
+    if (significance >= ecc::SIG_CRITICAL) {
+      return SignificanceClass::kCritical;
+    }
+    if (significance >= ecc::SIG_POINTER) {
+      return SignificanceClass::kPointer;
+    }
+    return significance >= ecc::SIG_DATA ? SignificanceClass::kData : SignificanceClass::kTemp;
+  }
+
+  [[nodiscard]] bool Enabled() const {
+    return enabled_;
+  }
+
+  void SetEnabled(bool enabled) {
+    enabled_ = enabled;
+  }
+
+  /**
+   * @brief Counts one check of value, as it was before the check, by the instruction at pc.
+   * VM thread only.
+   */
+  void Record(uint64_t value, ecc::CheckResult result, uint64_t pc) {
+    Record(ecc::get_significance(value), ecc::get_freq(value), result, pc);
+  }
+
+  /**
+   * @brief The same from the metadata alone, for the shadow register layout.
+   */
+  void Record(uint8_t significance, uint16_t freq, ecc::CheckResult result, uint64_t pc) {
+    if (!enabled_) {
+      return;
+    }
+    Bump(results_[static_cast<size_t>(Classify(significance))][static_cast<size_t>(result)]);
+    Bump(freq_[freq >> kFreqBucketShift]);
+    if (result==ecc::CheckResult::kCorrected || result==ecc::CheckResult::kUncorrectable) {
+      RecordError(result, pc);
+    }
+  }
+
+  /**
+   * @brief Clears every count. Not while the VM is running.
+   */
+  void Clear();
+
+  /**
+   * @brief The counts so far; safe from any thread.
+   */
+  [[nodiscard]] Snapshot Take(const char *policy) const;
+
+ private:
+  static void Bump(std::atomic<uint64_t> &counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  void RecordError(ecc::CheckResult result, uint64_t pc);
+
+  bool enabled_ = true;
+  std::array<std::array<std::atomic<uint64_t>, kResults>, kClasses> results_{};
+  std::array<std::atomic<uint64_t>, kFreqBuckets> freq_{};
+
+  mutable std::mutex errors_mutex_; ///< Guards errors_by_pc_.
+  std::unordered_map<uint64_t, std::array<uint64_t, 2>> errors_by_pc_;
+};
+
+#endif // ECC_TELEMETRY_H
@@ -0,0 +1,56 @@
+/**
+ * @file fault_rng.h
+ * @brief Contains the counter-based random number generator behind fault injection.
+ */
+#ifndef FAULT_RNG_H
+#define FAULT_RNG_H
+
+#include <array>
+#include <cstdint>
+
+/**
+ * @brief Philox4x32-10: the random bits for a position in the sequence are a function of the
+ * seed and the position alone.
+ *
+ * There is no state to advance, so each VM can own one without locking anything, and skipping
+ * to any position costs nothing: a run restored to a checkpoint or snapshot draws exactly what
+ * a run from the start draws there.
+ */
+class FaultRng {
+ public:
+  using Block = std::array<uint32_t, 4>;
+
+  FaultRng() = default;
+  explicit FaultRng(uint64_t seed) : seed_(seed) {}
+
+  void Seed(uint64_t seed) {
+    seed_ = seed;
+  }
+
+  [[nodiscard]] uint64_t GetSeed() const {
+    return seed_;
+  }
+
+  /**
+   * @brief 128 random bits for one position of the sequence.
+   */
+  [[nodiscard]] Block Draw(uint64_t position) const {
+    return Philox({static_cast<uint32_t>(position), static_cast<uint32_t>(position >> 32), 0, 0},
+                  {static_cast<uint32_t>(seed_), static_cast<uint32_t>(seed_ >> 32)});
+  }
+
+  /**
+   * @brief A double in [0, 1) from 53 bits of a block.
+   */
+  [[nodiscard]] static double ToUnit(const Block &block) {
+    uint64_t bits = (static_cast<uint64_t>(block[1]) << 32 | block[0]) >> 11;
+    return static_cast<double>(bits) * 0x1.0p-53;
+  }
+
+  [[nodiscard]] static Block Philox(Block counter, std::array<uint32_t, 2> key);
+
+ private:
+  uint64_t seed_ = 0;
+};
+
+#endif // FAULT_RNG_H
@@ -1,6 +1,6 @@
 /**
  * @file main_memory.h
- * @brief Contains the definition of the MemoryBlock and Memory classes.
+ * @brief Contains the definition of the Memory class.
  * @author Vishank Singh, https://github.com/VishankSingh
  */
 
@@ -9,62 +9,256 @@
 
 #include "config.h"
 
+#include <array>
 #include <vector>
-#include <unordered_map>
+#include <memory>
+#include <span>
+#include <cstddef>
 #include <cstdint>
+#include <utility>
+#include <atomic>
 #include <string>
 #include <stdexcept>
+#include <unordered_set>
 
 /**
- * @brief Represents a memory block containing 1 KB of memory.
+ * @brief Represents a memory management system with pages allocated on first write.
+ *
+ * Pages are found through a four-level radix table indexed by the page number, so the
+ * whole 64-bit address space can be sparsely populated. Pages and tables come from an
+ * arena owned by the Memory object and live until Reset().
+ *
+ * For checkpointing, memory can preserve pages copy-on-write: after BeginEpoch(), the
+ * first write to each page saves the page's previous contents, so the state at the
+ * start of the epoch can be put back with RestorePages().
+ *
+ * In ECC mode every aligned 32-bit word also has a check byte (ecc::memory_check_byte).
+ * The check bytes of a page are kept out of line in their own cache-line-aligned array,
+ * so page data stays contiguous and bulk copies are unaffected. Writes update the check
+ * bytes, and reads verify the words they touch, correcting single flipped bits in place
+ * and counting words with errors that cannot be corrected.
+ *
+ * A MemoryScrubber may check pages from another thread while ECC is on. Each page has a
+ * sequence counter that is odd while someone modifies the page (a per-page seqlock): the
+ * ECC-mode access paths take it around every access, and the scrubber reads pages
+ * optimistically and only takes it to correct a word.
  */
-struct MemoryBlock {
-  std::vector<uint8_t> data; ///< A vector representing the memory block data.
-  unsigned int block_size = vm_config::config.getMemoryBlockSize(); ///< The size of the memory block in bytes.
+class Memory {
+ public:
+  static constexpr unsigned kPageBits = 12;
+  static constexpr uint64_t kPageSize = uint64_t{1} << kPageBits; ///< The size of each page in bytes.
 
   /**
-   * @brief Constructs a MemoryBlock with a size of 1 KB initialized to 0.
+   * @brief Page contents saved on the first write of an epoch, in the order they were saved.
    */
-  MemoryBlock() {
-    data.resize(block_size, 0);
-  }
-};
+  struct PreservedPages {
+    std::vector<uint64_t> page_numbers;
+    std::vector<uint8_t> bytes; ///< kPageSize bytes per entry of page_numbers.
+
+    [[nodiscard]] size_t size() const {
+      return page_numbers.size();
+    }
+  };
+
+  /**
+   * @brief A copy of memory's contents taken with TakeImage(). Pages are immutable and shared
+   * with the images taken before it, so a series of images costs one copy per page changed
+   * between them.
+   */
+  struct Image {
+    struct PageCopy {
+      std::array<uint8_t, kPageSize> bytes;
+      std::array<uint8_t, kPageSize / 4> check; ///< Check bytes in ECC mode, otherwise zero.
+    };
+
+    std::vector<std::pair<uint64_t, std::shared_ptr<const PageCopy>>> pages; ///< By page number; blank pages left out.
+  };
+
+  struct EccStats {
+    uint64_t corrected = 0; ///< Words with a single flipped bit that was corrected.
+    uint64_t uncorrectable = 0; ///< Words found with a double flip, once per word until it is rewritten; left as they are.
+    uint64_t injected = 0; ///< Bits flipped through InjectBitFlip().
+  };
 
-/**
- * @brief Represents a memory management system with dynamic memory block allocation.
- */
-class Memory {
  private:
-  std::unordered_map<uint64_t, MemoryBlock> blocks_; ///< A map storing memory blocks, indexed by block index.
-  unsigned int block_size_; ///< The size of each memory block in bytes.
+  static constexpr unsigned kTableBits = 13;
+  static constexpr size_t kTableEntries = size_t{1} << kTableBits;
+  static constexpr unsigned kLevels = 4; ///< kPageBits + kLevels * kTableBits covers 64 bits.
+  static constexpr size_t kArenaChunkSize = 1024 * 1024;
+  static constexpr size_t kCacheLineSize = 64;
+  static constexpr size_t kWordsPerPage = kPageSize / 4;
+
+  struct Page {
+    alignas(4) std::array<uint8_t, kPageSize> bytes;
+    uint64_t epoch; ///< Epoch in which the page was last preserved.
+    uint8_t *check; ///< kWordsPerPage check bytes in ECC mode, otherwise nullptr.
+    std::atomic<uint32_t> sequence; ///< Odd while the page is locked.
+    Page *next_resident; ///< The page allocated before this one.
+  };
+
+  /**
+   * @brief Holds a page's seqlock for the lifetime of the guard.
+   */
+  class PageLock {
+   public:
+    explicit PageLock(Page *page);
+    ~PageLock() {
+      page_->sequence.fetch_add(1, std::memory_order_release);
+    }
+    PageLock(const PageLock &) = delete;
+    PageLock &operator=(const PageLock &) = delete;
+
+   private:
+    Page *page_;
+  };
+
+  struct alignas(kCacheLineSize) ArenaLine {
+    std::byte bytes[kCacheLineSize];
+  };
+
+  /**
+   * @brief One level of the radix table. The last level points to pages, the others to tables.
+   */
+  struct Table {
+    std::array<void *, kTableEntries> slots;
+  };
+
+  std::vector<std::unique_ptr<ArenaLine[]>> arena_chunks_; ///< Zeroed backing storage for pages and tables.
+  size_t arena_used_ = kArenaChunkSize; ///< Bytes handed out from the newest chunk.
+
+  Table *root_ = nullptr;
+  std::vector<std::pair<uint64_t, Page *>> resident_pages_; ///< Every allocated page with its page number.
+  std::atomic<Page *> newest_page_ = nullptr; ///< Head of the next_resident list, for the scrubber.
+
+  uint64_t last_page_number_ = 0; ///< Page number of the last page accessed.
+  Page *last_page_ = nullptr; ///< The last page accessed, or nullptr if none is cached.
+
   uint64_t memory_size_ = vm_config::config.getMemorySize(); ///< The total memory size in bytes.
 
+  uint64_t epoch_ = 0; ///< Zero until the first BeginEpoch(); nothing is preserved before that.
+  PreservedPages preserved_; ///< Pages preserved in the current epoch.
+
+  bool ecc_enabled_ = vm_config::config.getMemoryEcc();
+  EccStats ecc_stats_;
+  std::unordered_set<const uint8_t *> reported_; ///< Uncorrectable words counted and not rewritten since.
+
   /**
-   * @brief Gets the block index for a given memory address.
-   * @param address The memory address.
-   * @return The block index corresponding to the address.
+   * @brief Hands out zeroed storage from the arena.
    */
-  uint64_t GetBlockIndex(uint64_t address) const;
+  void *Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
 
   /**
-   * @brief Gets the offset within a block for a given memory address.
+   * @brief Finds the page holding an address.
    * @param address The memory address.
-   * @return The offset within the block corresponding to the address.
+   * @param create Whether to allocate the page (and any missing tables) if it is absent.
+   * @return The page, or nullptr if it is absent and create is false.
+   */
+  Page *FindPage(uint64_t address, bool create);
+
+  /**
+   * @brief Finds or allocates the page holding an address for writing, preserving it first if needed.
+   */
+  Page *WritablePage(uint64_t address) {
+    Page *page = FindPage(address, true);
+    if (page->epoch!=epoch_) {
+      Preserve(address >> kPageBits, page);
+    }
+    return page;
+  }
+
+  void Preserve(uint64_t page_number, Page *page);
+
+  /**
+   * @brief Whether a page's data and check bytes are all zero, as if it had never been written.
    */
-  uint64_t GetBlockOffset(uint64_t address) const;
+  static bool IsBlank(const Page *page);
 
   /**
-   * @brief Checks if a memory block is present at the specified index.
-   * @param block_index The index of the block to check.
-   * @return True if the block is present, false otherwise.
+   * @brief Whether a page holds the same data and check bytes as a copy of one.
    */
-  bool IsBlockPresent(uint64_t block_index) const;
+  static bool SameAs(const Page *page, const Image::PageCopy &copy);
 
   /**
-   * @brief Ensures that a memory block exists at the specified index, if not then adds it.
-   * @param block_index The index of the block to check or create.
+   * @brief Recomputes the check bytes of every word overlapping [offset, offset + size) of a page.
    */
-  void EnsureBlockExists(uint64_t block_index);
+  static void EncodeWords(Page *page, uint64_t offset, size_t size);
+
+  /**
+   * @brief Verifies (and corrects) every word overlapping [offset, offset + size) of a page.
+   * Uncorrectable words are counted only if they are not already in reported.
+   */
+  static void VerifyWords(Page *page, uint64_t offset, size_t size, EccStats &stats,
+                          std::unordered_set<const uint8_t *> &reported);
+
+  /**
+   * @brief Drops the rewritten words in [offset, offset + size) of a page from reported_.
+   */
+  void ForgetReported(Page *page, uint64_t offset, size_t size) {
+    if (reported_.empty()) [[likely]] {
+      return;
+    }
+    for (size_t word = offset >> 2; word <= (offset + size - 1) >> 2; ++word) {
+      reported_.erase(page->bytes.data() + word * 4);
+    }
+  }
+
+  /**
+   * @brief Counters are only bumped by one thread at a time, so a relaxed load and store is
+   * enough for GetEccStats() to read them from another.
+   */
+  static void BumpCount(uint64_t &counter) {
+    std::atomic_ref<uint64_t> count(counter);
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  static uint64_t LoadCount(const uint64_t &counter) {
+    return std::atomic_ref<uint64_t>(const_cast<uint64_t &>(counter)).load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief The scrubber reads ECC pages without the lock, so their words and check bytes are
+   * loaded and stored through relaxed atomics, as the seqlock pattern requires.
+   */
+  static uint32_t LoadWord(const Page *page, size_t word) {
+    auto *data = reinterpret_cast<uint32_t *>(const_cast<uint8_t *>(page->bytes.data()) + word * 4);
+    return std::atomic_ref<uint32_t>(*data).load(std::memory_order_relaxed);
+  }
+
+  static void StoreWord(Page *page, size_t word, uint32_t data) {
+    std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t *>(page->bytes.data() + word * 4))
+        .store(data, std::memory_order_relaxed);
+  }
+
+  static uint8_t LoadCheck(const Page *page, size_t word) {
+    return std::atomic_ref<uint8_t>(page->check[word]).load(std::memory_order_relaxed);
+  }
+
+  static void StoreCheck(Page *page, size_t word, uint8_t check) {
+    std::atomic_ref<uint8_t>(page->check[word]).store(check, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Copies bytes into an ECC page a whole word at a time; the page lock must be held.
+   */
+  static void StoreBytes(Page *page, uint64_t offset, const void *value, size_t size);
+
+  /**
+   * @brief Verifies the words a write covers only partly, since their other bytes are kept.
+   */
+  void VerifyPartialWords(Page *page, uint64_t offset, size_t size) {
+    if (offset & 3) {
+      VerifyWords(page, offset, 1, ecc_stats_, reported_);
+    }
+    if ((offset + size) & 3) {
+      VerifyWords(page, offset + size - 1, 1, ecc_stats_, reported_);
+    }
+  }
+
+  /**
+   * @brief ECC-mode access to size bytes within one page, kept out of line so the plain paths stay lean.
+   */
+  void ReadChecked(uint64_t address, void *value, size_t size);
+  void WriteChecked(uint64_t address, const void *value, size_t size);
 
   /**
    * @brief Generic function to read data of type T from the memory.
@@ -85,21 +279,98 @@ class Memory {
   void WriteGeneric(uint64_t address, T value);
 
  public:
+  friend class MemoryScrubber;
+
   /**
    * @brief Constructs a Memory object.
    */
-  Memory() {
-    block_size_ = vm_config::config.getMemoryBlockSize();
-  }
+  Memory() = default;
   /**
    * @brief Destroys the Memory object.
    */
   ~Memory() = default;
 
-  void Reset() {
-    blocks_.clear();
+  Memory(const Memory &) = delete;
+  Memory &operator=(const Memory &) = delete;
+
+  void Reset();
+
+  /**
+   * @brief Starts a new preservation epoch.
+   * @return The pages preserved during the epoch that just ended.
+   */
+  PreservedPages BeginEpoch();
+
+  /**
+   * @brief Continues an earlier epoch: its preserved pages are put in front of the current ones.
+   *
+   * Used when the checkpoint that ended the earlier epoch is dropped.
+   */
+  void MergeEpoch(PreservedPages &&earlier);
+
+  /**
+   * @brief Writes preserved pages back, newest first, so each page ends up as it was when first preserved.
+   *
+   * Restored pages are not preserved again; their next write in the current epoch preserves them.
+   */
+  void RestorePages(const PreservedPages &pages);
+
+  /**
+   * @brief Turns ECC mode on or off. Turning it on encodes every resident page.
+   */
+  void SetEccEnabled(bool enabled);
+
+  [[nodiscard]] bool EccEnabled() const {
+    return ecc_enabled_;
+  }
+
+  /**
+   * @brief The ECC counts since the last Reset(); safe from any thread, as dump_ecc_stats reads
+   * them while a program runs.
+   */
+  [[nodiscard]] EccStats GetEccStats() const {
+    EccStats stats;
+    stats.corrected = LoadCount(ecc_stats_.corrected);
+    stats.uncorrectable = LoadCount(ecc_stats_.uncorrectable);
+    stats.injected = LoadCount(ecc_stats_.injected);
+    return stats;
+  }
+
+  /**
+   * @brief Flips one stored bit of the aligned word holding an address, without updating its check byte.
+   * @param bit 0-31 for a data bit, 32-38 for a check bit (check bits need ECC mode).
+   */
+  void InjectBitFlip(uint64_t address, unsigned int bit);
+
+  /**
+   * @brief Hash of the data in memory. Pages that are all zero count as absent, so two memories
+   * with the same contents hash the same whichever pages they happened to allocate.
+   */
+  [[nodiscard]] uint64_t ContentHash() const;
+
+  [[nodiscard]] size_t ResidentPageCount() const {
+    return resident_pages_.size();
   }
 
+  /**
+   * @brief Copies memory into an image, sharing every page that is unchanged since previous.
+   */
+  [[nodiscard]] Image TakeImage(const Image *previous = nullptr) const;
+
+  /**
+   * @brief Whether memory holds exactly an image's contents, check bytes included. Blank
+   * (all-zero) pages count as absent.
+   */
+  [[nodiscard]] bool MatchesImage(const Image &image) const;
+
+  /**
+   * @brief Puts an image's contents back, writing only the pages that differ from it.
+   *
+   * Like RestorePages(), this bypasses preservation.
+   * @return The numbers of the pages that were written.
+   */
+  std::vector<uint64_t> RestoreImage(const Image &image);
+
   /**
    * @brief Reads a single byte from the given memory address.
    * @param address The memory address to read from.
@@ -178,6 +449,13 @@ class Memory {
 
   void WriteDouble(uint64_t address, double value);
 
+  /**
+   * @brief Copies a run of bytes into memory, one page at a time.
+   * @param address The memory address of the first byte.
+   * @param bytes The bytes to write.
+   */
+  void WriteBlock(uint64_t address, std::span<const uint8_t> bytes);
+
   void PrintMemory(uint64_t address, unsigned int rows);
 
   void DumpMemory(std::vector<std::string> args);
@@ -9,10 +9,13 @@
 
 #include "../config.h"
 #include "main_memory.h"
+#include "memory_scrubber.h"
+#include "cache/cache_hierarchy.h"
 
 #include <iostream>
 #include <string>
 #include <vector>
+#include <utility>
 
 
 /**
@@ -21,49 +24,193 @@
 class MemoryController {
 private:
     Memory memory_; ///< The main memory object.
+    MemoryScrubber scrubber_; ///< Declared after memory_ so it stops before the memory goes away.
+    cache::CacheHierarchy caches_; ///< Sees fetches and every access but the _d ones; models presence only, the data stays in memory_.
+
+    void StartScrubber() {
+      if (memory_.EccEnabled()) {
+        scrubber_.Start(memory_, vm_config::config.getScrubRate());
+      }
+    }
+
+    void ConfigureCaches() {
+      std::string error = caches_.Configure(vm_config::config.getCacheEnabled(),
+                                            vm_config::config.getCacheHierarchyConfig());
+      if (!error.empty()) {
+        std::cerr << "VM warning: cache disabled: " << error << std::endl;
+      }
+    }
 public:
-    MemoryController() = default;
+    MemoryController() {
+      ConfigureCaches();
+      StartScrubber();
+    }
 
     void Reset() {
+        scrubber_.Stop();
         memory_.Reset();
+        ConfigureCaches();
+        StartScrubber();
     }
 
     void PrintCacheStatus() const {
+      caches_.PrintStatus(std::cout);
+    }
+
+    [[nodiscard]] const cache::CacheHierarchy &GetCaches() const {
+      return caches_;
+    }
+
+    void SetAccessTrace(cache::AccessTrace *trace) {
+      caches_.SetTrace(trace);
+    }
+
+    /**
+     * @brief Reads the instruction word at address through the instruction side of the caches.
+     */
+    [[nodiscard]] uint32_t FetchWord(uint64_t address) {
+      RecordFetch(address);
+      return memory_.ReadWord(address);
+    }
+
+    /**
+     * @brief Counts a fetch of the instruction at address whose word is already known, such as
+     * one taken from the decode cache.
+     */
+    void RecordFetch(uint64_t address) {
+      if (caches_.Active()) [[unlikely]] {
+        caches_.Fetch(address);
+      }
     }
 
     void WriteByte(uint64_t address, uint8_t value) {
+      if (caches_.Active()) [[unlikely]] {
+        caches_.Data(address, 1, true);
+      }
       memory_.WriteByte(address, value);
     }
 
     void WriteHalfWord(uint64_t address, uint16_t value) {
+      if (caches_.Active()) [[unlikely]] {
+        caches_.Data(address, 2, true);
+      }
       memory_.WriteHalfWord(address, value);
     }
 
     void WriteWord(uint64_t address, uint32_t value) {
+      if (caches_.Active()) [[unlikely]] {
+        caches_.Data(address, 4, true);
+      }
       memory_.WriteWord(address, value);
     }
 
     void WriteDoubleWord(uint64_t address, uint64_t value) {
+      if (caches_.Active()) [[unlikely]] {
+        caches_.Data(address, 8, true);
+      }
       memory_.WriteDoubleWord(address, value);
     }
 
+
+    void WriteBlock(uint64_t address, std::span<const uint8_t> bytes) {
+      memory_.WriteBlock(address, bytes);
+    }
+
+    Memory::PreservedPages BeginEpoch() {
+      return memory_.BeginEpoch();
+    }
+
+    void MergeEpoch(Memory::PreservedPages &&earlier) {
+      memory_.MergeEpoch(std::move(earlier));
+    }
+
+    void RestorePages(const Memory::PreservedPages &pages) {
+      memory_.RestorePages(pages);
+    }
+
+    /**
+     * @brief Stops the scrubber until the next Reset() or SetEccEnabled().
+     */
+    void StopScrubber() {
+      scrubber_.Stop();
+    }
+
+    void SetEccEnabled(bool enabled) {
+      scrubber_.Stop();
+      memory_.SetEccEnabled(enabled);
+      StartScrubber();
+    }
+
+    [[nodiscard]] bool EccEnabled() const {
+      return memory_.EccEnabled();
+    }
+
+    [[nodiscard]] Memory::EccStats GetEccStats() const {
+      return memory_.GetEccStats();
+    }
+
+    [[nodiscard]] bool Scrubbing() const {
+      return scrubber_.Running();
+    }
+
+    [[nodiscard]] MemoryScrubber::Stats GetScrubStats() const {
+      return scrubber_.GetStats();
+    }
+
+    void InjectBitFlip(uint64_t address, unsigned int bit) {
+      memory_.InjectBitFlip(address, bit);
+    }
+
+    [[nodiscard]] uint64_t ContentHash() const {
+      return memory_.ContentHash();
+    }
+
+    [[nodiscard]] size_t ResidentPageCount() const {
+      return memory_.ResidentPageCount();
+    }
+
+    [[nodiscard]] Memory::Image TakeImage(const Memory::Image *previous = nullptr) const {
+      return memory_.TakeImage(previous);
+    }
+
+    [[nodiscard]] bool MatchesImage(const Memory::Image &image) const {
+      return memory_.MatchesImage(image);
+    }
+
+    std::vector<uint64_t> RestoreImage(const Memory::Image &image) {
+      return memory_.RestoreImage(image);
+    }
+
     [[nodiscard]] uint8_t ReadByte(uint64_t address) {
+        if (caches_.Active()) [[unlikely]] {
+          caches_.Data(address, 1, false);
+        }
         return memory_.ReadByte(address);
     }
 
     [[nodiscard]] uint16_t ReadHalfWord(uint64_t address) {
+        if (caches_.Active()) [[unlikely]] {
+          caches_.Data(address, 2, false);
+        }
         return memory_.ReadHalfWord(address);
     }
 
     [[nodiscard]] uint32_t ReadWord(uint64_t address) {
+        if (caches_.Active()) [[unlikely]] {
+          caches_.Data(address, 4, false);
+        }
         return memory_.ReadWord(address);
     }
 
     [[nodiscard]] uint64_t ReadDoubleWord(uint64_t address) {
+        if (caches_.Active()) [[unlikely]] {
+          caches_.Data(address, 8, false);
+        }
         return memory_.ReadDoubleWord(address);
     }
 
-    // Functions to read memory directly with cache bypass
+    // Functions to access memory directly with cache bypass, for the VM's own bookkeeping
+    // (undo history, system calls, the debugger)
 
     [[nodiscard]] uint8_t ReadByte_d(uint64_t address) {
         return memory_.ReadByte(address);
@@ -81,6 +228,22 @@ public:
         return memory_.ReadDoubleWord(address);
     }
 
+    void WriteByte_d(uint64_t address, uint8_t value) {
+        memory_.WriteByte(address, value);
+    }
+
+    void WriteHalfWord_d(uint64_t address, uint16_t value) {
+        memory_.WriteHalfWord(address, value);
+    }
+
+    void WriteWord_d(uint64_t address, uint32_t value) {
+        memory_.WriteWord(address, value);
+    }
+
+    void WriteDoubleWord_d(uint64_t address, uint64_t value) {
+        memory_.WriteDoubleWord(address, value);
+    }
+
     void PrintMemory(const uint64_t address, unsigned int rows) {
       memory_.PrintMemory(address, rows);
     }
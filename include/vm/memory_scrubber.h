@@ -0,0 +1,80 @@
+/**
+ * @file memory_scrubber.h
+ * @brief Contains the declaration of the MemoryScrubber, which checks ECC memory in the background.
+ */
+#ifndef MEMORY_SCRUBBER_H
+#define MEMORY_SCRUBBER_H
+
+#include "main_memory.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+/**
+ * @brief Walks the resident pages of an ECC-mode Memory on its own thread, correcting single
+ * flipped bits before a second flip in the same word makes them uncorrectable.
+ *
+ * Pages are copied under their seqlock without holding it, checked a page at a time with
+ * ecc::memory_check_batch(), and only locked when a word needs correcting, so the VM thread
+ * never waits on a clean page. The rate is in words per second and is spread evenly over
+ * the pass instead of being spent in bursts.
+ *
+ * The Memory must stay in ECC mode and must not be Reset() while the scrubber is running.
+ */
+class MemoryScrubber {
+ public:
+  struct Stats {
+    uint64_t passes = 0; ///< Complete walks over the resident pages.
+    uint64_t words_scrubbed = 0;
+    uint64_t corrected = 0; ///< Words with a single flipped bit, corrected in place.
+    uint64_t uncorrectable = 0; ///< Double flips found, once per word until it is rewritten; left as they are.
+  };
+
+  MemoryScrubber() = default;
+  ~MemoryScrubber() {
+    Stop();
+  }
+  MemoryScrubber(const MemoryScrubber &) = delete;
+  MemoryScrubber &operator=(const MemoryScrubber &) = delete;
+
+  /**
+   * @brief Starts scrubbing memory at the given rate, restarting if already running.
+   * Statistics start again from zero. Does nothing if the rate is 0.
+   */
+  void Start(Memory &memory, uint64_t words_per_second);
+
+  /**
+   * @brief Stops the scrubbing thread and waits for it to exit.
+   */
+  void Stop();
+
+  [[nodiscard]] bool Running() const {
+    return thread_.joinable();
+  }
+
+  [[nodiscard]] Stats GetStats() const;
+
+ private:
+  void Run();
+  void ScrubPage(Memory::Page *page);
+
+  Memory *memory_ = nullptr;
+  uint64_t words_per_second_ = 0;
+  std::thread thread_;
+
+  std::mutex mutex_; ///< Guards stop_; the thread waits on wake_ between pages.
+  std::condition_variable wake_;
+  bool stop_ = false;
+
+  std::atomic<uint64_t> passes_ = 0;
+  std::atomic<uint64_t> words_scrubbed_ = 0;
+  std::atomic<uint64_t> corrected_ = 0;
+  std::atomic<uint64_t> uncorrectable_ = 0;
+  std::unordered_set<const uint8_t *> reported_; ///< Uncorrectable words counted and not rewritten since. Scrubber thread only.
+};
+
+#endif // MEMORY_SCRUBBER_H
@@ -16,6 +16,12 @@
 
 /**
  * @brief Represents a register file containing integer, floating-point, and vector registers.
+ *
+ * GPRs have two ECC layouts. In the packed one (the default) a protected value carries its
+ * 7-bit code and metadata in its own upper bits (ecc_metadata.h), which limits it to 32 data
+ * bits. In the shadow one every GPR holds a plain 64-bit value, and its SECDED(72,64) code and
+ * metadata byte are kept alongside, each in an array of its own. Writes through WriteGpr()
+ * encode the value; the rest of the shadow state is only touched by the ECC instructions.
  */
 class RegisterFile {
  private:
@@ -23,6 +29,9 @@ class RegisterFile {
   static constexpr size_t NUM_FPR = 32; ///< Number of Floating-Point Registers (FPR).
 
   std::array<uint64_t, NUM_GPR> gpr_ = {}; ///< Array for storing GPR values.
+  std::array<uint8_t, NUM_GPR> gpr_check_ = {}; ///< SECDED(72,64) code of each GPR, in the shadow ECC layout.
+  std::array<uint8_t, NUM_GPR> gpr_meta_ = {}; ///< Significance and error history of each GPR (ecc::shadow_meta).
+  bool shadow_ecc_ = false;
   std::array<uint64_t, NUM_FPR> fpr_ = {}; ///< Array for storing FPR values.
 
   static constexpr size_t NUM_CSR = 4096; ///< Number of Control and Status Registers (CSR).
@@ -45,6 +54,8 @@ class RegisterFile {
 
   void Reset();
 
+  bool operator==(const RegisterFile &other) const = default;
+
   /**
    * @brief Reads the value of a General-Purpose Register (GPR).
    * @param reg The index of the GPR to read.
@@ -59,6 +70,40 @@ class RegisterFile {
    */
   void WriteGpr(size_t reg, uint64_t value);
 
+  [[nodiscard]] bool ShadowEcc() const {
+    return shadow_ecc_;
+  }
+
+  /**
+   * @brief Switches the GPR ECC layout, re-encoding every GPR and clearing its metadata.
+   */
+  void SetShadowEcc(bool enabled);
+
+  [[nodiscard]] uint8_t ReadGprCheck(size_t reg) const {
+    return gpr_check_[reg];
+  }
+
+  [[nodiscard]] uint8_t ReadGprMeta(size_t reg) const {
+    return gpr_meta_[reg];
+  }
+
+  /**
+   * @brief Writes a GPR together with its code and metadata byte, as they are. Shadow layout only.
+   */
+  void WriteGprShadow(size_t reg, uint64_t value, uint8_t check, uint8_t meta);
+
+  /**
+   * @brief Flips one bit of a GPR as a soft error would: in the shadow layout its code is left as
+   * it was, so the next check finds the flip.
+   */
+  void FlipGprBit(size_t reg, unsigned bit);
+
+  /**
+   * @brief Returns the backing storage of the GPRs for code that accesses them directly.
+   * @note x0 is never written through WriteGpr, but direct users must not write it either.
+   */
+  [[nodiscard]] uint64_t *GprData();
+
   /**
    * @brief Reads the value of a Floating-Point Register (FPR).
    * @param reg The index of the FPR to read.
@@ -0,0 +1,52 @@
+/**
+ * @file rv5s_control_unit.h
+ * @brief RV5S Control Unit
+ */
+#ifndef RV5S_CONTROL_UNIT_H
+#define RV5S_CONTROL_UNIT_H
+
+#include "../rvss/rvss_control_unit.h"
+
+#include <cstdint>
+
+/**
+ * @brief Register file an operand is read from or a result is written to.
+ */
+enum class RegisterClass : uint8_t {
+  kNone,
+  kGpr,
+  kFpr
+};
+
+/**
+ * @brief The registers an instruction reads and writes, for the hazard detection and forwarding units.
+ */
+struct RegisterUse {
+  RegisterClass rs1 = RegisterClass::kNone;
+  RegisterClass rs2 = RegisterClass::kNone;
+  RegisterClass rs3 = RegisterClass::kNone;
+  RegisterClass rd = RegisterClass::kNone; ///< kNone for x0, which is never written
+};
+
+/**
+ * @brief Decodes like the RVSS control unit, and adds the signals the pipeline needs to track
+ * dependencies between the instructions in flight.
+ */
+class RV5SControlUnit : public RVSSControlUnit {
+ public:
+  /**
+   * @brief The registers the stages of op read and write, as RVSSVM accesses them.
+   */
+  static RegisterUse GetRegisterUse(const DecodedInstruction &op);
+
+  /**
+   * @brief Whether op only enters EX once every older instruction has retired, and keeps younger
+   * ones in ID until it has retired itself: ecall and the CSR instructions, which read and write
+   * state the forwarding unit does not track.
+   */
+  static bool IsSerializing(const DecodedInstruction &op) {
+    return op.exec_class==ExecClass::kSyscall || op.exec_class==ExecClass::kCsr;
+  }
+};
+
+#endif // RV5S_CONTROL_UNIT_H
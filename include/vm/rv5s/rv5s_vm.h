@@ -0,0 +1,224 @@
+/**
+ * @file rv5s_vm.h
+ * @brief RV5S VM definition: a five-stage IF/ID/EX/MEM/WB pipeline
+ */
+#ifndef RV5S_VM_H
+#define RV5S_VM_H
+
+#include "vm/vm_base.h"
+
+#include "rv5s_control_unit.h"
+
+#include <cstdint>
+#include <iostream>
+#include <optional>
+
+/**
+ * @brief A register value on its way through the pipeline: a GPR as the register file holds it,
+ * with its shadow code and metadata, or an FPR.
+ */
+struct PipelineValue {
+  uint64_t value = 0;
+  uint8_t check = 0; ///< SECDED(72,64) code, in the shadow ECC layout
+  uint8_t meta = 0;  ///< ecc::shadow_meta byte, in the shadow ECC layout
+};
+
+/**
+ * @brief The access a CSR instruction makes, read in EX and written in WB.
+ */
+struct CsrAccess {
+  uint16_t address = 0;
+  uint64_t old_value = 0;
+  uint64_t write_value = 0; ///< rs1
+  uint8_t uimm = 0;
+};
+
+struct IfIdLatch {
+  bool valid = false;
+  uint64_t pc = 0;
+  uint32_t instruction = 0;
+};
+
+struct IdExLatch {
+  bool valid = false;
+  uint64_t pc = 0;
+  DecodedInstruction op;
+  RegisterUse use;
+  PipelineValue rs1; ///< As read from the register files in ID; EX applies forwarding
+  PipelineValue rs2;
+  PipelineValue rs3;
+};
+
+struct ExMemLatch {
+  bool valid = false;
+  uint64_t pc = 0;
+  DecodedInstruction op;
+  RegisterUse use;
+  uint64_t alu_result = 0;  ///< The address of a load or store
+  uint64_t store_value = 0; ///< rs2 of a store
+  PipelineValue result;     ///< What rd gets; not known before MEM for a load
+  CsrAccess csr;
+};
+
+struct MemWbLatch {
+  bool valid = false;
+  uint64_t pc = 0;
+  DecodedInstruction op;
+  RegisterUse use;
+  PipelineValue result;
+  CsrAccess csr;
+};
+
+/**
+ * @brief Cycle-accurate five-stage pipeline over the same decode, ALU and register ECC handling as
+ * RVSSVM, so the two compute the same results.
+ *
+ * Every call to Clock() runs WB, MEM, EX, ID and IF in that order on the latches as the previous
+ * cycle left them, so WB writes the register files before ID reads them. Branches are predicted
+ * not taken and resolved in EX; a taken branch or a jump flushes IF and ID, as does a store into
+ * an instruction already fetched, which is then fetched again. With hazard
+ * detection, ID stalls an instruction until its operands can be had: one cycle behind a load with
+ * forwarding, until the producer reaches WB without. ecall and the CSR instructions always drain
+ * the pipeline ahead of them. The audio and image sample ports of RVSSVM are not modelled; those
+ * addresses are ordinary memory here.
+ *
+ * cycle_s_ counts the cycles the pipeline advanced and stall_cycles_ those it spent on hazard
+ * stalls, plus the cache hierarchy's estimate when the caches are enabled.
+ */
+class RV5SVM : public VmBase {
+ public:
+  RV5SControlUnit control_unit_;
+
+  IfIdLatch if_id_;
+  IdExLatch id_ex_;
+  ExMemLatch ex_mem_;
+  MemWbLatch mem_wb_;
+
+  bool hazard_detection_ = true; ///< Execution.hazard_detection, taken at construction and reset
+  bool forwarding_ = true;       ///< Execution.forwarding
+  uint64_t hazard_stall_cycles_ = 0; ///< Cycles ID held an instruction back
+  uint64_t flushed_instructions_ = 0; ///< Instructions fetched down a mispredicted path
+
+  RV5SVM();
+  ~RV5SVM() = default;
+
+  DecodedInstruction DecodeInstruction(uint32_t instruction) override;
+
+  /**
+   * @brief Also has the instructions behind a store fetched again if it rewrote one of them.
+   */
+  void InvalidateText(uint64_t address, uint64_t size) override;
+
+  /**
+   * @brief Advances the pipeline by one cycle.
+   * @param fetch Whether IF may start a new instruction.
+   */
+  void Clock(bool fetch = true);
+
+  /**
+   * @brief Instructions in the latches, in any stage.
+   */
+  [[nodiscard]] uint64_t InFlight() const {
+    return if_id_.valid + id_ex_.valid + ex_mem_.valid + mem_wb_.valid;
+  }
+
+  /**
+   * @brief Clocks without fetching until every instruction in flight has retired, so the
+   * registers, memory and program counter are exactly those after instructions_retired_
+   * instructions.
+   */
+  void Drain();
+
+  /**
+   * @brief The loop behind Run(), without its messages or state dumps.
+   *
+   * Stops at a stop request, at the end of the text or after exactly budget instructions, with
+   * the pipeline drained. Does not clear an earlier stop request.
+   * @return The number of instructions retired.
+   */
+  uint64_t RunFor(uint64_t budget);
+
+  void Run() override;
+
+  /**
+   * @brief Runs cycle by cycle, dumping the state after each; stops before fetching an
+   * instruction on a breakpoint, with the instructions ahead of it retired.
+   */
+  void DebugRun() override;
+
+  /**
+   * @brief Advances the pipeline by one cycle.
+   */
+  void Step() override;
+
+  /**
+   * @brief The pipeline keeps no history: both only report that there is nothing to undo or redo.
+   */
+  void Undo() override;
+  void Redo() override;
+  void Reset() override;
+
+  [[nodiscard]] CycleStats ComputeCycleStats() const override;
+
+  void RequestStop() {
+    stop_requested_ = true;
+  }
+
+ private:
+  void WriteBackStage();
+  MemWbLatch MemoryStage();
+
+  /**
+   * @brief Executes id_ex_; a taken branch or a jump sets redirect and target.
+   */
+  ExMemLatch ExecuteStage(bool &redirect, uint64_t &target);
+
+  /**
+   * @brief Decodes if_id_ and reads its operands, or sets stall if a hazard holds it back.
+   */
+  IdExLatch DecodeStage(bool &stall);
+
+  /**
+   * @brief Whether the hazard detection unit holds op back in ID this cycle.
+   */
+  [[nodiscard]] bool MustStall(const DecodedInstruction &op, const RegisterUse &use) const;
+
+  /**
+   * @brief The newest value of a register, from EX/MEM or MEM/WB if one of them is about to write
+   * it, or value as ID read it.
+   */
+  [[nodiscard]] PipelineValue Forward(RegisterClass register_class, uint8_t reg, PipelineValue value) const;
+
+  [[nodiscard]] PipelineValue ReadRegister(RegisterClass register_class, uint8_t reg) const;
+
+  void ExecuteInteger(const IdExLatch &in, ExMemLatch &out, bool &taken, uint64_t &target);
+
+  /**
+   * @brief The ALU part of ExecuteInteger() for the shadow ECC layout, as RVSSVM::ExecuteIntegerShadow().
+   * @param meta Receives the metadata byte of the result.
+   * @param check Receives the code to store with the result instead of its own, if any.
+   * @return The result.
+   */
+  uint64_t ExecuteIntegerShadow(const IdExLatch &in, PipelineValue rs1, PipelineValue rs2, uint64_t reg2_value,
+                                bool is_addr_calc, uint8_t &meta, std::optional<uint8_t> &check);
+  void ExecuteFloat(const IdExLatch &in, ExMemLatch &out);
+  void ExecuteCsr(const IdExLatch &in, ExMemLatch &out);
+  void HandleSyscall();
+
+  void MemoryInteger(const ExMemLatch &in, MemWbLatch &out);
+  void MemoryFloat(const ExMemLatch &in, MemWbLatch &out);
+
+  /**
+   * @brief Writes result to a GPR, with its code and metadata in the shadow ECC layout.
+   */
+  void WriteGpr(uint8_t reg, const PipelineValue &result);
+
+  /**
+   * @brief result for a plain GPR write: in the shadow layout, a fresh code and no metadata.
+   */
+  [[nodiscard]] PipelineValue GprResult(uint64_t value) const;
+
+  bool stale_fetch_ = false; ///< Set by MEM when a store rewrote an instruction in IF/ID or ID/EX
+};
+
+#endif // RV5S_VM_H
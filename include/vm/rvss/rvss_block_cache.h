@@ -0,0 +1,109 @@
+/**
+ * @file rvss_block_cache.h
+ * @brief Contains the basic-block translation cache used by the RVSS VM run loop.
+ */
+#ifndef RVSS_BLOCK_CACHE_H
+#define RVSS_BLOCK_CACHE_H
+
+#include "vm/decode_cache.h"
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+
+class RVSSVM;
+struct JitContext;
+
+/**
+ * @brief Executes one translated instruction. The instruction is already in RVSSVM::current_op_.
+ */
+using BlockHandler = void (*)(RVSSVM &vm);
+
+/**
+ * @brief Native code compiled for a whole block by RVSSJit.
+ */
+using JitFunction = void (*)(JitContext *ctx);
+
+/**
+ * @brief One instruction of a translated block, with the handler chosen at translation time.
+ */
+struct BlockEntry {
+  BlockHandler handler = nullptr;
+  DecodedInstruction op;
+};
+
+/**
+ * @brief A straight-line run of instructions ending at the first control transfer, ecall or CSR access.
+ */
+struct TranslatedBlock {
+  uint64_t start_pc = 0;
+  std::vector<BlockEntry> entries;
+  uint32_t execution_count = 0; ///< Times the block was entered; drives JIT compilation.
+  JitFunction native = nullptr; ///< Compiled code, when the JIT is enabled and the block is hot.
+
+  [[nodiscard]] uint64_t EndPc() const {
+    return start_pc + entries.size() * 4;
+  }
+};
+
+/**
+ * @brief Translated blocks indexed by their start address.
+ *
+ * Blocks may overlap when control enters the middle of an existing block.
+ * Invalidated blocks are kept alive until the next insertion, so a block that
+ * writes into its own text can still finish the instruction doing the write.
+ */
+class BlockCache {
+ public:
+  static constexpr size_t kMaxBlockLength = 64;
+
+  void Clear() {
+    blocks_.clear();
+    retired_.clear();
+  }
+
+  /**
+   * @brief Returns the block starting at the given address, or nullptr if none is translated.
+   */
+  [[nodiscard]] TranslatedBlock *Lookup(uint64_t pc) const {
+    uint64_t index = pc >> 2;
+    if (index >= blocks_.size() || (pc & 0b11)) {
+      return nullptr;
+    }
+    return blocks_[index].get();
+  }
+
+  TranslatedBlock *Insert(TranslatedBlock &&block) {
+    retired_.clear();
+    uint64_t index = block.start_pc >> 2;
+    if (index >= blocks_.size()) {
+      blocks_.resize(index + 1);
+    }
+    blocks_[index] = std::make_unique<TranslatedBlock>(std::move(block));
+    return blocks_[index].get();
+  }
+
+  /**
+   * @brief Drops every block overlapping [address, address + size).
+   */
+  void Invalidate(uint64_t address, uint64_t size) {
+    if (size == 0 || blocks_.empty()) {
+      return;
+    }
+    uint64_t last = address + size - 1;
+    uint64_t first_index = (address >> 2) > kMaxBlockLength ? (address >> 2) - kMaxBlockLength : 0;
+    uint64_t last_index = std::min<uint64_t>(last >> 2, blocks_.size() - 1);
+    for (uint64_t i = first_index; i <= last_index; ++i) {
+      if (blocks_[i] && blocks_[i]->EndPc() > address) {
+        retired_.push_back(std::move(blocks_[i]));
+      }
+    }
+  }
+
+ private:
+  std::vector<std::unique_ptr<TranslatedBlock>> blocks_;
+  std::vector<std::unique_ptr<TranslatedBlock>> retired_;
+};
+
+#endif // RVSS_BLOCK_CACHE_H
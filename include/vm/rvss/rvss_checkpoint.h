@@ -0,0 +1,34 @@
+/**
+ * @file rvss_checkpoint.h
+ * @brief Contains the periodic checkpoints the RVSS VM restores from for reverse execution.
+ */
+#ifndef RVSS_CHECKPOINT_H
+#define RVSS_CHECKPOINT_H
+
+#include "vm/registers.h"
+#include "vm/main_memory.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Architectural state at one instruction count.
+ *
+ * Memory is not copied when the checkpoint is taken. Instead, the old contents of each
+ * page first written after it are kept (copy-on-write), which is enough to roll memory
+ * back to this point from any later one.
+ */
+struct Checkpoint {
+  uint64_t instruction = 0; ///< instructions_retired_ when the checkpoint was taken.
+  uint64_t program_counter = 0;
+  uint64_t cycle_count = 0;
+  RegisterFile registers;
+  bool branch_flag = false;
+  size_t audio_sample_index = 0;
+  size_t image_sample_index = 0;
+  size_t input_position = 0; ///< Lines of the stdin log consumed so far.
+  uint64_t fault_draws = 0; ///< Position of the kInjectFlip generator.
+  Memory::PreservedPages preserved_pages; ///< Pages written before the next checkpoint; filled when it is taken.
+};
+
+#endif // RVSS_CHECKPOINT_H
@@ -7,6 +7,7 @@
 #define RVSS_CONTROL_UNIT_H
 
 #include "../control_unit_base.h"
+#include "../decode_cache.h"
 
 
 class RVSSControlUnit : public ControlUnit {
@@ -15,6 +16,12 @@ class RVSSControlUnit : public ControlUnit {
 
   alu::AluOp GetAluSignal(uint32_t instruction, bool ALUOp) override;
 
+  /**
+   * @brief Resolves every field, control signal and the ALU operation of an instruction.
+   * @param imm The instruction's immediate, as VmBase::ImmGenerator produces it.
+   */
+  DecodedInstruction Decode(uint32_t instruction, int32_t imm);
+
 };
 
 #endif // RVSS_CONTROL_UNIT_H
\ No newline at end of file
@@ -0,0 +1,70 @@
+/**
+ * @file rvss_jit.h
+ * @brief Contains the x86-64 block compiler used by the RVSS VM in JIT mode.
+ */
+#ifndef RVSS_JIT_H
+#define RVSS_JIT_H
+
+#include "rvss_block_cache.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+
+/**
+ * @brief State shared between the run loop and compiled blocks.
+ *
+ * The guest registers are not copied in or out: gpr aliases RegisterFile's storage.
+ */
+struct JitContext {
+  uint64_t *gpr = nullptr;
+  RVSSVM *vm = nullptr;
+  const TranslatedBlock *block = nullptr;
+  uint64_t pc = 0; ///< Guest PC after the block has run.
+  uint64_t executed = 0; ///< Instructions retired by the block.
+  uint64_t branch_flag = 0; ///< Mirrors RVSSVM::branch_flag_ across the block.
+  std::exception_ptr fault; ///< Exception thrown by an interpreted instruction, rethrown by the run loop.
+};
+
+/**
+ * @brief Lowers translated blocks to native x86-64 code.
+ *
+ * RV64I/M register-register and register-immediate operations, LUI, AUIPC, JAL and
+ * the conditional branches are emitted inline. ALU operations that produce ECC
+ * protected results call Alu::execute. Everything else (memory, F/D, BF16, SIMD,
+ * CSR, ecall, JALR) calls back into the interpreter's block handler for that entry.
+ *
+ * Code lives in one mmap'd buffer that is writable only while a block is being
+ * copied in and executable otherwise. On hosts other than x86-64 Linux Available()
+ * is false and Compile() always returns nullptr.
+ */
+class RVSSJit {
+ public:
+  static constexpr uint32_t kHotThreshold = 16; ///< Block entries before compilation.
+  static constexpr size_t kBufferSize = 16 * 1024 * 1024;
+
+  RVSSJit();
+  ~RVSSJit();
+
+  RVSSJit(const RVSSJit &) = delete;
+  RVSSJit &operator=(const RVSSJit &) = delete;
+
+  [[nodiscard]] bool Available() const;
+
+  /**
+   * @brief Compiles a block.
+   * @return The native entry point, or nullptr if the buffer is full or the JIT is unavailable.
+   */
+  JitFunction Compile(const TranslatedBlock &block);
+
+  /**
+   * @brief Discards all compiled code. Callers must drop every JitFunction they hold.
+   */
+  void Clear();
+
+ private:
+  uint8_t *buffer_ = nullptr;
+  size_t used_ = 0;
+};
+
+#endif // RVSS_JIT_H
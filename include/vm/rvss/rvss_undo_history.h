@@ -0,0 +1,111 @@
+/**
+ * @file rvss_undo_history.h
+ * @brief Contains the bounded undo/redo history used by the RVSS VM.
+ */
+#ifndef RVSS_UNDO_HISTORY_H
+#define RVSS_UNDO_HISTORY_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+struct RegisterChange {
+  unsigned int reg_index;
+  unsigned int reg_type; // 0 for GPR, 1 for CSR, 2 for FPR
+  uint64_t old_value;
+  uint64_t new_value;
+};
+
+struct MemoryChange {
+  uint64_t address;
+  std::vector<uint8_t> old_bytes_vec;
+  std::vector<uint8_t> new_bytes_vec;
+};
+
+struct StepDelta {
+  uint64_t old_pc;
+  uint64_t new_pc;
+  std::vector<RegisterChange> register_changes;
+  std::vector<MemoryChange> memory_changes;
+};
+
+/**
+ * @brief Undo/redo history kept in a fixed-size byte ring.
+ *
+ * Each step is packed into one variable-length record:
+ * [length:4][old_pc:8][new_pc:8][register count:2][memory count:2]
+ * then per register [index:2][type:1][old:8][new:8],
+ * per memory change [address:8][size:4][old bytes][new bytes], and a trailing [length:4]
+ * so the ring can be walked in both directions.
+ *
+ * Records between the oldest retained step and the cursor can be undone, records
+ * after the cursor can be redone. Pushing a step drops the redo records and then
+ * evicts the oldest steps until the new one fits, so Undo() only reaches back as
+ * far as the byte budget allows. The arena is allocated on the first push.
+ */
+class UndoHistory {
+ public:
+  static constexpr size_t kDefaultCapacity = 64 * 1024 * 1024;
+
+  explicit UndoHistory(size_t capacity = kDefaultCapacity) : capacity_(capacity) {}
+
+  /**
+   * @brief Changes the byte budget. Discards the whole history.
+   */
+  void SetCapacity(size_t capacity);
+
+  void Clear();
+
+  /**
+   * @brief Records a new step, discarding everything that could be redone.
+   *
+   * A step larger than the whole budget cannot be kept; the history is cleared instead,
+   * since older steps could no longer be undone past it.
+   */
+  void Push(const StepDelta &delta);
+
+  /**
+   * @brief Moves the cursor back one step.
+   * @return false if there is nothing to undo; delta is left untouched.
+   */
+  bool Undo(StepDelta &delta);
+
+  /**
+   * @brief Moves the cursor forward one step.
+   * @return false if there is nothing to redo; delta is left untouched.
+   */
+  bool Redo(StepDelta &delta);
+
+  [[nodiscard]] size_t UndoDepth() const {
+    return undo_count_;
+  }
+
+  [[nodiscard]] size_t RedoDepth() const {
+    return redo_count_;
+  }
+
+  [[nodiscard]] size_t BytesUsed() const {
+    return tail_ - head_;
+  }
+
+  [[nodiscard]] size_t Capacity() const {
+    return capacity_;
+  }
+
+ private:
+  // Positions are logical byte offsets that only grow; the arena index is position % capacity_.
+  void WriteBytes(uint64_t position, const void *data, size_t size);
+  void ReadBytes(uint64_t position, void *data, size_t size) const;
+  uint32_t ReadLength(uint64_t position) const;
+  void Decode(uint64_t position, StepDelta &delta) const;
+
+  std::vector<uint8_t> arena_;
+  size_t capacity_;
+  uint64_t head_ = 0; ///< Start of the oldest record.
+  uint64_t cursor_ = 0; ///< End of the newest record that can be undone.
+  uint64_t tail_ = 0; ///< End of the newest record.
+  size_t undo_count_ = 0;
+  size_t redo_count_ = 0;
+};
+
+#endif // RVSS_UNDO_HISTORY_H
@@ -10,92 +10,31 @@
 #include "vm/vm_base.h"
 
 #include "rvss_control_unit.h"
+#include "rvss_block_cache.h"
+#include "rvss_jit.h"
+#include "rvss_undo_history.h"
+#include "rvss_checkpoint.h"
 
-#include <stack>
+#include <deque>
 #include <vector>
 #include <iostream>
 #include <cstdint>
+#include <optional>
 
-// TODO: use a circular buffer instead of a stack for undo/redo
-
-struct RegisterChange {
-  unsigned int reg_index;
-  unsigned int reg_type; // 0 for GPR, 1 for CSR, 2 for FPR
-  uint64_t old_value;
-  uint64_t new_value;
-};
-
-struct MemoryChange {
-  uint64_t address;
-  std::vector<uint8_t> old_bytes_vec; 
-  std::vector<uint8_t> new_bytes_vec; 
+/**
+ * @brief Delta capture policy: the stage functions fill current_delta_ for undo/redo.
+ */
+struct RecordDeltas {
+  static constexpr bool kRecord = true;
 };
 
-struct StepDelta {
-  uint64_t old_pc;
-  uint64_t new_pc;
-  std::vector<RegisterChange> register_changes;
-  std::vector<MemoryChange> memory_changes;
+/**
+ * @brief Delta capture policy: nothing is captured. Used by Run(), which keeps no history.
+ */
+struct SkipDeltas {
+  static constexpr bool kRecord = false;
 };
 
-
-// class RingUndoRedo {
-//   std::vector<StepDelta> buffer_;
-//   int current_;      // index of current state
-//   int size_;         // number of valid entries
-//   int head_;
-//   const int capacity_;
-
-//  public:
-//   explicit RingUndoRedo(int cap)
-//     : buffer_(cap), current_(-1), size_(0), head_(-1), capacity_(cap) {}
-
-//   void push(const StepDelta& delta) {
-//     head_ = (head_ + 1) % capacity_;
-//     buffer_[head_] = delta;
-//     current_ = head_;  // move current to new step
-
-//     if (size_ < capacity_)
-//         size_++;
-//     else {
-//         ; // overwrite oldest entry
-//     }
-
-//     // Invalidate all redos beyond head_
-//     int i = (head_ + 1) % capacity_;
-//     while (i != current_) {
-//         buffer_[i] = StepDelta(); // or mark invalid
-//         i = (i + 1) % capacity_;
-//     }
-// }
-
-
-//   bool can_undo() const {
-//     return size_ > 0 && current_ != -1;
-//   }
-
-//   bool can_redo() const {
-//     return current_ != head_ && !buffer_[(current_ + 1) % capacity_].register_changes.empty();
-// }
-
-//   StepDelta undo() {
-//     if (!can_undo()) throw std::runtime_error("Nothing to undo");
-//     StepDelta delta = buffer_[current_];
-//     current_ = (current_ - 1 + capacity_) % capacity_;
-//     return delta;
-//   }
-
-//   StepDelta redo() {
-//     if (!can_redo()) throw std::runtime_error("Nothing to redo");
-
-//     current_ = (current_ + 1) % capacity_;
-//     return buffer_[current_];
-// }
-// };
-
-
-
-
 class RVSSVM : public VmBase {
  public:
   RVSSControlUnit control_unit_;
@@ -110,16 +49,46 @@ class RVSSVM : public VmBase {
   size_t image_sample_index_ = 0;
   void LoadImageFile(const std::string& image_path);
 
+  std::vector<uint64_t> audio_encoded_; ///< audio_samples_ with their ECC, as LWPD loads them.
+  std::vector<uint64_t> image_encoded_; ///< image_samples_ with their ECC, as LWPD loads them.
 
-  std::stack<StepDelta> undo_stack_;
-  std::stack<StepDelta> redo_stack_;
-  // RingUndoRedo history_{1000}; // or however many steps you want to store
+  bool samples_loaded_ = false;
+  /**
+   * @brief Reads audio_data.txt and image_data.txt on the first LWPD from either input address,
+   * after the VM has been sandboxed or not, so a campaign run says nothing about missing files.
+   * Every sample is encoded once here with ecc::compute_ecc_batch().
+   */
+  void LoadSamples();
+
+
+  UndoHistory undo_history_; ///< Bounded by Execution.undo_history_size.
+
+  std::deque<Checkpoint> checkpoints_; ///< Oldest first; bounded by Execution.checkpoint_limit.
+  uint64_t next_checkpoint_ = 0; ///< Instruction count at which the next checkpoint is due.
+  uint64_t furthest_instruction_ = 0; ///< Furthest instruction count reached, the limit for replays.
+  std::vector<std::string> input_log_; ///< Every line read from stdin, so replays read the same input.
+  size_t input_position_ = 0;
+  bool replaying_ = false; ///< Set while re-executing from a checkpoint; file output is suppressed.
 
   StepDelta current_delta_;
 
+  DecodedInstruction current_op_; ///< Decoded form of current_instruction_.
+
+  BlockCache block_cache_;
+  uint64_t block_position_ = 0; ///< Index of the entry being executed in the current block.
+  uint64_t block_length_ = 0; ///< Entries to execute in the current block; cut short by writes into it.
+  uint64_t block_start_pc_ = 0;
+  uint64_t block_end_pc_ = 0;
+
+  RVSSJit jit_;
+  JitContext jit_context_;
+
   // intermediate variables
   int64_t execution_result_{};
+  uint8_t execution_meta_{}; ///< Metadata byte of execution_result_, in the shadow ECC layout.
+  std::optional<uint8_t> execution_check_; ///< Code to store with execution_result_ instead of its own.
   int64_t memory_result_{};
+  std::optional<uint64_t> memory_encoded_; ///< ECC-encoded memory_result_ when LWPD read a pre-encoded sample.
   // int64_t memory_address_{};
   // int64_t memory_data_{};
   uint64_t return_address_{};
@@ -133,31 +102,150 @@ class RVSSVM : public VmBase {
   uint64_t csr_write_val_{};
   uint8_t csr_uimm_{};
 
+  DecodedInstruction DecodeInstruction(uint32_t instruction) override;
+  void InvalidateText(uint64_t address, uint64_t size) override;
+
   void Fetch();
 
   void Decode();
 
+  /**
+   * @brief Fetch and decode in one step, served from the decode cache when possible.
+   */
+  void FetchDecoded();
+
+  // Stages that touch architectural state take a RecordDeltas/SkipDeltas policy.
+  template <typename Deltas = RecordDeltas>
   void Execute();
+  void ExecuteInteger();
+
+  /**
+   * @brief The ALU part of ExecuteInteger() for the shadow ECC layout.
+   */
+  void ExecuteIntegerShadow(alu::AluOp op, uint64_t reg2_value, bool is_addr_calc);
+
+  /**
+   * @brief Checks a GPR against its shadow code under the VM's ECC policy.
+   * @return The value, corrected if the policy checked it and found one flipped bit.
+   */
+  uint64_t CheckShadowGpr(uint8_t reg, ecc::CheckResult &result, uint8_t &meta);
   void ExecuteFloat();
   void ExecuteBFloat16();
   void ExecuteSIMDF32();
   void ExecuteDouble();
   void ExecuteCsr();
+  template <typename Deltas = RecordDeltas>
   void HandleSyscall();
 
+  template <typename Deltas = RecordDeltas>
   void WriteMemory();
+  template <typename Deltas = RecordDeltas>
+  void WriteMemoryInteger();
+  template <typename Deltas = RecordDeltas>
   void WriteMemoryFloat();
+  template <typename Deltas = RecordDeltas>
   void WriteMemoryDouble();
 
+  template <typename Deltas = RecordDeltas>
   void WriteBack();
+  template <typename Deltas = RecordDeltas>
+  void WriteBackInteger();
+  template <typename Deltas = RecordDeltas>
   void WriteBackFloat();
+  template <typename Deltas = RecordDeltas>
   void WriteBackDouble();
   void WriteBackCsr();
 
+  /**
+   * @brief Builds the block starting at start_pc from the decode cache, or returns nullptr outside the text section.
+   */
+  TranslatedBlock *TranslateBlock(uint64_t start_pc);
+
+  /**
+   * @brief Runs every entry of a block without stop or limit checks in between.
+   * @return The number of instructions executed.
+   */
+  uint64_t ExecuteBlock(const TranslatedBlock &block);
+
+  /**
+   * @brief Runs the compiled code of a block and copies its exit state back into the VM.
+   * @return The number of instructions executed.
+   */
+  uint64_t ExecuteNative(const TranslatedBlock &block);
+
+  static void HandleIntegerAlu(RVSSVM &vm);
+  static void HandleIntegerMemory(RVSSVM &vm);
+  static void HandleIntegerBranch(RVSSVM &vm);
+  static void HandleGeneric(RVSSVM &vm);
+
+  /**
+   * @brief Takes a checkpoint if one is due. Called between instructions or blocks.
+   */
+  void MaybeCheckpoint() {
+    if (instructions_retired_ >= next_checkpoint_) {
+      TakeCheckpoint();
+    }
+  }
+
+  void TakeCheckpoint();
+
+  /**
+   * @brief The VM's architectural state apart from memory, as a checkpoint with no preserved pages.
+   */
+  [[nodiscard]] Checkpoint CaptureState() const;
+
+  /**
+   * @brief Puts back the state CaptureState() returned. Memory, the undo history and the
+   * checkpoint schedule are left alone.
+   */
+  void ApplyState(const Checkpoint &state);
+
+  /**
+   * @brief Drops every checkpoint and takes a new one now.
+   *
+   * Needed after changes that replay cannot reproduce, such as editing registers or memory by hand.
+   */
+  void RebaseCheckpoints();
+
+  /**
+   * @brief Drops checkpoints taken after the current instruction count, e.g. after Undo().
+   */
+  void TrimCheckpoints();
+
+  /**
+   * @brief Rolls the whole VM state back to a checkpoint and drops every newer one.
+   */
+  void RestoreCheckpoint(size_t index);
+
+  /**
+   * @brief Re-executes until instructions_retired_ reaches the target, ignoring breakpoints and stops.
+   * @param last_breakpoint If set, receives the last instruction count at which the PC was on a breakpoint.
+   */
+  void ReplayTo(uint64_t instruction, uint64_t *last_breakpoint = nullptr);
+
+  /**
+   * @brief Restores the nearest checkpoint at or before the target and replays up to it.
+   * @return false if the target is outside the checkpointed range.
+   */
+  bool SeekTo(uint64_t instruction);
+
+  void ReverseStep(uint64_t count);
+  void ReverseContinue();
+  void GotoInstruction(uint64_t instruction);
+
   RVSSVM();
   ~RVSSVM();
 
   void Run() override;
+
+  /**
+   * @brief The loop behind Run(), without its messages or state dumps.
+   *
+   * Stops at a stop request, at the end of the text or after exactly budget instructions.
+   * Does not clear an earlier stop request.
+   * @return The number of instructions executed.
+   */
+  uint64_t RunFor(uint64_t budget);
   void DebugRun() override;
   void Step() override;
   void Undo() override;
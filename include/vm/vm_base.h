@@ -10,6 +10,9 @@
 #include "registers.h"
 #include "memory_controller.h"
 #include "alu.h"
+#include "decode_cache.h"
+#include "ecc_telemetry.h"
+#include "breakpoints.h"
 
 #include "vm_asm_mw.h"
 
@@ -21,6 +24,8 @@
 #include <condition_variable>
 #include <queue>
 #include <atomic>
+#include <optional>
+#include <iostream>
 
 enum SyscallCode {
     SYSCALL_PRINT_INT = 1,
@@ -44,7 +49,7 @@ public:
     std::condition_variable input_cv_;
     std::queue<std::string> input_queue_;
 
-    std::vector<uint64_t> breakpoints_;
+    BreakpointSet breakpoints_;
 
     uint32_t current_instruction_{};
     uint64_t program_counter_{};
@@ -53,11 +58,23 @@ public:
     unsigned int instructions_retired_{};
     float cpi_{};
     float ipc_{};
-    unsigned int stall_cycles_{};
+    uint64_t stall_cycles_{}; ///< Estimated by the cache hierarchy, plus hazard stalls in a pipeline; undo does not take them back.
     unsigned int branch_mispredictions_{};
 
     std::string output_status_;
 
+    /**
+     * @brief Set to run the VM sandboxed, as fault-injection campaigns do: program output goes to
+     * this stream instead of std::cout, the exit syscall stops the VM instead of the process, stdin
+     * reads see no input and nothing is written to files.
+     */
+    std::ostream *sandbox_output_ = nullptr;
+    std::optional<uint64_t> exit_code_; ///< Set by the exit syscall in a sandbox.
+
+    std::ostream &ProgramOutput() {
+        return sandbox_output_ ? *sandbox_output_ : std::cout;
+    }
+
     
 
 
@@ -66,9 +83,30 @@ public:
     RegisterFile registers_;
     
     alu::Alu alu_;
+    alu::FaultContext fault_context_; ///< Generator and counters of kInjectFlip and kCheckError.
+    EccTelemetry ecc_telemetry_;
+
+    /**
+     * @brief What the register ECC checks, and memory in ECC mode, have found so far; safe
+     * while the VM runs.
+     */
+    [[nodiscard]] EccTelemetry::Snapshot EccStats() const {
+        EccTelemetry::Snapshot snapshot = ecc_telemetry_.Take(fault_context_.ecc_policy.name());
+        snapshot.memory_ecc = memory_controller_.EccEnabled();
+        snapshot.memory = memory_controller_.GetEccStats();
+        snapshot.scrubbing = memory_controller_.Scrubbing();
+        snapshot.scrub = memory_controller_.GetScrubStats();
+        return snapshot;
+    }
+
+    DecodeCache decode_cache_;
 
 
-    void LoadProgram(const AssembledProgram &program);
+    /**
+     * @brief Copies the text and data sections into memory and predecodes the text.
+     * @param dump_state Whether to write the VM state file once the program is loaded.
+     */
+    void LoadProgram(const AssembledProgram &program, bool dump_state = true);
     uint64_t program_size_ = 0;
 
     uint64_t GetProgramCounter() const;
@@ -76,9 +114,29 @@ public:
     
     int32_t ImmGenerator(uint32_t instruction);
 
-    void AddBreakpoint(uint64_t val, bool is_line = true);
+    /**
+     * @brief Resolves every field, control signal and the ALU operation of an instruction.
+     */
+    virtual DecodedInstruction DecodeInstruction(uint32_t instruction) = 0;
+
+    /**
+     * @brief Drops every cached translation of the text in [address, address + size).
+     */
+    virtual void InvalidateText(uint64_t address, uint64_t size);
+
+    /**
+     * @brief Adds a breakpoint at a line number or instruction address.
+     * @param options Condition, ignore count and temporary flag; its address is filled in from val.
+     */
+    void AddBreakpoint(uint64_t val, bool is_line = true, Breakpoint options = {});
     void RemoveBreakpoint(uint64_t val, bool is_line = true);
-    bool CheckBreakpoint(uint64_t address);
+
+    /**
+     * @brief Whether a breakpoint is set at the address, regardless of its condition.
+     */
+    bool CheckBreakpoint(uint64_t address) const {
+        return breakpoints_.MaybeHit(address);
+    }
 
     // void fetchInstruction();
     // void decodeInstruction();
@@ -97,6 +155,28 @@ public:
     virtual void Reset() = 0;
     void DumpState(const std::filesystem::path &filename);
 
+    struct CycleStats {
+        uint64_t stall_cycles;
+        float cpi;
+        float ipc;
+    };
+
+    /**
+     * @brief Works out stall_cycles_, cpi_ and ipc_ from the stall cycles the cache hierarchy has
+     * estimated so far, without storing them, so a dump can read them while the VM is running.
+     * Returns the stored values while the caches are disabled; a pipelined VM adds its own stalls.
+     */
+    [[nodiscard]] virtual CycleStats ComputeCycleStats() const;
+
+    /**
+     * @brief Stores ComputeCycleStats() into stall_cycles_, cpi_ and ipc_.
+     */
+    void UpdateCycleStats();
+
+    [[nodiscard]] uint64_t TotalCycles() const {
+        return cycle_s_ + stall_cycles_;
+    }
+
     void ModifyRegister(const std::string &reg_name, uint64_t value);
     void PushInput(const std::string& input) {
         std::lock_guard<std::mutex> lock(input_mutex_);
@@ -30,7 +30,17 @@ struct AssembledProgram {
 
   std::string filename;
   std::vector<std::variant<uint8_t, uint16_t, uint32_t, uint64_t, std::string, float, double>> data_buffer;
+  std::vector<uint8_t> data_image; ///< data_buffer laid out byte for byte, alignment padding included.
   std::vector<uint32_t> text_buffer;
 };
 
+/**
+ * @brief Lays out a data buffer as it appears in memory from the start of the data section.
+ *
+ * Each item is aligned to its own size, matching the offsets the parser assigns to data labels.
+ * @param data_buffer The data items, in directive order.
+ * @return The little-endian bytes of the data section.
+ */
+std::vector<uint8_t> BuildDataImage(const decltype(AssembledProgram::data_buffer) &data_buffer);
+
 #endif // VM_ASM_MW_H
\ No newline at end of file
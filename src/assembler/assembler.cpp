@@ -49,6 +49,7 @@ AssembledProgram assemble(const std::string &filename) {
     std::vector<uint32_t> machine_code_bits = generateMachineCode(parser.getIntermediateCode());
 
     program.data_buffer = parser.getDataBuffer();
+    program.data_image = BuildDataImage(program.data_buffer);
     program.intermediate_code = parser.getIntermediateCode();
     program.text_buffer = machine_code_bits;
     program.instruction_number_line_number_mapping = parser.getInstructionNumberLineNumberMapping();
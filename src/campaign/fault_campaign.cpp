@@ -0,0 +1,553 @@
+/**
+ * @file fault_campaign.cpp
+ * @brief Contains the implementation of the fault-injection campaign runner.
+ */
+
+#include "campaign/fault_campaign.h"
+#include "campaign/json.h"
+#include "campaign/work_stealing_pool.h"
+#include "assembler/assembler.h"
+#include "vm/rvss/rvss_vm.h"
+#include "vm/alu.h"
+#include "config.h"
+
+#include <algorithm>
+#include <bit>
+#include <cfenv>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+namespace campaign {
+
+namespace {
+
+/**
+ * @brief SplitMix64: tiny, and any seed (including consecutive ones) gives an independent stream.
+ */
+class SplitMix64 {
+ public:
+  explicit SplitMix64(uint64_t seed) : state_(seed) {}
+
+  uint64_t Next() {
+    uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+  /**
+   * @brief A value in [0, bound), or 0 if bound is 0. The modulo bias is far below anything a
+   * campaign can measure.
+   */
+  uint64_t Below(uint64_t bound) {
+    return bound ? Next() % bound : 0;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+FaultModel ParseFaultModel(const std::string &name) {
+  if (name=="register") {
+    return FaultModel::kRegister;
+  }
+  if (name=="memory") {
+    return FaultModel::kMemory;
+  }
+  if (name=="pc") {
+    return FaultModel::kPc;
+  }
+  if (name=="inject_flip") {
+    return FaultModel::kInjectFlip;
+  }
+  throw std::runtime_error("Unknown fault model: " + name);
+}
+
+/**
+ * @brief Runs its scope in the default floating-point environment and restores the caller's
+ * afterwards, so a rounding mode a faulty run leaves behind cannot leak into the next run.
+ */
+class DefaultFloatingPoint {
+ public:
+  DefaultFloatingPoint() {
+    std::feholdexcept(&caller_);
+    std::fesetenv(FE_DFL_ENV);
+  }
+
+  ~DefaultFloatingPoint() {
+    std::fesetenv(&caller_);
+  }
+
+  DefaultFloatingPoint(const DefaultFloatingPoint &) = delete;
+  DefaultFloatingPoint &operator=(const DefaultFloatingPoint &) = delete;
+
+ private:
+  std::fenv_t caller_;
+};
+
+bool IsRunning(const RVSSVM &vm) {
+  return !vm.IsStopRequested() && vm.program_counter_ < vm.program_size_;
+}
+
+/**
+ * @brief Seeds the VM's alu::FaultContext for a run.
+ * @return Whether the program's own kInjectFlip instructions flip bits in this run.
+ */
+bool SeedFaultContext(RVSSVM &vm, const FaultPlan *fault, uint64_t campaign_seed) {
+  alu::FaultContext &context = vm.fault_context_;
+  bool program_flips = fault && fault->model==FaultModel::kInjectFlip;
+  context.Seed(fault ? fault->seed : campaign_seed);
+  context.flip_probability = program_flips ? vm_config::config.getFlipProbability() : 0.0;
+  return program_flips;
+}
+
+uint64_t Corrections(const RVSSVM &vm) {
+  return vm.fault_context_.corrections + vm.memory_controller_.GetEccStats().corrected;
+}
+
+void Inject(RVSSVM &vm, const FaultPlan &fault) {
+  switch (fault.model) {
+    case FaultModel::kRegister:
+      vm.registers_.FlipGprBit(fault.target, fault.bit);
+      break;
+    case FaultModel::kMemory:
+      vm.memory_controller_.InjectBitFlip(fault.target, fault.bit);
+      vm.InvalidateText(fault.target & ~uint64_t{3}, 4);
+      break;
+    case FaultModel::kPc:
+      vm.program_counter_ ^= uint64_t{1} << fault.bit;
+      break;
+    case FaultModel::kInjectFlip:
+      break;
+  }
+}
+
+/**
+ * @brief Fills in how a run ended and takes the VM out of sandbox mode.
+ */
+void Record(RVSSVM &vm, const std::ostringstream &output, RunRecord &record) {
+  record.finished = !record.threw && (record.converged || !IsRunning(vm));
+  record.program_counter = vm.program_counter_;
+  record.exit_code = vm.exit_code_;
+  record.output = output.str();
+  for (size_t i = 0; i < 32; ++i) {
+    record.gpr[i] = vm.registers_.ReadGpr(i);
+    record.fpr[i] = vm.registers_.ReadFpr(i);
+  }
+  record.memory_hash = vm.memory_controller_.ContentHash();
+  vm.sandbox_output_ = nullptr;
+}
+
+uint64_t DataSectionSize(const AssembledProgram &program) {
+  if (!program.data_image.empty() || program.data_buffer.empty()) {
+    return program.data_image.size();
+  }
+  return BuildDataImage(program.data_buffer).size();
+}
+
+} // namespace
+
+const char *FaultModelName(FaultModel model) {
+  switch (model) {
+    case FaultModel::kRegister: return "register";
+    case FaultModel::kMemory: return "memory";
+    case FaultModel::kPc: return "pc";
+    case FaultModel::kInjectFlip: return "inject_flip";
+  }
+  return "unknown";
+}
+
+const char *OutcomeName(Outcome outcome) {
+  switch (outcome) {
+    case Outcome::kMasked: return "masked";
+    case Outcome::kCorrected: return "corrected";
+    case Outcome::kSdc: return "sdc";
+    case Outcome::kCrash: return "crash";
+    case Outcome::kHang: return "hang";
+  }
+  return "unknown";
+}
+
+CampaignSpec CampaignSpec::FromJson(const JsonValue &json, const std::filesystem::path &base_directory) {
+  CampaignSpec spec;
+  bool has_program = false;
+  for (const auto &[key, value] : json.AsObject()) {
+    if (key=="program") {
+      spec.program = value.AsString();
+      if (spec.program.is_relative() && !base_directory.empty()) {
+        spec.program = base_directory / spec.program;
+      }
+      has_program = true;
+    } else if (key=="runs") {
+      spec.runs = value.AsUint();
+    } else if (key=="seed") {
+      spec.seed = value.AsUint();
+    } else if (key=="threads") {
+      spec.threads = value.AsUint();
+    } else if (key=="models") {
+      spec.models.clear();
+      for (const JsonValue &model : value.AsArray()) {
+        spec.models.push_back(ParseFaultModel(model.AsString()));
+      }
+      if (spec.models.empty()) {
+        throw std::runtime_error("Campaign needs at least one fault model");
+      }
+    } else if (key=="hang_factor") {
+      spec.hang_factor = value.AsDouble();
+      if (!(spec.hang_factor >= 1.0)) {
+        throw std::runtime_error("hang_factor must be at least 1");
+      }
+    } else if (key=="snapshot_interval") {
+      spec.snapshot_interval = value.AsUint();
+    } else if (key=="output") {
+      spec.output = value.AsString();
+    } else if (key=="config") {
+      for (const auto &[section, entries] : value.AsObject()) {
+        for (const auto &[name, setting] : entries.AsObject()) {
+          spec.config.emplace_back(section, name, setting.AsString());
+        }
+      }
+    } else {
+      throw std::runtime_error("Unknown campaign field: " + key);
+    }
+  }
+  if (!has_program) {
+    throw std::runtime_error("Campaign specification has no \"program\"");
+  }
+  if (spec.output.empty()) {
+    spec.output = spec.program;
+    spec.output.replace_extension(".campaign.csv");
+  }
+  return spec;
+}
+
+CampaignSpec CampaignSpec::FromFile(const std::filesystem::path &path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not open campaign specification: " + path.string());
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+  return FromJson(JsonValue::Parse(text.str()), path.parent_path());
+}
+
+void CampaignResults::Resize(size_t runs) {
+  model.resize(runs);
+  instruction.resize(runs);
+  target.resize(runs);
+  bit.resize(runs);
+  outcome.resize(runs);
+  instructions.resize(runs);
+}
+
+std::array<uint64_t, kOutcomeCount> CampaignResults::Counts() const {
+  std::array<uint64_t, kOutcomeCount> counts{};
+  for (Outcome run : outcome) {
+    counts[static_cast<size_t>(run)]++;
+  }
+  return counts;
+}
+
+void CampaignResults::WriteCsv(std::ostream &os) const {
+  os << "run,model,instruction,target,bit,outcome,instructions\n";
+  for (size_t i = 0; i < Size(); ++i) {
+    os << i << ',' << FaultModelName(model[i]) << ',' << instruction[i] << ",0x" << std::hex << target[i] << std::dec
+       << ',' << static_cast<unsigned>(bit[i]) << ',' << OutcomeName(outcome[i]) << ',' << instructions[i] << '\n';
+  }
+}
+
+FaultCampaign::FaultCampaign(CampaignSpec spec, AssembledProgram program)
+    : spec_(std::move(spec)), program_(std::move(program)) {}
+
+FaultPlan FaultCampaign::Plan(uint64_t index) const {
+  SplitMix64 random(spec_.seed ^ (index * 0xD1B54A32D192ED03ull));
+  FaultPlan plan;
+  plan.model = spec_.models[random.Below(spec_.models.size())];
+  plan.instruction = random.Below(golden_.instructions);
+
+  const uint64_t text_size = program_.text_buffer.size() * 4;
+  switch (plan.model) {
+    case FaultModel::kRegister:
+      plan.target = 1 + random.Below(31);
+      plan.bit = static_cast<unsigned>(random.Below(64));
+      break;
+    case FaultModel::kMemory: {
+      uint64_t text_words = text_size / 4;
+      uint64_t data_words = (DataSectionSize(program_) + 3) / 4;
+      uint64_t word = random.Below(text_words + data_words);
+      plan.target = word < text_words ? word * 4
+                                      : vm_config::config.getDataSectionStart() + (word - text_words) * 4;
+      plan.bit = static_cast<unsigned>(random.Below(vm_config::config.getMemoryEcc() ? 39 : 32));
+      break;
+    }
+    case FaultModel::kPc: {
+      // Bits 0 and 1 would misalign the PC; bits above the text size all land far outside it
+      unsigned highest = std::max(2u, static_cast<unsigned>(std::bit_width(text_size > 0 ? text_size - 1 : 0)));
+      plan.bit = 2 + static_cast<unsigned>(random.Below(highest - 1));
+      break;
+    }
+    case FaultModel::kInjectFlip:
+      plan.instruction = 0;
+      break;
+  }
+  plan.seed = random.Next();
+  return plan;
+}
+
+void FaultCampaign::Load(RVSSVM &vm, std::ostringstream &output) const {
+  vm.sandbox_output_ = &output;
+  vm.Reset();
+  // When the scrubber gets to a word depends on thread timing, and would decide outcomes
+  vm.memory_controller_.StopScrubber();
+  vm.ClearStop();
+  vm.exit_code_.reset();
+  vm.audio_sample_index_ = 0;
+  vm.image_sample_index_ = 0;
+  // Nothing here reverses execution, and checkpoints would copy every page written
+  vm.next_checkpoint_ = UINT64_MAX;
+  vm.LoadProgram(program_, false);
+}
+
+void FaultCampaign::Prepare(RVSSVM &vm) const {
+  std::ostringstream output;
+  Load(vm, output);
+  vm.sandbox_output_ = nullptr;
+}
+
+RunRecord FaultCampaign::Execute(RVSSVM &vm, const FaultPlan *fault, uint64_t budget) const {
+  DefaultFloatingPoint floating_point;
+  std::ostringstream output;
+  Load(vm, output);
+  bool program_flips = SeedFaultContext(vm, fault, spec_.seed);
+
+  RunRecord record;
+  try {
+    if (fault && !program_flips) {
+      record.instructions = vm.RunFor(fault->instruction);
+      if (record.instructions==fault->instruction && IsRunning(vm)) {
+        Inject(vm, *fault);
+      }
+    }
+    record.instructions += vm.RunFor(budget - record.instructions);
+  } catch (const std::exception &) {
+    record.threw = true;
+  }
+  record.corrections = Corrections(vm);
+  Record(vm, output, record);
+  return record;
+}
+
+RunRecord FaultCampaign::Fork(RVSSVM &vm, const FaultPlan &fault) const {
+  DefaultFloatingPoint floating_point;
+  const size_t first = std::min<uint64_t>(fault.instruction / snapshot_interval_, snapshots_.size() - 1);
+  const GoldenSnapshot &start = snapshots_[first];
+
+  // Pages earlier runs scribbled on stay resident, and restoring or comparing memory looks at
+  // every one of them; once there are many, starting from a fresh load is cheaper
+  if (vm.memory_controller_.ResidentPageCount() > start.memory.pages.size() + kSpareResidentPages) {
+    Prepare(vm);
+  }
+
+  std::ostringstream output;
+  output << std::string_view(golden_.output).substr(0, start.output_size);
+  vm.sandbox_output_ = &output;
+  vm.ClearStop();
+  vm.exit_code_.reset();
+  // Seeding rewinds the generator; the snapshot then moves it to where the golden run had it
+  bool program_flips = SeedFaultContext(vm, &fault, spec_.seed);
+  vm.ApplyState(start.state);
+  for (uint64_t page_number : vm.memory_controller_.RestoreImage(start.memory)) {
+    vm.InvalidateText(page_number << Memory::kPageBits, Memory::kPageSize);
+  }
+  // Memory keeps counting across forks; only what this run adds counts
+  const uint64_t corrections_before = Corrections(vm);
+
+  RunRecord record;
+  record.instructions = first * snapshot_interval_;
+  try {
+    if (!program_flips) {
+      record.instructions += vm.RunFor(fault.instruction - record.instructions);
+      if (record.instructions==fault.instruction && IsRunning(vm)) {
+        Inject(vm, fault);
+      }
+    }
+    // Back in the golden run's state at one of its snapshots, the run can only go on as the golden
+    // run did. The program's own flips keep drawing random numbers, so those runs never rejoin it
+    for (size_t next = first + 1; !program_flips && next < snapshots_.size() && IsRunning(vm); ++next) {
+      const uint64_t at = next * snapshot_interval_;
+      record.instructions += vm.RunFor(at - record.instructions);
+      if (record.instructions==at && Matches(vm, output, snapshots_[next])) {
+        record.converged = true;
+        record.corrections = start.corrections + (Corrections(vm) - corrections_before) +
+            (golden_.corrections - snapshots_[next].corrections);
+        break;
+      }
+    }
+    if (!record.converged) {
+      record.instructions += vm.RunFor(budget_ - record.instructions);
+    }
+  } catch (const std::exception &) {
+    record.threw = true;
+  }
+  if (!record.converged) {
+    record.corrections = start.corrections + (Corrections(vm) - corrections_before);
+  }
+  Record(vm, output, record);
+  return record;
+}
+
+bool FaultCampaign::Matches(const RVSSVM &vm, const std::ostringstream &output, const GoldenSnapshot &snapshot) const {
+  const Checkpoint &state = snapshot.state;
+  if (vm.program_counter_!=state.program_counter || vm.branch_flag_!=state.branch_flag ||
+      vm.fault_context_.draws!=state.fault_draws ||
+      vm.audio_sample_index_!=state.audio_sample_index || vm.image_sample_index_!=state.image_sample_index) {
+    return false;
+  }
+  // A run that has not converged usually still differs in some register; find that out before
+  // comparing every CSR
+  for (size_t i = 0; i < 32; ++i) {
+    if (vm.registers_.ReadGpr(i)!=state.registers.ReadGpr(i) || vm.registers_.ReadFpr(i)!=state.registers.ReadFpr(i)) {
+      return false;
+    }
+  }
+  return vm.registers_==state.registers &&
+      output.view()==std::string_view(golden_.output).substr(0, snapshot.output_size) &&
+      vm.memory_controller_.MatchesImage(snapshot.memory);
+}
+
+Outcome FaultCampaign::Classify(const RunRecord &run) const {
+  if (run.converged) {
+    return run.corrections > golden_.corrections ? Outcome::kCorrected : Outcome::kMasked;
+  }
+  if (run.threw) {
+    return Outcome::kCrash;
+  }
+  if (!run.finished) {
+    return Outcome::kHang;
+  }
+  if (!run.exit_code && run.program_counter!=golden_.program_counter) {
+    // Jumped out of the text: real hardware would have faulted on the fetch
+    return Outcome::kCrash;
+  }
+  bool same = run.program_counter==golden_.program_counter && run.exit_code==golden_.exit_code &&
+      run.output==golden_.output && run.gpr==golden_.gpr && run.fpr==golden_.fpr &&
+      run.memory_hash==golden_.memory_hash;
+  if (!same) {
+    return Outcome::kSdc;
+  }
+  return run.corrections > golden_.corrections ? Outcome::kCorrected : Outcome::kMasked;
+}
+
+void FaultCampaign::RunGolden(RVSSVM &vm) {
+  const uint64_t limit = vm_config::config.getInstructionExecutionLimit();
+  golden_ = Execute(vm, nullptr, limit==UINT64_MAX ? limit : limit + 1);
+  if (golden_.threw) {
+    throw std::runtime_error("The golden run crashed");
+  }
+  if (!golden_.finished) {
+    throw std::runtime_error("The golden run did not finish within Execution.instruction_execution_limit");
+  }
+  double budget = std::ceil(static_cast<double>(golden_.instructions) * spec_.hang_factor);
+  budget_ = budget >= 1.8e19 ? UINT64_MAX : std::max<uint64_t>(1, static_cast<uint64_t>(budget));
+
+  snapshot_interval_ = spec_.snapshot_interval;
+  if (!snapshot_interval_) {
+    snapshot_interval_ = std::max(kMinSnapshotInterval, (golden_.instructions + kSnapshots - 1) / kSnapshots);
+  }
+  TakeSnapshots(vm);
+}
+
+void FaultCampaign::TakeSnapshots(RVSSVM &vm) {
+  DefaultFloatingPoint floating_point;
+  std::ostringstream output;
+  Load(vm, output);
+  SeedFaultContext(vm, nullptr, spec_.seed);
+
+  snapshots_.clear();
+  uint64_t executed = 0;
+  do {
+    GoldenSnapshot snapshot;
+    snapshot.state = vm.CaptureState();
+    snapshot.memory = vm.memory_controller_.TakeImage(snapshots_.empty() ? nullptr : &snapshots_.back().memory);
+    snapshot.output_size = output.view().size();
+    snapshot.corrections = Corrections(vm);
+    snapshots_.push_back(std::move(snapshot));
+    executed += vm.RunFor(snapshot_interval_);
+  } while (executed < golden_.instructions && IsRunning(vm));
+  vm.sandbox_output_ = nullptr;
+
+  if (executed!=golden_.instructions || IsRunning(vm)) {
+    throw std::runtime_error("The golden run did not repeat itself; it cannot be forked from");
+  }
+}
+
+CampaignResults FaultCampaign::Run() {
+  for (const auto &[section, key, value] : spec_.config) {
+    vm_config::config.modifyConfig(section, key, value);
+  }
+
+  WorkStealingPool pool(spec_.threads);
+  std::vector<std::unique_ptr<RVSSVM>> vms;
+  for (size_t worker = 0; worker < pool.Threads(); ++worker) {
+    vms.push_back(std::make_unique<RVSSVM>());
+  }
+  RunGolden(*vms[0]);
+  for (size_t worker = 1; worker < vms.size(); ++worker) {
+    Prepare(*vms[worker]);
+  }
+
+  CampaignResults results;
+  results.Resize(spec_.runs);
+  pool.ForEach(spec_.runs, [&](size_t worker, size_t index) {
+    FaultPlan plan = Plan(index);
+    RunRecord run = Fork(*vms[worker], plan);
+    results.model[index] = plan.model;
+    results.instruction[index] = plan.instruction;
+    results.target[index] = plan.target;
+    results.bit[index] = static_cast<uint8_t>(plan.bit);
+    results.outcome[index] = Classify(run);
+    results.instructions[index] = run.instructions;
+  });
+  return results;
+}
+
+int RunCampaignFile(const std::filesystem::path &spec_path) {
+  try {
+    CampaignSpec spec = CampaignSpec::FromFile(spec_path);
+    FaultCampaign campaign(spec, assemble(spec.program.string()));
+
+    auto start = std::chrono::steady_clock::now();
+    CampaignResults results = campaign.Run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::ofstream file(spec.output);
+    if (!file.is_open()) {
+      throw std::runtime_error("Could not write campaign results: " + spec.output.string());
+    }
+    results.WriteCsv(file);
+
+    std::cout << "Campaign: " << results.Size() << " runs of " << spec.program.string() << " ("
+              << campaign.Golden().instructions << " instructions) in " << std::fixed << std::setprecision(2)
+              << elapsed.count() << " s\n";
+    std::array<uint64_t, kOutcomeCount> counts = results.Counts();
+    for (size_t i = 0; i < kOutcomeCount; ++i) {
+      double share = results.Size() ? 100.0 * static_cast<double>(counts[i]) / static_cast<double>(results.Size()) : 0.0;
+      std::cout << "  " << std::left << std::setw(10) << OutcomeName(static_cast<Outcome>(i)) << std::right
+                << std::setw(10) << counts[i] << std::setw(8) << share << " %\n";
+    }
+    std::cout << "Results written to " << spec.output.string() << std::endl;
+    return 0;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+}
+
+} // namespace campaign
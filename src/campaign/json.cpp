@@ -0,0 +1,262 @@
+/**
+ * @file json.cpp
+ * @brief Contains the implementation of the JSON reader.
+ */
+
+#include "campaign/json.h"
+
+#include <cctype>
+#include <stdexcept>
+
+namespace campaign {
+
+class JsonParser {
+ public:
+  explicit JsonParser(std::string_view text) : text_(text) {}
+
+  JsonValue ParseDocument() {
+    JsonValue value = ParseValue(0);
+    SkipSpace();
+    if (position_!=text_.size()) {
+      Fail("trailing characters");
+    }
+    return value;
+  }
+
+ private:
+  // Deep enough for any specification, shallow enough that hostile input cannot exhaust the stack
+  static constexpr int kMaxDepth = 64;
+
+  [[noreturn]] void Fail(const std::string &what) const {
+    throw std::runtime_error("JSON error at offset " + std::to_string(position_) + ": " + what);
+  }
+
+  void SkipSpace() {
+    while (position_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[position_]))) {
+      position_++;
+    }
+  }
+
+  char Peek() {
+    SkipSpace();
+    if (position_ >= text_.size()) {
+      Fail("unexpected end of input");
+    }
+    return text_[position_];
+  }
+
+  void Expect(char c) {
+    if (Peek()!=c) {
+      Fail(std::string("expected '") + c + "'");
+    }
+    position_++;
+  }
+
+  void ExpectWord(std::string_view word) {
+    if (text_.substr(position_, word.size())!=word) {
+      Fail("invalid literal");
+    }
+    position_ += word.size();
+  }
+
+  JsonValue ParseValue(int depth) {
+    if (depth > kMaxDepth) {
+      Fail("nesting too deep");
+    }
+    JsonValue value;
+    char c = Peek();
+    if (c=='{') {
+      value.type_ = JsonValue::Type::kObject;
+      position_++;
+      if (Peek()=='}') {
+        position_++;
+        return value;
+      }
+      for (;;) {
+        if (Peek()!='"') {
+          Fail("expected a key");
+        }
+        std::string key = ParseString();
+        Expect(':');
+        value.object_.emplace_back(std::move(key), ParseValue(depth + 1));
+        if (Peek()==',') {
+          position_++;
+          continue;
+        }
+        Expect('}');
+        return value;
+      }
+    }
+    if (c=='[') {
+      value.type_ = JsonValue::Type::kArray;
+      position_++;
+      if (Peek()==']') {
+        position_++;
+        return value;
+      }
+      for (;;) {
+        value.array_.push_back(ParseValue(depth + 1));
+        if (Peek()==',') {
+          position_++;
+          continue;
+        }
+        Expect(']');
+        return value;
+      }
+    }
+    if (c=='"') {
+      value.type_ = JsonValue::Type::kString;
+      value.text_ = ParseString();
+      return value;
+    }
+    if (c=='t' || c=='f') {
+      value.type_ = JsonValue::Type::kBool;
+      value.boolean_ = c=='t';
+      ExpectWord(c=='t' ? "true" : "false");
+      return value;
+    }
+    if (c=='n') {
+      ExpectWord("null");
+      return value;
+    }
+    if (c=='-' || std::isdigit(static_cast<unsigned char>(c))) {
+      size_t start = position_;
+      position_++;
+      while (position_ < text_.size() && (std::isdigit(static_cast<unsigned char>(text_[position_])) ||
+                                          std::string_view(".eE+-").find(text_[position_])!=std::string_view::npos)) {
+        position_++;
+      }
+      value.type_ = JsonValue::Type::kNumber;
+      value.text_ = std::string(text_.substr(start, position_ - start));
+      return value;
+    }
+    Fail("unexpected character");
+  }
+
+  std::string ParseString() {
+    position_++; // opening quote
+    std::string result;
+    while (position_ < text_.size() && text_[position_]!='"') {
+      char c = text_[position_++];
+      if (c!='\\') {
+        result += c;
+        continue;
+      }
+      if (position_ >= text_.size()) {
+        break;
+      }
+      char escape = text_[position_++];
+      switch (escape) {
+        case '"': result += '"'; break;
+        case '\\': result += '\\'; break;
+        case '/': result += '/'; break;
+        case 'b': result += '\b'; break;
+        case 'f': result += '\f'; break;
+        case 'n': result += '\n'; break;
+        case 'r': result += '\r'; break;
+        case 't': result += '\t'; break;
+        case 'u': {
+          for (size_t i = 0; i < 4; ++i) {
+            if (position_ + i >= text_.size() || !std::isxdigit(static_cast<unsigned char>(text_[position_ + i]))) {
+              Fail("invalid \\u escape");
+            }
+          }
+          unsigned code = std::stoul(std::string(text_.substr(position_, 4)), nullptr, 16);
+          position_ += 4;
+          // Only what a specification needs: ASCII and the rest of the BMP as UTF-8
+          if (code < 0x80) {
+            result += static_cast<char>(code);
+          } else if (code < 0x800) {
+            result += static_cast<char>(0xC0 | (code >> 6));
+            result += static_cast<char>(0x80 | (code & 0x3F));
+          } else {
+            result += static_cast<char>(0xE0 | (code >> 12));
+            result += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (code & 0x3F));
+          }
+          break;
+        }
+        default: Fail("invalid escape");
+      }
+    }
+    if (position_ >= text_.size()) {
+      Fail("unterminated string");
+    }
+    position_++; // closing quote
+    return result;
+  }
+
+  std::string_view text_;
+  size_t position_ = 0;
+};
+
+JsonValue JsonValue::Parse(std::string_view text) {
+  return JsonParser(text).ParseDocument();
+}
+
+bool JsonValue::AsBool() const {
+  if (type_!=Type::kBool) {
+    throw std::runtime_error("JSON value is not a boolean");
+  }
+  return boolean_;
+}
+
+double JsonValue::AsDouble() const {
+  if (type_!=Type::kNumber) {
+    throw std::runtime_error("JSON value is not a number");
+  }
+  size_t consumed = 0;
+  double value = 0;
+  try {
+    value = std::stod(text_, &consumed);
+  } catch (const std::exception &) {
+    consumed = 0;
+  }
+  if (consumed!=text_.size()) {
+    throw std::runtime_error("Invalid JSON number: " + text_);
+  }
+  return value;
+}
+
+uint64_t JsonValue::AsUint() const {
+  if (type_!=Type::kNumber || text_.find_first_not_of("0123456789")!=std::string::npos) {
+    throw std::runtime_error("JSON value is not an unsigned integer: " + text_);
+  }
+  try {
+    return std::stoull(text_);
+  } catch (const std::out_of_range &) {
+    throw std::runtime_error("JSON integer out of range: " + text_);
+  }
+}
+
+const std::string &JsonValue::AsString() const {
+  if (type_!=Type::kString) {
+    throw std::runtime_error("JSON value is not a string");
+  }
+  return text_;
+}
+
+const std::vector<JsonValue> &JsonValue::AsArray() const {
+  if (type_!=Type::kArray) {
+    throw std::runtime_error("JSON value is not an array");
+  }
+  return array_;
+}
+
+const std::vector<std::pair<std::string, JsonValue>> &JsonValue::AsObject() const {
+  if (type_!=Type::kObject) {
+    throw std::runtime_error("JSON value is not an object");
+  }
+  return object_;
+}
+
+const JsonValue *JsonValue::Find(std::string_view key) const {
+  for (const auto &[name, value] : AsObject()) {
+    if (name==key) {
+      return &value;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace campaign
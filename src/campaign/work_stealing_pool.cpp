@@ -0,0 +1,96 @@
+/**
+ * @file work_stealing_pool.cpp
+ * @brief Contains the implementation of the work-stealing thread pool.
+ */
+
+#include "campaign/work_stealing_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+namespace campaign {
+
+WorkStealingPool::WorkStealingPool(size_t threads)
+    : threads_(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+  for (size_t i = 0; i < threads_; ++i) {
+    slices_.push_back(std::make_unique<Slice>());
+  }
+}
+
+bool WorkStealingPool::Take(size_t worker, size_t &index) {
+  {
+    Slice &own = *slices_[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (own.begin < own.end) {
+      index = own.begin++;
+      return true;
+    }
+  }
+
+  // Work is never added once ForEach() has started, so one sweep that finds every slice empty
+  // means the range is used up (the last indices may still be running elsewhere)
+  for (size_t offset = 1; offset < threads_; ++offset) {
+    Slice &victim = *slices_[(worker + offset) % threads_];
+    size_t begin;
+    size_t end;
+    {
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.begin >= victim.end) {
+        continue;
+      }
+      size_t middle = victim.begin + (victim.end - victim.begin) / 2;
+      begin = middle;
+      end = victim.end;
+      victim.end = middle;
+    }
+    Slice &own = *slices_[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    index = begin;
+    own.begin = begin + 1;
+    own.end = end;
+    return true;
+  }
+  return false;
+}
+
+void WorkStealingPool::ForEach(size_t count, const std::function<void(size_t worker, size_t index)> &task) {
+  for (size_t i = 0; i < threads_; ++i) {
+    slices_[i]->begin = count * i / threads_;
+    slices_[i]->end = count * (i + 1) / threads_;
+  }
+
+  std::atomic<bool> failed = false;
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto work = [&](size_t worker) {
+    size_t index;
+    while (!failed.load(std::memory_order_relaxed) && Take(worker, index)) {
+      try {
+        task(worker, index);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        failed = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(threads_ - 1);
+  for (size_t worker = 1; worker < threads_; ++worker) {
+    threads.emplace_back(work, worker);
+  }
+  work(0);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace campaign
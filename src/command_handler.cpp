@@ -32,6 +32,12 @@ Command ParseCommand(const std::string &input) {
     command_type = command_handler::CommandType::UNDO;
   } else if (command_str=="redo" || command_str=="r") {
     command_type = command_handler::CommandType::REDO;
+  } else if (command_str=="reverse_step" || command_str=="rs") {
+    command_type = command_handler::CommandType::REVERSE_STEP;
+  } else if (command_str=="reverse_continue" || command_str=="rc") {
+    command_type = command_handler::CommandType::REVERSE_CONTINUE;
+  } else if (command_str=="goto_instruction" || command_str=="goto") {
+    command_type = command_handler::CommandType::GOTO_INSTRUCTION;
   } else if (command_str=="reset") {
     command_type = command_handler::CommandType::RESET;
   } else if (command_str=="modify_register" || command_str=="mreg") {
@@ -40,6 +46,8 @@ Command ParseCommand(const std::string &input) {
     command_type = command_handler::CommandType::GET_REGISTER;
   } else if (command_str=="modify_memory" || command_str=="mmem") {
     command_type = command_handler::CommandType::MODIFY_MEMORY;
+  } else if (command_str=="inject_mem_flip" || command_str=="imf") {
+    command_type = command_handler::CommandType::INJECT_MEMORY_FLIP;
   } 
   
   
@@ -52,6 +60,10 @@ Command ParseCommand(const std::string &input) {
     command_type = command_handler::CommandType::GET_MEMORY_POINT;
   } else if (command_str=="dump_cache") {
     command_type = command_handler::CommandType::DUMP_CACHE;
+  } else if (command_str=="dump_state" || command_str=="ds") {
+    command_type = command_handler::CommandType::DUMP_STATE;
+  } else if (command_str=="dump_ecc_stats") {
+    command_type = command_handler::CommandType::DUMP_ECC_STATS;
   } else if (command_str=="add_breakpoint") {
     command_type = command_handler::CommandType::ADD_BREAKPOINT;
   } else if (command_str=="remove_breakpoint") {
@@ -0,0 +1,283 @@
+#include "ecc/ecc_utils.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define ECC_BATCH_X86 1
+#include <immintrin.h>
+#endif
+
+namespace ecc{
+    namespace{
+
+        void compute_ecc_batch_scalar(const uint32_t *data, uint64_t *out, size_t count){
+            for(size_t i=0;i<count;i++){
+                out[i] = compute_ecc(data[i]);
+            }
+        }
+
+        void memory_check_batch_scalar(const uint32_t *words, uint8_t *check, size_t count){
+            for(size_t i=0;i<count;i++){
+                check[i] = memory_check_byte(words[i]);
+            }
+        }
+
+        size_t check_batch_scalar(const uint64_t *encoded, uint64_t *out, size_t count){
+            size_t changed = 0;
+            for(size_t i=0;i<count;i++){
+                uint64_t checked = checkError(encoded[i]);
+                changed += checked!=encoded[i];
+                out[i] = checked;
+            }
+            return changed;
+        }
+
+        // checkError only touches a word when the overall parity bit disagrees, i.e. when the
+        // parity of the data and all seven check bits together is odd. The vector check kernels
+        // test that for a whole group and only fall back to checkError for groups that fail.
+
+#ifdef ECC_BATCH_X86
+        // Parity of each 16-bit lane half folded down to a nibble, then looked up with vpshufb.
+        // Works for 32- and 64-bit lanes as long as only the low 32 bits are set.
+        __attribute__((target("avx2")))
+        inline __m256i parity_avx2(__m256i v){
+            const __m256i lut = _mm256_setr_epi8(0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,
+                                                 0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0);
+            v = _mm256_xor_si256(v,_mm256_srli_epi32(v,16));
+            v = _mm256_xor_si256(v,_mm256_srli_epi32(v,8));
+            v = _mm256_xor_si256(v,_mm256_srli_epi32(v,4));
+            return _mm256_shuffle_epi8(lut,_mm256_and_si256(v,_mm256_set1_epi32(0xF)));
+        }
+
+        // Six parity bits from the given masks plus the overall parity in bit 6, per 32-bit lane
+        __attribute__((target("avx2")))
+        inline __m256i check_bits_avx2(__m256i d, const std::array<uint32_t, 6> &masks){
+            __m256i code = _mm256_setzero_si256();
+            __m256i code_parity = _mm256_setzero_si256();
+            for(int j=0;j<6;j++){
+                __m256i p = parity_avx2(_mm256_and_si256(d,_mm256_set1_epi32(static_cast<int>(masks[j]))));
+                code = _mm256_or_si256(code,_mm256_slli_epi32(p,j));
+                code_parity = _mm256_xor_si256(code_parity,p);
+            }
+            __m256i p_all = _mm256_xor_si256(parity_avx2(d),code_parity);
+            return _mm256_or_si256(code,_mm256_slli_epi32(p_all,6));
+        }
+
+        __attribute__((target("avx2")))
+        void compute_ecc_batch_avx2(const uint32_t *data, uint64_t *out, size_t count){
+            size_t i = 0;
+            for(;i+8<=count;i+=8){
+                __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data+i));
+                __m256i ecc = check_bits_avx2(d,PARITY_MASKS);
+
+                __m256i lo = _mm256_or_si256(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(d)),
+                                             _mm256_slli_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(ecc)),32));
+                __m256i hi = _mm256_or_si256(_mm256_cvtepu32_epi64(_mm256_extracti128_si256(d,1)),
+                                             _mm256_slli_epi64(_mm256_cvtepu32_epi64(_mm256_extracti128_si256(ecc,1)),32));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out+i),lo);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out+i+4),hi);
+            }
+            compute_ecc_batch_scalar(data+i,out+i,count-i);
+        }
+
+        __attribute__((target("avx2")))
+        void memory_check_batch_avx2(const uint32_t *words, uint8_t *check, size_t count){
+            // Low byte of each lane to the front of its 128-bit half
+            const __m256i gather = _mm256_setr_epi8(0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+                                                    0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+            size_t i = 0;
+            for(;i+8<=count;i+=8){
+                __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words+i));
+                __m256i bytes = _mm256_shuffle_epi8(check_bits_avx2(d,MEMORY_PARITY_MASKS),gather);
+                __m128i packed = _mm_unpacklo_epi32(_mm256_castsi256_si128(bytes),_mm256_extracti128_si256(bytes,1));
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(check+i),packed);
+            }
+            memory_check_batch_scalar(words+i,check+i,count-i);
+        }
+
+        __attribute__((target("avx2")))
+        size_t check_batch_avx2(const uint64_t *encoded, uint64_t *out, size_t count){
+            const __m256i data_mask = _mm256_set1_epi64x(0xFFFFFFFFLL);
+            const __m256i ecc_mask = _mm256_set1_epi64x(0x7F);
+            size_t changed = 0;
+            size_t i = 0;
+            for(;i+8<=count;i+=8){
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(encoded+i));
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(encoded+i+4));
+                __m256i fold_a = _mm256_xor_si256(_mm256_and_si256(a,data_mask),_mm256_and_si256(_mm256_srli_epi64(a,32),ecc_mask));
+                __m256i fold_b = _mm256_xor_si256(_mm256_and_si256(b,data_mask),_mm256_and_si256(_mm256_srli_epi64(b,32),ecc_mask));
+                __m256i odd = _mm256_or_si256(parity_avx2(fold_a),parity_avx2(fold_b));
+                if(_mm256_testz_si256(odd,odd)){
+                    if(out!=encoded){
+                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out+i),a);
+                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out+i+4),b);
+                    }
+                }
+                else{
+                    changed += check_batch_scalar(encoded+i,out+i,8);
+                }
+            }
+            return changed+check_batch_scalar(encoded+i,out+i,count-i);
+        }
+
+        // GCC 12 reports the _mm512_undefined_* placeholders inside its own intrinsics as uninitialized
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+        __attribute__((target("avx512f,avx512vpopcntdq")))
+        inline __m512i check_bits_avx512(__m512i d, const std::array<uint32_t, 6> &masks){
+            const __m512i one = _mm512_set1_epi32(1);
+            __m512i code = _mm512_setzero_si512();
+            for(int j=0;j<6;j++){
+                __m512i bits = _mm512_and_si512(d,_mm512_set1_epi32(static_cast<int>(masks[j])));
+                __m512i p = _mm512_and_si512(_mm512_popcnt_epi32(bits),one);
+                code = _mm512_or_si512(code,_mm512_slli_epi32(p,j));
+            }
+            __m512i total = _mm512_add_epi32(_mm512_popcnt_epi32(d),_mm512_popcnt_epi32(code));
+            return _mm512_or_si512(code,_mm512_slli_epi32(_mm512_and_si512(total,one),6));
+        }
+
+        __attribute__((target("avx512f,avx512vpopcntdq")))
+        void compute_ecc_batch_avx512(const uint32_t *data, uint64_t *out, size_t count){
+            size_t i = 0;
+            for(;i+16<=count;i+=16){
+                __m512i d = _mm512_loadu_si512(data+i);
+                __m512i ecc = check_bits_avx512(d,PARITY_MASKS);
+
+                __m512i lo = _mm512_or_si512(_mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(d,0)),
+                                             _mm512_slli_epi64(_mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(ecc,0)),32));
+                __m512i hi = _mm512_or_si512(_mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(d,1)),
+                                             _mm512_slli_epi64(_mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(ecc,1)),32));
+                _mm512_storeu_si512(out+i,lo);
+                _mm512_storeu_si512(out+i+8,hi);
+            }
+            compute_ecc_batch_scalar(data+i,out+i,count-i);
+        }
+
+        __attribute__((target("avx512f,avx512vpopcntdq")))
+        void memory_check_batch_avx512(const uint32_t *words, uint8_t *check, size_t count){
+            size_t i = 0;
+            for(;i+16<=count;i+=16){
+                __m512i d = _mm512_loadu_si512(words+i);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(check+i),_mm512_cvtepi32_epi8(check_bits_avx512(d,MEMORY_PARITY_MASKS)));
+            }
+            memory_check_batch_scalar(words+i,check+i,count-i);
+        }
+
+        __attribute__((target("avx512f,avx512vpopcntdq")))
+        size_t check_batch_avx512(const uint64_t *encoded, uint64_t *out, size_t count){
+            const __m512i data_mask = _mm512_set1_epi64(0xFFFFFFFFLL);
+            const __m512i ecc_mask = _mm512_set1_epi64(0x7F);
+            const __m512i one = _mm512_set1_epi64(1);
+            size_t changed = 0;
+            size_t i = 0;
+            for(;i+16<=count;i+=16){
+                __m512i a = _mm512_loadu_si512(encoded+i);
+                __m512i b = _mm512_loadu_si512(encoded+i+8);
+                __m512i fold_a = _mm512_xor_si512(_mm512_and_si512(a,data_mask),_mm512_and_si512(_mm512_srli_epi64(a,32),ecc_mask));
+                __m512i fold_b = _mm512_xor_si512(_mm512_and_si512(b,data_mask),_mm512_and_si512(_mm512_srli_epi64(b,32),ecc_mask));
+                __mmask8 odd_a = _mm512_test_epi64_mask(_mm512_popcnt_epi64(fold_a),one);
+                __mmask8 odd_b = _mm512_test_epi64_mask(_mm512_popcnt_epi64(fold_b),one);
+                if((odd_a|odd_b)==0){
+                    if(out!=encoded){
+                        _mm512_storeu_si512(out+i,a);
+                        _mm512_storeu_si512(out+i+8,b);
+                    }
+                }
+                else{
+                    changed += check_batch_scalar(encoded+i,out+i,16);
+                }
+            }
+            return changed+check_batch_scalar(encoded+i,out+i,count-i);
+        }
+#pragma GCC diagnostic pop
+#endif
+
+    } // namespace
+
+    bool batch_kernel_supported(BatchKernel kernel){
+        switch(kernel){
+            case BatchKernel::kScalar:
+                return true;
+#ifdef ECC_BATCH_X86
+            case BatchKernel::kAvx2:
+                return __builtin_cpu_supports("avx2");
+            case BatchKernel::kAvx512:
+                return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+#else
+            default:
+                return false;
+#endif
+        }
+        return false;
+    }
+
+    BatchKernel best_batch_kernel(){
+        static const BatchKernel best = batch_kernel_supported(BatchKernel::kAvx512) ? BatchKernel::kAvx512
+                                      : batch_kernel_supported(BatchKernel::kAvx2) ? BatchKernel::kAvx2
+                                      : BatchKernel::kScalar;
+        return best;
+    }
+
+    const char *batch_kernel_name(BatchKernel kernel){
+        switch(kernel){
+            case BatchKernel::kScalar: return "scalar";
+            case BatchKernel::kAvx2: return "avx2";
+            case BatchKernel::kAvx512: return "avx512";
+        }
+        return "unknown";
+    }
+
+    void compute_ecc_batch(const uint32_t *data, uint64_t *out, size_t count){
+        compute_ecc_batch(data,out,count,best_batch_kernel());
+    }
+
+    // Callers must only pass kernels batch_kernel_supported() accepts
+    void compute_ecc_batch(const uint32_t *data, uint64_t *out, size_t count, BatchKernel kernel){
+        switch(kernel){
+#ifdef ECC_BATCH_X86
+            case BatchKernel::kAvx512:
+                compute_ecc_batch_avx512(data,out,count);
+                return;
+            case BatchKernel::kAvx2:
+                compute_ecc_batch_avx2(data,out,count);
+                return;
+#endif
+            default:
+                compute_ecc_batch_scalar(data,out,count);
+        }
+    }
+
+    void memory_check_batch(const uint32_t *words, uint8_t *check, size_t count){
+        memory_check_batch(words,check,count,best_batch_kernel());
+    }
+
+    void memory_check_batch(const uint32_t *words, uint8_t *check, size_t count, BatchKernel kernel){
+        switch(kernel){
+#ifdef ECC_BATCH_X86
+            case BatchKernel::kAvx512:
+                memory_check_batch_avx512(words,check,count);
+                return;
+            case BatchKernel::kAvx2:
+                memory_check_batch_avx2(words,check,count);
+                return;
+#endif
+            default:
+                memory_check_batch_scalar(words,check,count);
+        }
+    }
+
+    size_t check_batch(const uint64_t *encoded, uint64_t *out, size_t count){
+        return check_batch(encoded,out,count,best_batch_kernel());
+    }
+
+    size_t check_batch(const uint64_t *encoded, uint64_t *out, size_t count, BatchKernel kernel){
+        switch(kernel){
+#ifdef ECC_BATCH_X86
+            case BatchKernel::kAvx512:
+                return check_batch_avx512(encoded,out,count);
+            case BatchKernel::kAvx2:
+                return check_batch_avx2(encoded,out,count);
+#endif
+            default:
+                return check_batch_scalar(encoded,out,count);
+        }
+    }
+}
@@ -3,10 +3,13 @@
 #include "utils.h"
 #include "globals.h"
 #include "vm/rvss/rvss_vm.h"
+#include "vm/rv5s/rv5s_vm.h"
 #include "vm_runner.h"
 #include "command_handler.h"
 #include "config.h"
+#include "campaign/fault_campaign.h"
 
+#include <fstream>
 #include <iostream>
 #include <thread>
 #include <bitset>
@@ -29,6 +32,9 @@ int main(int argc, char *argv[]) {
                   << "  --help, -h           Show this help message\n"
                   << "  --assemble <file>    Assemble the specified file\n"
                   << "  --run <file>         Run the specified file\n"
+                  << "  --campaign <spec.json>  Run a fault-injection campaign\n"
+                  << "  --cache-sweep <file>  Run the file once and write the LRU hit rates of every CacheSweep geometry\n"
+                  << "  --config <section> <key> <value>  Set a configuration value, as modify_config does\n"
                   << "  --verbose-errors     Enable verbose error printing\n"
                   << "  --start-vm           Start the VM with the default program\n"
                   << "  --start-vm --vm-as-backend  Start the VM with the default program in backend mode\n";
@@ -55,16 +61,71 @@ int main(int argc, char *argv[]) {
         }
         try {
             AssembledProgram program = assemble(argv[i]);
+            if (vm_config::config.getVmType() == vm_config::VmTypes::MULTI_STAGE) {
+              RV5SVM vm;
+              vm.LoadProgram(program, false);
+              vm.Run();
+              std::cout << "Program running: " << program.filename << '\n';
+              if (EccTelemetry::Snapshot ecc_stats = vm.EccStats(); ecc_stats.Checks() || ecc_stats.memory_ecc) {
+                ecc_stats.PrintSummary(std::cout);
+              }
+              if (vm.memory_controller_.GetCaches().Enabled()) {
+                vm.memory_controller_.PrintCacheStatus();
+              }
+              vm.UpdateCycleStats();
+              std::cout << "  " << vm.instructions_retired_ << " instructions in " << vm.TotalCycles()
+                        << " cycles (" << vm.stall_cycles_ << " stall cycles, " << vm.branch_mispredictions_
+                        << " branch mispredictions), CPI " << vm.cpi_ << "\n";
+              return 0;
+            }
             RVSSVM vm;
-            vm.LoadProgram(program);
+            vm.LoadProgram(program, false); // Run() dumps the state when it finishes
             vm.Run();
             std::cout << "Program running: " << program.filename << '\n';
+            if (EccTelemetry::Snapshot ecc_stats = vm.EccStats(); ecc_stats.Checks() || ecc_stats.memory_ecc) {
+              ecc_stats.PrintSummary(std::cout);
+            }
+            if (vm.memory_controller_.GetCaches().Enabled()) {
+              vm.memory_controller_.PrintCacheStatus();
+              vm.UpdateCycleStats();
+              std::cout << "  " << vm.instructions_retired_ << " instructions in " << vm.TotalCycles()
+                        << " cycles, CPI " << vm.cpi_ << "\n";
+            }
             return 0;
         } catch (const std::runtime_error& e) {
             std::cerr << e.what() << '\n';
             return 1;
         }
 
+    } else if (arg == "--campaign") {
+        if (++i >= argc) {
+            std::cerr << "Error: No campaign specification given.\n";
+            return 1;
+        }
+        setupVmStateDirectory(); // The assembler reports errors there
+        return campaign::RunCampaignFile(argv[i]);
+
+    } else if (arg == "--cache-sweep") {
+        if (++i >= argc) {
+            std::cerr << "Error: No file specified to sweep.\n";
+            return 1;
+        }
+        setupVmStateDirectory();
+        return cache::RunCacheSweep(argv[i]);
+
+    } else if (arg == "--config") {
+        if (i + 3 >= argc) {
+            std::cerr << "Error: --config needs a section, a key and a value.\n";
+            return 1;
+        }
+        try {
+            vm_config::config.modifyConfig(argv[i + 1], argv[i + 2], argv[i + 3]);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << '\n';
+            return 1;
+        }
+        i += 3;
+
     } else if (arg == "--verbose-errors") {
         globals::verbose_errors_print = true;
         std::cout << "Verbose error printing enabled.\n";
@@ -178,6 +239,7 @@ int main(int argc, char *argv[]) {
       launch_vm_thread([&]() { vm.DebugRun(); });
     } else if (command.type==command_handler::CommandType::STOP) {
       vm.RequestStop();
+      if (vm_thread.joinable()) vm_thread.join(); // the dump below reads what the VM thread updates
       std::cout << "VM_STOPPED" << std::endl;
       vm.output_status_ = "VM_STOPPED";
       vm.DumpState(globals::vm_state_dump_file_path);
@@ -191,6 +253,34 @@ int main(int argc, char *argv[]) {
     } else if (command.type==command_handler::CommandType::REDO) {
       if (vm_running) continue;
       vm.Redo();
+    } else if (command.type==command_handler::CommandType::REVERSE_STEP) {
+      if (vm_running) continue;
+      try {
+        vm.ReverseStep(command.args.empty() ? 1 : std::stoull(command.args[0]));
+      } catch (const std::exception &e) {
+        std::cout << "VM_REVERSE_ERROR" << std::endl;
+        std::cerr << e.what() << '\n';
+      }
+    } else if (command.type==command_handler::CommandType::REVERSE_CONTINUE) {
+      if (vm_running) continue;
+      try {
+        vm.ReverseContinue();
+      } catch (const std::exception &e) {
+        std::cout << "VM_REVERSE_ERROR" << std::endl;
+        std::cerr << e.what() << '\n';
+      }
+    } else if (command.type==command_handler::CommandType::GOTO_INSTRUCTION) {
+      if (vm_running) continue;
+      try {
+        if (command.args.size() != 1) {
+          std::cout << "VM_REVERSE_ERROR" << std::endl;
+          continue;
+        }
+        vm.GotoInstruction(std::stoull(command.args[0]));
+      } catch (const std::exception &e) {
+        std::cout << "VM_REVERSE_ERROR" << std::endl;
+        std::cerr << e.what() << '\n';
+      }
     } else if (command.type==command_handler::CommandType::RESET) {
       vm.Reset();
     } else if (command.type==command_handler::CommandType::EXIT) {
@@ -200,10 +290,39 @@ int main(int argc, char *argv[]) {
       vm.DumpState(globals::vm_state_dump_file_path);
       break;
     } else if (command.type==command_handler::CommandType::ADD_BREAKPOINT) {
-      vm.AddBreakpoint(std::stoul(command.args[0], nullptr, 10));
+      try {
+        if (command.args.empty()) {
+          std::cout << "VM_ADD_BREAKPOINT_ERROR" << std::endl;
+          continue;
+        }
+        // add_breakpoint <line> [if <lhs> <op> <value>] [ignore <count>] [temp]
+        Breakpoint options;
+        for (size_t i = 1; i < command.args.size(); ++i) {
+          if (command.args[i]=="if" && i + 3 < command.args.size()) {
+            options.condition = BreakpointCondition::Parse(command.args[i + 1], command.args[i + 2], command.args[i + 3]);
+            i += 3;
+          } else if (command.args[i]=="ignore" && i + 1 < command.args.size()) {
+            options.ignore_count = std::stoull(command.args[++i]);
+          } else if (command.args[i]=="temp") {
+            options.temporary = true;
+          } else {
+            throw std::invalid_argument("Unexpected breakpoint argument: " + command.args[i]);
+          }
+        }
+        vm.AddBreakpoint(std::stoul(command.args[0], nullptr, 10), true, options);
+      } catch (const std::exception &e) {
+        std::cout << "VM_ADD_BREAKPOINT_ERROR" << std::endl;
+        std::cerr << e.what() << '\n';
+      }
     } else if (command.type==command_handler::CommandType::REMOVE_BREAKPOINT) {
       vm.RemoveBreakpoint(std::stoul(command.args[0], nullptr, 10));
     } else if (command.type==command_handler::CommandType::MODIFY_REGISTER) {
+      // Rebasing the checkpoints would race the ones Run() and DebugRun() take
+      if (vm_running) {
+        std::cout << "VM_MODIFY_REGISTER_ERROR" << std::endl;
+        std::cerr << "Cannot modify a register while the VM is running\n";
+        continue;
+      }
       try {
         if (command.args.size() != 2) {
           std::cout << "VM_MODIFY_REGISTER_ERROR" << std::endl;
@@ -212,6 +331,7 @@ int main(int argc, char *argv[]) {
         std::string reg_name = command.args[0];
         uint64_t value = std::stoull(command.args[1], nullptr, 16);
         vm.ModifyRegister(reg_name, value);
+        vm.RebaseCheckpoints();
         DumpRegisters(globals::registers_dump_file_path, vm.registers_);
         std::cout << "VM_MODIFY_REGISTER_SUCCESS" << std::endl;
       } catch (const std::out_of_range &e) {
@@ -244,6 +364,12 @@ int main(int argc, char *argv[]) {
 
   
     else if (command.type==command_handler::CommandType::MODIFY_MEMORY) {
+      // As for modify_register; the decode cache is also the VM thread's
+      if (vm_running) {
+        std::cout << "VM_MODIFY_MEMORY_ERROR" << std::endl;
+        std::cerr << "Cannot modify memory while the VM is running\n";
+        continue;
+      }
       if (command.args.size() != 3) {
         std::cout << "VM_MODIFY_MEMORY_ERROR" << std::endl;
         continue;
@@ -254,17 +380,19 @@ int main(int argc, char *argv[]) {
         uint64_t value = std::stoull(command.args[2], nullptr, 16);
 
         if (type == "byte") {
-          vm.memory_controller_.WriteByte(address, static_cast<uint8_t>(value));
+          vm.memory_controller_.WriteByte_d(address, static_cast<uint8_t>(value));
         } else if (type == "half") {
-          vm.memory_controller_.WriteHalfWord(address, static_cast<uint16_t>(value));
+          vm.memory_controller_.WriteHalfWord_d(address, static_cast<uint16_t>(value));
         } else if (type == "word") {
-          vm.memory_controller_.WriteWord(address, static_cast<uint32_t>(value));
+          vm.memory_controller_.WriteWord_d(address, static_cast<uint32_t>(value));
         } else if (type == "double") {
-          vm.memory_controller_.WriteDoubleWord(address, value);
+          vm.memory_controller_.WriteDoubleWord_d(address, value);
         } else {
           std::cout << "VM_MODIFY_MEMORY_ERROR" << std::endl;
           continue;
         }
+        vm.InvalidateText(address, 8);
+        vm.RebaseCheckpoints();
         std::cout << "VM_MODIFY_MEMORY_SUCCESS" << std::endl;
       } catch (const std::out_of_range &e) {
         std::cout << "VM_MODIFY_MEMORY_ERROR" << std::endl;
@@ -277,6 +405,21 @@ int main(int argc, char *argv[]) {
     
     
     
+    else if (command.type==command_handler::CommandType::INJECT_MEMORY_FLIP) {
+      if (command.args.size() != 2) {
+        std::cout << "VM_INJECT_MEMORY_FLIP_ERROR" << std::endl;
+        continue;
+      }
+      try {
+        uint64_t address = std::stoull(command.args[0], nullptr, 16);
+        unsigned int bit = std::stoul(command.args[1]);
+        vm.memory_controller_.InjectBitFlip(address, bit);
+        std::cout << "VM_INJECT_MEMORY_FLIP_SUCCESS" << std::endl;
+      } catch (const std::exception &e) {
+        std::cout << "VM_INJECT_MEMORY_FLIP_ERROR" << std::endl;
+        std::cerr << e.what() << '\n';
+      }
+    }
     else if (command.type==command_handler::CommandType::DUMP_MEMORY) {
       try {
         vm.memory_controller_.DumpMemory(command.args);
@@ -310,7 +453,35 @@ int main(int argc, char *argv[]) {
     
     
     else if (command.type==command_handler::CommandType::DUMP_CACHE) {
-      std::cout << "Cache dumped." << std::endl;
+      // The VM thread updates the lines and counters on every access
+      if (vm_running) {
+        std::cout << "VM_CACHE_DUMP_ERROR" << std::endl;
+        continue;
+      }
+      std::ofstream file(globals::cache_dump_file_path);
+      if (!file) {
+        std::cout << "VM_CACHE_DUMP_ERROR" << std::endl;
+        continue;
+      }
+      vm.memory_controller_.GetCaches().WriteJson(file);
+      std::cout << "VM_CACHE_DUMPED" << std::endl;
+    } else if (command.type==command_handler::CommandType::DUMP_STATE) {
+      // The stall cycles come from the cache counters, which the VM thread updates as dump_cache's lines
+      if (vm_running) {
+        std::cout << "VM_STATE_DUMP_ERROR" << std::endl;
+        continue;
+      }
+      DumpRegisters(globals::registers_dump_file_path, vm.registers_);
+      vm.DumpState(globals::vm_state_dump_file_path);
+      std::cout << "VM_STATE_DUMPED" << std::endl;
+    } else if (command.type==command_handler::CommandType::DUMP_ECC_STATS) {
+      std::ofstream file(globals::ecc_stats_dump_file_path);
+      if (!file) {
+        std::cout << "VM_ECC_STATS_DUMP_ERROR" << std::endl;
+        continue;
+      }
+      vm.EccStats().WriteJson(file);
+      std::cout << "VM_ECC_STATS_DUMPED" << std::endl;
     } else {
       std::cout << "Invalid command.";
       std::cout << command_buffer << std::endl;
@@ -8,6 +8,7 @@
 #include <random>
 #include <bitset>
 #include "vm/alu.h"
+#include "config.h"
 #include "fp_utils/bfloat16.h"
 #include <cfenv>
 #include <cmath>
@@ -20,6 +21,42 @@
 
 namespace alu {
 
+void FaultContext::Configure() {
+  uint64_t seed = vm_config::config.getFaultSeed();
+  if (!seed) {
+    std::random_device device;
+    seed = static_cast<uint64_t>(device()) << 32 | device();
+  }
+  Seed(seed);
+  flip_probability = vm_config::config.getFlipProbability();
+  flip_bit_min = vm_config::config.getFlipBitMin();
+  flip_bit_max = vm_config::config.getFlipBitMax();
+  if (flip_bit_min > flip_bit_max) {
+    std::cerr << "VM warning: flip_bit_min " << flip_bit_min << " is above flip_bit_max " << flip_bit_max
+              << ", flipping the data bits 0 to 31 instead" << std::endl;
+    flip_bit_min = 0;
+    flip_bit_max = 31;
+  }
+
+  switch (vm_config::config.getEccPolicy()) {
+    case vm_config::EccPolicies::ADAPTIVE: ecc_policy = ecc::PolicyEngine(ecc::AdaptivePolicy()); break;
+    case vm_config::EccPolicies::ALWAYS_SECDED: ecc_policy = ecc::PolicyEngine(ecc::AlwaysSecdedPolicy()); break;
+    case vm_config::EccPolicies::SIGNIFICANCE: {
+      ecc::SignificanceThresholdPolicy policy;
+      policy.threshold = vm_config::config.getEccSignificanceThreshold();
+      ecc_policy = ecc::PolicyEngine(policy);
+      break;
+    }
+    case vm_config::EccPolicies::FREQUENCY_DECAY: {
+      ecc::FrequencyDecayPolicy policy;
+      policy.period = vm_config::config.getEccCheckPeriod();
+      ecc_policy = ecc::PolicyEngine(policy);
+      break;
+    }
+    case vm_config::EccPolicies::NONE: ecc_policy = ecc::PolicyEngine(ecc::NoEccPolicy()); break;
+  }
+}
+
 static std::string decode_fclass(uint16_t res) {
   static const std::vector<std::string> labels = {
     "-infinity",   
@@ -46,6 +83,50 @@ static std::string decode_fclass(uint16_t res) {
 }
 
 
+std::pair<uint64_t, bool> Alu::injectFlip(uint64_t value, FaultContext &context) {
+  // One position per execution, flip or not, so the position only depends on how many ran
+  FaultRng::Block block = context.rng.Draw(context.draws++);
+  if (FaultRng::ToUnit(block) >= context.flip_probability) {
+    return {value, false};
+  }
+  unsigned span = context.flip_bit_max - context.flip_bit_min + 1;
+  unsigned bit = context.flip_bit_min + block[2] % span;
+  context.flips++;
+  return {value ^ (uint64_t{1} << bit), true};
+}
+
+std::pair<uint64_t, bool> Alu::executeWide(AluOp op, uint64_t a, uint64_t b) {
+  auto sa = static_cast<int64_t>(a);
+  auto sb = static_cast<int64_t>(b);
+  int64_t result;
+  switch (op) {
+    case AluOp::kAdd: {
+      bool overflow = __builtin_add_overflow(sa, sb, &result);
+      return {static_cast<uint64_t>(result), overflow};
+    }
+    case AluOp::kSub: {
+      bool overflow = __builtin_sub_overflow(sa, sb, &result);
+      return {static_cast<uint64_t>(result), overflow};
+    }
+    case AluOp::kMul: {
+      bool overflow = __builtin_mul_overflow(sa, sb, &result);
+      return {a * b, overflow};
+    }
+    case AluOp::kDiv: {
+      if (sb==0) {
+        return {UINT64_MAX, false};
+      }
+      if (sa==INT64_MIN && sb==-1) {
+        return {static_cast<uint64_t>(INT64_MIN), true};
+      }
+      return {static_cast<uint64_t>(sa / sb), false};
+    }
+    default: {
+      return execute(op, a, b);
+    }
+  }
+}
+
 [[nodiscard]] std::pair<uint64_t, bool> Alu::execute(AluOp op, uint64_t a, uint64_t b) {
   switch (op) {
     case AluOp::kAdd: {
@@ -70,29 +151,9 @@ static std::string decode_fclass(uint16_t res) {
       return {static_cast<uint64_t>(result), overflow};
     }
     case AluOp::kInjectFlip: {
-    // a = x2 (source and destination), b = x0 (ignored)
-    uint64_t value = a;  // Extract lower 32 bits as signed int
-
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    
-    // Probability: 1 in 10,000 → p = 0.0001
-    std::bernoulli_distribution flip_happens(0.1);
-    
-    bool did_flip = false;
-
-    if (flip_happens(gen)) {
-      // Choose random bit position: 0 to 31
-      std::uniform_int_distribution<int> bit_pos(0, 31);
-      int pos = bit_pos(gen);
-
-      value ^= (1ULL << pos);
-      did_flip = true;
+      // Only a VM's FaultContext can decide on a flip; see the overload taking one
+      return {a, false};
     }
-
-    // Return new value in x2 (zero-extended to 64-bit), and whether flip occurred
-    return {value, did_flip};
-  }
     case AluOp::kCheckError: {
       uint64_t input_val = a;
 
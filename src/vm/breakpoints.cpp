@@ -0,0 +1,274 @@
+/**
+ * @file breakpoints.cpp
+ * @brief Contains the implementation of the breakpoint set and its address lookups.
+ */
+
+#include "vm/breakpoints.h"
+
+#include "vm/registers.h"
+#include "vm/memory_controller.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+uint64_t ParseValue(const std::string &text) {
+  size_t consumed = 0;
+  uint64_t value = 0;
+  try {
+    value = std::stoull(text, &consumed, 0);
+  } catch (const std::exception &) {
+    throw std::invalid_argument("Invalid breakpoint condition value: " + text);
+  }
+  if (consumed!=text.size()) {
+    throw std::invalid_argument("Invalid breakpoint condition value: " + text);
+  }
+  return value;
+}
+
+/**
+ * @brief First entry at or after the address in a vector sorted by address.
+ */
+template<typename Entries>
+auto LowerBound(Entries &entries, uint64_t address) {
+  return std::lower_bound(entries.begin(), entries.end(), address, [](const Breakpoint &entry, uint64_t key) {
+    return entry.address < key;
+  });
+}
+
+} // namespace
+
+BreakpointCondition BreakpointCondition::Parse(const std::string &lhs, const std::string &op, const std::string &value) {
+  BreakpointCondition condition;
+
+  if (lhs.size() > 5 && lhs.starts_with("mem[") && lhs.back()==']') {
+    condition.source = Source::kMemory;
+    condition.operand = ParseValue(lhs.substr(4, lhs.size() - 5));
+  } else if (lhs.size() > 1 && (lhs[0]=='x' || lhs[0]=='f')) {
+    condition.source = lhs[0]=='x' ? Source::kGpr : Source::kFpr;
+    condition.operand = ParseValue(lhs.substr(1));
+    if (condition.operand >= 32) {
+      throw std::invalid_argument("Invalid breakpoint condition register: " + lhs);
+    }
+  } else {
+    throw std::invalid_argument("Invalid breakpoint condition operand: " + lhs);
+  }
+
+  if (op=="==") {
+    condition.compare = Compare::kEq;
+  } else if (op=="!=") {
+    condition.compare = Compare::kNe;
+  } else if (op=="<") {
+    condition.compare = Compare::kLt;
+  } else if (op=="<=") {
+    condition.compare = Compare::kLe;
+  } else if (op==">") {
+    condition.compare = Compare::kGt;
+  } else if (op==">=") {
+    condition.compare = Compare::kGe;
+  } else {
+    throw std::invalid_argument("Invalid breakpoint condition operator: " + op);
+  }
+
+  condition.value = ParseValue(value);
+  return condition;
+}
+
+bool BreakpointCondition::Evaluate(const RegisterFile &registers, MemoryController &memory) const {
+  uint64_t actual = 0;
+  switch (source) {
+    case Source::kNone:
+      return true;
+    case Source::kGpr:
+      actual = registers.ReadGpr(operand);
+      break;
+    case Source::kFpr:
+      actual = registers.ReadFpr(operand);
+      break;
+    case Source::kMemory:
+      try {
+        actual = memory.ReadDoubleWord_d(operand);
+      } catch (const std::out_of_range &) {
+        return false;
+      }
+      break;
+  }
+
+  switch (compare) {
+    case Compare::kEq: return actual==value;
+    case Compare::kNe: return actual!=value;
+    case Compare::kLt: return actual < value;
+    case Compare::kLe: return actual <= value;
+    case Compare::kGt: return actual > value;
+    case Compare::kGe: return actual >= value;
+  }
+  return false;
+}
+
+bool FlatAddressSet::Contains(uint64_t address) const {
+  if (slots_.empty()) {
+    return false;
+  }
+  size_t mask = slots_.size() - 1;
+  for (size_t slot = Slot(address);; slot = (slot + 1) & mask) {
+    if (slots_[slot]==address) {
+      return true;
+    }
+    if (slots_[slot]==kEmpty) {
+      return false;
+    }
+  }
+}
+
+bool FlatAddressSet::Insert(uint64_t address) {
+  if (Contains(address)) {
+    return false;
+  }
+  // Keep the load factor at or below one half
+  if ((size_ + 1) * 2 > slots_.size()) {
+    Grow();
+  }
+  size_t mask = slots_.size() - 1;
+  size_t slot = Slot(address);
+  while (slots_[slot]!=kEmpty) {
+    slot = (slot + 1) & mask;
+  }
+  slots_[slot] = address;
+  size_++;
+  return true;
+}
+
+bool FlatAddressSet::Erase(uint64_t address) {
+  if (slots_.empty()) {
+    return false;
+  }
+  size_t mask = slots_.size() - 1;
+  size_t slot = Slot(address);
+  while (slots_[slot]!=address) {
+    if (slots_[slot]==kEmpty) {
+      return false;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  // Backward-shift deletion: pull later entries of the probe run into the hole so lookups
+  // never need tombstones
+  size_t hole = slot;
+  for (size_t next = (hole + 1) & mask; slots_[next]!=kEmpty; next = (next + 1) & mask) {
+    size_t home = Slot(slots_[next]);
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      slots_[hole] = slots_[next];
+      hole = next;
+    }
+  }
+  slots_[hole] = kEmpty;
+  size_--;
+  return true;
+}
+
+void FlatAddressSet::Clear() {
+  slots_.clear();
+  size_ = 0;
+  bits_ = 0;
+}
+
+void FlatAddressSet::Grow() {
+  std::vector<uint64_t> old = std::move(slots_);
+  bits_ = bits_==0 ? 3 : bits_ + 1;
+  slots_.assign(size_t{1} << bits_, kEmpty);
+  size_ = 0;
+  for (uint64_t address : old) {
+    if (address!=kEmpty) {
+      Insert(address);
+    }
+  }
+}
+
+void BreakpointSet::SetTextSize(uint64_t size) {
+  text_slots_ = size / 4;
+  bitmap_.assign((text_slots_ + 63) / 64, 0);
+  outside_text_.Clear();
+  for (const auto &breakpoint : entries_) {
+    Mark(breakpoint.address, true);
+  }
+}
+
+void BreakpointSet::Mark(uint64_t address, bool set) {
+  uint64_t slot = address >> 2;
+  if (slot < text_slots_) {
+    uint64_t bit = uint64_t{1} << (slot & 63);
+    if (set) {
+      bitmap_[slot >> 6] |= bit;
+    } else {
+      bitmap_[slot >> 6] &= ~bit;
+    }
+  } else if (set) {
+    outside_text_.Insert(address);
+  } else {
+    outside_text_.Erase(address);
+  }
+}
+
+bool BreakpointSet::Add(const Breakpoint &breakpoint) {
+  // The bitmap has one bit per instruction, so a misaligned address would mark its neighbour
+  if (breakpoint.address % 4!=0) {
+    throw std::invalid_argument("Breakpoint address must be a multiple of 4: " + std::to_string(breakpoint.address));
+  }
+  if (MaybeHit(breakpoint.address)) {
+    return false;
+  }
+  entries_.insert(LowerBound(entries_, breakpoint.address), breakpoint);
+  Mark(breakpoint.address, true);
+  return true;
+}
+
+bool BreakpointSet::Remove(uint64_t address) {
+  if (address % 4!=0 || !MaybeHit(address)) {
+    return false;
+  }
+  auto it = LowerBound(entries_, address);
+  if (it!=entries_.end() && it->address==address) {
+    entries_.erase(it);
+  }
+  Mark(address, false);
+  return true;
+}
+
+void BreakpointSet::Clear() {
+  entries_.clear();
+  std::fill(bitmap_.begin(), bitmap_.end(), 0);
+  outside_text_.Clear();
+}
+
+const Breakpoint *BreakpointSet::Find(uint64_t address) const {
+  if (!MaybeHit(address)) {
+    return nullptr;
+  }
+  auto it = LowerBound(entries_, address);
+  return it!=entries_.end() && it->address==address ? &*it : nullptr;
+}
+
+bool BreakpointSet::Matches(uint64_t address, const RegisterFile &registers, MemoryController &memory) const {
+  const Breakpoint *breakpoint = Find(address);
+  return breakpoint && breakpoint->condition.Evaluate(registers, memory);
+}
+
+bool BreakpointSet::ShouldStop(uint64_t address, const RegisterFile &registers, MemoryController &memory) {
+  if (!MaybeHit(address)) {
+    return false;
+  }
+  auto breakpoint = LowerBound(entries_, address);
+  if (breakpoint==entries_.end() || breakpoint->address!=address
+      || !breakpoint->condition.Evaluate(registers, memory)) {
+    return false;
+  }
+  breakpoint->hit_count++;
+  if (breakpoint->hit_count <= breakpoint->ignore_count) {
+    return false;
+  }
+  if (breakpoint->temporary) {
+    Remove(address);
+  }
+  return true;
+}
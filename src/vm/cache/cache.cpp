@@ -4,3 +4,314 @@
  * @author Vishank Singh, https://github.com/VishankSingh
  */
 #include "vm/cache/cache.h"
+
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+
+namespace cache {
+
+const char *ReplacementPolicyName(ReplacementPolicy policy) {
+  switch (policy) {
+    case ReplacementPolicy::LRU: return "LRU";
+    case ReplacementPolicy::FIFO: return "FIFO";
+    case ReplacementPolicy::Random: return "Random";
+  }
+  return "?";
+}
+
+const char *WriteHitPolicyName(WriteHitPolicy policy) {
+  return policy==WriteHitPolicy::WriteBack ? "write_back" : "write_through";
+}
+
+const char *WriteMissPolicyName(WriteMissPolicy policy) {
+  return policy==WriteMissPolicy::WriteAllocate ? "write_allocate" : "no_write_allocate";
+}
+
+CacheConfig CacheConfig::FromSizes(unsigned long size, unsigned long line_size, unsigned long associativity) {
+  CacheConfig config;
+  config.size = size;
+  config.associativity = associativity;
+  config.words_per_line = line_size / 4;
+  config.lines = line_size ? size / line_size : 0;
+  return config;
+}
+
+std::string CacheConfig::Validate() const {
+  const unsigned long line_size = words_per_line * 4;
+  if (!words_per_line || !std::has_single_bit(line_size)) {
+    return "cache_block_size must be a power of two of at least 4 bytes";
+  }
+  if (!associativity) {
+    return "cache_associativity must be at least 1";
+  }
+  if (!lines || size!=lines * line_size || lines % associativity) {
+    return "cache_size must be a multiple of cache_block_size * cache_associativity";
+  }
+  if (!std::has_single_bit(lines / associativity)) {
+    return "cache_size / (cache_block_size * cache_associativity) sets must be a power of two";
+  }
+  return {};
+}
+
+std::string Cache::Configure(bool enabled, const CacheConfig &config) {
+  config_ = config;
+  enabled_ = false;
+  tags_.clear();
+  states_.clear();
+  stamps_.clear();
+  if (!enabled) {
+    Clear();
+    return {};
+  }
+  if (std::string error = config.Validate(); !error.empty()) {
+    Clear();
+    return error;
+  }
+
+  offset_bits_ = static_cast<unsigned>(std::countr_zero(config.words_per_line * 4));
+  associativity_ = config.associativity;
+  set_mask_ = config.lines / config.associativity - 1;
+  tags_.assign(config.lines, 0);
+  states_.assign(config.lines, CacheLineState::Invalid);
+  stamps_.assign(config.lines, 0);
+  enabled_ = true;
+  Clear();
+  return {};
+}
+
+void Cache::Clear() {
+  std::fill(states_.begin(), states_.end(), CacheLineState::Invalid);
+  std::fill(stamps_.begin(), stamps_.end(), 0);
+  clock_ = 0;
+  random_state_ = 0x9E3779B97F4A7C15ULL; // Fixed, so runs replace the same lines every time
+  stats_ = CacheStats();
+}
+
+void Cache::Access(uint64_t address, uint64_t size, bool write) {
+  if (!enabled_) {
+    return;
+  }
+  const uint64_t first = address >> offset_bits_;
+  const uint64_t last = (address + size - 1) >> offset_bits_;
+  for (uint64_t line = first; line <= last; ++line) {
+    AccessLine(line, write);
+  }
+}
+
+Cache::AccessResult Cache::AccessLine(uint64_t line_address, bool write) {
+  AccessResult result;
+  const size_t base = Base(line_address);
+  stats_.accesses++;
+  clock_++;
+  if (write) {
+    stats_.writes++;
+  } else {
+    stats_.reads++;
+  }
+
+  size_t way = Find(base, line_address);
+  if (way < base + associativity_) {
+    result.hit = true;
+    stats_.hits++;
+    if (config_.replacement_policy==ReplacementPolicy::LRU) {
+      stamps_[way] = clock_;
+    }
+  } else {
+    stats_.misses++;
+    if (write) {
+      stats_.write_misses++;
+      if (config_.write_miss_policy==WriteMissPolicy::NoWriteAllocate) {
+        stats_.write_throughs++;
+        return result;
+      }
+    } else {
+      stats_.read_misses++;
+    }
+    way = Fill(base, line_address, result);
+  }
+
+  if (write) {
+    if (config_.write_hit_policy==WriteHitPolicy::WriteBack) {
+      states_[way] = CacheLineState::Dirty;
+    } else {
+      stats_.write_throughs++;
+    }
+  }
+  return result;
+}
+
+Cache::AccessResult Cache::Insert(uint64_t line_address, bool dirty) {
+  AccessResult result;
+  const size_t base = Base(line_address);
+  clock_++;
+  size_t way = Find(base, line_address);
+  if (way < base + associativity_) {
+    result.hit = true;
+  } else {
+    way = Fill(base, line_address, result);
+  }
+  if (dirty) {
+    states_[way] = CacheLineState::Dirty;
+  }
+  return result;
+}
+
+bool Cache::WriteIfPresent(uint64_t line_address) {
+  const size_t base = Base(line_address);
+  stats_.accesses++;
+  stats_.writes++;
+  clock_++;
+  const size_t way = Find(base, line_address);
+  if (way==base + associativity_) {
+    stats_.misses++;
+    stats_.write_misses++;
+    stats_.write_throughs++;
+    return false;
+  }
+  stats_.hits++;
+  if (config_.replacement_policy==ReplacementPolicy::LRU) {
+    stamps_[way] = clock_;
+  }
+  if (config_.write_hit_policy==WriteHitPolicy::WriteBack) {
+    states_[way] = CacheLineState::Dirty;
+  } else {
+    stats_.write_throughs++;
+  }
+  return true;
+}
+
+CacheLineState Cache::Extract(uint64_t line_address) {
+  const size_t base = Base(line_address);
+  stats_.accesses++;
+  stats_.reads++;
+  const size_t way = Find(base, line_address);
+  if (way==base + associativity_) {
+    stats_.misses++;
+    stats_.read_misses++;
+    return CacheLineState::Invalid;
+  }
+  stats_.hits++;
+  const CacheLineState state = states_[way];
+  states_[way] = CacheLineState::Invalid;
+  return state;
+}
+
+CacheLineState Cache::Invalidate(uint64_t address) {
+  if (!enabled_) {
+    return CacheLineState::Invalid;
+  }
+  const uint64_t line_address = address >> offset_bits_;
+  const size_t base = Base(line_address);
+  const size_t way = Find(base, line_address);
+  if (way==base + associativity_) {
+    return CacheLineState::Invalid;
+  }
+  const CacheLineState state = states_[way];
+  states_[way] = CacheLineState::Invalid;
+  return state;
+}
+
+size_t Cache::Find(size_t base, uint64_t line_address) const {
+  size_t way = base;
+  const size_t end = base + associativity_;
+  while (way < end && (tags_[way]!=line_address || states_[way]==CacheLineState::Invalid)) {
+    ++way;
+  }
+  return way;
+}
+
+size_t Cache::Fill(size_t base, uint64_t line_address, AccessResult &result) {
+  const size_t way = Victim(base);
+  result.filled = true;
+  if (states_[way]!=CacheLineState::Invalid) {
+    stats_.evictions++;
+    result.evicted = true;
+    result.victim = tags_[way];
+    if (states_[way]==CacheLineState::Dirty) {
+      stats_.writebacks++;
+      result.writeback = true;
+    }
+  }
+  tags_[way] = line_address;
+  states_[way] = CacheLineState::Valid;
+  stamps_[way] = clock_;
+  return way;
+}
+
+size_t Cache::Victim(size_t base) {
+  const size_t end = base + associativity_;
+  for (size_t way = base; way < end; ++way) {
+    if (states_[way]==CacheLineState::Invalid) {
+      return way;
+    }
+  }
+  if (config_.replacement_policy==ReplacementPolicy::Random) {
+    // xorshift64
+    random_state_ ^= random_state_ << 13;
+    random_state_ ^= random_state_ >> 7;
+    random_state_ ^= random_state_ << 17;
+    return base + static_cast<size_t>(random_state_ % associativity_);
+  }
+  // LRU and FIFO both evict the oldest stamp; only LRU refreshes it on hits
+  return static_cast<size_t>(std::min_element(stamps_.begin() + static_cast<std::ptrdiff_t>(base),
+                                              stamps_.begin() + static_cast<std::ptrdiff_t>(end)) - stamps_.begin());
+}
+
+bool Cache::Contains(uint64_t address) const {
+  if (!enabled_) {
+    return false;
+  }
+  const uint64_t line_address = address >> offset_bits_;
+  const size_t base = Base(line_address);
+  return Find(base, line_address) < base + associativity_;
+}
+
+void Cache::WriteJson(std::ostream &os, const std::string &indent) const {
+  const unsigned set_bits = static_cast<unsigned>(std::popcount(set_mask_));
+  os << "{\n";
+  os << indent << "  \"enabled\": " << (enabled_ ? "true" : "false") << ",\n";
+  os << indent << "  \"config\": {\"size\": " << config_.size << ", \"line_size\": " << config_.words_per_line * 4
+     << ", \"associativity\": " << config_.associativity << ", \"lines\": " << config_.lines
+     << ", \"sets\": " << (enabled_ ? set_mask_ + 1 : 0)
+     << ", \"replacement_policy\": \"" << ReplacementPolicyName(config_.replacement_policy)
+     << "\", \"write_hit_policy\": \"" << WriteHitPolicyName(config_.write_hit_policy)
+     << "\", \"write_miss_policy\": \"" << WriteMissPolicyName(config_.write_miss_policy) << "\"},\n";
+  os << indent << "  \"stats\": {\"accesses\": " << stats_.accesses << ", \"hits\": " << stats_.hits
+     << ", \"misses\": " << stats_.misses << ", \"reads\": " << stats_.reads << ", \"writes\": " << stats_.writes
+     << ", \"read_misses\": " << stats_.read_misses << ", \"write_misses\": " << stats_.write_misses
+     << ", \"evictions\": " << stats_.evictions << ", \"writebacks\": " << stats_.writebacks
+     << ", \"write_throughs\": " << stats_.write_throughs
+     << ", \"hit_rate\": " << std::fixed << std::setprecision(6) << stats_.HitRate() << std::defaultfloat << "},\n";
+  os << indent << "  \"lines\": [";
+  bool first = true;
+  for (size_t i = 0; i < states_.size(); ++i) {
+    if (states_[i]==CacheLineState::Invalid) {
+      continue;
+    }
+    os << (first ? "\n" : ",\n");
+    os << indent << "    {\"set\": " << i / associativity_ << ", \"way\": " << i % associativity_
+       << ", \"tag\": \"0x" << std::hex << (tags_[i] >> set_bits)
+       << "\", \"address\": \"0x" << std::setw(8) << std::setfill('0') << (tags_[i] << offset_bits_)
+       << std::dec << std::setfill(' ') << "\", \"dirty\": "
+       << (states_[i]==CacheLineState::Dirty ? "true" : "false") << "}";
+    first = false;
+  }
+  os << (first ? "]\n" : "\n" + indent + "  ]\n");
+  os << indent << "}";
+}
+
+void Cache::PrintStatus(std::ostream &os, const std::string &name) const {
+  if (!enabled_) {
+    os << name << ": disabled\n";
+    return;
+  }
+  os << name << ": " << config_.size << " B, " << config_.words_per_line * 4 << " B lines, "
+     << config_.associativity << "-way, " << ReplacementPolicyName(config_.replacement_policy) << ", "
+     << WriteHitPolicyName(config_.write_hit_policy) << ", " << WriteMissPolicyName(config_.write_miss_policy) << "\n";
+  os << "  " << stats_.accesses << " accesses, " << stats_.hits << " hits, " << stats_.misses << " misses ("
+     << std::fixed << std::setprecision(2) << 100.0 * stats_.HitRate() << std::defaultfloat << " % hits), "
+     << stats_.writebacks << " writebacks, " << stats_.write_throughs << " write-throughs\n";
+}
+
+} // namespace cache
@@ -0,0 +1,374 @@
+/**
+ * @file cache_hierarchy.cpp
+ * @brief Contains the implementation of the CacheHierarchy class.
+ */
+#include "vm/cache/cache_hierarchy.h"
+
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+
+namespace cache {
+
+namespace {
+
+constexpr size_t kL1I = static_cast<size_t>(Level::L1I);
+constexpr size_t kL1D = static_cast<size_t>(Level::L1D);
+constexpr size_t kL2 = static_cast<size_t>(Level::L2);
+
+} // namespace
+
+const char *LevelName(Level level) {
+  switch (level) {
+    case Level::L1I: return "L1I";
+    case Level::L1D: return "L1D";
+    case Level::L2: return "L2";
+    case Level::L3: return "L3";
+  }
+  return "?";
+}
+
+const char *InclusionName(Inclusion inclusion) {
+  return inclusion==Inclusion::Inclusive ? "inclusive" : "exclusive";
+}
+
+std::string HierarchyConfig::Validate() const {
+  if (!levels[kL1D].Present()) {
+    return "the L1 data cache (cache_size) must be set";
+  }
+  const unsigned long l1d_line = levels[kL1D].cache.words_per_line * 4;
+  unsigned long above_line = 0; // Largest line of the present levels above
+  for (size_t i = 0; i < kLevels; ++i) {
+    const LevelConfig &level = levels[i];
+    if (!level.Present()) {
+      continue;
+    }
+    const std::string name = LevelName(static_cast<Level>(i));
+    if (std::string error = level.cache.Validate(); !error.empty()) {
+      return name + ": " + error;
+    }
+    const unsigned long line = level.cache.words_per_line * 4;
+    if (inclusion==Inclusion::Exclusive && line!=l1d_line) {
+      return name + ": every level of an exclusive hierarchy needs the same line size";
+    }
+    if (i >= kL2 && line < above_line) {
+      return name + ": an inclusive level needs lines at least as large as the levels above it";
+    }
+    above_line = std::max(above_line, line);
+  }
+  return {};
+}
+
+std::string CacheHierarchy::Configure(bool enabled, const HierarchyConfig &config) {
+  config_ = config;
+  enabled_ = false;
+  for (Cache &cache : caches_) {
+    cache.Configure(false, CacheConfig());
+  }
+  stats_ = HierarchyStats();
+  prefetcher_ = config.prefetcher;
+  prefetching_ = false;
+  prefetched_.clear();
+  clock_ = 0;
+  fetch_pc_ = 0;
+  if (!enabled) {
+    return {};
+  }
+  if (std::string error = config.Validate(); !error.empty()) {
+    return error;
+  }
+
+  for (size_t i = 0; i < kLevels; ++i) {
+    if (!config_.levels[i].Present()) {
+      continue;
+    }
+    CacheConfig &cache_config = config_.levels[i].cache;
+    cache_config.cache_type = i==kL1I ? CacheType::Instruction : CacheType::Data;
+    if (i >= kL2) {
+      // Shared levels only ever see whole lines from the level above
+      cache_config.write_hit_policy = WriteHitPolicy::WriteBack;
+      cache_config.write_miss_policy = WriteMissPolicy::WriteAllocate;
+    }
+    caches_[i].Configure(true, cache_config);
+  }
+  enabled_ = true;
+  prefetching_ = !std::holds_alternative<NoPrefetcher>(prefetcher_);
+  return {};
+}
+
+void CacheHierarchy::Clear() {
+  for (Cache &cache : caches_) {
+    cache.Clear();
+  }
+  stats_ = HierarchyStats();
+  prefetcher_ = config_.prefetcher;
+  prefetched_.clear();
+  clock_ = 0;
+}
+
+uint64_t CacheHierarchy::Fetch(uint64_t address) {
+  if (trace_) {
+    trace_->Record(address, 4, Stream::Instruction);
+  }
+  fetch_pc_ = address;
+  clock_++;
+  if (!enabled_ || !caches_[kL1I].Enabled()) {
+    return 0;
+  }
+  const uint64_t cycles = AccessL1(kL1I, address, 4, false);
+  stats_.fetches++;
+  stats_.fetch_cycles += cycles;
+  stats_.stall_cycles += cycles > 1 ? cycles - 1 : 0;
+  clock_ += cycles > 1 ? cycles - 1 : 0;
+  return cycles;
+}
+
+uint64_t CacheHierarchy::Data(uint64_t address, uint64_t size, bool write) {
+  if (trace_) {
+    trace_->Record(address, size, Stream::Data);
+  }
+  if (!enabled_) {
+    return 0;
+  }
+  const uint64_t cycles = AccessL1(kL1D, address, size, write);
+  stats_.data_accesses++;
+  stats_.data_cycles += cycles;
+  stats_.stall_cycles += cycles > 1 ? cycles - 1 : 0;
+  clock_ += cycles > 1 ? cycles - 1 : 0;
+  return cycles;
+}
+
+uint64_t CacheHierarchy::AccessL1(size_t level, uint64_t address, uint64_t size, bool write) {
+  Cache &cache = caches_[level];
+  const uint64_t line_size = cache.LineSize();
+  const bool write_through = cache.Config().write_hit_policy==WriteHitPolicy::WriteThrough;
+  uint64_t cycles = 0;
+  for (uint64_t line = address / line_size; line <= (address + size - 1) / line_size; ++line) {
+    const Cache::AccessResult result = cache.AccessLine(line, write);
+    cycles += config_.levels[level].latency;
+    if (result.filled) {
+      cycles += Fill(Next(level), line * line_size, level);
+    }
+    if (write && (write_through || (!result.hit && !result.filled))) {
+      if (config_.inclusion==Inclusion::Inclusive) {
+        WriteTo(Next(level), line * line_size);
+      } else if (result.hit || result.filled) {
+        // The line is in L1, so no exclusive level below holds it
+        WriteTo(kLevels, line * line_size);
+      } else {
+        WriteAround(level, line * line_size);
+      }
+    }
+    Evicted(level, result);
+    if (prefetching_ && level==kL1D) [[unlikely]] {
+      cycles += Prefetch(std::max(address, line * line_size), line, result);
+    }
+  }
+  return cycles;
+}
+
+uint64_t CacheHierarchy::Prefetch(uint64_t address, uint64_t line, const Cache::AccessResult &result) {
+  uint64_t wait = 0;
+  bool prefetch_hit = false;
+  if (result.hit) {
+    if (auto it = prefetched_.find(line); it!=prefetched_.end()) {
+      prefetch_hit = true;
+      stats_.prefetch.useful++;
+      if (it->second > clock_) {
+        stats_.prefetch.late++;
+        wait = it->second - clock_;
+      }
+      prefetched_.erase(it);
+    }
+  }
+  const PrefetchTrigger trigger{fetch_pc_, address, line, !result.hit, prefetch_hit};
+  const unsigned offset_bits = static_cast<unsigned>(std::countr_zero(caches_[kL1D].LineSize()));
+  // A prefetch triggered by a late line can only start once that line is in
+  const uint64_t now = clock_ + wait;
+  std::visit([&](auto &prefetcher) {
+    prefetcher.Observe(trigger, offset_bits, [this, now](uint64_t target) { Issue(target, now); });
+  }, prefetcher_);
+  return wait;
+}
+
+void CacheHierarchy::Issue(uint64_t line, uint64_t now) {
+  Cache &l1d = caches_[kL1D];
+  const uint64_t address = line * l1d.LineSize();
+  if (l1d.Contains(address)) {
+    stats_.prefetch.redundant++;
+    return;
+  }
+  const Cache::AccessResult result = l1d.Insert(line, false);
+  stats_.prefetch.issued++;
+  prefetched_[line] = now + config_.levels[kL1D].latency + Fill(Next(kL1D), address, kL1D);
+  Evicted(kL1D, result);
+}
+
+uint64_t CacheHierarchy::Fill(size_t level, uint64_t address, size_t l1) {
+  if (level==kLevels) {
+    stats_.memory_reads++;
+    return config_.memory_latency;
+  }
+  Cache &cache = caches_[level];
+  const uint64_t latency = config_.levels[level].latency;
+  const uint64_t line = address / cache.LineSize();
+
+  if (config_.inclusion==Inclusion::Exclusive) {
+    const CacheLineState state = cache.Extract(line);
+    if (state==CacheLineState::Invalid) {
+      return latency + Fill(Next(level), address, l1);
+    }
+    if (state==CacheLineState::Dirty) {
+      // The line moves up dirty; an L1 that cannot hold dirty lines writes it out instead
+      Cache &upper = caches_[l1];
+      if (l1==kL1D && upper.Config().write_hit_policy==WriteHitPolicy::WriteBack) {
+        upper.Insert(address / upper.LineSize(), true);
+      } else {
+        stats_.memory_writes++;
+      }
+    }
+    return latency;
+  }
+
+  const Cache::AccessResult result = cache.AccessLine(line, false);
+  const uint64_t cycles = latency + (result.hit ? 0 : Fill(Next(level), address, l1));
+  Evicted(level, result);
+  return cycles;
+}
+
+void CacheHierarchy::WriteTo(size_t level, uint64_t address) {
+  if (level==kLevels) {
+    stats_.memory_writes++;
+    return;
+  }
+  Cache &cache = caches_[level];
+  Evicted(level, cache.AccessLine(address / cache.LineSize(), true));
+}
+
+void CacheHierarchy::WriteAround(size_t level, uint64_t address) {
+  for (size_t below = Next(level); below < kLevels; below = Next(below)) {
+    Cache &cache = caches_[below];
+    if (cache.WriteIfPresent(address / cache.LineSize())) {
+      return;
+    }
+  }
+  stats_.memory_writes++;
+}
+
+void CacheHierarchy::Evicted(size_t level, const Cache::AccessResult &result) {
+  if (!result.evicted) {
+    return;
+  }
+  const uint64_t line_size = caches_[level].LineSize();
+  const uint64_t address = result.victim * line_size;
+  const size_t next = Next(level);
+  if (level==kL1D && prefetched_.erase(result.victim)) {
+    stats_.prefetch.useless++;
+  }
+
+  if (config_.inclusion==Inclusion::Exclusive) {
+    if (next==kLevels) {
+      stats_.memory_writes += result.writeback ? 1 : 0;
+      return;
+    }
+    Cache &below = caches_[next];
+    Evicted(next, below.Insert(address / below.LineSize(), result.writeback));
+    return;
+  }
+
+  bool dirty = result.writeback;
+  if (level >= kL2) {
+    // Keep the levels above inclusive; a dirty copy there is newer than this one
+    for (size_t above = 0; above < level; ++above) {
+      Cache &upper = caches_[above];
+      if (!upper.Enabled()) {
+        continue;
+      }
+      for (uint64_t a = address; a < address + line_size; a += upper.LineSize()) {
+        const CacheLineState state = upper.Invalidate(a);
+        if (state!=CacheLineState::Invalid) {
+          stats_.back_invalidations++;
+          dirty = dirty || state==CacheLineState::Dirty;
+          if (above==kL1D && prefetched_.erase(a / upper.LineSize())) {
+            stats_.prefetch.useless++;
+          }
+        }
+      }
+    }
+  }
+  if (dirty) {
+    WriteTo(next, address);
+  }
+}
+
+size_t CacheHierarchy::Next(size_t level) const {
+  for (size_t i = std::max(level + 1, kL2); i < kLevels; ++i) {
+    if (caches_[i].Enabled()) {
+      return i;
+    }
+  }
+  return kLevels;
+}
+
+void CacheHierarchy::WriteJson(std::ostream &os) const {
+  os << "{\n";
+  os << "  \"enabled\": " << (enabled_ ? "true" : "false") << ",\n";
+  os << "  \"inclusion\": \"" << InclusionName(config_.inclusion) << "\",\n";
+  os << "  \"memory_latency\": " << config_.memory_latency << ",\n";
+  os << "  \"prefetcher\": \"" << PrefetcherName() << "\",\n";
+  os << "  \"stats\": {\"fetches\": " << stats_.fetches << ", \"fetch_cycles\": " << stats_.fetch_cycles
+     << ", \"data_accesses\": " << stats_.data_accesses << ", \"data_cycles\": " << stats_.data_cycles
+     << ", \"stall_cycles\": " << stats_.stall_cycles << ", \"memory_reads\": " << stats_.memory_reads
+     << ", \"memory_writes\": " << stats_.memory_writes << ", \"back_invalidations\": " << stats_.back_invalidations
+     << std::fixed << std::setprecision(6) << ", \"fetch_amat\": " << stats_.FetchAmat()
+     << ", \"data_amat\": " << stats_.DataAmat() << ", \"amat\": " << stats_.Amat() << std::defaultfloat << "},\n";
+  const PrefetchStats &prefetch = stats_.prefetch;
+  os << "  \"prefetch\": {\"issued\": " << prefetch.issued << ", \"redundant\": " << prefetch.redundant
+     << ", \"useful\": " << prefetch.useful << ", \"late\": " << prefetch.late << ", \"useless\": " << prefetch.useless
+     << std::fixed << std::setprecision(6) << ", \"accuracy\": " << prefetch.Accuracy()
+     << ", \"coverage\": " << prefetch.Coverage(caches_[kL1D].Stats().misses)
+     << ", \"timeliness\": " << prefetch.Timeliness() << std::defaultfloat << "},\n";
+  os << "  \"levels\": [";
+  bool first = true;
+  for (size_t i = 0; i < kLevels; ++i) {
+    if (!caches_[i].Enabled()) {
+      continue;
+    }
+    os << (first ? "\n" : ",\n");
+    os << "    {\"name\": \"" << LevelName(static_cast<Level>(i)) << "\", \"latency\": " << config_.levels[i].latency
+       << ", \"cache\": ";
+    caches_[i].WriteJson(os, "    ");
+    os << "}";
+    first = false;
+  }
+  os << (first ? "]\n" : "\n  ]\n");
+  os << "}\n";
+}
+
+void CacheHierarchy::PrintStatus(std::ostream &os) const {
+  if (!enabled_) {
+    os << "Caches: disabled\n";
+    return;
+  }
+  os << "Caches: " << InclusionName(config_.inclusion) << ", memory latency " << config_.memory_latency << "\n";
+  for (size_t i = 0; i < kLevels; ++i) {
+    if (caches_[i].Enabled()) {
+      const uint64_t latency = config_.levels[i].latency;
+      caches_[i].PrintStatus(os, std::string(LevelName(static_cast<Level>(i))) + " (" + std::to_string(latency)
+          + (latency==1 ? " cycle)" : " cycles)"));
+    }
+  }
+  os << "  AMAT " << std::fixed << std::setprecision(2) << stats_.Amat() << " cycles (fetch " << stats_.FetchAmat()
+     << ", data " << stats_.DataAmat() << ")" << std::defaultfloat << ", " << stats_.stall_cycles << " stall cycles, "
+     << stats_.memory_reads << " memory reads, " << stats_.memory_writes << " memory writes\n";
+  if (prefetching_) {
+    const PrefetchStats &prefetch = stats_.prefetch;
+    os << "  Prefetch (" << PrefetcherName() << "): " << prefetch.issued << " issued, " << prefetch.useful
+       << " useful, " << prefetch.late << " late, " << prefetch.useless << " useless; " << std::fixed
+       << std::setprecision(2) << 100.0 * prefetch.Accuracy() << " % accuracy, "
+       << 100.0 * prefetch.Coverage(caches_[kL1D].Stats().misses) << " % coverage, "
+       << 100.0 * prefetch.Timeliness() << " % timely" << std::defaultfloat << "\n";
+  }
+}
+
+} // namespace cache
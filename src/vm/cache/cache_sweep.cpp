@@ -0,0 +1,233 @@
+/**
+ * @file cache_sweep.cpp
+ * @brief Contains the implementation of the single-pass cache sweep.
+ */
+#include "vm/cache/cache_sweep.h"
+
+#include "assembler/assembler.h"
+#include "campaign/work_stealing_pool.h"
+#include "config.h"
+#include "vm/rvss/rvss_vm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+namespace cache {
+
+namespace {
+
+// Fenwick tree over tree[0, length): one per set, laid out back to back in a single array
+void FenwickAdd(uint32_t *tree, size_t length, size_t index, uint32_t delta) {
+  for (size_t i = index + 1; i <= length; i += i & (~i + 1)) {
+    tree[i - 1] += delta;
+  }
+}
+
+uint32_t FenwickPrefix(const uint32_t *tree, size_t end) {
+  uint32_t sum = 0;
+  for (size_t i = end; i > 0; i -= i & (~i + 1)) {
+    sum += tree[i - 1];
+  }
+  return sum;
+}
+
+SetFamily ComputeFamily(const std::vector<uint64_t> &entries, const std::array<uint64_t, kStreams> &repeats,
+                        uint64_t sets, uint64_t max_ways) {
+  SetFamily family;
+  family.sets = sets;
+  for (size_t stream = 0; stream < kStreams; ++stream) {
+    family.distances[stream].assign(max_ways + 1, 0);
+    family.distances[stream][0] = repeats[stream];
+  }
+
+  // Both streams get their own sets (split caches): set index << 1 | stream
+  const uint64_t mask = sets - 1;
+  auto set_of = [mask](uint64_t entry) {
+    return static_cast<size_t>(((entry >> 1) & mask) << 1 | (entry & 1));
+  };
+  std::vector<uint32_t> begin(2 * sets + 1, 0);
+  for (uint64_t entry : entries) {
+    begin[set_of(entry) + 1]++;
+  }
+  for (size_t set = 0; set < 2 * sets; ++set) {
+    begin[set + 1] += begin[set];
+  }
+
+  // A 1 at the latest position of every line in its set: the ones after a line's previous use
+  // count the distinct lines used since
+  std::vector<uint32_t> tree(entries.size(), 0);
+  std::vector<uint32_t> next(2 * sets, 0);
+  std::unordered_map<uint64_t, uint32_t> last_use;
+  last_use.reserve(entries.size() / 4);
+  for (uint64_t entry : entries) {
+    const size_t set = set_of(entry);
+    uint32_t *set_tree = tree.data() + begin[set];
+    const size_t length = begin[set + 1] - begin[set];
+    const uint32_t position = next[set]++;
+    std::vector<uint64_t> &distances = family.distances[entry & 1];
+
+    auto [it, first_use] = last_use.try_emplace(entry, position);
+    if (first_use) {
+      distances[max_ways]++;
+    } else {
+      const uint32_t previous = it->second;
+      const uint64_t distance = FenwickPrefix(set_tree, position) - FenwickPrefix(set_tree, previous + 1);
+      distances[std::min(distance, max_ways)]++;
+      FenwickAdd(set_tree, length, previous, std::numeric_limits<uint32_t>::max()); // -1
+      it->second = position;
+    }
+    FenwickAdd(set_tree, length, position, 1);
+  }
+  return family;
+}
+
+} // namespace
+
+const char *StreamName(Stream stream) {
+  return stream==Stream::Data ? "data" : "instruction";
+}
+
+std::string SweepConfig::Validate() const {
+  for (uint64_t value : {line_size, min_size, max_size, max_associativity}) {
+    if (!std::has_single_bit(value)) {
+      return "line_size, min_size, max_size and max_associativity must be powers of two";
+    }
+  }
+  if (line_size < 4 || line_size > min_size || min_size > max_size) {
+    return "the sizes need 4 <= line_size <= min_size <= max_size";
+  }
+  return {};
+}
+
+uint64_t SetFamily::Hits(Stream stream, uint64_t ways) const {
+  const std::vector<uint64_t> &counts = distances[static_cast<size_t>(stream)];
+  uint64_t hits = 0;
+  for (uint64_t d = 0; d < ways && d + 1 < counts.size(); ++d) {
+    hits += counts[d];
+  }
+  return hits;
+}
+
+double SweepResult::HitRate(Stream stream, uint64_t size, uint64_t ways) const {
+  if (!ways || size < config.line_size * ways) {
+    return -1.0;
+  }
+  const uint64_t sets = size / (config.line_size * ways);
+  const size_t index = static_cast<size_t>(std::countr_zero(sets));
+  if (!std::has_single_bit(sets) || index >= families.size()) {
+    return -1.0;
+  }
+  const uint64_t accesses_of_stream = accesses[static_cast<size_t>(stream)];
+  return accesses_of_stream
+      ? static_cast<double>(families[index].Hits(stream, ways)) / static_cast<double>(accesses_of_stream) : 0.0;
+}
+
+void SweepResult::WriteCsv(std::ostream &os) const {
+  os << "stream,size,accesses";
+  for (uint64_t ways = 1; ways <= config.max_associativity; ways *= 2) {
+    os << "," << ways << "_way";
+  }
+  os << ",fully_associative\n";
+  os << std::fixed << std::setprecision(6);
+  for (Stream stream : {Stream::Instruction, Stream::Data}) {
+    for (uint64_t size = config.min_size; size <= config.max_size; size *= 2) {
+      os << StreamName(stream) << "," << size << "," << accesses[static_cast<size_t>(stream)];
+      for (uint64_t ways = 1; ways <= config.max_associativity; ways *= 2) {
+        os << ",";
+        if (double rate = HitRate(stream, size, ways); rate >= 0) {
+          os << rate;
+        }
+      }
+      os << "," << HitRate(stream, size, size / config.line_size) << "\n";
+    }
+  }
+  os << std::defaultfloat;
+}
+
+SweepResult Sweep(const AccessTrace &trace, const SweepConfig &config) {
+  if (std::string error = config.Validate(); !error.empty()) {
+    throw std::runtime_error("Invalid cache sweep: " + error);
+  }
+  if (trace.LineSize()!=config.line_size) {
+    throw std::runtime_error("Cache sweep: the trace was recorded with another line size");
+  }
+  SweepResult result;
+  result.config = config;
+
+  // Using the line a stream used last is a hit at distance 0 whatever the geometry, and changes
+  // no LRU order, so only the other accesses need a pass per set count
+  std::vector<uint64_t> entries;
+  std::array<uint64_t, kStreams> repeats{};
+  std::array<uint64_t, kStreams> previous{~uint64_t{0}, ~uint64_t{0}};
+  for (uint64_t entry : trace.Entries()) {
+    result.accesses[entry & 1]++;
+    if (entry==previous[entry & 1]) {
+      repeats[entry & 1]++;
+    } else {
+      previous[entry & 1] = entry;
+      entries.push_back(entry);
+    }
+  }
+  if (entries.size() > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("Cache sweep: trace too long");
+  }
+
+  // Direct mapped at the largest size needs the most sets; fully associative needs one
+  const uint64_t max_lines = config.max_size / config.line_size;
+  result.families.resize(static_cast<size_t>(std::countr_zero(max_lines)) + 1);
+  campaign::WorkStealingPool pool(std::min(config.threads ? config.threads : std::thread::hardware_concurrency(),
+                                           result.families.size()));
+  pool.ForEach(result.families.size(), [&](size_t, size_t index) {
+    const uint64_t sets = uint64_t{1} << index;
+    result.families[index] = ComputeFamily(entries, repeats, sets, max_lines / sets);
+  });
+  return result;
+}
+
+int RunCacheSweep(const std::filesystem::path &program_path) {
+  try {
+    const SweepConfig config = vm_config::config.getCacheSweepConfig();
+    if (std::string error = config.Validate(); !error.empty()) {
+      throw std::runtime_error("Invalid cache sweep: " + error);
+    }
+
+    AssembledProgram program = assemble(program_path.string());
+    AccessTrace trace(config.line_size);
+    RVSSVM vm;
+    vm.LoadProgram(program, false);
+    vm.memory_controller_.SetAccessTrace(&trace);
+    vm.Run();
+    vm.memory_controller_.SetAccessTrace(nullptr);
+
+    auto start = std::chrono::steady_clock::now();
+    SweepResult result = Sweep(trace, config);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::filesystem::path output = program_path;
+    output.replace_extension(".cache_sweep.csv");
+    std::ofstream file(output);
+    if (!file.is_open()) {
+      throw std::runtime_error("Could not write cache sweep results: " + output.string());
+    }
+    result.WriteCsv(file);
+
+    std::cout << "Cache sweep: " << result.accesses[static_cast<size_t>(Stream::Instruction)] << " fetches and "
+              << result.accesses[static_cast<size_t>(Stream::Data)] << " data accesses of "
+              << program_path.string() << ", " << result.families.size() << " set counts in " << std::fixed
+              << std::setprecision(2) << elapsed.count() << " s\n";
+    std::cout << "Results written to " << output.string() << std::endl;
+    return 0;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+}
+
+} // namespace cache
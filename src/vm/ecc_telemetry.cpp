@@ -0,0 +1,135 @@
+/**
+ * @file ecc_telemetry.cpp
+ * @brief Contains the implementation of the EccTelemetry class.
+ */
+
+#include "vm/ecc_telemetry.h"
+
+#include <iomanip>
+
+namespace {
+
+constexpr std::array<const char *, EccTelemetry::kClasses> kClassNames = {"temp", "data", "pointer", "critical"};
+constexpr std::array<const char *, EccTelemetry::kResults> kResultNames = {"skipped", "clean", "corrected", "uncorrectable"};
+
+} // namespace
+
+uint64_t EccTelemetry::Snapshot::Total(ecc::CheckResult result) const {
+  uint64_t total = 0;
+  for (const auto &by_result : results) {
+    total += by_result[static_cast<size_t>(result)];
+  }
+  return total;
+}
+
+uint64_t EccTelemetry::Snapshot::Checks() const {
+  uint64_t total = 0;
+  for (size_t result = 0; result < kResults; ++result) {
+    total += Total(static_cast<ecc::CheckResult>(result));
+  }
+  return total;
+}
+
+void EccTelemetry::Snapshot::WriteJson(std::ostream &os) const {
+  os << "{\n";
+  os << "  \"policy\": \"" << policy << "\",\n";
+  os << "  \"checks\": " << Checks() << ",\n";
+  os << "  \"by_significance\": {\n";
+  for (size_t c = 0; c < kClasses; ++c) {
+    os << "    \"" << kClassNames[c] << "\": {";
+    for (size_t r = 0; r < kResults; ++r) {
+      os << "\"" << kResultNames[r] << "\": " << results[c][r] << (r + 1 < kResults ? ", " : "");
+    }
+    os << "}" << (c + 1 < kClasses ? "," : "") << "\n";
+  }
+  os << "  },\n";
+  os << "  \"freq_bucket_width\": " << (1u << kFreqBucketShift) << ",\n";
+  os << "  \"freq_histogram\": [";
+  for (size_t b = 0; b < kFreqBuckets; ++b) {
+    os << freq[b] << (b + 1 < kFreqBuckets ? ", " : "");
+  }
+  os << "],\n";
+  os << "  \"errors_by_pc\": [";
+  bool first = true;
+  for (const auto &[pc, errors] : errors_by_pc) {
+    os << (first ? "\n" : ",\n");
+    os << "    {\"pc\": \"0x" << std::hex << std::setw(8) << std::setfill('0') << pc << std::dec << std::setfill(' ')
+       << "\", \"corrected\": " << errors[0] << ", \"uncorrectable\": " << errors[1] << "}";
+    first = false;
+  }
+  os << (first ? "],\n" : "\n  ],\n");
+  os << "  \"memory\": {\"ecc\": " << (memory_ecc ? "true" : "false")
+     << ", \"corrected\": " << memory.corrected << ", \"uncorrectable\": " << memory.uncorrectable
+     << ", \"injected\": " << memory.injected
+     << ", \"scrubber\": {\"running\": " << (scrubbing ? "true" : "false") << ", \"passes\": " << scrub.passes
+     << ", \"words_scrubbed\": " << scrub.words_scrubbed << ", \"corrected\": " << scrub.corrected
+     << ", \"uncorrectable\": " << scrub.uncorrectable << "}}\n";
+  os << "}\n";
+}
+
+void EccTelemetry::Snapshot::PrintSummary(std::ostream &os) const {
+  if (memory_ecc) {
+    os << "Memory ECC: " << memory.corrected << " corrected, " << memory.uncorrectable << " uncorrectable, "
+       << memory.injected << " bits injected\n";
+    if (scrubbing || scrub.words_scrubbed) {
+      os << "  scrubber " << scrub.words_scrubbed << " words in " << scrub.passes << " passes, "
+         << scrub.corrected << " corrected, " << scrub.uncorrectable << " uncorrectable\n";
+    }
+  }
+  if (!Checks()) {
+    return;
+  }
+  os << "Register ECC (" << policy << "): " << Checks() << " values, "
+     << Total(ecc::CheckResult::kSkipped) << " skipped, "
+     << Total(ecc::CheckResult::kClean) << " clean, "
+     << Total(ecc::CheckResult::kCorrected) << " corrected, "
+     << Total(ecc::CheckResult::kUncorrectable) << " uncorrectable\n";
+  for (size_t c = 0; c < kClasses; ++c) {
+    uint64_t values = 0;
+    for (uint64_t count : results[c]) {
+      values += count;
+    }
+    if (!values) {
+      continue;
+    }
+    os << "  " << std::left << std::setw(9) << kClassNames[c] << std::right;
+    for (size_t r = 0; r < kResults; ++r) {
+      os << " " << kResultNames[r] << " " << results[c][r];
+    }
+    os << "\n";
+  }
+}
+
+void EccTelemetry::Clear() {
+  for (auto &by_result : results_) {
+    for (auto &count : by_result) {
+      count.store(0, std::memory_order_relaxed);
+    }
+  }
+  for (auto &count : freq_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  std::lock_guard<std::mutex> lock(errors_mutex_);
+  errors_by_pc_.clear();
+}
+
+EccTelemetry::Snapshot EccTelemetry::Take(const char *policy) const {
+  Snapshot snapshot;
+  snapshot.policy = policy;
+  for (size_t c = 0; c < kClasses; ++c) {
+    for (size_t r = 0; r < kResults; ++r) {
+      snapshot.results[c][r] = results_[c][r].load(std::memory_order_relaxed);
+    }
+  }
+  for (size_t b = 0; b < kFreqBuckets; ++b) {
+    snapshot.freq[b] = freq_[b].load(std::memory_order_relaxed);
+  }
+  std::lock_guard<std::mutex> lock(errors_mutex_);
+  snapshot.errors_by_pc.insert(errors_by_pc_.begin(), errors_by_pc_.end());
+  return snapshot;
+}
+
+void EccTelemetry::RecordError(ecc::CheckResult result, uint64_t pc) {
+  std::lock_guard<std::mutex> lock(errors_mutex_);
+  errors_by_pc_[pc][result==ecc::CheckResult::kCorrected ? 0 : 1]++;
+}
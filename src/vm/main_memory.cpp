@@ -6,7 +6,9 @@
 
 #include "vm/main_memory.h"
 #include "globals.h"
+#include "ecc/ecc_utils.h"
 
+#include <bit>
 #include <cstdint>
 #include <stdexcept>
 #include <cstring>
@@ -17,49 +19,427 @@
 #include <iomanip>
 #include <algorithm>
 #include <sstream>
+#include <new>
+#include <optional>
+#include <thread>
+
+void Memory::Reset() {
+  arena_chunks_.clear();
+  arena_used_ = kArenaChunkSize;
+  root_ = nullptr;
+  resident_pages_.clear();
+  newest_page_.store(nullptr, std::memory_order_relaxed);
+  last_page_ = nullptr;
+  epoch_ = 0;
+  preserved_ = PreservedPages();
+  ecc_enabled_ = vm_config::config.getMemoryEcc();
+  ecc_stats_ = EccStats();
+  reported_.clear();
+}
+
+void Memory::Preserve(uint64_t page_number, Page *page) {
+  page->epoch = epoch_;
+  preserved_.page_numbers.push_back(page_number);
+  preserved_.bytes.insert(preserved_.bytes.end(), page->bytes.begin(), page->bytes.end());
+}
+
+Memory::PreservedPages Memory::BeginEpoch() {
+  epoch_++;
+  return std::exchange(preserved_, PreservedPages());
+}
+
+void Memory::MergeEpoch(PreservedPages &&earlier) {
+  earlier.page_numbers.insert(earlier.page_numbers.end(),
+                              preserved_.page_numbers.begin(), preserved_.page_numbers.end());
+  earlier.bytes.insert(earlier.bytes.end(), preserved_.bytes.begin(), preserved_.bytes.end());
+  preserved_ = std::move(earlier);
+}
+
+void Memory::RestorePages(const PreservedPages &pages) {
+  // A page can appear more than once after MergeEpoch(); the earliest copy must win
+  for (size_t i = pages.size(); i-- > 0;) {
+    Page *page = FindPage(pages.page_numbers[i] << kPageBits, true);
+    if (ecc_enabled_) {
+      PageLock lock(page);
+      StoreBytes(page, 0, pages.bytes.data() + i * kPageSize, kPageSize);
+      EncodeWords(page, 0, kPageSize);
+      ForgetReported(page, 0, kPageSize);
+      continue;
+    }
+    std::memcpy(page->bytes.data(), pages.bytes.data() + i * kPageSize, kPageSize);
+  }
+}
+
+void Memory::SetEccEnabled(bool enabled) {
+  if (enabled && !ecc_enabled_) {
+    // Check bytes may be missing or stale from time spent without ECC
+    for (auto &[page_number, page] : resident_pages_) {
+      if (!page->check) {
+        page->check = static_cast<uint8_t *>(Allocate(kWordsPerPage, kCacheLineSize));
+      }
+      EncodeWords(page, 0, kPageSize);
+    }
+    reported_.clear();
+  }
+  ecc_enabled_ = enabled;
+}
+
+void Memory::EncodeWords(Page *page, uint64_t offset, size_t size) {
+  size_t first = offset >> 2;
+  size_t count = ((offset + size + 3) >> 2) - first;
+  if (count <= 2) {
+    for (size_t word = first; word < first + count; ++word) {
+      StoreCheck(page, word, ecc::memory_check_byte(LoadWord(page, word)));
+    }
+    return;
+  }
+  std::array<uint32_t, kWordsPerPage> words;
+  std::array<uint8_t, kWordsPerPage> checks;
+  std::memcpy(words.data(), page->bytes.data() + first * 4, count * 4);
+  ecc::memory_check_batch(words.data(), checks.data(), count);
+  for (size_t i = 0; i < count; ++i) {
+    StoreCheck(page, first + i, checks[i]);
+  }
+}
+
+void Memory::StoreBytes(Page *page, uint64_t offset, const void *value, size_t size) {
+  const auto *bytes = static_cast<const uint8_t *>(value);
+  size_t last = (offset + size - 1) >> 2;
+  for (size_t word = offset >> 2; word <= last; ++word) {
+    uint64_t begin = std::max<uint64_t>(offset, word * 4);
+    uint64_t end = std::min<uint64_t>(offset + size, word * 4 + 4);
+    uint32_t data = LoadWord(page, word);
+    std::memcpy(reinterpret_cast<uint8_t *>(&data) + (begin - word * 4), bytes + (begin - offset), end - begin);
+    StoreWord(page, word, data);
+  }
+}
+
+Memory::PageLock::PageLock(Page *page) : page_(page) {
+  uint32_t sequence = page->sequence.load(std::memory_order_relaxed);
+  for (;;) {
+    if (!(sequence & 1) && page->sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire,
+                                                                std::memory_order_relaxed)) {
+      return;
+    }
+    if (sequence & 1) {
+      // Held by the other thread for at most one page; let it finish
+      std::this_thread::yield();
+      sequence = page->sequence.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void Memory::VerifyWords(Page *page, uint64_t offset, size_t size, EccStats &stats,
+                         std::unordered_set<const uint8_t *> &reported) {
+  size_t last = (offset + size - 1) >> 2;
+  for (size_t word = offset >> 2; word <= last; ++word) {
+    uint32_t data = LoadWord(page, word);
+    uint8_t check = LoadCheck(page, word);
+    if (ecc::memory_check_byte(data)==check) {
+      continue;
+    }
+    if (ecc::correct_memory_word(data, check)==ecc::WordCheck::kCorrected) {
+      StoreWord(page, word, data);
+      StoreCheck(page, word, check);
+      BumpCount(stats.corrected);
+      reported.erase(page->bytes.data() + word * 4);
+    } else if (reported.insert(page->bytes.data() + word * 4).second) {
+      BumpCount(stats.uncorrectable);
+    }
+  }
+}
+
+void Memory::InjectBitFlip(uint64_t address, unsigned int bit) {
+  if (address >= memory_size_) {
+    throw std::out_of_range("Memory address out of range: " + std::to_string(address));
+  }
+  if (bit >= 39 || (bit >= 32 && !ecc_enabled_)) {
+    throw std::invalid_argument("Invalid bit to flip: " + std::to_string(bit));
+  }
+  // A fault, not a guest write: nothing is preserved and the check byte is left alone
+  Page *page = FindPage(address, true);
+  uint64_t word = (address & (kPageSize - 1)) >> 2;
+  PageLock lock(page);
+  if (bit >= 32) {
+    StoreCheck(page, word, LoadCheck(page, word) ^ static_cast<uint8_t>(1 << (bit - 32)));
+  } else if (page->check) {
+    StoreWord(page, word, LoadWord(page, word) ^ (uint32_t{1} << bit));
+  } else {
+    page->bytes[word * 4 + bit / 8] ^= static_cast<uint8_t>(1 << (bit % 8));
+  }
+  BumpCount(ecc_stats_.injected);
+}
+
+uint64_t Memory::ContentHash() const {
+  std::vector<std::pair<uint64_t, Page *>> pages = resident_pages_;
+  std::sort(pages.begin(), pages.end(), [](const auto &a, const auto &b) {
+    return a.first < b.first;
+  });
+
+  constexpr uint64_t kMultiplier = 0x9E3779B97F4A7C15ull;
+  uint64_t hash = 0;
+  for (const auto &[page_number, page] : pages) {
+    std::array<uint64_t, kPageSize / 8> words;
+    std::memcpy(words.data(), page->bytes.data(), kPageSize);
+    uint64_t page_hash = 0;
+    uint64_t any = 0;
+    for (uint64_t word : words) {
+      page_hash = (std::rotl(page_hash, 23) ^ word) * kMultiplier;
+      any |= word;
+    }
+    if (any) {
+      hash = (std::rotl(hash, 23) ^ page_number ^ page_hash) * kMultiplier;
+    }
+  }
+  return hash;
+}
+
+namespace {
+
+constexpr std::array<uint8_t, Memory::kPageSize> kZeroPage{};
+
+const std::shared_ptr<const Memory::Image::PageCopy> *FindCopy(const Memory::Image &image, uint64_t page_number) {
+  auto it = std::lower_bound(image.pages.begin(), image.pages.end(), page_number, [](const auto &entry, uint64_t number) {
+    return entry.first < number;
+  });
+  return it!=image.pages.end() && it->first==page_number ? &it->second : nullptr;
+}
+
+} // namespace
+
+bool Memory::IsBlank(const Page *page) {
+  if (std::memcmp(page->bytes.data(), kZeroPage.data(), kPageSize)!=0) {
+    return false;
+  }
+  return !page->check || std::memcmp(page->check, kZeroPage.data(), kWordsPerPage)==0;
+}
+
+bool Memory::SameAs(const Page *page, const Image::PageCopy &copy) {
+  if (std::memcmp(page->bytes.data(), copy.bytes.data(), kPageSize)!=0) {
+    return false;
+  }
+  return std::memcmp(page->check ? page->check : kZeroPage.data(), copy.check.data(), kWordsPerPage)==0;
+}
+
+Memory::Image Memory::TakeImage(const Image *previous) const {
+  std::vector<std::pair<uint64_t, Page *>> pages = resident_pages_;
+  std::sort(pages.begin(), pages.end(), [](const auto &a, const auto &b) {
+    return a.first < b.first;
+  });
+
+  Image image;
+  image.pages.reserve(pages.size());
+  for (const auto &[page_number, page] : pages) {
+    std::optional<PageLock> lock;
+    if (page->check) {
+      lock.emplace(page);
+    }
+    if (IsBlank(page)) {
+      continue;
+    }
+    const std::shared_ptr<const Image::PageCopy> *earlier = previous ? FindCopy(*previous, page_number) : nullptr;
+    if (earlier && SameAs(page, **earlier)) {
+      image.pages.emplace_back(page_number, *earlier);
+      continue;
+    }
+    auto copy = std::make_shared<Image::PageCopy>();
+    std::memcpy(copy->bytes.data(), page->bytes.data(), kPageSize);
+    if (page->check) {
+      std::memcpy(copy->check.data(), page->check, kWordsPerPage);
+    }
+    image.pages.emplace_back(page_number, std::move(copy));
+  }
+  return image;
+}
+
+bool Memory::MatchesImage(const Image &image) const {
+  size_t matched = 0;
+  for (const auto &[page_number, page] : resident_pages_) {
+    std::optional<PageLock> lock;
+    if (page->check) {
+      lock.emplace(page);
+    }
+    const std::shared_ptr<const Image::PageCopy> *copy = FindCopy(image, page_number);
+    if (!copy ? !IsBlank(page) : !SameAs(page, **copy)) {
+      return false;
+    }
+    matched += copy!=nullptr;
+  }
+  // An image holds no blank pages, so any it has that are not resident differ
+  return matched==image.pages.size();
+}
+
+std::vector<uint64_t> Memory::RestoreImage(const Image &image) {
+  std::vector<uint64_t> written;
+  // Blank out what the image does not have first: FindPage() below may add resident pages
+  for (const auto &[page_number, page] : resident_pages_) {
+    std::optional<PageLock> lock;
+    if (page->check) {
+      lock.emplace(page);
+    }
+    if (FindCopy(image, page_number) || IsBlank(page)) {
+      continue;
+    }
+    // Zero words already match their zero check bytes
+    if (page->check) {
+      StoreBytes(page, 0, kZeroPage.data(), kPageSize);
+      ForgetReported(page, 0, kPageSize);
+      for (size_t word = 0; word < kWordsPerPage; ++word) {
+        StoreCheck(page, word, 0);
+      }
+    } else {
+      page->bytes.fill(0);
+    }
+    written.push_back(page_number);
+  }
+
+  for (const auto &[page_number, copy] : image.pages) {
+    Page *page = FindPage(page_number << kPageBits, true);
+    std::optional<PageLock> lock;
+    if (page->check) {
+      lock.emplace(page);
+    }
+    if (SameAs(page, *copy)) {
+      continue;
+    }
+    if (page->check) {
+      StoreBytes(page, 0, copy->bytes.data(), kPageSize);
+      ForgetReported(page, 0, kPageSize);
+      for (size_t word = 0; word < kWordsPerPage; ++word) {
+        StoreCheck(page, word, copy->check[word]);
+      }
+    } else {
+      std::memcpy(page->bytes.data(), copy->bytes.data(), kPageSize);
+    }
+    written.push_back(page_number);
+  }
+  return written;
+}
+
+void *Memory::Allocate(size_t size, size_t alignment) {
+  arena_used_ = (arena_used_ + alignment - 1) & ~(alignment - 1);
+  if (arena_used_ + size > kArenaChunkSize) {
+    arena_chunks_.push_back(std::make_unique<ArenaLine[]>(kArenaChunkSize / kCacheLineSize));
+    arena_used_ = 0;
+  }
+  void *storage = reinterpret_cast<std::byte *>(arena_chunks_.back().get()) + arena_used_;
+  arena_used_ += size;
+  return storage;
+}
+
+Memory::Page *Memory::FindPage(uint64_t address, bool create) {
+  uint64_t page_number = address >> kPageBits;
+  if (last_page_ && page_number==last_page_number_) {
+    return last_page_;
+  }
+
+  if (!root_) {
+    if (!create) {
+      return nullptr;
+    }
+    root_ = new (Allocate(sizeof(Table))) Table{};
+  }
+
+  Table *table = root_;
+  for (unsigned level = kLevels - 1; level > 0; --level) {
+    void *&slot = table->slots[(page_number >> (level * kTableBits)) & (kTableEntries - 1)];
+    if (!slot) {
+      if (!create) {
+        return nullptr;
+      }
+      slot = new (Allocate(sizeof(Table))) Table{};
+    }
+    table = static_cast<Table *>(slot);
+  }
+
+  void *&slot = table->slots[page_number & (kTableEntries - 1)];
+  if (!slot) {
+    if (!create) {
+      return nullptr;
+    }
+    Page *page = new (Allocate(sizeof(Page))) Page{};
+    if (ecc_enabled_) {
+      // Zero words already match their zero check bytes
+      page->check = static_cast<uint8_t *>(Allocate(kWordsPerPage, kCacheLineSize));
+    }
+    slot = page;
+    resident_pages_.emplace_back(page_number, page);
+    page->next_resident = newest_page_.load(std::memory_order_relaxed);
+    newest_page_.store(page, std::memory_order_release);
+  }
+
+  last_page_number_ = page_number;
+  last_page_ = static_cast<Page *>(slot);
+  return last_page_;
+}
 
 uint8_t Memory::Read(uint64_t address) {
   if (address >= memory_size_) {
     throw std::out_of_range("Memory address out of range: " + std::to_string(address));
   }
-  uint64_t block_index = GetBlockIndex(address);
-  uint64_t offset = GetBlockOffset(address);
-  if (!IsBlockPresent(block_index)) {
+  if (ecc_enabled_) [[unlikely]] {
+    uint8_t value = 0;
+    ReadChecked(address, &value, 1);
+    return value;
+  }
+  const Page *page = FindPage(address, false);
+  if (!page) {
     return 0;
   }
-  return blocks_[block_index].data[offset];
+  return page->bytes[address & (kPageSize - 1)];
 }
 
 void Memory::Write(uint64_t address, uint8_t value) {
   if (address >= memory_size_) {
     throw std::out_of_range(std::string("Memory address out of range: ") + std::to_string(address));
   }
-  uint64_t block_index = GetBlockIndex(address);
-  uint64_t offset = GetBlockOffset(address);
-  EnsureBlockExists(block_index);
-  blocks_[block_index].data[offset] = value;
-}
-
-uint64_t Memory::GetBlockIndex(uint64_t address) const {
-  return address/block_size_;
-}
-
-uint64_t Memory::GetBlockOffset(uint64_t address) const {
-  return address%block_size_;
+  if (ecc_enabled_) [[unlikely]] {
+    WriteChecked(address, &value, 1);
+    return;
+  }
+  WritablePage(address)->bytes[address & (kPageSize - 1)] = value;
 }
 
-bool Memory::IsBlockPresent(uint64_t block_index) const {
-  return blocks_.find(block_index)!=blocks_.end();
+void Memory::ReadChecked(uint64_t address, void *value, size_t size) {
+  if (Page *page = FindPage(address, false)) {
+    uint64_t offset = address & (kPageSize - 1);
+    PageLock lock(page);
+    VerifyWords(page, offset, size, ecc_stats_, reported_);
+    std::memcpy(value, page->bytes.data() + offset, size);
+  }
 }
 
-void Memory::EnsureBlockExists(uint64_t block_index) {
-  if (blocks_.find(block_index)==blocks_.end()) {
-    blocks_.emplace(block_index, MemoryBlock());
+void Memory::WriteChecked(uint64_t address, const void *value, size_t size) {
+  Page *page = FindPage(address, true);
+  uint64_t offset = address & (kPageSize - 1);
+  PageLock lock(page);
+  if (page->epoch!=epoch_) {
+    Preserve(address >> kPageBits, page);
   }
+  VerifyPartialWords(page, offset, size);
+  StoreBytes(page, offset, value, size);
+  EncodeWords(page, offset, size);
+  ForgetReported(page, offset, size);
 }
 
+// The fast paths copy guest bytes straight into host integers
+static_assert(std::endian::native==std::endian::little, "Memory assumes a little-endian host");
+
 template<typename T>
 T Memory::ReadGeneric(uint64_t address) {
+  uint64_t offset = address & (kPageSize - 1);
+  if (offset + sizeof(T) <= kPageSize) {
+    T value = 0;
+    if (ecc_enabled_) [[unlikely]] {
+      ReadChecked(address, &value, sizeof(T));
+      return value;
+    }
+    if (const Page *page = FindPage(address, false)) {
+      std::memcpy(&value, page->bytes.data() + offset, sizeof(T));
+    }
+    return value;
+  }
+
   T value = 0;
   for (size_t i = 0; i < sizeof(T); ++i) {
     value |= static_cast<T>(Read(address + i)) << (8*i);
@@ -69,6 +449,16 @@ T Memory::ReadGeneric(uint64_t address) {
 
 template<typename T>
 void Memory::WriteGeneric(uint64_t address, T value) {
+  uint64_t offset = address & (kPageSize - 1);
+  if (offset + sizeof(T) <= kPageSize) {
+    if (ecc_enabled_) [[unlikely]] {
+      WriteChecked(address, &value, sizeof(T));
+      return;
+    }
+    std::memcpy(WritablePage(address)->bytes.data() + offset, &value, sizeof(T));
+    return;
+  }
+
   for (size_t i = 0; i < sizeof(T); ++i) {
     Write(address + i, static_cast<uint8_t>(value >> (8*i)));
   }
@@ -106,10 +496,7 @@ float Memory::ReadFloat(uint64_t address) {
   if (address >= memory_size_ - (sizeof(float) - 1)) {
     throw std::out_of_range(std::string("Memory address out of range: ") + std::to_string(address));;
   }
-  uint32_t value = 0;
-  for (size_t i = 0; i < sizeof(float); ++i) {
-    value |= static_cast<uint32_t>(Read(address + i)) << (8*i);
-  }
+  uint32_t value = ReadGeneric<uint32_t>(address);
   float result;
   std::memcpy(&result, &value, sizeof(float));
   return result;
@@ -119,10 +506,7 @@ double Memory::ReadDouble(uint64_t address) {
   if (address >= memory_size_ - (sizeof(double) - 1)) {
     throw std::out_of_range(std::string("Memory address out of range: ") + std::to_string(address));
   }
-  uint64_t value = 0;
-  for (size_t i = 0; i < sizeof(double); ++i) {
-    value |= static_cast<uint64_t>(Read(address + i)) << (8*i);
-  }
+  uint64_t value = ReadGeneric<uint64_t>(address);
   double result;
   std::memcpy(&result, &value, sizeof(double));
   return result;
@@ -162,9 +546,7 @@ void Memory::WriteFloat(uint64_t address, float value) {
   }
   uint32_t value_bits;
   std::memcpy(&value_bits, &value, sizeof(float));
-  for (size_t i = 0; i < sizeof(float); ++i) {
-    Write(address + i, static_cast<uint8_t>((value_bits >> (8*i)) & 0xFF));
-  }
+  WriteGeneric<uint32_t>(address, value_bits);
 }
 
 void Memory::WriteDouble(uint64_t address, double value) {
@@ -173,8 +555,31 @@ void Memory::WriteDouble(uint64_t address, double value) {
   }
   uint64_t value_bits;
   std::memcpy(&value_bits, &value, sizeof(double));
-  for (size_t i = 0; i < sizeof(double); ++i) {
-    Write(address + i, static_cast<uint8_t>((value_bits >> (8*i)) & 0xFF));
+  WriteGeneric<uint64_t>(address, value_bits);
+}
+
+void Memory::WriteBlock(uint64_t address, std::span<const uint8_t> bytes) {
+  if (bytes.size() > memory_size_ || address > memory_size_ - bytes.size()) {
+    throw std::out_of_range(std::string("Memory address out of range: ") + std::to_string(address));
+  }
+  size_t written = 0;
+  while (written < bytes.size()) {
+    uint64_t offset = (address + written) & (kPageSize - 1);
+    size_t chunk = std::min<size_t>(bytes.size() - written, kPageSize - offset);
+    if (ecc_enabled_) {
+      Page *page = FindPage(address + written, true);
+      PageLock lock(page);
+      if (page->epoch!=epoch_) {
+        Preserve((address + written) >> kPageBits, page);
+      }
+      VerifyPartialWords(page, offset, chunk);
+      StoreBytes(page, offset, bytes.data() + written, chunk);
+      EncodeWords(page, offset, chunk);
+      ForgetReported(page, offset, chunk);
+    } else {
+      std::memcpy(WritablePage(address + written)->bytes.data() + offset, bytes.data() + written, chunk);
+    }
+    written += chunk;
   }
 }
 
@@ -272,21 +677,14 @@ void Memory::GetMemoryPoint(std::string addr_str) {
 void Memory::printMemoryUsage() const {
   std::cout << "Memory Usage Report:\n";
   std::cout << "---------------------\n";
-  std::cout << "Block Count: " << blocks_.size() << "\n";
-  for (const auto &[block_index, block] : blocks_) {
-    size_t used_bytes = std::count_if(block.data.begin(), block.data.end(),
+  std::cout << "Page Count: " << resident_pages_.size() << "\n";
+  for (const auto &[page_number, page] : resident_pages_) {
+    size_t used_bytes = std::count_if(page->bytes.begin(), page->bytes.end(),
                                       [](uint8_t byte) { return byte!=0; });
     if (used_bytes > 0) {
-      std::cout << "Block " << block_index << ": " << used_bytes
-                << " / " << block_size_ << " bytes used\n";
+      std::cout << "Page " << page_number << ": " << used_bytes
+                << " / " << kPageSize << " bytes used\n";
     }
   }
 
 }
-
-
-
-
-
-
-
@@ -0,0 +1,151 @@
+/**
+ * @file memory_scrubber.cpp
+ * @brief Contains the implementation of the MemoryScrubber.
+ */
+
+#include "vm/memory_scrubber.h"
+#include "ecc/ecc_utils.h"
+
+#include <array>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+// A page that keeps changing under the scrubber is being written, and writes check it anyway
+constexpr int kSnapshotAttempts = 4;
+
+// When no pages are resident yet
+constexpr auto kIdleWait = std::chrono::milliseconds(10);
+
+} // namespace
+
+void MemoryScrubber::Start(Memory &memory, uint64_t words_per_second) {
+  Stop();
+  if (words_per_second==0) {
+    return;
+  }
+  memory_ = &memory;
+  words_per_second_ = words_per_second;
+  passes_ = 0;
+  words_scrubbed_ = 0;
+  corrected_ = 0;
+  uncorrectable_ = 0;
+  reported_.clear();
+  stop_ = false;
+  thread_ = std::thread(&MemoryScrubber::Run, this);
+}
+
+void MemoryScrubber::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  thread_.join();
+}
+
+MemoryScrubber::Stats MemoryScrubber::GetStats() const {
+  Stats stats;
+  stats.passes = passes_.load(std::memory_order_relaxed);
+  stats.words_scrubbed = words_scrubbed_.load(std::memory_order_relaxed);
+  stats.corrected = corrected_.load(std::memory_order_relaxed);
+  stats.uncorrectable = uncorrectable_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void MemoryScrubber::Run() {
+  using Clock = std::chrono::steady_clock;
+  const auto page_time = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::nanoseconds(Memory::kWordsPerPage * uint64_t{1000000000} / words_per_second_));
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  Clock::time_point next = Clock::now();
+  while (!stop_) {
+    // Pages are only ever added at the head, so a pass sees every page resident when it started
+    Memory::Page *page = memory_->newest_page_.load(std::memory_order_acquire);
+    if (!page) {
+      wake_.wait_for(lock, kIdleWait, [this] { return stop_; });
+      next = Clock::now();
+      continue;
+    }
+    for (; page && !stop_; page = page->next_resident) {
+      lock.unlock();
+      ScrubPage(page);
+      words_scrubbed_.fetch_add(Memory::kWordsPerPage, std::memory_order_relaxed);
+      lock.lock();
+
+      next += page_time;
+      Clock::time_point now = Clock::now();
+      if (next > now) {
+        wake_.wait_until(lock, next, [this] { return stop_; });
+      } else if (now - next > 16 * page_time) {
+        // Fell behind (the machine was busy); do not make up for it with a burst
+        next = now;
+      }
+    }
+    if (!page) {
+      passes_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+void MemoryScrubber::ScrubPage(Memory::Page *page) {
+  std::array<uint32_t, Memory::kWordsPerPage> words;
+  std::array<uint8_t, Memory::kWordsPerPage> stored;
+  bool consistent = false;
+  for (int attempt = 0; attempt < kSnapshotAttempts && !consistent; ++attempt) {
+    uint32_t sequence = page->sequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    // Writers may be mid-update; the sequence check below discards a torn snapshot
+    for (size_t word = 0; word < Memory::kWordsPerPage; ++word) {
+      words[word] = Memory::LoadWord(page, word);
+      stored[word] = Memory::LoadCheck(page, word);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    consistent = page->sequence.load(std::memory_order_relaxed)==sequence;
+  }
+  if (!consistent) {
+    return;
+  }
+
+  std::array<uint8_t, Memory::kWordsPerPage> expected;
+  ecc::memory_check_batch(words.data(), expected.data(), Memory::kWordsPerPage);
+
+  // A reported word that checks clean again has been rewritten, so a later failure counts anew
+  const uintptr_t page_begin = reinterpret_cast<uintptr_t>(page->bytes.data());
+  for (auto it = reported_.begin(); it != reported_.end();) {
+    uintptr_t offset = reinterpret_cast<uintptr_t>(*it) - page_begin;
+    if (offset < Memory::kPageSize && expected[offset / 4]==stored[offset / 4]) {
+      it = reported_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  if (std::memcmp(expected.data(), stored.data(), Memory::kWordsPerPage)==0) {
+    return;
+  }
+
+  // The snapshot may be stale by now; VerifyWords() re-reads each word under the lock
+  Memory::PageLock lock(page);
+  for (size_t word = 0; word < Memory::kWordsPerPage; ++word) {
+    if (expected[word]==stored[word]) {
+      continue;
+    }
+    Memory::EccStats found;
+    Memory::VerifyWords(page, word * 4, 4, found, reported_);
+    if (found.corrected) {
+      corrected_.fetch_add(found.corrected, std::memory_order_relaxed);
+    }
+    if (found.uncorrectable) {
+      uncorrectable_.fetch_add(found.uncorrectable, std::memory_order_relaxed);
+    }
+  }
+}
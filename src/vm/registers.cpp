@@ -5,6 +5,7 @@
  */
 
 #include "vm/registers.h"
+#include "ecc/ecc_utils.h"
 
 #include <stdexcept>
 #include <unordered_set>
@@ -16,6 +17,8 @@ RegisterFile::RegisterFile() = default;
 
 void RegisterFile::Reset() {
   gpr_.fill(0);
+  gpr_check_.fill(0); // The code of 0
+  gpr_meta_.fill(0);
   fpr_.fill(0.0);
   csr_.fill(0);
   csr_[0x002] = 0b000; // Default: RNE (IEEE 754)
@@ -31,6 +34,36 @@ void RegisterFile::WriteGpr(size_t reg, uint64_t value) {
   if (reg >= NUM_GPR) throw std::out_of_range("Invalid GPR index");
   if (reg==0) return;
   gpr_[reg] = value;
+  if (shadow_ecc_) {
+    gpr_check_[reg] = ecc::secded64_check_byte(value);
+    gpr_meta_[reg] = 0;
+  }
+}
+
+void RegisterFile::SetShadowEcc(bool enabled) {
+  shadow_ecc_ = enabled;
+  for (size_t reg = 0; reg < NUM_GPR; ++reg) {
+    gpr_check_[reg] = enabled ? ecc::secded64_check_byte(gpr_[reg]) : 0;
+  }
+  gpr_meta_.fill(0);
+}
+
+void RegisterFile::WriteGprShadow(size_t reg, uint64_t value, uint8_t check, uint8_t meta) {
+  if (reg >= NUM_GPR) throw std::out_of_range("Invalid GPR index");
+  if (reg==0) return;
+  gpr_[reg] = value;
+  gpr_check_[reg] = check;
+  gpr_meta_[reg] = meta;
+}
+
+void RegisterFile::FlipGprBit(size_t reg, unsigned bit) {
+  if (reg >= NUM_GPR) throw std::out_of_range("Invalid GPR index");
+  if (reg==0) return;
+  gpr_[reg] ^= uint64_t{1} << (bit & 63);
+}
+
+uint64_t *RegisterFile::GprData() {
+  return gpr_.data();
 }
 
 uint64_t RegisterFile::ReadFpr(size_t reg) const {
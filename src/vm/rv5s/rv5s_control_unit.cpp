@@ -0,0 +1,105 @@
+/**
+ * @file rv5s_control_unit.cpp
+ * @brief RV5S Control Unit implementation
+ */
+
+#include "vm/rv5s/rv5s_control_unit.h"
+
+#include "common/instructions.h"
+using instruction_set::Instruction;
+using instruction_set::get_instr_encoding;
+
+namespace {
+
+bool IsR4Type(uint8_t opcode) {
+  return opcode==0b1000011 || opcode==0b1000111 || opcode==0b1001011 || opcode==0b1001111;
+}
+
+// fsqrt, the conversions, moves and fclass take no second operand; rs2 selects a variant
+bool IgnoresFloatRs2(uint8_t funct7) {
+  switch (funct7) {
+    case 0b0101100: case 0b0101101: // fsqrt.(s|d)
+    case 0b0100000: case 0b0100001: // fcvt.s.d, fcvt.d.s
+    case 0b1100000: case 0b1100001: // fcvt.(w|wu|l|lu).(s|d)
+    case 0b1101000: case 0b1101001: // fcvt.(s|d).(w|wu|l|lu)
+    case 0b1110000: case 0b1110001: // fmv.x.(w|d), fclass.(s|d)
+    case 0b1111000: case 0b1111001: // fmv.(w|d).x
+      return true;
+    default:
+      return false;
+  }
+}
+
+} // namespace
+
+RegisterUse RV5SControlUnit::GetRegisterUse(const DecodedInstruction &op) {
+  RegisterUse use;
+  const uint8_t opcode = op.opcode;
+  const uint8_t funct7 = op.funct7;
+  const RegisterClass gpr_rd = op.rd!=0 ? RegisterClass::kGpr : RegisterClass::kNone;
+
+  switch (op.exec_class) {
+    case ExecClass::kSyscall: {
+      return use;
+    }
+    case ExecClass::kCsr: {
+      use.rs1 = op.funct3 < 0b100 ? RegisterClass::kGpr : RegisterClass::kNone; // The immediate forms read no register
+      use.rd = gpr_rd;
+      return use;
+    }
+    case ExecClass::kInteger: {
+      const bool no_rs1 = opcode==get_instr_encoding(Instruction::klui).opcode ||
+                          opcode==get_instr_encoding(Instruction::kauipc).opcode ||
+                          opcode==get_instr_encoding(Instruction::kjal).opcode;
+      use.rs1 = no_rs1 ? RegisterClass::kNone : RegisterClass::kGpr;
+      if ((!op.alu_src || op.mem_write) && opcode!=get_instr_encoding(Instruction::kjal).opcode) {
+        use.rs2 = RegisterClass::kGpr;
+      }
+      // What WriteBackInteger() writes
+      if (op.reg_write) {
+        switch (opcode) {
+          case get_instr_encoding(Instruction::kRtype).opcode:
+          case get_instr_encoding(Instruction::kItype).opcode:
+          case get_instr_encoding(Instruction::kauipc).opcode:
+          case get_instr_encoding(Instruction::kLoadType).opcode:
+          case get_instr_encoding(Instruction::kjalr).opcode:
+          case get_instr_encoding(Instruction::kjal).opcode:
+          case get_instr_encoding(Instruction::klui).opcode:
+            use.rd = gpr_rd;
+            break;
+          default:
+            break;
+        }
+      }
+      return use;
+    }
+    case ExecClass::kFloat:
+    case ExecClass::kBFloat16:
+    case ExecClass::kSIMDF32:
+    case ExecClass::kDouble: {
+      const bool is_double = op.exec_class==ExecClass::kDouble;
+      const bool is_load = opcode==0b0000111;
+      const bool is_store = opcode==0b0100111;
+      const bool gpr_rs1 = is_load || is_store ||
+          (is_double ? (funct7==0b1101001 || funct7==0b1111001) : (funct7==0b1101000 || funct7==0b1111000));
+      use.rs1 = gpr_rs1 ? RegisterClass::kGpr : RegisterClass::kFpr;
+      if (!is_load && !(opcode==0b1010011 && IgnoresFloatRs2(funct7))) {
+        use.rs2 = RegisterClass::kFpr;
+      }
+      if (IsR4Type(opcode)) {
+        use.rs3 = RegisterClass::kFpr;
+      }
+      if (op.reg_write) {
+        // What WriteBackFloat() and WriteBackDouble() write
+        const bool writes_gpr = op.exec_class==ExecClass::kFloat || op.exec_class==ExecClass::kBFloat16
+            ? funct7==get_instr_encoding(Instruction::kfle_s).funct7 ||
+              funct7==get_instr_encoding(Instruction::kfcvt_w_s).funct7 ||
+              funct7==get_instr_encoding(Instruction::kfmv_x_w).funct7
+            : funct7==0b1010001 || funct7==0b1100001 || funct7==0b1110001;
+        use.rd = writes_gpr ? gpr_rd : RegisterClass::kFpr;
+      }
+      return use;
+    }
+  }
+  return use;
+}
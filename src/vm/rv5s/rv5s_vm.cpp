@@ -0,0 +1,885 @@
+/**
+ * @file rv5s_vm.cpp
+ * @brief RV5S VM implementation
+ */
+
+#include "vm/rv5s/rv5s_vm.h"
+#include "ecc/ecc_utils.h"
+
+#include "utils.h"
+#include "globals.h"
+#include "common/instructions.h"
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+using instruction_set::Instruction;
+using instruction_set::get_instr_encoding;
+
+
+RV5SVM::RV5SVM() : VmBase() {
+  fault_context_.Configure();
+  ecc_telemetry_.SetEnabled(vm_config::config.getEccTelemetry());
+  registers_.SetShadowEcc(vm_config::config.getEccShadowRegisters());
+  hazard_detection_ = vm_config::config.getHazardDetection();
+  forwarding_ = vm_config::config.getForwarding();
+  DumpRegisters(globals::registers_dump_file_path, registers_);
+  DumpState(globals::vm_state_dump_file_path);
+}
+
+DecodedInstruction RV5SVM::DecodeInstruction(uint32_t instruction) {
+  return control_unit_.Decode(instruction, ImmGenerator(instruction));
+}
+
+void RV5SVM::InvalidateText(uint64_t address, uint64_t size) {
+  VmBase::InvalidateText(address, size);
+  auto rewritten = [&](bool valid, uint64_t pc) {
+    return valid && pc < address + size && pc + 4 > address;
+  };
+  if (rewritten(id_ex_.valid, id_ex_.pc) || rewritten(if_id_.valid, if_id_.pc)) {
+    stale_fetch_ = true;
+  }
+}
+
+void RV5SVM::Clock(bool fetch) {
+  // Back to front, so each stage still sees what the one before it latched last cycle
+  WriteBackStage();
+  stale_fetch_ = false;
+  MemWbLatch mem_wb = MemoryStage();
+  bool redirect = false;
+  uint64_t target = 0;
+  ExMemLatch ex_mem;
+  if (stale_fetch_) {
+    // The store in MEM rewrote an instruction behind it: drop it before EX runs and fetch it again
+    flushed_instructions_ += id_ex_.valid;
+    redirect = true;
+    target = id_ex_.valid ? id_ex_.pc : if_id_.pc;
+  } else {
+    ex_mem = ExecuteStage(redirect, target);
+  }
+
+  bool stall = false;
+  IdExLatch id_ex;
+  if (redirect) {
+    // Whatever IF and ID hold is not what runs next
+    flushed_instructions_ += if_id_.valid;
+    if_id_ = IfIdLatch();
+    program_counter_ = target;
+  } else {
+    id_ex = DecodeStage(stall);
+    if (!stall) {
+      if_id_ = IfIdLatch();
+      if (fetch && program_counter_ < program_size_) {
+        if_id_ = {true, program_counter_, memory_controller_.FetchWord(program_counter_)};
+        UpdateProgramCounter(4);
+      }
+    }
+  }
+
+  mem_wb_ = mem_wb;
+  ex_mem_ = ex_mem;
+  id_ex_ = id_ex;
+  if (stall) {
+    hazard_stall_cycles_++;
+  } else {
+    cycle_s_++;
+  }
+}
+
+void RV5SVM::Drain() {
+  while (InFlight()) {
+    Clock(false);
+  }
+}
+
+IdExLatch RV5SVM::DecodeStage(bool &stall) {
+  if (!if_id_.valid) {
+    return IdExLatch();
+  }
+  IdExLatch out;
+  out.valid = true;
+  out.pc = if_id_.pc;
+  DecodedInstruction *cached = decode_cache_.Lookup(if_id_.pc);
+  if (cached && cached->valid && cached->instruction==if_id_.instruction) {
+    out.op = *cached;
+  } else {
+    out.op = DecodeInstruction(if_id_.instruction);
+  }
+  out.use = RV5SControlUnit::GetRegisterUse(out.op);
+
+  if (MustStall(out.op, out.use)) {
+    stall = true;
+    return IdExLatch();
+  }
+  out.rs1 = ReadRegister(out.use.rs1, out.op.rs1);
+  out.rs2 = ReadRegister(out.use.rs2, out.op.rs2);
+  out.rs3 = ReadRegister(out.use.rs3, out.op.rs3);
+  return out;
+}
+
+bool RV5SVM::MustStall(const DecodedInstruction &op, const RegisterUse &use) const {
+  if (RV5SControlUnit::IsSerializing(op) && (id_ex_.valid || ex_mem_.valid)) {
+    return true;
+  }
+  if ((id_ex_.valid && RV5SControlUnit::IsSerializing(id_ex_.op)) ||
+      (ex_mem_.valid && RV5SControlUnit::IsSerializing(ex_mem_.op))) {
+    return true;
+  }
+  if (!hazard_detection_) {
+    return false;
+  }
+
+  auto reads = [&](const DecodedInstruction &producer, const RegisterUse &producer_use) {
+    const RegisterClass written = producer_use.rd;
+    return written!=RegisterClass::kNone &&
+        ((use.rs1==written && op.rs1==producer.rd) ||
+         (use.rs2==written && op.rs2==producer.rd) ||
+         (use.rs3==written && op.rs3==producer.rd));
+  };
+
+  if (forwarding_) {
+    // Everything but a load's result can be forwarded by the time op reaches EX
+    return id_ex_.valid && id_ex_.op.mem_read && reads(id_ex_.op, id_ex_.use);
+  }
+  // WB writes before ID reads, so only the producers in EX and MEM are too far behind
+  return (id_ex_.valid && reads(id_ex_.op, id_ex_.use)) || (ex_mem_.valid && reads(ex_mem_.op, ex_mem_.use));
+}
+
+PipelineValue RV5SVM::ReadRegister(RegisterClass register_class, uint8_t reg) const {
+  switch (register_class) {
+    case RegisterClass::kGpr:
+      return {registers_.ReadGpr(reg), registers_.ReadGprCheck(reg), registers_.ReadGprMeta(reg)};
+    case RegisterClass::kFpr:
+      return {registers_.ReadFpr(reg), 0, 0};
+    case RegisterClass::kNone:
+      break;
+  }
+  return PipelineValue();
+}
+
+PipelineValue RV5SVM::Forward(RegisterClass register_class, uint8_t reg, PipelineValue value) const {
+  if (!forwarding_ || register_class==RegisterClass::kNone) {
+    return value;
+  }
+  // A load in EX/MEM has no result yet; hazard detection keeps its users from getting this far
+  if (ex_mem_.valid && !ex_mem_.op.mem_read && ex_mem_.use.rd==register_class && ex_mem_.op.rd==reg) {
+    return ex_mem_.result;
+  }
+  if (mem_wb_.valid && mem_wb_.use.rd==register_class && mem_wb_.op.rd==reg) {
+    return mem_wb_.result;
+  }
+  return value;
+}
+
+PipelineValue RV5SVM::GprResult(uint64_t value) const {
+  if (registers_.ShadowEcc()) {
+    return {value, ecc::secded64_check_byte(value), 0};
+  }
+  return {value, 0, 0};
+}
+
+void RV5SVM::WriteGpr(uint8_t reg, const PipelineValue &result) {
+  if (registers_.ShadowEcc()) {
+    registers_.WriteGprShadow(reg, result.value, result.check, result.meta);
+  } else {
+    registers_.WriteGpr(reg, result.value);
+  }
+}
+
+ExMemLatch RV5SVM::ExecuteStage(bool &redirect, uint64_t &target) {
+  if (!id_ex_.valid) {
+    return ExMemLatch();
+  }
+  ExMemLatch out;
+  out.valid = true;
+  out.pc = id_ex_.pc;
+  out.op = id_ex_.op;
+  out.use = id_ex_.use;
+
+  switch (id_ex_.op.exec_class) {
+    case ExecClass::kSyscall: {
+      // Serialized, so every older instruction has retired and the registers are current
+      HandleSyscall();
+      stop_requested_ = true;
+      // Nothing younger may run before the stop is seen
+      redirect = true;
+      target = id_ex_.pc + 4;
+      break;
+    }
+    case ExecClass::kCsr: {
+      ExecuteCsr(id_ex_, out);
+      break;
+    }
+    case ExecClass::kInteger: {
+      bool taken = false;
+      ExecuteInteger(id_ex_, out, taken, target);
+      if (taken && target!=id_ex_.pc + 4) {
+        redirect = true;
+        branch_mispredictions_++;
+      }
+      break;
+    }
+    case ExecClass::kFloat:
+    case ExecClass::kBFloat16:
+    case ExecClass::kSIMDF32:
+    case ExecClass::kDouble: {
+      ExecuteFloat(id_ex_, out);
+      break;
+    }
+  }
+  return out;
+}
+
+void RV5SVM::ExecuteInteger(const IdExLatch &in, ExMemLatch &out, bool &taken, uint64_t &target) {
+  const DecodedInstruction &op = in.op;
+  const uint8_t opcode = op.opcode;
+  const int32_t imm = op.imm;
+  const bool shadow = registers_.ShadowEcc();
+  const bool is_jalr = opcode==get_instr_encoding(Instruction::kjalr).opcode;
+  const bool is_jal = opcode==get_instr_encoding(Instruction::kjal).opcode;
+
+  const PipelineValue rs1 = Forward(in.use.rs1, op.rs1, in.rs1);
+  const PipelineValue rs2 = Forward(in.use.rs2, op.rs2, in.rs2);
+  uint64_t reg1_value = rs1.value;
+  uint64_t reg2_value = rs2.value;
+  if (op.alu_src) {
+    reg2_value = static_cast<uint64_t>(static_cast<int64_t>(imm));
+  }
+
+  const alu::AluOp alu_op = op.alu_op;
+  const bool is_addr_calc = op.mem_write || op.mem_read;
+
+  uint64_t result = 0;
+  uint8_t meta = 0;
+  std::optional<uint8_t> check;
+  if (shadow) {
+    result = ExecuteIntegerShadow(in, rs1, rs2, reg2_value, is_addr_calc, meta, check);
+  } else if (is_jalr) {
+    ecc::CheckResult check_result;
+    uint64_t checked = fault_context_.ecc_policy.check(reg1_value, check_result);
+    ecc_telemetry_.Record(reg1_value, check_result, in.pc);
+    reg1_value = checked;
+    uint64_t clean_addr = static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(reg1_value & 0xFFFFFFFFULL)));
+    result = alu_.execute(alu::AluOp::kAddrAdd, clean_addr, reg2_value).first;
+  } else if (is_addr_calc && alu_op==alu::AluOp::kAdd) {
+    result = alu_.execute(alu::AluOp::kAddrAdd, reg1_value, reg2_value).first;
+  } else {
+    result = alu_.execute(alu_op, reg1_value, reg2_value, fault_context_).first;
+    if (alu_op==alu::AluOp::kCheckError) {
+      ecc_telemetry_.Record(reg1_value, fault_context_.last_check, in.pc);
+    }
+  }
+  out.alu_result = result;
+  out.store_value = rs2.value;
+
+  const uint64_t link = in.pc + 4;
+  if (is_jal || is_jalr) {
+    taken = true;
+    if (is_jalr) {
+      // A packed value keeps its code in the upper half; a shadow one is a full address
+      target = shadow ? result : result & 0xFFFFFFFFULL;
+    } else {
+      target = in.pc + static_cast<int64_t>(imm);
+    }
+  } else if (op.branch && opcode==0b1100011) {
+    uint64_t data_result = shadow ? result : result & 0xFFFFFFFFULL;
+    switch (op.funct3) {
+      case 0b000: // BEQ
+      case 0b101: // BGE
+      case 0b111: { // BGEU
+        taken = data_result==0;
+        break;
+      }
+      case 0b001: { // BNE
+        taken = data_result!=0;
+        break;
+      }
+      case 0b100: // BLT
+      case 0b110: { // BLTU
+        taken = data_result==1;
+        break;
+      }
+      default: break;
+    }
+    target = in.pc + static_cast<int64_t>(imm);
+  }
+
+  if (opcode==get_instr_encoding(Instruction::kauipc).opcode) {
+    result = static_cast<uint64_t>(static_cast<int64_t>(in.pc) + (imm << 12));
+  }
+
+  // What WriteBackStage() writes to rd
+  switch (opcode) {
+    case get_instr_encoding(Instruction::kRtype).opcode:
+    case get_instr_encoding(Instruction::kItype).opcode:
+    case get_instr_encoding(Instruction::kauipc).opcode: {
+      out.result = shadow ? PipelineValue{result, check.value_or(ecc::secded64_check_byte(result)), meta}
+                          : PipelineValue{result, 0, 0};
+      break;
+    }
+    case get_instr_encoding(Instruction::kjalr).opcode:
+    case get_instr_encoding(Instruction::kjal).opcode: {
+      if (shadow) {
+        out.result = {link, ecc::secded64_check_byte(link), ecc::shadow_meta(ecc::SIG_POINTER, 0)};
+        break;
+      }
+      uint64_t protected_pointer = ecc::compute_ecc(static_cast<uint32_t>(link & 0xFFFFFFFF));
+      protected_pointer = ecc::update_metadata(protected_pointer, ecc::MODE_SEC, 0, 1, ecc::Significance::SIG_POINTER);
+      out.result = {protected_pointer, 0, 0};
+      break;
+    }
+    case get_instr_encoding(Instruction::klui).opcode: {
+      out.result = GprResult(static_cast<uint64_t>(static_cast<int64_t>(imm << 12)));
+      break;
+    }
+    default: break;
+  }
+}
+
+uint64_t RV5SVM::ExecuteIntegerShadow(const IdExLatch &in, PipelineValue rs1, PipelineValue rs2, uint64_t reg2_value,
+                                      bool is_addr_calc, uint8_t &meta, std::optional<uint8_t> &check) {
+  const uint8_t opcode = in.op.opcode;
+  const bool is_jalr = opcode==get_instr_encoding(Instruction::kjalr).opcode;
+  alu::AluOp op = in.op.alu_op;
+  uint64_t reg1_value = rs1.value;
+  uint8_t rs1_meta = rs1.meta;
+
+  // Results are as significant as the most significant operand
+  uint8_t sig = 0;
+  if (opcode==get_instr_encoding(Instruction::kRtype).opcode || opcode==get_instr_encoding(Instruction::kItype).opcode) {
+    sig = ecc::shadow_sig(rs1_meta);
+    if (!in.op.alu_src) {
+      sig = std::max(sig, ecc::shadow_sig(rs2.meta));
+    }
+  }
+  meta = ecc::shadow_meta(sig, 0);
+  check.reset();
+
+  if (is_jalr || op==alu::AluOp::kCheckError) {
+    uint8_t code = rs1.check;
+    const uint8_t rs1_sig = ecc::shadow_sig(rs1_meta);
+    ecc::CheckResult check_result = fault_context_.ecc_policy.check_shadow(reg1_value, code, rs1_meta);
+    ecc_telemetry_.Record(rs1_sig, 0, check_result, in.pc);
+    if (op==alu::AluOp::kCheckError) {
+      fault_context_.last_check = check_result;
+      fault_context_.corrections += check_result==ecc::CheckResult::kCorrected;
+    }
+  }
+  if (is_jalr || (is_addr_calc && op==alu::AluOp::kAdd)) {
+    op = alu::AluOp::kAddrAdd;
+  }
+
+  switch (op) {
+    case alu::AluOp::kCheckError: {
+      meta = rs1_meta;
+      return reg1_value;
+    }
+    case alu::AluOp::kInjectFlip: {
+      // rd gets rs1's code, so a flipped bit is an error the next check finds
+      check = rs1.check;
+      meta = rs1_meta;
+      return alu::Alu::injectFlip(reg1_value, fault_context_).first;
+    }
+    case alu::AluOp::kSetSig: {
+      meta = ecc::shadow_meta(static_cast<uint8_t>(reg2_value & ecc::SIG_MASK), ecc::shadow_hist(rs1_meta));
+      return reg1_value;
+    }
+    default: {
+      return alu::Alu::executeWide(op, reg1_value, reg2_value).first;
+    }
+  }
+}
+
+void RV5SVM::ExecuteFloat(const IdExLatch &in, ExMemLatch &out) {
+  const DecodedInstruction &op = in.op;
+  const PipelineValue rs1 = Forward(in.use.rs1, op.rs1, in.rs1);
+  const PipelineValue rs2 = Forward(in.use.rs2, op.rs2, in.rs2);
+  const PipelineValue rs3 = Forward(in.use.rs3, op.rs3, in.rs3);
+
+  uint64_t reg2_value = rs2.value;
+  if (op.alu_src) {
+    reg2_value = static_cast<uint64_t>(static_cast<int64_t>(op.imm));
+  }
+
+  uint8_t rm = op.funct3;
+  uint64_t result = 0;
+  if (op.exec_class==ExecClass::kDouble) {
+    result = alu::Alu::dfpexecute(op.alu_op, rs1.value, reg2_value, rs3.value, rm).first;
+  } else {
+    if (rm==0b111) {
+      rm = registers_.ReadCsr(0x002);
+    }
+    uint8_t fcsr_status = 0;
+    switch (op.exec_class) {
+      case ExecClass::kBFloat16: {
+        std::tie(result, fcsr_status) = alu::Alu::bf16execute(op.alu_op, rs1.value, reg2_value, rs3.value, rm);
+        break;
+      }
+      case ExecClass::kSIMDF32: {
+        std::tie(result, fcsr_status) = alu::Alu::simdf32execute(op.alu_op, rs1.value, reg2_value, rs3.value, rm);
+        break;
+      }
+      default: {
+        std::tie(result, fcsr_status) = alu::Alu::fpexecute(op.alu_op, rs1.value, reg2_value, rs3.value, rm);
+        break;
+      }
+    }
+    registers_.WriteCsr(0x003, fcsr_status);
+  }
+
+  out.alu_result = result;
+  out.store_value = rs2.value;
+  out.result = in.use.rd==RegisterClass::kGpr ? GprResult(result) : PipelineValue{result, 0, 0};
+}
+
+void RV5SVM::ExecuteCsr(const IdExLatch &in, ExMemLatch &out) {
+  const uint16_t csr = (in.op.instruction >> 20) & 0xFFF;
+  out.csr.address = csr;
+  out.csr.old_value = registers_.ReadCsr(csr);
+  out.csr.write_value = Forward(in.use.rs1, in.op.rs1, in.rs1).value;
+  out.csr.uimm = in.op.rs1;
+  out.result = GprResult(out.csr.old_value);
+}
+
+void RV5SVM::HandleSyscall() {
+  uint64_t syscall_number = registers_.ReadGpr(17);
+  std::ostream &out = ProgramOutput();
+  switch (syscall_number) {
+    case SYSCALL_PRINT_INT: {
+      out << (globals::vm_as_backend ? "VM_STDOUT_START" : "[Syscall output: ");
+      out << static_cast<int64_t>(registers_.ReadGpr(10));
+      out << (globals::vm_as_backend ? "VM_STDOUT_END" : "]") << std::endl;
+      break;
+    }
+    case SYSCALL_PRINT_FLOAT: {
+      out << (globals::vm_as_backend ? "VM_STDOUT_START" : "[Syscall output: ");
+      float float_value;
+      uint64_t raw = registers_.ReadGpr(10);
+      std::memcpy(&float_value, &raw, sizeof(float_value));
+      out << std::setprecision(std::numeric_limits<float>::max_digits10) << float_value;
+      out << (globals::vm_as_backend ? "VM_STDOUT_END" : "]") << std::endl;
+      break;
+    }
+    case SYSCALL_PRINT_DOUBLE: {
+      out << (globals::vm_as_backend ? "VM_STDOUT_START" : "[Syscall output: ");
+      double double_value;
+      uint64_t raw = registers_.ReadGpr(10);
+      std::memcpy(&double_value, &raw, sizeof(double_value));
+      out << std::setprecision(std::numeric_limits<double>::max_digits10) << double_value;
+      out << (globals::vm_as_backend ? "VM_STDOUT_END" : "]") << std::endl;
+      break;
+    }
+    case SYSCALL_PRINT_STRING: {
+      if (!globals::vm_as_backend) {
+        out << "[Syscall output: ";
+      }
+      PrintString(registers_.ReadGpr(10));
+      if (!globals::vm_as_backend) {
+        out << "]" << std::endl;
+      }
+      break;
+    }
+    case SYSCALL_EXIT: {
+      stop_requested_ = true;
+      if (sandbox_output_) {
+        exit_code_ = registers_.ReadGpr(10);
+        break;
+      }
+      if (!globals::vm_as_backend) {
+        std::cout << "VM_EXIT" << std::endl;
+      }
+      output_status_ = "VM_EXIT";
+      std::cout << "Exited with exit code: " << registers_.ReadGpr(10) << std::endl;
+      exit(0);
+    }
+    case SYSCALL_READ: {
+      uint64_t file_descriptor = registers_.ReadGpr(10);
+      uint64_t buffer_address = registers_.ReadGpr(11);
+      uint64_t length = registers_.ReadGpr(12);
+      if (file_descriptor!=0) {
+        if (!sandbox_output_) {
+          std::cerr << "Unsupported file descriptor: " << file_descriptor << std::endl;
+        }
+        break;
+      }
+
+      std::string input;
+      if (!sandbox_output_) { // In a sandbox the read sees end of input
+        std::cout << "VM_STDIN_START" << std::endl;
+        output_status_ = "VM_STDIN_START";
+        std::unique_lock<std::mutex> lock(input_mutex_);
+        input_cv_.wait(lock, [this]() {
+          return !input_queue_.empty();
+        });
+        output_status_ = "VM_STDIN_END";
+        std::cout << "VM_STDIN_END" << std::endl;
+        input = input_queue_.front();
+        input_queue_.pop();
+      }
+
+      for (size_t i = 0; i < input.size() && i < length; ++i) {
+        memory_controller_.WriteByte_d(buffer_address + i, static_cast<uint8_t>(input[i]));
+      }
+      if (input.size() < length) {
+        memory_controller_.WriteByte_d(buffer_address + input.size(), '\0');
+      }
+      InvalidateText(buffer_address, length);
+      registers_.WriteGpr(10, std::min(static_cast<uint64_t>(length), static_cast<uint64_t>(input.size())));
+      break;
+    }
+    case SYSCALL_WRITE: {
+      uint64_t file_descriptor = registers_.ReadGpr(10);
+      uint64_t buffer_address = registers_.ReadGpr(11);
+      uint64_t length = registers_.ReadGpr(12);
+      if (file_descriptor!=1) {
+        if (!sandbox_output_) {
+          std::cerr << "Unsupported file descriptor: " << file_descriptor << std::endl;
+        }
+        break;
+      }
+
+      out << "VM_STDOUT_START";
+      output_status_ = "VM_STDOUT_START";
+      for (uint64_t i = 0; i < length; ++i) {
+        out << static_cast<char>(memory_controller_.ReadByte_d(buffer_address + i));
+      }
+      out << std::flush;
+      output_status_ = "VM_STDOUT_END";
+      out << "VM_STDOUT_END" << std::endl;
+      registers_.WriteGpr(10, length);
+      break;
+    }
+    default: {
+      if (!sandbox_output_) {
+        std::cerr << "Unknown syscall number: " << syscall_number << std::endl;
+      }
+      break;
+    }
+  }
+}
+
+MemWbLatch RV5SVM::MemoryStage() {
+  if (!ex_mem_.valid) {
+    return MemWbLatch();
+  }
+  MemWbLatch out;
+  out.valid = true;
+  out.pc = ex_mem_.pc;
+  out.op = ex_mem_.op;
+  out.use = ex_mem_.use;
+  out.result = ex_mem_.result;
+  out.csr = ex_mem_.csr;
+
+  switch (ex_mem_.op.exec_class) {
+    case ExecClass::kSyscall:
+    case ExecClass::kCsr: {
+      break;
+    }
+    case ExecClass::kInteger: {
+      MemoryInteger(ex_mem_, out);
+      break;
+    }
+    case ExecClass::kFloat:
+    case ExecClass::kBFloat16:
+    case ExecClass::kSIMDF32:
+    case ExecClass::kDouble: {
+      MemoryFloat(ex_mem_, out);
+      break;
+    }
+  }
+  return out;
+}
+
+void RV5SVM::MemoryInteger(const ExMemLatch &in, MemWbLatch &out) {
+  const uint64_t address = in.alu_result;
+
+  if (in.op.mem_read) {
+    int64_t memory_result = 0;
+    switch (in.op.funct3) {
+      case 0b000: {// LB
+        memory_result = static_cast<int8_t>(memory_controller_.ReadByte(address));
+        break;
+      }
+      case 0b001: {// LH
+        memory_result = static_cast<int16_t>(memory_controller_.ReadHalfWord(address));
+        break;
+      }
+      case 0b010: {// LW
+        memory_result = static_cast<int32_t>(memory_controller_.ReadWord(address));
+        break;
+      }
+      case 0b011: // LD
+      case 0b111: {// LWPD
+        memory_result = static_cast<int64_t>(memory_controller_.ReadDoubleWord(address));
+        break;
+      }
+      case 0b100: {// LBU
+        memory_result = static_cast<uint8_t>(memory_controller_.ReadByte(address));
+        break;
+      }
+      case 0b101: {// LHU
+        memory_result = static_cast<uint16_t>(memory_controller_.ReadHalfWord(address));
+        break;
+      }
+      case 0b110: {// LWU
+        memory_result = static_cast<uint32_t>(memory_controller_.ReadWord(address));
+        break;
+      }
+    }
+
+    const uint64_t value = static_cast<uint64_t>(memory_result);
+    if (in.op.load_protected && registers_.ShadowEcc()) {
+      out.result = {value, ecc::secded64_check_byte(value), ecc::shadow_meta(1, 0)};
+    } else if (in.op.load_protected) {
+      uint64_t protected_value = ecc::compute_ecc(static_cast<uint32_t>(value & 0xFFFFFFFF));
+      protected_value = ecc::update_metadata(protected_value, ecc::MODE_SEC, 0, 0, 1); // Low sensitivity
+      out.result = {protected_value, 0, 0};
+    } else {
+      out.result = GprResult(value);
+    }
+  }
+
+  if (in.op.mem_write) {
+    switch (in.op.funct3) {
+      case 0b000: {// SB
+        memory_controller_.WriteByte(address, in.store_value & 0xFF);
+        InvalidateText(address, 1);
+        break;
+      }
+      case 0b001: {// SH
+        memory_controller_.WriteHalfWord(address, in.store_value & 0xFFFF);
+        InvalidateText(address, 2);
+        break;
+      }
+      case 0b010: {// SW
+        memory_controller_.WriteWord(address, in.store_value & 0xFFFFFFFF);
+        InvalidateText(address, 4);
+        break;
+      }
+      case 0b011: {// SD
+        memory_controller_.WriteDoubleWord(address, in.store_value);
+        InvalidateText(address, 8);
+        break;
+      }
+    }
+  }
+}
+
+void RV5SVM::MemoryFloat(const ExMemLatch &in, MemWbLatch &out) {
+  const uint64_t address = in.alu_result;
+  // Double and SIMDF32 move 64 bits, float and BF16 32
+  const bool wide = in.op.exec_class==ExecClass::kDouble || in.op.exec_class==ExecClass::kSIMDF32;
+
+  if (in.op.mem_read) { // FLW, FLD
+    out.result.value = wide ? memory_controller_.ReadDoubleWord(address) : memory_controller_.ReadWord(address);
+  }
+  if (in.op.mem_write) { // FSW, FSD
+    if (wide) {
+      memory_controller_.WriteDoubleWord(address, in.store_value);
+      InvalidateText(address, 8);
+    } else {
+      memory_controller_.WriteWord(address, static_cast<uint32_t>(in.store_value & 0xFFFFFFFF));
+      InvalidateText(address, 4);
+    }
+  }
+}
+
+void RV5SVM::WriteBackStage() {
+  if (!mem_wb_.valid) {
+    return;
+  }
+  const DecodedInstruction &op = mem_wb_.op;
+
+  if (op.exec_class==ExecClass::kCsr) {
+    const CsrAccess &csr = mem_wb_.csr;
+    WriteGpr(op.rd, mem_wb_.result);
+    switch (op.funct3) {
+      case get_instr_encoding(Instruction::kcsrrw).funct3: {
+        registers_.WriteCsr(csr.address, csr.write_value);
+        break;
+      }
+      case get_instr_encoding(Instruction::kcsrrs).funct3: {
+        if (csr.write_value!=0) {
+          registers_.WriteCsr(csr.address, csr.old_value | csr.write_value);
+        }
+        break;
+      }
+      case get_instr_encoding(Instruction::kcsrrc).funct3: {
+        if (csr.write_value!=0) {
+          registers_.WriteCsr(csr.address, csr.old_value & ~csr.write_value);
+        }
+        break;
+      }
+      case get_instr_encoding(Instruction::kcsrrwi).funct3: {
+        registers_.WriteCsr(csr.address, csr.uimm);
+        break;
+      }
+      case get_instr_encoding(Instruction::kcsrrsi).funct3: {
+        if (csr.uimm!=0) {
+          registers_.WriteCsr(csr.address, csr.old_value | csr.uimm);
+        }
+        break;
+      }
+      case get_instr_encoding(Instruction::kcsrrci).funct3: {
+        if (csr.uimm!=0) {
+          registers_.WriteCsr(csr.address, csr.old_value & ~static_cast<uint64_t>(csr.uimm));
+        }
+        break;
+      }
+    }
+  } else if (mem_wb_.use.rd==RegisterClass::kGpr) {
+    WriteGpr(op.rd, mem_wb_.result);
+  } else if (mem_wb_.use.rd==RegisterClass::kFpr) {
+    registers_.WriteFpr(op.rd, mem_wb_.result.value);
+  }
+  instructions_retired_++;
+}
+
+uint64_t RV5SVM::RunFor(uint64_t budget) {
+  const uint64_t start = instructions_retired_;
+  while (!stop_requested_ && instructions_retired_ - start < budget &&
+         (program_counter_ < program_size_ || InFlight())) {
+    // Only start instructions that fit in the budget, so the limit stays exact
+    Clock(instructions_retired_ - start + InFlight() < budget);
+  }
+  Drain();
+  return instructions_retired_ - start;
+}
+
+void RV5SVM::Run() {
+  stop_requested_ = false;
+  // The limit itself may be executed, plus one more instruction
+  const uint64_t instruction_limit = vm_config::config.getInstructionExecutionLimit();
+  uint64_t instruction_executed = RunFor(instruction_limit==UINT64_MAX ? instruction_limit : instruction_limit + 1);
+  if (instruction_executed > instruction_limit && !stop_requested_ && program_counter_ < program_size_) {
+    std::cout << "Execution stopped — limit "
+              << instruction_limit
+              << " reached after " << instruction_executed << " instructions.\n";
+  }
+  if (program_counter_ >= program_size_) {
+    std::cout << "VM_PROGRAM_END" << std::endl;
+    output_status_ = "VM_PROGRAM_END";
+  }
+  DumpRegisters(globals::registers_dump_file_path, registers_);
+  DumpState(globals::vm_state_dump_file_path);
+}
+
+void RV5SVM::DebugRun() {
+  stop_requested_ = false;
+  const uint64_t start = instructions_retired_;
+  uint64_t checked_pc = UINT64_MAX; // A breakpoint already looked at, not to be counted twice
+  while (!stop_requested_ && (program_counter_ < program_size_ || InFlight())) {
+    if (instructions_retired_ - start > vm_config::config.getInstructionExecutionLimit()) {
+      break;
+    }
+    if (program_counter_!=checked_pc && program_counter_ < program_size_ && breakpoints_.MaybeHit(program_counter_)) {
+      // Stop with the instructions ahead retired; one of them may still branch away
+      Drain();
+      if (breakpoints_.MaybeHit(program_counter_)) {
+        checked_pc = program_counter_;
+        if (breakpoints_.ShouldStop(program_counter_, registers_, memory_controller_)) {
+          std::cout << "VM_BREAKPOINT_HIT " << program_counter_ << std::endl;
+          output_status_ = "VM_BREAKPOINT_HIT";
+          break;
+        }
+      }
+      continue;
+    }
+
+    Clock();
+    if (program_counter_!=checked_pc) {
+      checked_pc = UINT64_MAX;
+    }
+    std::cout << "Program Counter: " << program_counter_ << std::endl;
+    if (program_counter_ < program_size_ || InFlight()) {
+      std::cout << "VM_STEP_COMPLETED" << std::endl;
+      output_status_ = "VM_STEP_COMPLETED";
+    } else {
+      std::cout << "VM_LAST_INSTRUCTION_STEPPED" << std::endl;
+      output_status_ = "VM_LAST_INSTRUCTION_STEPPED";
+    }
+    DumpRegisters(globals::registers_dump_file_path, registers_);
+    DumpState(globals::vm_state_dump_file_path);
+
+    unsigned int delay_ms = vm_config::config.getRunStepDelay();
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+  }
+  if (program_counter_ >= program_size_ && !InFlight()) {
+    std::cout << "VM_PROGRAM_END" << std::endl;
+    output_status_ = "VM_PROGRAM_END";
+  }
+  DumpRegisters(globals::registers_dump_file_path, registers_);
+  DumpState(globals::vm_state_dump_file_path);
+}
+
+void RV5SVM::Step() {
+  if (program_counter_ < program_size_ || InFlight()) {
+    Clock();
+    std::cout << "Program Counter: " << std::hex << program_counter_ << std::dec << std::endl;
+    if (program_counter_ < program_size_ || InFlight()) {
+      std::cout << "VM_STEP_COMPLETED" << std::endl;
+      output_status_ = "VM_STEP_COMPLETED";
+    } else {
+      std::cout << "VM_LAST_INSTRUCTION_STEPPED" << std::endl;
+      output_status_ = "VM_LAST_INSTRUCTION_STEPPED";
+    }
+  } else {
+    std::cout << "VM_PROGRAM_END" << std::endl;
+    output_status_ = "VM_PROGRAM_END";
+  }
+  DumpRegisters(globals::registers_dump_file_path, registers_);
+  DumpState(globals::vm_state_dump_file_path);
+}
+
+void RV5SVM::Undo() {
+  std::cout << "VM_NO_MORE_UNDO" << std::endl;
+  output_status_ = "VM_NO_MORE_UNDO";
+}
+
+void RV5SVM::Redo() {
+  std::cout << "VM_NO_MORE_REDO" << std::endl;
+}
+
+RV5SVM::CycleStats RV5SVM::ComputeCycleStats() const {
+  const cache::CacheHierarchy &caches = memory_controller_.GetCaches();
+  CycleStats stats{hazard_stall_cycles_ + (caches.Enabled() ? caches.Stats().stall_cycles : 0), cpi_, ipc_};
+  if (instructions_retired_) {
+    stats.cpi = static_cast<float>(cycle_s_ + stats.stall_cycles) / static_cast<float>(instructions_retired_);
+    stats.ipc = 1.0f / stats.cpi;
+  }
+  return stats;
+}
+
+void RV5SVM::Reset() {
+  program_counter_ = 0;
+  instructions_retired_ = 0;
+  cycle_s_ = 0;
+  stall_cycles_ = 0;
+  cpi_ = 0;
+  ipc_ = 0;
+  branch_mispredictions_ = 0;
+  hazard_stall_cycles_ = 0;
+  flushed_instructions_ = 0;
+  if_id_ = IfIdLatch();
+  id_ex_ = IdExLatch();
+  ex_mem_ = ExMemLatch();
+  mem_wb_ = MemWbLatch();
+  hazard_detection_ = vm_config::config.getHazardDetection();
+  forwarding_ = vm_config::config.getForwarding();
+  registers_.Reset();
+  registers_.SetShadowEcc(vm_config::config.getEccShadowRegisters());
+  memory_controller_.Reset();
+  control_unit_.Reset();
+  decode_cache_.Clear();
+  fault_context_.Configure();
+  ecc_telemetry_.Clear();
+  ecc_telemetry_.SetEnabled(vm_config::config.getEccTelemetry());
+}
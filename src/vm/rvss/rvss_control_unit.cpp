@@ -119,6 +119,49 @@ void RVSSControlUnit::SetControlSignals(uint32_t instruction) {
     
 }
 
+DecodedInstruction RVSSControlUnit::Decode(uint32_t instruction, int32_t imm) {
+  DecodedInstruction op;
+  op.instruction = instruction;
+  op.opcode = instruction & 0b1111111;
+  op.funct3 = (instruction >> 12) & 0b111;
+  op.funct7 = (instruction >> 25) & 0b1111111;
+  op.rd = (instruction >> 7) & 0b11111;
+  op.rs1 = (instruction >> 15) & 0b11111;
+  op.rs2 = (instruction >> 20) & 0b11111;
+  op.rs3 = (instruction >> 27) & 0b11111;
+  op.imm = imm;
+
+  SetControlSignals(instruction);
+  op.alu_op = GetAluSignal(instruction, GetAluOp());
+  op.alu_src = GetAluSrc();
+  op.reg_write = GetRegWrite();
+  op.mem_read = GetMemRead();
+  op.mem_write = GetMemWrite();
+  op.branch = GetBranch();
+  op.load_protected = IsLoadProtected();
+
+  // Same precedence as the classifier chain Execute() used to run on every instruction
+  if (op.opcode == get_instr_encoding(Instruction::kecall).opcode &&
+      op.funct3 == get_instr_encoding(Instruction::kecall).funct3) {
+    op.exec_class = ExecClass::kSyscall;
+  } else if (instruction_set::isBFloat16Instruction(instruction)) {
+    op.exec_class = ExecClass::kBFloat16;
+  } else if (instruction_set::isSIMDF32Instruction(instruction)) {
+    op.exec_class = ExecClass::kSIMDF32;
+  } else if (instruction_set::isFInstruction(instruction)) {
+    op.exec_class = ExecClass::kFloat;
+  } else if (instruction_set::isDInstruction(instruction)) {
+    op.exec_class = ExecClass::kDouble;
+  } else if (op.opcode == 0b1110011) {
+    op.exec_class = ExecClass::kCsr;
+  } else {
+    op.exec_class = ExecClass::kInteger;
+  }
+
+  op.valid = true;
+  return op;
+}
+
 alu::AluOp RVSSControlUnit::GetAluSignal(uint32_t instruction, bool ALUOp) {
     (void)ALUOp; // Suppress unused variable warning
     // DONT UNCOMMENT THIS WITHOUT SUPPORTING ALUOP IN CONTROL SIGNAL SETTING
@@ -0,0 +1,372 @@
+/**
+ * @file rvss_jit.cpp
+ * @brief x86-64 code generation for translated RVSS blocks.
+ */
+
+#include "vm/rvss/rvss_jit.h"
+#include "vm/rvss/rvss_vm.h"
+#include "vm/alu.h"
+#include "ecc/ecc_utils.h"
+#include "common/instructions.h"
+
+#include <cstring>
+#include <cstddef>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define RVSS_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define RVSS_JIT_SUPPORTED 0
+#endif
+
+using instruction_set::Instruction;
+using instruction_set::get_instr_encoding;
+
+namespace {
+
+/**
+ * @brief Runs one entry of the block through its interpreter handler.
+ * @return Non-zero when the block must stop after this entry.
+ */
+uint64_t JitInterpret(JitContext *ctx, uint64_t index) noexcept {
+  RVSSVM &vm = *ctx->vm;
+  const BlockEntry &entry = ctx->block->entries[index];
+
+  vm.branch_flag_ = ctx->branch_flag != 0;
+  vm.program_counter_ = ctx->block->start_pc + index * 4 + 4;
+  vm.current_op_ = entry.op;
+  vm.current_instruction_ = entry.op.instruction;
+  vm.block_position_ = index;
+  vm.block_length_ = ctx->block->entries.size();
+
+  try {
+    entry.handler(vm);
+  } catch (...) {
+    ctx->fault = std::current_exception();
+    ctx->pc = vm.program_counter_;
+    ctx->executed = index;
+    return 1;
+  }
+
+  ctx->branch_flag = vm.branch_flag_;
+  ctx->pc = vm.program_counter_;
+  ctx->executed = index + 1;
+  return vm.block_length_ <= index + 1;
+}
+
+uint64_t JitAlu(uint64_t op, uint64_t a, uint64_t b) noexcept {
+  return alu::Alu::execute(static_cast<alu::AluOp>(op), a, b).first;
+}
+
+/**
+ * @brief Minimal x86-64 encoder for the handful of instructions the block compiler needs.
+ */
+class CodeEmitter {
+ public:
+  enum Reg : uint8_t { kRax = 0, kRcx = 1, kRdx = 2, kRbx = 3 };
+  enum Cond : uint8_t { kB = 0x2, kAe = 0x3, kE = 0x4, kNe = 0x5, kL = 0xC, kGe = 0xD };
+
+  std::vector<uint8_t> code;
+  std::vector<size_t> exit_fixups; ///< rel32 fields that jump to the epilogue.
+
+  void Bytes(std::initializer_list<uint8_t> bytes) {
+    code.insert(code.end(), bytes);
+  }
+
+  void Imm32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  void Imm64(uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+      code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  // push rbx; push r12; push r13 keeps rsp 16-byte aligned at helper calls
+  // mov r12, rdi; mov rbx, [r12 + gpr]
+  void Prologue() {
+    Bytes({0x53, 0x41, 0x54, 0x41, 0x55});
+    Bytes({0x49, 0x89, 0xFC});
+    Bytes({0x49, 0x8B, 0x9C, 0x24});
+    Imm32(offsetof(JitContext, gpr));
+  }
+
+  void Epilogue() {
+    for (size_t fixup : exit_fixups) {
+      uint32_t rel = static_cast<uint32_t>(code.size() - (fixup + 4));
+      std::memcpy(&code[fixup], &rel, 4);
+    }
+    Bytes({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+  }
+
+  // mov reg, [rbx + 8 * gpr_index], or a zero for x0
+  void LoadGpr(Reg reg, uint8_t index) {
+    if (index == 0) {
+      Bytes({0x31, static_cast<uint8_t>(0xC0 | (reg << 3) | reg)});
+      return;
+    }
+    Bytes({0x48, 0x8B, static_cast<uint8_t>(0x80 | (reg << 3) | kRbx)});
+    Imm32(index * 8);
+  }
+
+  // mov [rbx + 8 * gpr_index], rax; writes to x0 are dropped like RegisterFile::WriteGpr
+  void StoreGpr(uint8_t index) {
+    if (index == 0) {
+      return;
+    }
+    Bytes({0x48, 0x89, 0x83});
+    Imm32(index * 8);
+  }
+
+  void MovImm(Reg reg, uint64_t value) {
+    Bytes({0x48, static_cast<uint8_t>(0xB8 + reg)});
+    Imm64(value);
+  }
+
+  // mov [r12 + offset], reg
+  void StoreContext(Reg reg, size_t offset) {
+    Bytes({0x49, 0x89, static_cast<uint8_t>(0x84 | (reg << 3)), 0x24});
+    Imm32(static_cast<uint32_t>(offset));
+  }
+
+  void CallHelper(const void *helper) {
+    MovImm(kRax, reinterpret_cast<uint64_t>(helper));
+    Bytes({0xFF, 0xD0});
+  }
+
+  // setcc al; movzx eax, al
+  void SetCondition(Reg reg, Cond cond) {
+    Bytes({0x0F, static_cast<uint8_t>(0x90 | cond), static_cast<uint8_t>(0xC0 | reg)});
+    Bytes({0x0F, 0xB6, static_cast<uint8_t>(0xC0 | (reg << 3) | reg)});
+  }
+
+  void JumpToExit() {
+    Bytes({0xE9});
+    exit_fixups.push_back(code.size());
+    Imm32(0);
+  }
+
+  // test rax, rax; jnz exit
+  void JumpToExitIfRaxNonZero() {
+    Bytes({0x48, 0x85, 0xC0, 0x0F, 0x85});
+    exit_fixups.push_back(code.size());
+    Imm32(0);
+  }
+
+  void ExitBlock(uint64_t next_pc, uint64_t executed) {
+    MovImm(kRax, next_pc);
+    StoreContext(kRax, offsetof(JitContext, pc));
+    MovImm(kRax, executed);
+    StoreContext(kRax, offsetof(JitContext, executed));
+    JumpToExit();
+  }
+};
+
+constexpr uint8_t kOpcodeRType = get_instr_encoding(Instruction::kRtype).opcode;
+constexpr uint8_t kOpcodeIType = get_instr_encoding(Instruction::kItype).opcode;
+constexpr uint8_t kOpcodeLui = get_instr_encoding(Instruction::klui).opcode;
+constexpr uint8_t kOpcodeAuipc = get_instr_encoding(Instruction::kauipc).opcode;
+constexpr uint8_t kOpcodeJal = get_instr_encoding(Instruction::kjal).opcode;
+constexpr uint8_t kOpcodeBranch = 0b1100011;
+
+/**
+ * @brief Emits an R/I-type ALU instruction, leaving the result in rax.
+ */
+void EmitAlu(CodeEmitter &emitter, const DecodedInstruction &op) {
+  emitter.LoadGpr(CodeEmitter::kRax, op.rs1);
+  if (op.alu_src) {
+    emitter.MovImm(CodeEmitter::kRcx, static_cast<uint64_t>(static_cast<int64_t>(op.imm)));
+  } else {
+    emitter.LoadGpr(CodeEmitter::kRcx, op.rs2);
+  }
+
+  switch (op.alu_op) {
+    case alu::AluOp::kAnd: emitter.Bytes({0x48, 0x21, 0xC8}); break;
+    case alu::AluOp::kOr: emitter.Bytes({0x48, 0x09, 0xC8}); break;
+    case alu::AluOp::kXor: emitter.Bytes({0x48, 0x31, 0xC8}); break;
+    // x86 masks 64-bit shift counts to 6 bits, as Alu::execute does
+    case alu::AluOp::kSll: emitter.Bytes({0x48, 0xD3, 0xE0}); break;
+    case alu::AluOp::kSrl: emitter.Bytes({0x48, 0xD3, 0xE8}); break;
+    case alu::AluOp::kSra: emitter.Bytes({0x48, 0xD3, 0xF8}); break;
+    case alu::AluOp::kSlt: {
+      emitter.Bytes({0x48, 0x39, 0xC8});
+      emitter.SetCondition(CodeEmitter::kRax, CodeEmitter::kL);
+      break;
+    }
+    case alu::AluOp::kSltu: {
+      emitter.Bytes({0x48, 0x39, 0xC8});
+      emitter.SetCondition(CodeEmitter::kRax, CodeEmitter::kB);
+      break;
+    }
+    case alu::AluOp::kNone: {
+      emitter.Bytes({0x31, 0xC0});
+      break;
+    }
+    default: {
+      // ECC protected and custom operations: mov rsi, rax; mov rdx, rcx; rdi = op
+      emitter.Bytes({0x48, 0x89, 0xC6, 0x48, 0x89, 0xCA});
+      emitter.Bytes({0x48, 0xBF});
+      emitter.Imm64(static_cast<uint64_t>(op.alu_op));
+      emitter.CallHelper(reinterpret_cast<const void *>(&JitAlu));
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Emits a conditional branch and the block exit. Returns false for encodings left to the interpreter.
+ */
+bool EmitBranch(CodeEmitter &emitter, const DecodedInstruction &op, uint64_t pc, uint64_t executed) {
+  CodeEmitter::Cond cond;
+  bool compare_low_word = false;
+  switch (op.funct3) {
+    case 0b000: cond = CodeEmitter::kE; compare_low_word = true; break; // BEQ, via kSub on the low word
+    case 0b001: cond = CodeEmitter::kNe; compare_low_word = true; break; // BNE
+    case 0b100: cond = CodeEmitter::kL; break; // BLT, via kSlt
+    case 0b101: cond = CodeEmitter::kGe; break; // BGE
+    case 0b110: cond = CodeEmitter::kB; break; // BLTU, via kSltu
+    case 0b111: cond = CodeEmitter::kAe; break; // BGEU
+    default: return false;
+  }
+
+  emitter.LoadGpr(CodeEmitter::kRax, op.rs1);
+  emitter.LoadGpr(CodeEmitter::kRcx, op.rs2);
+  if (compare_low_word) {
+    emitter.Bytes({0x39, 0xC8});
+  } else {
+    emitter.Bytes({0x48, 0x39, 0xC8});
+  }
+  emitter.SetCondition(CodeEmitter::kRdx, cond);
+  emitter.StoreContext(CodeEmitter::kRdx, offsetof(JitContext, branch_flag));
+
+  // rax = taken ? target : fall-through
+  emitter.MovImm(CodeEmitter::kRax, pc + 4);
+  emitter.MovImm(CodeEmitter::kRcx, pc + static_cast<int64_t>(op.imm));
+  emitter.Bytes({0x48, 0x85, 0xD2, 0x48, 0x0F, 0x45, 0xC1});
+  emitter.StoreContext(CodeEmitter::kRax, offsetof(JitContext, pc));
+  emitter.MovImm(CodeEmitter::kRax, executed);
+  emitter.StoreContext(CodeEmitter::kRax, offsetof(JitContext, executed));
+  emitter.JumpToExit();
+  return true;
+}
+
+/**
+ * @brief Emits one entry. Returns true if the entry ended the block.
+ */
+bool EmitEntry(CodeEmitter &emitter, const TranslatedBlock &block, size_t index) {
+  const DecodedInstruction &op = block.entries[index].op;
+  uint64_t pc = block.start_pc + index * 4;
+  bool is_last = index + 1 == block.entries.size();
+
+  // The fault operations draw from and count into the VM's FaultContext, so they go through the interpreter
+  bool uses_fault_context = op.alu_op == alu::AluOp::kInjectFlip || op.alu_op == alu::AluOp::kCheckError;
+
+  if (op.exec_class == ExecClass::kInteger && !uses_fault_context) {
+    if (op.opcode == kOpcodeRType || op.opcode == kOpcodeIType) {
+      EmitAlu(emitter, op);
+      emitter.StoreGpr(op.rd);
+      return false;
+    }
+    if (op.opcode == kOpcodeLui) {
+      emitter.MovImm(CodeEmitter::kRax, static_cast<uint64_t>(static_cast<int64_t>(op.imm << 12)));
+      emitter.StoreGpr(op.rd);
+      return false;
+    }
+    if (op.opcode == kOpcodeAuipc) {
+      emitter.MovImm(CodeEmitter::kRax, pc + static_cast<int64_t>(op.imm << 12));
+      emitter.StoreGpr(op.rd);
+      return false;
+    }
+    if (op.opcode == kOpcodeJal) {
+      // The link value is the same protected pointer WriteBackInteger builds
+      uint64_t link = ecc::compute_ecc(static_cast<uint32_t>(pc + 4));
+      link = ecc::update_metadata(link, ecc::MODE_SEC, 0, 1, ecc::Significance::SIG_POINTER);
+      emitter.MovImm(CodeEmitter::kRax, link);
+      emitter.StoreGpr(op.rd);
+      emitter.ExitBlock(pc + static_cast<int64_t>(op.imm), index + 1);
+      return true;
+    }
+    if (op.opcode == kOpcodeBranch && !op.mem_read && !op.mem_write &&
+        EmitBranch(emitter, op, pc, index + 1)) {
+      return true;
+    }
+  }
+
+  // mov rdi, r12; rsi = index
+  emitter.Bytes({0x4C, 0x89, 0xE7, 0x48, 0xBE});
+  emitter.Imm64(index);
+  emitter.CallHelper(reinterpret_cast<const void *>(&JitInterpret));
+  if (is_last) {
+    emitter.JumpToExit();
+    return true;
+  }
+  emitter.JumpToExitIfRaxNonZero();
+  return false;
+}
+
+} // namespace
+
+RVSSJit::RVSSJit() = default;
+
+RVSSJit::~RVSSJit() {
+#if RVSS_JIT_SUPPORTED
+  if (buffer_) {
+    munmap(buffer_, kBufferSize);
+  }
+#endif
+}
+
+bool RVSSJit::Available() const {
+  return RVSS_JIT_SUPPORTED;
+}
+
+JitFunction RVSSJit::Compile(const TranslatedBlock &block) {
+#if RVSS_JIT_SUPPORTED
+  if (!buffer_) {
+    void *mapping = mmap(nullptr, kBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+      return nullptr;
+    }
+    buffer_ = static_cast<uint8_t *>(mapping);
+    used_ = 0;
+  }
+
+  CodeEmitter emitter;
+  emitter.Prologue();
+  bool ended = false;
+  for (size_t i = 0; i < block.entries.size() && !ended; ++i) {
+    ended = EmitEntry(emitter, block, i);
+  }
+  if (!ended) {
+    emitter.ExitBlock(block.EndPc(), block.entries.size());
+  }
+  emitter.Epilogue();
+
+  size_t offset = (used_ + 15) & ~static_cast<size_t>(15);
+  if (offset + emitter.code.size() > kBufferSize) {
+    return nullptr;
+  }
+
+  // Keep the buffer W^X: writable only while the new code is copied in
+  if (mprotect(buffer_, kBufferSize, PROT_READ | PROT_WRITE) != 0) {
+    return nullptr;
+  }
+  std::memcpy(buffer_ + offset, emitter.code.data(), emitter.code.size());
+  if (mprotect(buffer_, kBufferSize, PROT_READ | PROT_EXEC) != 0) {
+    return nullptr;
+  }
+  used_ = offset + emitter.code.size();
+  return reinterpret_cast<JitFunction>(buffer_ + offset);
+#else
+  (void)block;
+  return nullptr;
+#endif
+}
+
+void RVSSJit::Clear() {
+  used_ = 0;
+}
@@ -0,0 +1,180 @@
+/**
+ * @file rvss_undo_history.cpp
+ * @brief Record encoding for the RVSS undo/redo ring.
+ */
+
+#include "vm/rvss/rvss_undo_history.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr size_t kHeaderSize = 4 + 8 + 8 + 2 + 2;
+constexpr size_t kTrailerSize = 4;
+constexpr size_t kRegisterChangeSize = 2 + 1 + 8 + 8;
+constexpr size_t kMemoryChangeHeaderSize = 8 + 4;
+
+size_t EncodedSize(const StepDelta &delta) {
+  size_t size = kHeaderSize + kTrailerSize + delta.register_changes.size() * kRegisterChangeSize;
+  for (const auto &change : delta.memory_changes) {
+    size += kMemoryChangeHeaderSize + 2 * change.old_bytes_vec.size();
+  }
+  return size;
+}
+
+} // namespace
+
+void UndoHistory::SetCapacity(size_t capacity) {
+  capacity_ = capacity;
+  arena_.clear();
+  arena_.shrink_to_fit();
+  Clear();
+}
+
+void UndoHistory::Clear() {
+  head_ = 0;
+  cursor_ = 0;
+  tail_ = 0;
+  undo_count_ = 0;
+  redo_count_ = 0;
+}
+
+void UndoHistory::WriteBytes(uint64_t position, const void *data, size_t size) {
+  if (size==0) {
+    return;
+  }
+  size_t offset = position % capacity_;
+  size_t first = std::min(size, capacity_ - offset);
+  std::memcpy(arena_.data() + offset, data, first);
+  std::memcpy(arena_.data(), static_cast<const uint8_t *>(data) + first, size - first);
+}
+
+void UndoHistory::ReadBytes(uint64_t position, void *data, size_t size) const {
+  if (size==0) {
+    return;
+  }
+  size_t offset = position % capacity_;
+  size_t first = std::min(size, capacity_ - offset);
+  std::memcpy(data, arena_.data() + offset, first);
+  std::memcpy(static_cast<uint8_t *>(data) + first, arena_.data(), size - first);
+}
+
+uint32_t UndoHistory::ReadLength(uint64_t position) const {
+  uint32_t length = 0;
+  ReadBytes(position, &length, sizeof(length));
+  return length;
+}
+
+void UndoHistory::Push(const StepDelta &delta) {
+  tail_ = cursor_;
+  redo_count_ = 0;
+
+  size_t size = EncodedSize(delta);
+  if (size > capacity_ || delta.register_changes.size() > UINT16_MAX || delta.memory_changes.size() > UINT16_MAX) {
+    Clear();
+    return;
+  }
+  if (arena_.size()!=capacity_) {
+    arena_.resize(capacity_);
+  }
+
+  while (tail_ + size - head_ > capacity_) {
+    head_ += ReadLength(head_);
+    undo_count_--;
+  }
+
+  auto length = static_cast<uint32_t>(size);
+  auto register_count = static_cast<uint16_t>(delta.register_changes.size());
+  auto memory_count = static_cast<uint16_t>(delta.memory_changes.size());
+  uint64_t position = tail_;
+  auto put = [&](const void *data, size_t bytes) {
+    WriteBytes(position, data, bytes);
+    position += bytes;
+  };
+
+  put(&length, 4);
+  put(&delta.old_pc, 8);
+  put(&delta.new_pc, 8);
+  put(&register_count, 2);
+  put(&memory_count, 2);
+  for (const auto &change : delta.register_changes) {
+    auto index = static_cast<uint16_t>(change.reg_index);
+    auto type = static_cast<uint8_t>(change.reg_type);
+    put(&index, 2);
+    put(&type, 1);
+    put(&change.old_value, 8);
+    put(&change.new_value, 8);
+  }
+  for (const auto &change : delta.memory_changes) {
+    // Both byte runs cover the same addresses, so they share one size field
+    auto bytes = static_cast<uint32_t>(change.old_bytes_vec.size());
+    put(&change.address, 8);
+    put(&bytes, 4);
+    put(change.old_bytes_vec.data(), bytes);
+    put(change.new_bytes_vec.data(), bytes);
+  }
+  put(&length, 4);
+
+  tail_ = position;
+  cursor_ = tail_;
+  undo_count_++;
+}
+
+void UndoHistory::Decode(uint64_t position, StepDelta &delta) const {
+  uint16_t register_count = 0;
+  uint16_t memory_count = 0;
+  position += 4;
+  auto get = [&](void *data, size_t bytes) {
+    ReadBytes(position, data, bytes);
+    position += bytes;
+  };
+
+  get(&delta.old_pc, 8);
+  get(&delta.new_pc, 8);
+  get(&register_count, 2);
+  get(&memory_count, 2);
+  delta.register_changes.resize(register_count);
+  for (auto &change : delta.register_changes) {
+    uint16_t index = 0;
+    uint8_t type = 0;
+    get(&index, 2);
+    get(&type, 1);
+    get(&change.old_value, 8);
+    get(&change.new_value, 8);
+    change.reg_index = index;
+    change.reg_type = type;
+  }
+  delta.memory_changes.resize(memory_count);
+  for (auto &change : delta.memory_changes) {
+    uint32_t bytes = 0;
+    get(&change.address, 8);
+    get(&bytes, 4);
+    change.old_bytes_vec.resize(bytes);
+    change.new_bytes_vec.resize(bytes);
+    get(change.old_bytes_vec.data(), bytes);
+    get(change.new_bytes_vec.data(), bytes);
+  }
+}
+
+bool UndoHistory::Undo(StepDelta &delta) {
+  if (undo_count_==0) {
+    return false;
+  }
+  cursor_ -= ReadLength(cursor_ - kTrailerSize);
+  Decode(cursor_, delta);
+  undo_count_--;
+  redo_count_++;
+  return true;
+}
+
+bool UndoHistory::Redo(StepDelta &delta) {
+  if (redo_count_==0) {
+    return false;
+  }
+  Decode(cursor_, delta);
+  cursor_ += ReadLength(cursor_);
+  redo_count_--;
+  undo_count_++;
+  return true;
+}
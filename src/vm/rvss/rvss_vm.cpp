@@ -16,7 +16,6 @@
 #include <cstdint>
 #include <iostream>
 #include <tuple>
-#include <stack>  
 #include <algorithm>
 #include <thread>
 #include <mutex>
@@ -24,15 +23,26 @@
 #include <queue>
 #include <atomic>
 #include <fstream>
+#include <utility>
+#include <exception>
 
 using instruction_set::Instruction;
 using instruction_set::get_instr_encoding;
 
 
 RVSSVM::RVSSVM() : VmBase() {
+  undo_history_.SetCapacity(vm_config::config.getUndoHistorySize());
+  fault_context_.Configure();
+  ecc_telemetry_.SetEnabled(vm_config::config.getEccTelemetry());
+  registers_.SetShadowEcc(vm_config::config.getEccShadowRegisters());
   DumpRegisters(globals::registers_dump_file_path, registers_);
   DumpState(globals::vm_state_dump_file_path);
+}
+
+RVSSVM::~RVSSVM() = default;
 
+void RVSSVM::LoadSamples() {
+  samples_loaded_ = true;
   std::ifstream audio_file("audio_data.txt");
  
   std::string line;
@@ -41,92 +51,145 @@ RVSSVM::RVSSVM() : VmBase() {
       audio_samples_.push_back(std::stoi(line));
     }
     audio_file.close();
-    std::cout << "VM: Loaded "<< audio_samples_.size() << " audio samples\n";
+    if (!sandbox_output_) {
+      std::cout << "VM: Loaded "<< audio_samples_.size() << " audio samples\n";
+    }
   }
-  else{
+  else if (!sandbox_output_) {
     std::cerr << "VM warning could not open audio_data.txt\n";
   }
 
   
   std::ifstream image_file("image_data.txt");
-  // std::string line;
   if(image_file.is_open()){
     while(std::getline(image_file,line)){
       image_samples_.push_back(std::stoi(line));
     }
     image_file.close();
-    std::cout << "VM: Loaded "<< image_samples_.size() << " image samples\n";
+    if (!sandbox_output_) {
+      std::cout << "VM: Loaded "<< image_samples_.size() << " image samples\n";
+    }
   }
-  else {
+  else if (!sandbox_output_) {
     // If you see this, your C++ cannot find the file generated by python
     std::cerr << "DEBUG ERROR: image_data.txt NOT FOUND. Check directory!\n"; 
   }
-  // else{
-  //   std::cerr << "VM warning could not open audio_data.txt or image_data.txt\n";
-  // }
 
+  // Sign-extended samples keep their low word, which is all LWPD encodes
+  audio_encoded_.resize(audio_samples_.size());
+  ecc::compute_ecc_batch(reinterpret_cast<const uint32_t *>(audio_samples_.data()), audio_encoded_.data(),
+                         audio_samples_.size());
+  image_encoded_.resize(image_samples_.size());
+  ecc::compute_ecc_batch(reinterpret_cast<const uint32_t *>(image_samples_.data()), image_encoded_.data(),
+                         image_samples_.size());
 }
 
-RVSSVM::~RVSSVM() = default;
+DecodedInstruction RVSSVM::DecodeInstruction(uint32_t instruction) {
+  return control_unit_.Decode(instruction, ImmGenerator(instruction));
+}
 
 void RVSSVM::Fetch() {
-  current_instruction_ = memory_controller_.ReadWord(program_counter_);
+  current_instruction_ = memory_controller_.FetchWord(program_counter_);
   UpdateProgramCounter(4);
 }
 
 void RVSSVM::Decode() {
-  control_unit_.SetControlSignals(current_instruction_);
+  DecodedInstruction *cached = decode_cache_.Lookup(program_counter_ - 4);
+  if (cached && cached->valid && cached->instruction == current_instruction_) {
+    current_op_ = *cached;
+  } else {
+    current_op_ = DecodeInstruction(current_instruction_);
+  }
 }
 
-void RVSSVM::Execute() {
-  uint8_t opcode = current_instruction_ & 0b1111111;
-  uint8_t funct3 = (current_instruction_ >> 12) & 0b111;
-
-  if (opcode == get_instr_encoding(Instruction::kecall).opcode && 
-      funct3 == get_instr_encoding(Instruction::kecall).funct3) {
-    HandleSyscall();
-    stop_requested_ = true;
+void RVSSVM::FetchDecoded() {
+  DecodedInstruction *cached = decode_cache_.Lookup(program_counter_);
+  if (!cached) {
+    Fetch();
+    current_op_ = DecodeInstruction(current_instruction_);
     return;
   }
-
-  if (instruction_set::isBFloat16Instruction(current_instruction_)){
-    ExecuteBFloat16();
-    return;
+  memory_controller_.RecordFetch(program_counter_);
+  if (!cached->valid) {
+    *cached = DecodeInstruction(memory_controller_.ReadWord_d(program_counter_));
   }
-  else if(instruction_set::isSIMDF32Instruction(current_instruction_)){
-    ExecuteSIMDF32();
-    return;
+  current_op_ = *cached;
+  current_instruction_ = current_op_.instruction;
+  UpdateProgramCounter(4);
+}
+
+void RVSSVM::InvalidateText(uint64_t address, uint64_t size) {
+  VmBase::InvalidateText(address, size);
+  block_cache_.Invalidate(address, size);
+  // A store into the running block ends it after the store itself
+  if (address < block_end_pc_ && address + size > block_start_pc_) {
+    block_length_ = block_position_ + 1;
   }
-  else if (instruction_set::isFInstruction(current_instruction_)) { // RV64 F
-    ExecuteFloat();
-    return;
-  } else if (instruction_set::isDInstruction(current_instruction_)) {
-    ExecuteDouble();
-    return;
-  } else if (opcode==0b1110011) {
-    ExecuteCsr();
-    return;
+}
+
+template <typename Deltas>
+void RVSSVM::Execute() {
+  switch (current_op_.exec_class) {
+    case ExecClass::kSyscall: {
+      HandleSyscall<Deltas>();
+      stop_requested_ = true;
+      return;
+    }
+    case ExecClass::kBFloat16: {
+      ExecuteBFloat16();
+      return;
+    }
+    case ExecClass::kSIMDF32: {
+      ExecuteSIMDF32();
+      return;
+    }
+    case ExecClass::kFloat: { // RV64 F
+      ExecuteFloat();
+      return;
+    }
+    case ExecClass::kDouble: {
+      ExecuteDouble();
+      return;
+    }
+    case ExecClass::kCsr: {
+      ExecuteCsr();
+      return;
+    }
+    case ExecClass::kInteger: {
+      ExecuteInteger();
+      return;
+    }
   }
+}
 
-  uint8_t rs1 = (current_instruction_ >> 15) & 0b11111;
-  uint8_t rs2 = (current_instruction_ >> 20) & 0b11111;
+void RVSSVM::ExecuteInteger() {
+  uint8_t opcode = current_op_.opcode;
+  uint8_t funct3 = current_op_.funct3;
+  uint8_t rs1 = current_op_.rs1;
+  uint8_t rs2 = current_op_.rs2;
 
-  int32_t imm = ImmGenerator(current_instruction_);
+  int32_t imm = current_op_.imm;
 
   uint64_t reg1_value = registers_.ReadGpr(rs1);
   uint64_t reg2_value = registers_.ReadGpr(rs2);
 
   bool overflow = false;
 
-  if (control_unit_.GetAluSrc()) {
+  if (current_op_.alu_src) {
     reg2_value = static_cast<uint64_t>(static_cast<int64_t>(imm));
   }
 
-  alu::AluOp aluOperation = control_unit_.GetAluSignal(current_instruction_, control_unit_.GetAluOp());
-  bool is_addr_calc = control_unit_.GetMemWrite() || control_unit_.GetMemRead();
+  alu::AluOp aluOperation = current_op_.alu_op;
+  bool is_addr_calc = current_op_.mem_write || current_op_.mem_read;
 
-  if(opcode==get_instr_encoding(Instruction::kjalr).opcode){
-    reg1_value = ecc::adaptive_check_error(reg1_value);
+  if (registers_.ShadowEcc()) {
+    ExecuteIntegerShadow(aluOperation, reg2_value, is_addr_calc);
+  }
+  else if(opcode==get_instr_encoding(Instruction::kjalr).opcode){
+    ecc::CheckResult check;
+    uint64_t checked = fault_context_.ecc_policy.check(reg1_value, check);
+    ecc_telemetry_.Record(reg1_value, check, program_counter_ - 4);
+    reg1_value = checked;
     uint64_t clean_addr = static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(reg1_value & 0xFFFFFFFFULL)));
     std::tie(execution_result_,overflow)=alu_.execute(alu::AluOp::kAddrAdd, clean_addr, reg2_value);
   }
@@ -135,18 +198,22 @@ void RVSSVM::Execute() {
 
   }
   else{
-    std::tie(execution_result_, overflow) = alu_.execute(aluOperation, reg1_value, reg2_value);
+    std::tie(execution_result_, overflow) = alu_.execute(aluOperation, reg1_value, reg2_value, fault_context_);
+    if (aluOperation==alu::AluOp::kCheckError) {
+      ecc_telemetry_.Record(reg1_value, fault_context_.last_check, program_counter_ - 4);
+    }
   }
 
 
-  if (control_unit_.GetBranch()) {
+  if (current_op_.branch) {
     if (opcode==get_instr_encoding(Instruction::kjalr).opcode || 
         opcode==get_instr_encoding(Instruction::kjal).opcode) {
       next_pc_ = static_cast<int64_t>(program_counter_); // PC was already updated in Fetch()
       UpdateProgramCounter(-4);
       return_address_ = program_counter_ + 4;
       if (opcode==get_instr_encoding(Instruction::kjalr).opcode) { 
-        uint64_t target_addr = execution_result_ & 0xFFFFFFFFULL;
+        // A packed value keeps its code in the upper half; a shadow one is a full address
+        uint64_t target_addr = registers_.ShadowEcc() ? execution_result_ : execution_result_ & 0xFFFFFFFFULL;
         UpdateProgramCounter(-program_counter_ + (target_addr));
       } else if (opcode==get_instr_encoding(Instruction::kjal).opcode) {
         UpdateProgramCounter(imm);
@@ -157,7 +224,7 @@ void RVSSVM::Execute() {
                opcode==get_instr_encoding(Instruction::kbge).opcode ||
                opcode==get_instr_encoding(Instruction::kbltu).opcode ||
                opcode==get_instr_encoding(Instruction::kbgeu).opcode) {
-      uint64_t data_result=execution_result_&0xFFFFFFFFULL;
+      uint64_t data_result = registers_.ShadowEcc() ? execution_result_ : execution_result_&0xFFFFFFFFULL;
       switch (funct3) {
         case 0b000: {// BEQ
           branch_flag_ = (data_result==0);
@@ -205,17 +272,17 @@ void RVSSVM::Execute() {
 }
 
 void RVSSVM::ExecuteBFloat16() {
-  uint8_t opcode = current_instruction_ & 0b1111111;
-  uint8_t funct3 = (current_instruction_ >> 12) & 0b111;
-  uint8_t funct7 = (current_instruction_ >> 25) & 0b1111111;
+  uint8_t opcode = current_op_.opcode;
+  uint8_t funct3 = current_op_.funct3;
+  uint8_t funct7 = current_op_.funct7;
   uint8_t rm = funct3;
-  uint8_t rs1 = (current_instruction_ >> 15) & 0b11111;
-  uint8_t rs2 = (current_instruction_ >> 20) & 0b11111;
-  uint8_t rs3 = (current_instruction_ >> 27) & 0b11111; 
+  uint8_t rs1 = current_op_.rs1;
+  uint8_t rs2 = current_op_.rs2;
+  uint8_t rs3 = current_op_.rs3; 
 
   uint8_t fcsr_status = 0;
 
-  int32_t imm = ImmGenerator(current_instruction_);
+  int32_t imm = current_op_.imm;
 
   if (rm == 0b111) {
     rm = registers_.ReadCsr(0x002);
@@ -232,11 +299,11 @@ void RVSSVM::ExecuteBFloat16() {
   }
 
 
-  if (control_unit_.GetAluSrc()) {
+  if (current_op_.alu_src) {
     reg2_value = static_cast<uint64_t>(static_cast<int64_t>(imm));
   }
 
-  alu::AluOp aluOperation = control_unit_.GetAluSignal(current_instruction_, control_unit_.GetAluOp());
+  alu::AluOp aluOperation = current_op_.alu_op;
   std::tie(execution_result_, fcsr_status) = alu::Alu::bf16execute(aluOperation, reg1_value, reg2_value, reg3_value, rm);
 
 
@@ -244,17 +311,17 @@ void RVSSVM::ExecuteBFloat16() {
 }
 
 void RVSSVM::ExecuteSIMDF32(){
-  uint8_t opcode = current_instruction_ & 0b1111111;
-  uint8_t funct3 = (current_instruction_ >> 12) & 0b111;
-  uint8_t funct7 = (current_instruction_ >> 25) & 0b1111111;
+  uint8_t opcode = current_op_.opcode;
+  uint8_t funct3 = current_op_.funct3;
+  uint8_t funct7 = current_op_.funct7;
   uint8_t rm = funct3;
-  uint8_t rs1 = (current_instruction_ >> 15) & 0b11111;
-  uint8_t rs2 = (current_instruction_ >> 20) & 0b11111;
-  uint8_t rs3 = (current_instruction_ >> 27) & 0b11111; 
+  uint8_t rs1 = current_op_.rs1;
+  uint8_t rs2 = current_op_.rs2;
+  uint8_t rs3 = current_op_.rs3; 
 
   uint8_t fcsr_status = 0;
 
-  int32_t imm = ImmGenerator(current_instruction_);
+  int32_t imm = current_op_.imm;
 
   if (rm == 0b111) {
     rm = registers_.ReadCsr(0x002);
@@ -271,11 +338,11 @@ void RVSSVM::ExecuteSIMDF32(){
   }
 
 
-  if (control_unit_.GetAluSrc()) {
+  if (current_op_.alu_src) {
     reg2_value = static_cast<uint64_t>(static_cast<int64_t>(imm));
   }
 
-  alu::AluOp aluOperation = control_unit_.GetAluSignal(current_instruction_, control_unit_.GetAluOp());
+  alu::AluOp aluOperation = current_op_.alu_op;
   std::tie(execution_result_, fcsr_status) = alu::Alu::simdf32execute(aluOperation, reg1_value, reg2_value, reg3_value, rm);
 
 
@@ -284,18 +351,82 @@ void RVSSVM::ExecuteSIMDF32(){
 }
 
 
+void RVSSVM::ExecuteIntegerShadow(alu::AluOp op, uint64_t reg2_value, bool is_addr_calc) {
+  const uint8_t opcode = current_op_.opcode;
+  const uint8_t rs1 = current_op_.rs1;
+  const bool is_jalr = opcode==get_instr_encoding(Instruction::kjalr).opcode;
+  uint64_t reg1_value = registers_.ReadGpr(rs1);
+  uint8_t rs1_meta = registers_.ReadGprMeta(rs1);
+
+  // Results are as significant as the most significant operand
+  uint8_t sig = 0;
+  if (opcode==get_instr_encoding(Instruction::kRtype).opcode || opcode==get_instr_encoding(Instruction::kItype).opcode) {
+    sig = ecc::shadow_sig(rs1_meta);
+    if (!current_op_.alu_src) {
+      sig = std::max(sig, ecc::shadow_sig(registers_.ReadGprMeta(current_op_.rs2)));
+    }
+  }
+  execution_meta_ = ecc::shadow_meta(sig, 0);
+  execution_check_.reset();
+
+  if (is_jalr || op==alu::AluOp::kCheckError) {
+    ecc::CheckResult check;
+    reg1_value = CheckShadowGpr(rs1, check, rs1_meta);
+    if (op==alu::AluOp::kCheckError) {
+      fault_context_.last_check = check;
+      fault_context_.corrections += check==ecc::CheckResult::kCorrected;
+    }
+  }
+  if (is_jalr || (is_addr_calc && op==alu::AluOp::kAdd)) {
+    op = alu::AluOp::kAddrAdd;
+  }
+
+  switch (op) {
+    case alu::AluOp::kCheckError: {
+      execution_result_ = static_cast<int64_t>(reg1_value);
+      execution_meta_ = rs1_meta;
+      break;
+    }
+    case alu::AluOp::kInjectFlip: {
+      // rd gets rs1's code, so a flipped bit is an error the next check finds
+      execution_result_ = static_cast<int64_t>(alu::Alu::injectFlip(reg1_value, fault_context_).first);
+      execution_check_ = registers_.ReadGprCheck(rs1);
+      execution_meta_ = rs1_meta;
+      break;
+    }
+    case alu::AluOp::kSetSig: {
+      execution_result_ = static_cast<int64_t>(reg1_value);
+      execution_meta_ = ecc::shadow_meta(static_cast<uint8_t>(reg2_value & ecc::SIG_MASK), ecc::shadow_hist(rs1_meta));
+      break;
+    }
+    default: {
+      execution_result_ = static_cast<int64_t>(alu::Alu::executeWide(op, reg1_value, reg2_value).first);
+      break;
+    }
+  }
+}
+
+uint64_t RVSSVM::CheckShadowGpr(uint8_t reg, ecc::CheckResult &result, uint8_t &meta) {
+  uint64_t value = registers_.ReadGpr(reg);
+  uint8_t check = registers_.ReadGprCheck(reg);
+  const uint8_t sig = ecc::shadow_sig(meta);
+  result = fault_context_.ecc_policy.check_shadow(value, check, meta);
+  ecc_telemetry_.Record(sig, 0, result, program_counter_ - 4);
+  return value;
+}
+
 void RVSSVM::ExecuteFloat() {
-  uint8_t opcode = current_instruction_ & 0b1111111;
-  uint8_t funct3 = (current_instruction_ >> 12) & 0b111;
-  uint8_t funct7 = (current_instruction_ >> 25) & 0b1111111;
+  uint8_t opcode = current_op_.opcode;
+  uint8_t funct3 = current_op_.funct3;
+  uint8_t funct7 = current_op_.funct7;
   uint8_t rm = funct3;
-  uint8_t rs1 = (current_instruction_ >> 15) & 0b11111;
-  uint8_t rs2 = (current_instruction_ >> 20) & 0b11111;
-  uint8_t rs3 = (current_instruction_ >> 27) & 0b11111;
+  uint8_t rs1 = current_op_.rs1;
+  uint8_t rs2 = current_op_.rs2;
+  uint8_t rs3 = current_op_.rs3;
 
   uint8_t fcsr_status = 0;
 
-  int32_t imm = ImmGenerator(current_instruction_);
+  int32_t imm = current_op_.imm;
 
   if (rm==0b111) {
     rm = registers_.ReadCsr(0x002);
@@ -309,11 +440,11 @@ void RVSSVM::ExecuteFloat() {
     reg1_value = registers_.ReadGpr(rs1);
   }
 
-  if (control_unit_.GetAluSrc()) {
+  if (current_op_.alu_src) {
     reg2_value = static_cast<uint64_t>(static_cast<int64_t>(imm));
   }
 
-  alu::AluOp aluOperation = control_unit_.GetAluSignal(current_instruction_, control_unit_.GetAluOp());
+  alu::AluOp aluOperation = current_op_.alu_op;
   std::tie(execution_result_, fcsr_status) = alu::Alu::fpexecute(aluOperation, reg1_value, reg2_value, reg3_value, rm);
 
   // std::cout << "+++++ Float execution result: " << execution_result_ << std::endl;
@@ -323,17 +454,17 @@ void RVSSVM::ExecuteFloat() {
 }
 
 void RVSSVM::ExecuteDouble() {
-  uint8_t opcode = current_instruction_ & 0b1111111;
-  uint8_t funct3 = (current_instruction_ >> 12) & 0b111;
-  uint8_t funct7 = (current_instruction_ >> 25) & 0b1111111;
+  uint8_t opcode = current_op_.opcode;
+  uint8_t funct3 = current_op_.funct3;
+  uint8_t funct7 = current_op_.funct7;
   uint8_t rm = funct3;
-  uint8_t rs1 = (current_instruction_ >> 15) & 0b11111;
-  uint8_t rs2 = (current_instruction_ >> 20) & 0b11111;
-  uint8_t rs3 = (current_instruction_ >> 27) & 0b11111;
+  uint8_t rs1 = current_op_.rs1;
+  uint8_t rs2 = current_op_.rs2;
+  uint8_t rs3 = current_op_.rs3;
 
   uint8_t fcsr_status = 0;
 
-  int32_t imm = ImmGenerator(current_instruction_);
+  int32_t imm = current_op_.imm;
 
   uint64_t reg1_value = registers_.ReadFpr(rs1);
   uint64_t reg2_value = registers_.ReadFpr(rs2);
@@ -343,16 +474,16 @@ void RVSSVM::ExecuteDouble() {
     reg1_value = registers_.ReadGpr(rs1);
   }
 
-  if (control_unit_.GetAluSrc()) {
+  if (current_op_.alu_src) {
     reg2_value = static_cast<uint64_t>(static_cast<int64_t>(imm));
   }
 
-  alu::AluOp aluOperation = control_unit_.GetAluSignal(current_instruction_, control_unit_.GetAluOp());
+  alu::AluOp aluOperation = current_op_.alu_op;
   std::tie(execution_result_, fcsr_status) = alu::Alu::dfpexecute(aluOperation, reg1_value, reg2_value, reg3_value, rm);
 }
 
 void RVSSVM::ExecuteCsr() {
-  uint8_t rs1 = (current_instruction_ >> 15) & 0b11111;
+  uint8_t rs1 = current_op_.rs1;
   uint16_t csr = (current_instruction_ >> 20) & 0xFFF;
   uint64_t csr_val = registers_.ReadCsr(csr);
 
@@ -363,69 +494,75 @@ void RVSSVM::ExecuteCsr() {
 }
 
 // TODO: implement writeback for syscalls
+template <typename Deltas>
 void RVSSVM::HandleSyscall() {
   uint64_t syscall_number = registers_.ReadGpr(17);
+  std::ostream &out = ProgramOutput();
   switch (syscall_number) {
     case SYSCALL_PRINT_INT: {
         if (!globals::vm_as_backend) {
-            std::cout << "[Syscall output: ";
+            out << "[Syscall output: ";
         } else {
-          std::cout << "VM_STDOUT_START";
+          out << "VM_STDOUT_START";
         }
-        std::cout << static_cast<int64_t>(registers_.ReadGpr(10)); // Print signed integer
+        out << static_cast<int64_t>(registers_.ReadGpr(10)); // Print signed integer
         if (!globals::vm_as_backend) {
-            std::cout << "]" << std::endl;
+            out << "]" << std::endl;
         } else {
-          std::cout << "VM_STDOUT_END" << std::endl;
+          out << "VM_STDOUT_END" << std::endl;
         }
         break;
     }
     case SYSCALL_PRINT_FLOAT: { // print float
         if (!globals::vm_as_backend) {
-            std::cout << "[Syscall output: ";
+            out << "[Syscall output: ";
         } else {
-          std::cout << "VM_STDOUT_START";
+          out << "VM_STDOUT_START";
         }
         float float_value;
         uint64_t raw = registers_.ReadGpr(10);
         std::memcpy(&float_value, &raw, sizeof(float_value));
-        std::cout << std::setprecision(std::numeric_limits<float>::max_digits10) << float_value;
+        out << std::setprecision(std::numeric_limits<float>::max_digits10) << float_value;
         if (!globals::vm_as_backend) {
-            std::cout << "]" << std::endl;
+            out << "]" << std::endl;
         } else {
-          std::cout << "VM_STDOUT_END" << std::endl;
+          out << "VM_STDOUT_END" << std::endl;
         }
         break;
     }
     case SYSCALL_PRINT_DOUBLE: { // print double
         if (!globals::vm_as_backend) {
-            std::cout << "[Syscall output: ";
+            out << "[Syscall output: ";
         } else {
-          std::cout << "VM_STDOUT_START";
+          out << "VM_STDOUT_START";
         }
         double double_value;
         uint64_t raw = registers_.ReadGpr(10);
         std::memcpy(&double_value, &raw, sizeof(double_value));
-        std::cout << std::setprecision(std::numeric_limits<double>::max_digits10) << double_value;
+        out << std::setprecision(std::numeric_limits<double>::max_digits10) << double_value;
         if (!globals::vm_as_backend) {
-            std::cout << "]" << std::endl;
+            out << "]" << std::endl;
         } else {
-          std::cout << "VM_STDOUT_END" << std::endl;
+          out << "VM_STDOUT_END" << std::endl;
         }
         break;
     }
     case SYSCALL_PRINT_STRING: {
         if (!globals::vm_as_backend) {
-            std::cout << "[Syscall output: ";
+            out << "[Syscall output: ";
         }
         PrintString(registers_.ReadGpr(10)); // Print string
         if (!globals::vm_as_backend) {
-            std::cout << "]" << std::endl;
+            out << "]" << std::endl;
         }
         break;
     }
     case SYSCALL_EXIT: {
         stop_requested_ = true; // Stop the VM
+        if (sandbox_output_) {
+          exit_code_ = registers_.ReadGpr(10);
+          break;
+        }
         if (!globals::vm_as_backend) {
             std::cout << "VM_EXIT" << std::endl;
         }
@@ -442,7 +579,12 @@ void RVSSVM::HandleSyscall() {
       if (file_descriptor == 0) {
         // Read from stdin
         std::string input;
-        {
+        if (input_position_ < input_log_.size()) {
+          // Replaying from a checkpoint: read what was read the first time
+          input = input_log_[input_position_];
+        } else if (sandbox_output_) {
+          // No one to type anything: the read sees end of input
+        } else {
           std::cout << "VM_STDIN_START" << std::endl;
           output_status_ = "VM_STDIN_START";
           std::unique_lock<std::mutex> lock(input_mutex_);
@@ -454,43 +596,50 @@ void RVSSVM::HandleSyscall() {
 
           input = input_queue_.front();
           input_queue_.pop();
+          input_log_.push_back(input);
         }
+        input_position_++;
 
 
-        std::vector<uint8_t> old_bytes_vec(length, 0);
-        std::vector<uint8_t> new_bytes_vec(length, 0);
-
-        for (size_t i = 0; i < length; ++i) {
-          old_bytes_vec[i] = memory_controller_.ReadByte(buffer_address + i);
+        std::vector<uint8_t> old_bytes_vec;
+        if constexpr (Deltas::kRecord) {
+          old_bytes_vec.resize(length);
+          for (size_t i = 0; i < length; ++i) {
+            old_bytes_vec[i] = memory_controller_.ReadByte_d(buffer_address + i);
+          }
         }
         
         for (size_t i = 0; i < input.size() && i < length; ++i) {
-          memory_controller_.WriteByte(buffer_address + i, static_cast<uint8_t>(input[i]));
+          memory_controller_.WriteByte_d(buffer_address + i, static_cast<uint8_t>(input[i]));
         }
         if (input.size() < length) {
-          memory_controller_.WriteByte(buffer_address + input.size(), '\0');
+          memory_controller_.WriteByte_d(buffer_address + input.size(), '\0');
         }
+        InvalidateText(buffer_address, length);
 
-        for (size_t i = 0; i < length; ++i) {
-          new_bytes_vec[i] = memory_controller_.ReadByte(buffer_address + i);
-        }
+        if constexpr (Deltas::kRecord) {
+          std::vector<uint8_t> new_bytes_vec(length, 0);
+          for (size_t i = 0; i < length; ++i) {
+            new_bytes_vec[i] = memory_controller_.ReadByte_d(buffer_address + i);
+          }
 
-        current_delta_.memory_changes.push_back({
-          buffer_address, 
-          old_bytes_vec, 
-          new_bytes_vec
-        });
+          current_delta_.memory_changes.push_back({
+            buffer_address, 
+            std::move(old_bytes_vec), 
+            std::move(new_bytes_vec)
+          });
+        }
 
         uint64_t old_reg = registers_.ReadGpr(10);
         unsigned int reg_index = 10;
         unsigned int reg_type = 0; // 0 for GPR, 1 for CSR, 2 for FPR
         uint64_t new_reg = std::min(static_cast<uint64_t>(length), static_cast<uint64_t>(input.size()));
         registers_.WriteGpr(10, new_reg); 
-        if (old_reg != new_reg) {
+        if (Deltas::kRecord && old_reg != new_reg) {
           current_delta_.register_changes.push_back({reg_index, reg_type, old_reg, new_reg});
         }
 
-      } else {
+      } else if (!sandbox_output_) {
           std::cerr << "Unsupported file descriptor: " << file_descriptor << std::endl;
       }
       break;
@@ -501,59 +650,70 @@ void RVSSVM::HandleSyscall() {
         uint64_t length = registers_.ReadGpr(12);
 
         if (file_descriptor == 1) { // stdout
-          std::cout << "VM_STDOUT_START";
+          out << "VM_STDOUT_START";
           output_status_ = "VM_STDOUT_START";
           uint64_t bytes_printed = 0;
           for (uint64_t i = 0; i < length; ++i) {
-              char c = memory_controller_.ReadByte(buffer_address + i);
+              char c = memory_controller_.ReadByte_d(buffer_address + i);
               // if (c == '\0') {
               //     break;
               // }
-              std::cout << c;
+              out << c;
               bytes_printed++;
           }
-          std::cout << std::flush; 
+          out << std::flush; 
           output_status_ = "VM_STDOUT_END";
-          std::cout << "VM_STDOUT_END" << std::endl;
+          out << "VM_STDOUT_END" << std::endl;
 
           uint64_t old_reg = registers_.ReadGpr(10);
           unsigned int reg_index = 10;
           unsigned int reg_type = 0; // 0 for GPR, 1 for CSR, 2 for FPR
           uint64_t new_reg = std::min(static_cast<uint64_t>(length), bytes_printed);
           registers_.WriteGpr(10, new_reg);
-          if (old_reg != new_reg) {
+          if (Deltas::kRecord && old_reg != new_reg) {
             current_delta_.register_changes.push_back({reg_index, reg_type, old_reg, new_reg});
           }
-        } else {
+        } else if (!sandbox_output_) {
             std::cerr << "Unsupported file descriptor: " << file_descriptor << std::endl;
         }
         break;
     }
     default: {
-      std::cerr << "Unknown syscall number: " << syscall_number << std::endl;
+      if (!sandbox_output_) {
+        std::cerr << "Unknown syscall number: " << syscall_number << std::endl;
+      }
       break;
     }
   }
 }
 
+template <typename Deltas>
 void RVSSVM::WriteMemory() {
-  uint8_t opcode = current_instruction_ & 0b1111111;
-  uint8_t rs2 = (current_instruction_ >> 20) & 0b11111;
-  uint8_t funct3 = (current_instruction_ >> 12) & 0b111;
-
-  if (opcode == 0b1110011 && funct3 == 0b000) {
-    return;
+  switch (current_op_.exec_class) {
+    case ExecClass::kSyscall: return;
+    case ExecClass::kFloat: // RV64 F
+    case ExecClass::kBFloat16: {
+      WriteMemoryFloat<Deltas>();
+      return;
+    }
+    case ExecClass::kDouble:
+    case ExecClass::kSIMDF32: {
+      WriteMemoryDouble<Deltas>();
+      return;
+    }
+    default: {
+      WriteMemoryInteger<Deltas>();
+      return;
+    }
   }
+}
 
-  if (instruction_set::isFInstruction(current_instruction_)) { // RV64 F
-    WriteMemoryFloat();
-    return;
-  } else if (instruction_set::isDInstruction(current_instruction_)) {
-    WriteMemoryDouble();
-    return;
-  }
+template <typename Deltas>
+void RVSSVM::WriteMemoryInteger() {
+  uint8_t rs2 = current_op_.rs2;
+  uint8_t funct3 = current_op_.funct3;
 
-  if (control_unit_.GetMemRead()) {
+  if (current_op_.mem_read) {
     switch (funct3) {
       case 0b000: {// LB
         memory_result_ = static_cast<int8_t>(memory_controller_.ReadByte(execution_result_));
@@ -588,9 +748,14 @@ void RVSSVM::WriteMemory() {
         const uint64_t AUDIO_INPUT_ADDRESS = 0x30000000;
         const uint64_t IMAGE_INPUT_ADDRESS = 0x40000000;
         // std::cout << "Loading from address: " << execution_result_ << "\n";
+        memory_encoded_.reset();
+        if((load_address==AUDIO_INPUT_ADDRESS || load_address==IMAGE_INPUT_ADDRESS) && !samples_loaded_){
+          LoadSamples();
+        }
         if(load_address==AUDIO_INPUT_ADDRESS){
           int32_t sample =0;
           if(audio_sample_index_<audio_samples_.size()){
+            memory_encoded_ = audio_encoded_[audio_sample_index_];
             sample = audio_samples_[audio_sample_index_++];
           }
           else{
@@ -601,8 +766,11 @@ void RVSSVM::WriteMemory() {
         }
         else if(load_address==IMAGE_INPUT_ADDRESS){
           int32_t sample =0;
-          std::cout << "Entering into the block and placing the things \n";
+          if (!sandbox_output_) {
+            std::cout << "Entering into the block and placing the things \n";
+          }
           if(image_sample_index_<image_samples_.size()){
+            memory_encoded_ = image_encoded_[image_sample_index_];
             sample = image_samples_[image_sample_index_++];
           }
           else{
@@ -627,23 +795,33 @@ void RVSSVM::WriteMemory() {
   // TODO: use direct read to read memory for undo/redo functionality, i.e. ReadByte -> ReadByte_d
 
 
-  if (control_unit_.GetMemWrite()) {
+  if (current_op_.mem_write) {
     switch (funct3) {
       case 0b000: {// SB
         addr = execution_result_;
-        old_bytes_vec.push_back(memory_controller_.ReadByte(addr));
+        if constexpr (Deltas::kRecord) {
+          old_bytes_vec.push_back(memory_controller_.ReadByte_d(addr));
+        }
         memory_controller_.WriteByte(execution_result_, registers_.ReadGpr(rs2) & 0xFF);
-        new_bytes_vec.push_back(memory_controller_.ReadByte(addr));
+        InvalidateText(addr, 1);
+        if constexpr (Deltas::kRecord) {
+          new_bytes_vec.push_back(memory_controller_.ReadByte_d(addr));
+        }
         break;
       }
       case 0b001: {// SH
         addr = execution_result_;
-        for (size_t i = 0; i < 2; ++i) {
-          old_bytes_vec.push_back(memory_controller_.ReadByte(addr + i));
+        if constexpr (Deltas::kRecord) {
+          for (size_t i = 0; i < 2; ++i) {
+            old_bytes_vec.push_back(memory_controller_.ReadByte_d(addr + i));
+          }
         }
         memory_controller_.WriteHalfWord(execution_result_, registers_.ReadGpr(rs2) & 0xFFFF);
-        for (size_t i = 0; i < 2; ++i) {
-          new_bytes_vec.push_back(memory_controller_.ReadByte(addr + i));
+        InvalidateText(addr, 2);
+        if constexpr (Deltas::kRecord) {
+          for (size_t i = 0; i < 2; ++i) {
+            new_bytes_vec.push_back(memory_controller_.ReadByte_d(addr + i));
+          }
         }
         break;
       }
@@ -652,6 +830,10 @@ void RVSSVM::WriteMemory() {
         if(addr == 0x10000000){
           uint32_t audio_sample = static_cast<uint32_t>(registers_.ReadGpr(rs2)&0xFFFFFFFF);
 
+          // A replay has already written these samples once
+          if (replaying_ || sandbox_output_) {
+            break;
+          }
           std::ofstream audio_log("audio_out.log",std::ios::app);
           if(audio_log.is_open()){
             audio_log << audio_sample << "\n";
@@ -662,6 +844,9 @@ void RVSSVM::WriteMemory() {
           uint32_t image_sample = static_cast<uint32_t>(registers_.ReadGpr(rs2)&0xFFFFFFFF);
 
           // std::cout << "Entering into the block\n";
+          if (replaying_ || sandbox_output_) {
+            break;
+          }
           static std::ofstream image_log("image_out.log",std::ios::app);
           if(image_log.is_open()){
             image_log << image_sample << "\n";
@@ -670,42 +855,53 @@ void RVSSVM::WriteMemory() {
           break;
         }
 
-        for (size_t i = 0; i < 4; ++i) {
-          old_bytes_vec.push_back(memory_controller_.ReadByte(addr + i));
+        if constexpr (Deltas::kRecord) {
+          for (size_t i = 0; i < 4; ++i) {
+            old_bytes_vec.push_back(memory_controller_.ReadByte_d(addr + i));
+          }
         }
         memory_controller_.WriteWord(execution_result_, registers_.ReadGpr(rs2) & 0xFFFFFFFF);
-        for (size_t i = 0; i < 4; ++i) {
-          new_bytes_vec.push_back(memory_controller_.ReadByte(addr + i));
+        InvalidateText(addr, 4);
+        if constexpr (Deltas::kRecord) {
+          for (size_t i = 0; i < 4; ++i) {
+            new_bytes_vec.push_back(memory_controller_.ReadByte_d(addr + i));
+          }
         }
         break;
       }
       case 0b011: {// SD
         addr = execution_result_;
-        for (size_t i = 0; i < 8; ++i) {
-          old_bytes_vec.push_back(memory_controller_.ReadByte(addr + i));
+        if constexpr (Deltas::kRecord) {
+          for (size_t i = 0; i < 8; ++i) {
+            old_bytes_vec.push_back(memory_controller_.ReadByte_d(addr + i));
+          }
         }
         memory_controller_.WriteDoubleWord(execution_result_, registers_.ReadGpr(rs2) & 0xFFFFFFFFFFFFFFFF);
-        for (size_t i = 0; i < 8; ++i) {
-          new_bytes_vec.push_back(memory_controller_.ReadByte(addr + i));
+        InvalidateText(addr, 8);
+        if constexpr (Deltas::kRecord) {
+          for (size_t i = 0; i < 8; ++i) {
+            new_bytes_vec.push_back(memory_controller_.ReadByte_d(addr + i));
+          }
         }
         break;
       }
     }
   }
 
-  if (old_bytes_vec != new_bytes_vec) {
+  if (Deltas::kRecord && old_bytes_vec != new_bytes_vec) {
     current_delta_.memory_changes.push_back({
       addr,
-      old_bytes_vec,
-      new_bytes_vec
+      std::move(old_bytes_vec),
+      std::move(new_bytes_vec)
     });
   }
 }
 
+template <typename Deltas>
 void RVSSVM::WriteMemoryFloat() {
-  uint8_t rs2 = (current_instruction_ >> 20) & 0b11111;
+  uint8_t rs2 = current_op_.rs2;
 
-  if (control_unit_.GetMemRead()) { // FLW
+  if (current_op_.mem_read) { // FLW
     memory_result_ = memory_controller_.ReadWord(execution_result_);
   }
 
@@ -715,28 +911,34 @@ void RVSSVM::WriteMemoryFloat() {
   std::vector<uint8_t> old_bytes_vec;
   std::vector<uint8_t> new_bytes_vec;
 
-  if (control_unit_.GetMemWrite()) { // FSW
+  if (current_op_.mem_write) { // FSW
     addr = execution_result_;
-    for (size_t i = 0; i < 4; ++i) {
-      old_bytes_vec.push_back(memory_controller_.ReadByte(addr + i));
+    if constexpr (Deltas::kRecord) {
+      for (size_t i = 0; i < 4; ++i) {
+        old_bytes_vec.push_back(memory_controller_.ReadByte_d(addr + i));
+      }
     }
     uint32_t val = registers_.ReadFpr(rs2) & 0xFFFFFFFF;
     memory_controller_.WriteWord(execution_result_, val);
+    InvalidateText(addr, 4);
     // new_bytes_vec.push_back(memory_controller_.ReadByte(addr));
-    for (size_t i = 0; i < 4; ++i) {
-      new_bytes_vec.push_back(memory_controller_.ReadByte(addr + i));
+    if constexpr (Deltas::kRecord) {
+      for (size_t i = 0; i < 4; ++i) {
+        new_bytes_vec.push_back(memory_controller_.ReadByte_d(addr + i));
+      }
     }
   }
 
-  if (old_bytes_vec!=new_bytes_vec) {
-    current_delta_.memory_changes.push_back({addr, old_bytes_vec, new_bytes_vec});
+  if (Deltas::kRecord && old_bytes_vec!=new_bytes_vec) {
+    current_delta_.memory_changes.push_back({addr, std::move(old_bytes_vec), std::move(new_bytes_vec)});
   }
 }
 
+template <typename Deltas>
 void RVSSVM::WriteMemoryDouble() {
-  uint8_t rs2 = (current_instruction_ >> 20) & 0b11111;
+  uint8_t rs2 = current_op_.rs2;
 
-  if (control_unit_.GetMemRead()) {// FLD
+  if (current_op_.mem_read) {// FLD
     memory_result_ = memory_controller_.ReadDoubleWord(execution_result_);
   }
 
@@ -744,64 +946,88 @@ void RVSSVM::WriteMemoryDouble() {
   std::vector<uint8_t> old_bytes_vec;
   std::vector<uint8_t> new_bytes_vec;
 
-  if (control_unit_.GetMemWrite()) {// FSD
+  if (current_op_.mem_write) {// FSD
     addr = execution_result_;
-    for (size_t i = 0; i < 8; ++i) {
-      old_bytes_vec.push_back(memory_controller_.ReadByte(addr + i));
+    if constexpr (Deltas::kRecord) {
+      for (size_t i = 0; i < 8; ++i) {
+        old_bytes_vec.push_back(memory_controller_.ReadByte_d(addr + i));
+      }
     }
     memory_controller_.WriteDoubleWord(execution_result_, registers_.ReadFpr(rs2));
-    for (size_t i = 0; i < 8; ++i) {
-      new_bytes_vec.push_back(memory_controller_.ReadByte(addr + i));
+    InvalidateText(addr, 8);
+    if constexpr (Deltas::kRecord) {
+      for (size_t i = 0; i < 8; ++i) {
+        new_bytes_vec.push_back(memory_controller_.ReadByte_d(addr + i));
+      }
     }
   }
 
-  if (old_bytes_vec!=new_bytes_vec) {
-    current_delta_.memory_changes.push_back({addr, old_bytes_vec, new_bytes_vec});
+  if (Deltas::kRecord && old_bytes_vec!=new_bytes_vec) {
+    current_delta_.memory_changes.push_back({addr, std::move(old_bytes_vec), std::move(new_bytes_vec)});
   }
 }
 
+template <typename Deltas>
 void RVSSVM::WriteBack() {
-  uint8_t opcode = current_instruction_ & 0b1111111;
-  uint8_t funct3 = (current_instruction_ >> 12) & 0b111;
-  uint8_t rd = (current_instruction_ >> 7) & 0b11111;
-  int32_t imm = ImmGenerator(current_instruction_);
-
-  if (opcode == get_instr_encoding(Instruction::kecall).opcode && 
-      funct3 == get_instr_encoding(Instruction::kecall).funct3) { // ecall
-    return;
+  switch (current_op_.exec_class) {
+    case ExecClass::kSyscall: return; // ecall
+    case ExecClass::kFloat: // RV64 F
+    case ExecClass::kBFloat16: {
+      WriteBackFloat<Deltas>();
+      return;
+    }
+    case ExecClass::kDouble:
+    case ExecClass::kSIMDF32: {
+      WriteBackDouble<Deltas>();
+      return;
+    }
+    case ExecClass::kCsr: { // CSR opcode
+      WriteBackCsr();
+      return;
+    }
+    case ExecClass::kInteger: {
+      WriteBackInteger<Deltas>();
+      return;
+    }
   }
+}
 
-  if (instruction_set::isFInstruction(current_instruction_)) { // RV64 F
-    WriteBackFloat();
-    return;
-  } else if (instruction_set::isDInstruction(current_instruction_)) {
-    WriteBackDouble();
-    return;
-  } else if (opcode==0b1110011) { // CSR opcode
-    WriteBackCsr();
-    return;
-  }
+template <typename Deltas>
+void RVSSVM::WriteBackInteger() {
+  uint8_t opcode = current_op_.opcode;
+  uint8_t rd = current_op_.rd;
+  int32_t imm = current_op_.imm;
 
   uint64_t old_reg = registers_.ReadGpr(rd);
   unsigned int reg_index = rd;
   unsigned int reg_type = 0; // 0 for GPR, 1 for CSR, 2 for FPR
 
 
-  if (control_unit_.GetRegWrite()) { 
+  if (current_op_.reg_write) { 
     switch (opcode) {
       case get_instr_encoding(Instruction::kRtype).opcode: /* R-Type */
       case get_instr_encoding(Instruction::kItype).opcode: /* I-Type */
       case get_instr_encoding(Instruction::kauipc).opcode: /* AUIPC */ {
-        registers_.WriteGpr(rd, execution_result_);
+        if (registers_.ShadowEcc()) {
+          uint64_t value = static_cast<uint64_t>(execution_result_);
+          registers_.WriteGprShadow(rd, value, execution_check_.value_or(ecc::secded64_check_byte(value)),
+                                    execution_meta_);
+        } else {
+          registers_.WriteGpr(rd, execution_result_);
+        }
         break;
       }
       case get_instr_encoding(Instruction::kLoadType).opcode: /* Load */ {  
-        if(control_unit_.IsLoadProtected()){
+        if (current_op_.load_protected && registers_.ShadowEcc()) {
+          uint64_t value = static_cast<uint64_t>(memory_result_);
+          registers_.WriteGprShadow(rd, value, ecc::secded64_check_byte(value), ecc::shadow_meta(1, 0));
+        }
+        else if(current_op_.load_protected){
           // std::cout << "entered the block\n";
           // std::cout << "mem_result:" << memory_result_ << "\n";
           uint32_t data_from_mem = static_cast<uint32_t>(memory_result_ & 0xFFFFFFFF);
 
-          uint64_t protected_value = ecc::compute_ecc(data_from_mem);
+          uint64_t protected_value = memory_encoded_ ? *memory_encoded_ : ecc::compute_ecc(data_from_mem);
 
           uint64_t init_mode =ecc::MODE_SEC;
           uint8_t init_hist = 0;
@@ -821,6 +1047,11 @@ void RVSSVM::WriteBack() {
       }
       case get_instr_encoding(Instruction::kjalr).opcode: /* JALR */
       case get_instr_encoding(Instruction::kjal).opcode: /* JAL */ {
+        if (registers_.ShadowEcc()) {
+          uint64_t link = static_cast<uint64_t>(next_pc_);
+          registers_.WriteGprShadow(rd, link, ecc::secded64_check_byte(link), ecc::shadow_meta(ecc::SIG_POINTER, 0));
+          break;
+        }
         uint32_t pointer_data =static_cast<uint32_t>(next_pc_ & 0xFFFFFFFF);
         uint64_t protected_pointer =ecc::compute_ecc(pointer_data);
 
@@ -845,23 +1076,24 @@ void RVSSVM::WriteBack() {
   }
 
   uint64_t new_reg = registers_.ReadGpr(rd);
-  if (old_reg!=new_reg) {
+  if (Deltas::kRecord && old_reg!=new_reg) {
     current_delta_.register_changes.push_back({reg_index, reg_type, old_reg, new_reg});
   }
 
 }
 
+template <typename Deltas>
 void RVSSVM::WriteBackFloat() {
-  uint8_t opcode = current_instruction_ & 0b1111111;
-  uint8_t funct7 = (current_instruction_ >> 25) & 0b1111111;
-  uint8_t rd = (current_instruction_ >> 7) & 0b11111;
+  uint8_t opcode = current_op_.opcode;
+  uint8_t funct7 = current_op_.funct7;
+  uint8_t rd = current_op_.rd;
 
   uint64_t old_reg = 0;
   unsigned int reg_index = rd;
   unsigned int reg_type = 2; // 0 for GPR, 1 for CSR, 2 for FPR
   uint64_t new_reg = 0;
 
-  if (control_unit_.GetRegWrite()) {
+  if (current_op_.reg_write) {
     switch(funct7) {
       // write to GPR
       case get_instr_encoding(Instruction::kfle_s).funct7: // f(eq|lt|le).s
@@ -921,22 +1153,23 @@ void RVSSVM::WriteBackFloat() {
     // }
   }
 
-  if (old_reg!=new_reg) {
+  if (Deltas::kRecord && old_reg!=new_reg) {
     current_delta_.register_changes.push_back({reg_index, reg_type, old_reg, new_reg});
   }
 }
 
+template <typename Deltas>
 void RVSSVM::WriteBackDouble() {
-  uint8_t opcode = current_instruction_ & 0b1111111;
-  uint8_t funct7 = (current_instruction_ >> 25) & 0b1111111;
-  uint8_t rd = (current_instruction_ >> 7) & 0b11111;
+  uint8_t opcode = current_op_.opcode;
+  uint8_t funct7 = current_op_.funct7;
+  uint8_t rd = current_op_.rd;
 
   uint64_t old_reg = 0;
   unsigned int reg_index = rd;
   unsigned int reg_type = 2; // 0 for GPR, 1 for CSR, 2 for FPR
   uint64_t new_reg = 0;
 
-  if (control_unit_.GetRegWrite()) {
+  if (current_op_.reg_write) {
     // write to GPR
     if (funct7==0b1010001
         || funct7==0b1100001
@@ -960,7 +1193,7 @@ void RVSSVM::WriteBackDouble() {
     }
   }
 
-  if (old_reg!=new_reg) {
+  if (Deltas::kRecord && old_reg!=new_reg) {
     current_delta_.register_changes.push_back({reg_index, reg_type, old_reg, new_reg});
   }
 
@@ -968,8 +1201,8 @@ void RVSSVM::WriteBackDouble() {
 }
 
 void RVSSVM::WriteBackCsr() {
-  uint8_t rd = (current_instruction_ >> 7) & 0b11111;
-  uint8_t funct3 = (current_instruction_ >> 12) & 0b111;
+  uint8_t rd = current_op_.rd;
+  uint8_t funct3 = current_op_.funct3;
 
   switch (funct3) {
     case get_instr_encoding(Instruction::kcsrrw).funct3: { // CSRRW
@@ -1014,23 +1247,150 @@ void RVSSVM::WriteBackCsr() {
 
 }
 
-void RVSSVM::Run() {
-  ClearStop();
-  uint64_t instruction_executed = 0;
+// Blocks only run from Run(), so their handlers never record deltas
+void RVSSVM::HandleIntegerAlu(RVSSVM &vm) {
+  vm.ExecuteInteger();
+  vm.WriteBackInteger<SkipDeltas>();
+}
 
-  while (!stop_requested_ && program_counter_ < program_size_) {
-    if (instruction_executed > vm_config::config.getInstructionExecutionLimit()){
-      std::cout << "Execution stopped — limit " 
-              << vm_config::config.getInstructionExecutionLimit()
-              << " reached after " << instruction_executed << " instructions.\n";
+void RVSSVM::HandleIntegerMemory(RVSSVM &vm) {
+  vm.ExecuteInteger();
+  vm.WriteMemoryInteger<SkipDeltas>();
+  vm.WriteBackInteger<SkipDeltas>();
+}
+
+void RVSSVM::HandleIntegerBranch(RVSSVM &vm) {
+  vm.ExecuteInteger();
+}
+
+void RVSSVM::HandleGeneric(RVSSVM &vm) {
+  vm.Execute<SkipDeltas>();
+  vm.WriteMemory<SkipDeltas>();
+  vm.WriteBack<SkipDeltas>();
+}
+
+TranslatedBlock *RVSSVM::TranslateBlock(uint64_t start_pc) {
+  TranslatedBlock block;
+  block.start_pc = start_pc;
+
+  for (uint64_t pc = start_pc; block.entries.size() < BlockCache::kMaxBlockLength; pc += 4) {
+    DecodedInstruction *cached = decode_cache_.Lookup(pc);
+    if (!cached) {
       break;
     }
+    if (!cached->valid) {
+      *cached = DecodeInstruction(memory_controller_.ReadWord_d(pc));
+    }
+    const DecodedInstruction &op = *cached;
+
+    bool is_branch = op.opcode==0b1100011;
+    bool is_jump = op.opcode==get_instr_encoding(Instruction::kjal).opcode ||
+                   op.opcode==get_instr_encoding(Instruction::kjalr).opcode;
+
+    BlockHandler handler = HandleGeneric;
+    if (op.exec_class==ExecClass::kInteger) {
+      if (op.mem_read || op.mem_write) {
+        handler = HandleIntegerMemory;
+      } else if (is_branch) {
+        handler = HandleIntegerBranch;
+      } else {
+        handler = HandleIntegerAlu;
+      }
+    }
+    block.entries.push_back({handler, op});
 
-    Fetch();
-    Decode();
-    Execute();
-    WriteMemory();
-    WriteBack();
+    if (is_branch || is_jump || op.branch ||
+        op.exec_class==ExecClass::kSyscall || op.exec_class==ExecClass::kCsr) {
+      break;
+    }
+  }
+
+  if (block.entries.empty()) {
+    return nullptr;
+  }
+  return block_cache_.Insert(std::move(block));
+}
+
+uint64_t RVSSVM::ExecuteBlock(const TranslatedBlock &block) {
+  const BlockEntry *entries = block.entries.data();
+  block_start_pc_ = block.start_pc;
+  block_end_pc_ = block.EndPc();
+  block_length_ = block.entries.size();
+
+  for (block_position_ = 0; block_position_ < block_length_; ++block_position_) {
+    const BlockEntry &entry = entries[block_position_];
+    current_op_ = entry.op;
+    current_instruction_ = entry.op.instruction;
+    UpdateProgramCounter(4);
+    entry.handler(*this);
+  }
+
+  block_start_pc_ = 0;
+  block_end_pc_ = 0;
+  return block_position_;
+}
+
+uint64_t RVSSVM::ExecuteNative(const TranslatedBlock &block) {
+  jit_context_.block = &block;
+  jit_context_.branch_flag = branch_flag_;
+  block_start_pc_ = block.start_pc;
+  block_end_pc_ = block.EndPc();
+
+  block.native(&jit_context_);
+
+  block_start_pc_ = 0;
+  block_end_pc_ = 0;
+  branch_flag_ = jit_context_.branch_flag != 0;
+  program_counter_ = jit_context_.pc;
+  if (jit_context_.fault) {
+    std::rethrow_exception(std::exchange(jit_context_.fault, nullptr));
+  }
+  if (jit_context_.executed > 0) {
+    current_op_ = block.entries[jit_context_.executed - 1].op;
+    current_instruction_ = current_op_.instruction;
+  }
+  return jit_context_.executed;
+}
+
+uint64_t RVSSVM::RunFor(uint64_t budget) {
+  uint64_t instruction_executed = 0;
+  // Compiled code writes GPRs directly, without their shadow codes
+  const bool use_jit = vm_config::config.getVmType()==vm_config::VmTypes::JIT && jit_.Available() &&
+      !registers_.ShadowEcc();
+  // Blocks skip instruction fetch, so the caches and access traces need every instruction to go through FetchDecoded
+  const bool use_blocks = !memory_controller_.GetCaches().Active();
+  jit_context_.gpr = registers_.GprData();
+  jit_context_.vm = this;
+
+  while (!stop_requested_ && program_counter_ < program_size_ && instruction_executed < budget) {
+    MaybeCheckpoint();
+
+    // Only enter a block when it fits in the remaining budget, so the limit stays exact
+    TranslatedBlock *block = use_blocks ? block_cache_.Lookup(program_counter_) : nullptr;
+    if (!block && use_blocks) {
+      block = TranslateBlock(program_counter_);
+    }
+    if (block && block->entries.size() <= budget - instruction_executed) {
+      if (use_jit && !block->native && ++block->execution_count==RVSSJit::kHotThreshold) {
+        block->native = jit_.Compile(*block);
+        if (!block->native) {
+          // Code buffer exhausted: start over with empty caches
+          jit_.Clear();
+          block_cache_.Clear();
+          continue;
+        }
+      }
+      uint64_t executed = block->native ? ExecuteNative(*block) : ExecuteBlock(*block);
+      instructions_retired_ += executed;
+      instruction_executed += executed;
+      cycle_s_ += executed;
+      continue;
+    }
+
+    FetchDecoded();
+    Execute<SkipDeltas>();
+    WriteMemory<SkipDeltas>();
+    WriteBack<SkipDeltas>();
     instructions_retired_++;
     instruction_executed++;
     cycle_s_++;
@@ -1042,6 +1402,22 @@ void RVSSVM::Run() {
     // }
     
   }
+  furthest_instruction_ = std::max<uint64_t>(furthest_instruction_, instructions_retired_);
+  return instruction_executed;
+}
+
+void RVSSVM::Run() {
+  ClearStop();
+  // Run records no deltas, so earlier history can no longer be replayed against the state it leaves
+  undo_history_.Clear();
+  // The limit itself may be executed, plus one more instruction
+  const uint64_t instruction_limit = vm_config::config.getInstructionExecutionLimit();
+  uint64_t instruction_executed = RunFor(instruction_limit==UINT64_MAX ? instruction_limit : instruction_limit + 1);
+  if (instruction_executed > instruction_limit && !stop_requested_ && program_counter_ < program_size_) {
+    std::cout << "Execution stopped — limit " 
+            << instruction_limit
+            << " reached after " << instruction_executed << " instructions.\n";
+  }
   if (program_counter_ >= program_size_) {
     std::cout << "VM_PROGRAM_END" << std::endl;
     output_status_ = "VM_PROGRAM_END";
@@ -1058,24 +1434,25 @@ void RVSSVM::DebugRun() {
       break;
     }
     current_delta_.old_pc = program_counter_;
-    if (std::find(breakpoints_.begin(), breakpoints_.end(), program_counter_) == breakpoints_.end()) {
+    // Conditions and hit counts are only looked at once the bitmap says the PC is marked
+    if (!breakpoints_.MaybeHit(program_counter_) ||
+        !breakpoints_.ShouldStop(program_counter_, registers_, memory_controller_)) {
+      MaybeCheckpoint();
       Fetch();
       Decode();
-      Execute();
-      WriteMemory();
-      WriteBack();
+      Execute<RecordDeltas>();
+      WriteMemory<RecordDeltas>();
+      WriteBack<RecordDeltas>();
       instructions_retired_++;
       instruction_executed++;
       cycle_s_++;
+      furthest_instruction_ = std::max<uint64_t>(furthest_instruction_, instructions_retired_);
       std::cout << "Program Counter: " << program_counter_ << std::endl;
 
       current_delta_.new_pc = program_counter_;
-      // history_.push(current_delta_);
-      undo_stack_.push(current_delta_);
-      while (!redo_stack_.empty()) {
-        redo_stack_.pop();
-      }
-      current_delta_ = StepDelta();
+      undo_history_.Push(current_delta_);
+      current_delta_.register_changes.clear();
+      current_delta_.memory_changes.clear();
       if (program_counter_ < program_size_) {
         std::cout << "VM_STEP_COMPLETED" << std::endl;
         output_status_ = "VM_STEP_COMPLETED";
@@ -1106,25 +1483,22 @@ void RVSSVM::DebugRun() {
 void RVSSVM::Step() {
   current_delta_.old_pc = program_counter_;
   if (program_counter_ < program_size_) {
+    MaybeCheckpoint();
     Fetch();
     Decode();
-    Execute();
-    WriteMemory();
-    WriteBack();
+    Execute<RecordDeltas>();
+    WriteMemory<RecordDeltas>();
+    WriteBack<RecordDeltas>();
     instructions_retired_++;
     cycle_s_++;
+    furthest_instruction_ = std::max<uint64_t>(furthest_instruction_, instructions_retired_);
     std::cout << "Program Counter: " << std::hex << program_counter_ << std::dec << std::endl;
 
     current_delta_.new_pc = program_counter_;
 
-    // history_.push(current_delta_);
-
-    undo_stack_.push(current_delta_);
-    while (!redo_stack_.empty()) {
-      redo_stack_.pop();
-    }
-
-    current_delta_ = StepDelta();
+    undo_history_.Push(current_delta_);
+    current_delta_.register_changes.clear();
+    current_delta_.memory_changes.clear();
 
 
     if (program_counter_ < program_size_) {
@@ -1144,22 +1518,13 @@ void RVSSVM::Step() {
 }
 
 void RVSSVM::Undo() {
-  if (undo_stack_.empty()) {
+  StepDelta last;
+  if (!undo_history_.Undo(last)) {
     std::cout << "VM_NO_MORE_UNDO" << std::endl;
     output_status_ = "VM_NO_MORE_UNDO";
     return;
   }
 
-  StepDelta last = undo_stack_.top();
-  undo_stack_.pop();
-
-  // if (!history_.can_undo()) {
-  //     std::cout << "Nothing to undo.\n";
-  //     return;
-  // }
-
-  // StepDelta last = history_.undo();
-
   for (const auto &change : last.register_changes) {
     switch (change.reg_type) {
       case 0: { // GPR
@@ -1181,17 +1546,23 @@ void RVSSVM::Undo() {
 
   for (const auto &change : last.memory_changes) {
     for (size_t i = 0; i < change.old_bytes_vec.size(); ++i) {
-      memory_controller_.WriteByte(change.address + i, change.old_bytes_vec[i]);
+      memory_controller_.WriteByte_d(change.address + i, change.old_bytes_vec[i]);
     }
+    InvalidateText(change.address, change.old_bytes_vec.size());
+  }
+
+  // Stepping it again must flip the same bit, if any
+  if (const DecodedInstruction *undone = decode_cache_.Lookup(last.old_pc);
+      undone && undone->valid && undone->alu_op==alu::AluOp::kInjectFlip && fault_context_.draws > 0) {
+    fault_context_.draws--;
   }
 
   program_counter_ = last.old_pc;
   instructions_retired_--;
   cycle_s_--;
+  TrimCheckpoints();
   std::cout << "Program Counter: " << program_counter_ << std::endl;
 
-  redo_stack_.push(last);
-
   output_status_ = "VM_UNDO_COMPLETED";
   std::cout << "VM_UNDO_COMPLETED" << std::endl;
 
@@ -1200,21 +1571,12 @@ void RVSSVM::Undo() {
 }
 
 void RVSSVM::Redo() {
-  if (redo_stack_.empty()) {
+  StepDelta next;
+  if (!undo_history_.Redo(next)) {
     std::cout << "VM_NO_MORE_REDO" << std::endl;
     return;
   }
 
-  StepDelta next = redo_stack_.top();
-  redo_stack_.pop();
-
-  // if (!history_.can_redo()) {
-  //       std::cout << "Nothing to redo.\n";
-  //       return;
-  //   }
-
-  //   StepDelta next = history_.redo();
-
   for (const auto &change : next.register_changes) {
     switch (change.reg_type) {
       case 0: { // GPR
@@ -1236,8 +1598,14 @@ void RVSSVM::Redo() {
 
   for (const auto &change : next.memory_changes) {
     for (size_t i = 0; i < change.new_bytes_vec.size(); ++i) {
-      memory_controller_.WriteByte(change.address + i, change.new_bytes_vec[i]);
+      memory_controller_.WriteByte_d(change.address + i, change.new_bytes_vec[i]);
     }
+    InvalidateText(change.address, change.new_bytes_vec.size());
+  }
+
+  if (const DecodedInstruction *redone = decode_cache_.Lookup(program_counter_);
+      redone && redone->valid && redone->alu_op==alu::AluOp::kInjectFlip) {
+    fault_context_.draws++;
   }
 
   program_counter_ = next.new_pc;
@@ -1246,21 +1614,219 @@ void RVSSVM::Redo() {
   DumpRegisters(globals::registers_dump_file_path, registers_);
   DumpState(globals::vm_state_dump_file_path);
   std::cout << "Program Counter: " << program_counter_ << std::endl;
-  undo_stack_.push(next);
+}
 
+void RVSSVM::TakeCheckpoint() {
+  uint64_t interval = vm_config::config.getCheckpointInterval();
+  if (interval==0) {
+    next_checkpoint_ = UINT64_MAX;
+    return;
+  }
+
+  Memory::PreservedPages preserved = memory_controller_.BeginEpoch();
+  if (!checkpoints_.empty()) {
+    checkpoints_.back().preserved_pages = std::move(preserved);
+  }
+  checkpoints_.push_back(CaptureState());
+  uint64_t limit = std::max<uint64_t>(vm_config::config.getCheckpointLimit(), 1);
+  while (checkpoints_.size() > limit) {
+    checkpoints_.pop_front();
+  }
+  next_checkpoint_ = instructions_retired_ + interval;
+}
+
+Checkpoint RVSSVM::CaptureState() const {
+  return {instructions_retired_, program_counter_, cycle_s_, registers_, branch_flag_,
+          audio_sample_index_, image_sample_index_, input_position_, fault_context_.draws, {}};
+}
+
+void RVSSVM::ApplyState(const Checkpoint &state) {
+  registers_ = state.registers;
+  program_counter_ = state.program_counter;
+  instructions_retired_ = state.instruction;
+  cycle_s_ = state.cycle_count;
+  branch_flag_ = state.branch_flag;
+  audio_sample_index_ = state.audio_sample_index;
+  image_sample_index_ = state.image_sample_index;
+  input_position_ = state.input_position;
+  fault_context_.draws = state.fault_draws;
+}
+
+void RVSSVM::RebaseCheckpoints() {
+  checkpoints_.clear();
+  furthest_instruction_ = instructions_retired_;
+  TakeCheckpoint();
+}
+
+void RVSSVM::TrimCheckpoints() {
+  while (checkpoints_.size() > 1 && checkpoints_.back().instruction > instructions_retired_) {
+    // The interval before the dropped checkpoint is open again
+    checkpoints_.pop_back();
+    memory_controller_.MergeEpoch(std::move(checkpoints_.back().preserved_pages));
+    checkpoints_.back().preserved_pages = Memory::PreservedPages();
+  }
+  if (!checkpoints_.empty() && checkpoints_.back().instruction > instructions_retired_) {
+    RebaseCheckpoints();
+    return;
+  }
+  if (!checkpoints_.empty()) {
+    next_checkpoint_ = checkpoints_.back().instruction + vm_config::config.getCheckpointInterval();
+  }
+}
+
+void RVSSVM::RestoreCheckpoint(size_t index) {
+  auto restore_pages = [this](const Memory::PreservedPages &pages) {
+    memory_controller_.RestorePages(pages);
+    for (uint64_t page_number : pages.page_numbers) {
+      InvalidateText(page_number << Memory::kPageBits, Memory::kPageSize);
+    }
+  };
+
+  // Roll back the open interval first, then each closed one, newest to oldest
+  restore_pages(memory_controller_.BeginEpoch());
+  for (size_t i = checkpoints_.size() - 1; i > index; --i) {
+    restore_pages(checkpoints_[i - 1].preserved_pages);
+  }
+  checkpoints_.erase(checkpoints_.begin() + static_cast<std::ptrdiff_t>(index) + 1, checkpoints_.end());
+
+  Checkpoint &checkpoint = checkpoints_.back();
+  checkpoint.preserved_pages = Memory::PreservedPages();
+  ApplyState(checkpoint);
+  next_checkpoint_ = checkpoint.instruction + vm_config::config.getCheckpointInterval();
+
+  // The deltas describe steps that are about to be re-executed or abandoned
+  undo_history_.Clear();
+  current_delta_.register_changes.clear();
+  current_delta_.memory_changes.clear();
+}
+
+void RVSSVM::ReplayTo(uint64_t instruction, uint64_t *last_breakpoint) {
+  // Output was already produced the first time round
+  std::streambuf *output = std::cout.rdbuf(nullptr);
+  replaying_ = true;
+  try {
+    while (instructions_retired_ < instruction && program_counter_ < program_size_) {
+      MaybeCheckpoint();
+
+      if (!last_breakpoint) {
+        TranslatedBlock *block = block_cache_.Lookup(program_counter_);
+        if (!block) {
+          block = TranslateBlock(program_counter_);
+        }
+        if (block && block->entries.size() <= instruction - instructions_retired_) {
+          uint64_t executed = ExecuteBlock(*block);
+          instructions_retired_ += executed;
+          cycle_s_ += executed;
+          continue;
+        }
+      } else if (breakpoints_.MaybeHit(program_counter_) &&
+          breakpoints_.Matches(program_counter_, registers_, memory_controller_)) {
+        *last_breakpoint = instructions_retired_;
+      }
+
+      FetchDecoded();
+      Execute<SkipDeltas>();
+      WriteMemory<SkipDeltas>();
+      WriteBack<SkipDeltas>();
+      instructions_retired_++;
+      cycle_s_++;
+    }
+  } catch (...) {
+    replaying_ = false;
+    std::cout.rdbuf(output);
+    throw;
+  }
+  replaying_ = false;
+  std::cout.rdbuf(output);
+  ClearStop();
+}
+
+bool RVSSVM::SeekTo(uint64_t instruction) {
+  if (checkpoints_.empty() || instruction < checkpoints_.front().instruction ||
+      instruction > furthest_instruction_) {
+    return false;
+  }
+  if (instruction < instructions_retired_) {
+    size_t index = checkpoints_.size() - 1;
+    while (checkpoints_[index].instruction > instruction) {
+      --index;
+    }
+    RestoreCheckpoint(index);
+  }
+  ReplayTo(instruction);
+  return true;
+}
+
+void RVSSVM::ReverseStep(uint64_t count) {
+  GotoInstruction(instructions_retired_ > count ? instructions_retired_ - count : 0);
+}
+
+void RVSSVM::ReverseContinue() {
+  uint64_t target = instructions_retired_;
+  uint64_t hit = UINT64_MAX;
+
+  // Scan one checkpoint interval at a time, newest first, for the last breakpoint before the target
+  while (hit==UINT64_MAX && !checkpoints_.empty() && checkpoints_.front().instruction < target) {
+    size_t index = checkpoints_.size() - 1;
+    while (checkpoints_[index].instruction >= target) {
+      --index;
+    }
+    RestoreCheckpoint(index);
+    uint64_t start = instructions_retired_;
+    ReplayTo(target, &hit);
+    target = start;
+  }
+
+  if (hit!=UINT64_MAX) {
+    SeekTo(hit);
+    std::cout << "VM_BREAKPOINT_HIT " << program_counter_ << std::endl;
+    output_status_ = "VM_BREAKPOINT_HIT";
+  } else {
+    // No earlier breakpoint: stop at the start of the history
+    if (!checkpoints_.empty()) {
+      SeekTo(checkpoints_.front().instruction);
+    }
+    std::cout << "VM_REVERSE_COMPLETED" << std::endl;
+    output_status_ = "VM_REVERSE_COMPLETED";
+  }
+  std::cout << "Program Counter: " << program_counter_ << std::endl;
+  DumpRegisters(globals::registers_dump_file_path, registers_);
+  DumpState(globals::vm_state_dump_file_path);
+}
+
+void RVSSVM::GotoInstruction(uint64_t instruction) {
+  if (!SeekTo(instruction)) {
+    std::cout << "VM_GOTO_OUT_OF_RANGE" << std::endl;
+    output_status_ = "VM_GOTO_OUT_OF_RANGE";
+    return;
+  }
+  std::cout << "Program Counter: " << program_counter_ << std::endl;
+  std::cout << "VM_REVERSE_COMPLETED" << std::endl;
+  output_status_ = "VM_REVERSE_COMPLETED";
+  DumpRegisters(globals::registers_dump_file_path, registers_);
+  DumpState(globals::vm_state_dump_file_path);
 }
 
 void RVSSVM::Reset() {
   program_counter_ = 0;
   instructions_retired_ = 0;
   cycle_s_ = 0;
+  stall_cycles_ = 0;
+  cpi_ = 0;
+  ipc_ = 0;
   registers_.Reset();
+  registers_.SetShadowEcc(vm_config::config.getEccShadowRegisters());
   memory_controller_.Reset();
   control_unit_.Reset();
+  decode_cache_.Clear();
+  block_cache_.Clear();
+  jit_.Clear();
+  current_op_ = DecodedInstruction();
   branch_flag_ = false;
   next_pc_ = 0;
   execution_result_ = 0;
   memory_result_ = 0;
+  memory_encoded_.reset();
 
   return_address_ = 0;
   csr_target_address_ = 0;
@@ -1271,10 +1837,24 @@ void RVSSVM::Reset() {
   current_delta_.memory_changes.clear();
   current_delta_.old_pc = 0;
   current_delta_.new_pc = 0;
-  undo_stack_ = std::stack<StepDelta>();
-  redo_stack_ = std::stack<StepDelta>();
-
+  undo_history_.SetCapacity(vm_config::config.getUndoHistorySize());
+  checkpoints_.clear();
+  next_checkpoint_ = 0;
+  furthest_instruction_ = 0;
+  input_log_.clear();
+  input_position_ = 0;
+  fault_context_.Configure();
+  ecc_telemetry_.Clear();
+  ecc_telemetry_.SetEnabled(vm_config::config.getEccTelemetry());
 }
 
 
 
+
+// Entry points called from outside this file with either policy
+template void RVSSVM::Execute<RecordDeltas>();
+template void RVSSVM::Execute<SkipDeltas>();
+template void RVSSVM::WriteMemory<RecordDeltas>();
+template void RVSSVM::WriteMemory<SkipDeltas>();
+template void RVSSVM::WriteBack<RecordDeltas>();
+template void RVSSVM::WriteBack<SkipDeltas>();
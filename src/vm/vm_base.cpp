@@ -9,6 +9,8 @@
 #include "globals.h"
 #include "config.h"
 
+#include <bit>
+#include <span>
 #include <cstdint>
 #include <iostream>
 #include <iomanip>
@@ -19,70 +21,38 @@
 #include <thread>
 
 
-void VmBase::LoadProgram(const AssembledProgram &program) {
+// Text words are copied to memory as they are laid out on the host
+static_assert(std::endian::native==std::endian::little, "LoadProgram assumes a little-endian host");
+
+void VmBase::LoadProgram(const AssembledProgram &program, bool dump_state) {
   program_ = program;
-  unsigned int counter = 0;
-  for (const auto &instruction: program.text_buffer) {
-    memory_controller_.WriteWord(counter, instruction);
-      counter += 4;
+  memory_controller_.WriteBlock(0, std::span<const uint8_t>(
+      reinterpret_cast<const uint8_t *>(program.text_buffer.data()),
+      program.text_buffer.size() * sizeof(uint32_t)));
+  program_size_ = program.text_buffer.size() * sizeof(uint32_t);
+  breakpoints_.SetTextSize(program_size_);
+
+  InvalidateText(0, program_size_);
+  decode_cache_.Resize(program_size_);
+  for (uint64_t address = 0; address < program_size_; address += 4) {
+    *decode_cache_.Lookup(address) = DecodeInstruction(program.text_buffer[address / 4]);
   }
-  program_size_ = counter;
-  AddBreakpoint(program_size_, false);  // address
-
-  unsigned int data_counter = 0;
-  uint64_t base_data_address = vm_config::config.getDataSectionStart();
-  auto align = [&](unsigned int alignment) {
-    if (data_counter % alignment != 0)
-      data_counter += alignment - (data_counter % alignment);
-  };
-  for (const auto& data : program.data_buffer) {
-    std::visit([&](auto&& value) {
-      using T = std::decay_t<decltype(value)>; 
-      
-
-      if constexpr (std::is_same_v<T, uint8_t>) {
-        align(1);
-        memory_controller_.WriteByte(base_data_address + data_counter, value);  // Write a byte
-        data_counter += 1;
-      } else if constexpr (std::is_same_v<T, uint16_t>) {
-        align(2);
-        memory_controller_.WriteHalfWord(base_data_address + data_counter, value);  // Write a halfword (16 bits)
-        data_counter += 2;
-      } else if constexpr (std::is_same_v<T, uint32_t>) {
-        align(4);
-        memory_controller_.WriteWord(base_data_address + data_counter, value);  // Write a word (32 bits)
-        data_counter += 4;
-      } else if constexpr (std::is_same_v<T, uint64_t>) {
-        align(8);
-        memory_controller_.WriteDoubleWord(base_data_address + data_counter, value);  // Write a double word (64 bits)
-        data_counter += 8;
-      } else if constexpr (std::is_same_v<T, float>) {
-        align(4);
-        uint32_t float_as_int;
-        std::memcpy(&float_as_int, &value, sizeof(float));
-        memory_controller_.WriteWord(base_data_address + data_counter, float_as_int);  // Write the float as a word
-        data_counter += 4;
-      } else if constexpr (std::is_same_v<T, double>) {
-        align(8);
-        uint64_t double_as_int;
-        std::memcpy(&double_as_int, &value, sizeof(double));
-        memory_controller_.WriteDoubleWord(base_data_address + data_counter, double_as_int);  // Write the double as a double word
-        data_counter += 8;
-      } else if constexpr (std::is_same_v<T, std::string>) {
-        align(1);
-        for (size_t i = 0; i < value.size(); i++) {
-          memory_controller_.WriteByte(base_data_address + data_counter, static_cast<uint8_t>(value[i]));  // Write each byte of the string
-          data_counter += 1;
-        }
-      }
-    }, data);
+
+  // Programs not built by the assembler may only carry the item list
+  if (!program.data_image.empty() || program.data_buffer.empty()) {
+    memory_controller_.WriteBlock(vm_config::config.getDataSectionStart(), program.data_image);
+  } else {
+    memory_controller_.WriteBlock(vm_config::config.getDataSectionStart(), BuildDataImage(program.data_buffer));
   }
-  std::cout << "VM_PROGRAM_LOADED" << std::endl;
-  output_status_ = "VM_PROGRAM_LOADED";
 
-  DumpState(globals::vm_state_dump_file_path);
-    
+  output_status_ = "VM_PROGRAM_LOADED";
+  if (!sandbox_output_) {
+    std::cout << "VM_PROGRAM_LOADED" << std::endl;
+  }
 
+  if (dump_state) {
+    DumpState(globals::vm_state_dump_file_path);
+  }
 }
 
 uint64_t VmBase::GetProgramCounter() const {
@@ -173,7 +143,7 @@ int32_t VmBase::ImmGenerator(uint32_t instruction) {
 }
 
 
-void VmBase::AddBreakpoint(uint64_t val, bool is_line) {
+void VmBase::AddBreakpoint(uint64_t val, bool is_line, Breakpoint options) {
     if (is_line) {
         // If the value is a line number, convert it to an instruction address
         if (program_.line_number_instruction_number_mapping.find(val) == program_.line_number_instruction_number_mapping.end()) {
@@ -186,7 +156,7 @@ void VmBase::AddBreakpoint(uint64_t val, bool is_line) {
             std::cerr << "Breakpoint already exists at line: " << line << std::endl;
             return;
         }
-        breakpoints_.emplace_back(bp);
+        options.address = bp;
     } else {
         if (val % 4 != 0) {
             std::cerr << "Invalid instruction address: " << val << ". Must be a multiple of 4." << std::endl;
@@ -196,12 +166,17 @@ void VmBase::AddBreakpoint(uint64_t val, bool is_line) {
             std::cerr << "Breakpoint already exists at address: " << val << std::endl;
             return;
         }
-        breakpoints_.emplace_back(val);
+        options.address = val;
     }
+    breakpoints_.Add(options);
 
     DumpState(globals::vm_state_dump_file_path);
 }
 
+void VmBase::InvalidateText(uint64_t address, uint64_t size) {
+  decode_cache_.Invalidate(address, size);
+}
+
 void VmBase::RemoveBreakpoint(uint64_t val, bool is_line) {
     if (is_line) {
         // If the value is a line number, convert it to an instruction address
@@ -215,7 +190,7 @@ void VmBase::RemoveBreakpoint(uint64_t val, bool is_line) {
             std::cerr << "No breakpoint exists at line: " << line << std::endl;
             return;
         }
-        breakpoints_.erase(std::remove(breakpoints_.begin(), breakpoints_.end(), bp), breakpoints_.end());
+        breakpoints_.Remove(bp);
     } else {
         if (val % 4 != 0) {
             std::cerr << "Invalid instruction address: " << val << ". Must be a multiple of 4." << std::endl;
@@ -225,28 +200,47 @@ void VmBase::RemoveBreakpoint(uint64_t val, bool is_line) {
             std::cerr << "No breakpoint exists at address: " << val << std::endl;
             return;
         }
-        breakpoints_.erase(std::remove(breakpoints_.begin(), breakpoints_.end(), val), breakpoints_.end());
+        breakpoints_.Remove(val);
     }
     DumpState(globals::vm_state_dump_file_path);
 
 
 }
 
-bool VmBase::CheckBreakpoint(uint64_t address) {
-    return std::find(breakpoints_.begin(), breakpoints_.end(), address) != breakpoints_.end();
-}
-
 
 void VmBase::PrintString(uint64_t address) {
     while (true) {
-        char c = memory_controller_.ReadByte(address);
+        char c = memory_controller_.ReadByte_d(address);
         if (c == '\0') break;
-        std::cout << c;
+        ProgramOutput() << c;
         address++;
     }
 }
 
+VmBase::CycleStats VmBase::ComputeCycleStats() const {
+    CycleStats stats{stall_cycles_, cpi_, ipc_};
+    const cache::CacheHierarchy &caches = memory_controller_.GetCaches();
+    if (!caches.Enabled()) {
+        return stats;
+    }
+    stats.stall_cycles = caches.Stats().stall_cycles;
+    if (instructions_retired_) {
+        stats.cpi = static_cast<float>(cycle_s_ + stats.stall_cycles) / static_cast<float>(instructions_retired_);
+        stats.ipc = 1.0f / stats.cpi;
+    }
+    return stats;
+}
+
+void VmBase::UpdateCycleStats() {
+    CycleStats stats = ComputeCycleStats();
+    stall_cycles_ = stats.stall_cycles;
+    cpi_ = stats.cpi;
+    ipc_ = stats.ipc;
+}
+
 void VmBase::DumpState(const std::filesystem::path &filename) {
+    // Only reads the VM; the cache counters behind the stall cycles are not safe to read while it runs
+    const CycleStats stats = ComputeCycleStats();
     std::ofstream file(filename);
     if (!file.is_open()) {
         std::cerr << "Error opening file for dumping VM state: " << filename.string() << std::endl;
@@ -269,17 +263,17 @@ void VmBase::DumpState(const std::filesystem::path &filename) {
          << std::dec << std::setfill(' ') 
          << "\",\n";
     file << "    \"disassembly_line_number\": " << program_.instruction_number_disassembly_mapping[instruction_number] << ",\n";
-    file << "    \"cycle_count\": " << cycle_s_ << ",\n";
+    file << "    \"cycle_count\": " << cycle_s_ + stats.stall_cycles << ",\n";
     file << "    \"instructions_retired\": " << instructions_retired_ << ",\n";
-    file << "    \"cpi\": " << cpi_ << ",\n";
-    file << "    \"ipc\": " << ipc_ << ",\n";
-    file << "    \"stall_cycles\": " << stall_cycles_ << ",\n";
+    file << "    \"cpi\": " << stats.cpi << ",\n";
+    file << "    \"ipc\": " << stats.ipc << ",\n";
+    file << "    \"stall_cycles\": " << stats.stall_cycles << ",\n";
     file << "    \"branch_mispredictions\": " << branch_mispredictions_ << ",\n";
     file << "    \"breakpoints\": [";
-    for (size_t i = 1; i < breakpoints_.size(); ++i) {
-        program_.instruction_number_line_number_mapping[breakpoints_[i] / 4];
-        file << program_.instruction_number_line_number_mapping[breakpoints_[i] / 4];
-        if (i < breakpoints_.size() - 1) {
+    const auto &breakpoints = breakpoints_.Entries();
+    for (size_t i = 0; i < breakpoints.size(); ++i) {
+        file << program_.instruction_number_line_number_mapping[breakpoints[i].address / 4];
+        if (i < breakpoints.size() - 1) {
             file << ", ";
         }
     }
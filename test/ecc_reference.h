@@ -0,0 +1,68 @@
+/**
+ * @file ecc_reference.h
+ * @brief The bit-serial encoder and checker the mask/table kernels replaced, shared by the ECC
+ * tests and benchmarks as the reference they are compared against.
+ */
+
+#ifndef ECC_REFERENCE_H
+#define ECC_REFERENCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+inline uint64_t ReferenceComputeEcc(uint32_t data) {
+  uint8_t p[6] = {0};
+  for (int i = 0; i < 32; i++) {
+    uint8_t data_bit = (data >> i) & 1;
+    uint32_t pos = i + 1;
+    for (int j = 0; j < 6; j++) {
+      if (pos & (1U << j)) p[j] ^= data_bit;
+    }
+  }
+  uint32_t hamming_code = (p[5] << 5) | (p[4] << 4) | (p[3] << 3) | (p[2] << 2) | (p[1] << 1) | p[0];
+  uint8_t p_all = __builtin_parityl(data) ^ __builtin_parity(hamming_code & 0x3F);
+  uint32_t final_ecc = (p_all << 6) | hamming_code;
+  return (static_cast<uint64_t>(final_ecc) << 32) | static_cast<uint64_t>(data);
+}
+
+inline uint64_t ReferenceCheckError(uint64_t encoded) {
+  uint32_t data = static_cast<uint32_t>(encoded & 0xFFFFFFFFULL);
+  uint32_t ecc_received = static_cast<uint32_t>((encoded >> 32) & 0x7F);
+  uint8_t p_all_received = (ecc_received >> 6) & 1;
+
+  uint8_t p_computed[6] = {0};
+  for (int i = 0; i < 32; ++i) {
+    uint8_t bit = (data >> i) & 1;
+    uint32_t pos = i + 1;
+    for (int j = 0; j < 6; j++) {
+      if (pos & (1U << j)) p_computed[j] ^= bit;
+    }
+  }
+  uint8_t syndrome = 0;
+  for (int i = 0; i < 6; ++i) {
+    if (p_computed[i] != ((ecc_received >> i) & 1)) syndrome |= (1 << i);
+  }
+  uint8_t p_all_computed = __builtin_parityl(data) ^ __builtin_parity(ecc_received & 0x3F);
+  bool parity_mismatch = (p_all_computed != p_all_received);
+
+  if (syndrome == 0 && !parity_mismatch) return encoded;
+  if (syndrome == 0 && parity_mismatch) return ReferenceComputeEcc(data);
+  if (syndrome != 0 && parity_mismatch) {
+    if (syndrome >= 1 && syndrome <= 32) data ^= (1U << (syndrome - 1));
+    return ReferenceComputeEcc(data);
+  }
+  return encoded;
+}
+
+inline std::vector<uint32_t> RandomWords(size_t count) {
+  std::mt19937_64 rng(0x5eed);
+  std::vector<uint32_t> words = {0, 1, 0x80000000, 0xFFFFFFFF, 0xAAAAAAAA, 0x55555555};
+  while (words.size() < count) {
+    words.push_back(static_cast<uint32_t>(rng()));
+  }
+  return words;
+}
+
+#endif // ECC_REFERENCE_H
@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
 #include "../src/vm/alu.h"
+#include "config.h"
+
+#include <utility>
+#include <vector>
 
 TEST(ALUTest, AddTest) {
   alu::Alu alu;
@@ -41,4 +45,71 @@ TEST(ALUTest, SraTest) {
   auto result = alu.execute(alu::AluOp::kSra, 0xfffffffffffffffa, 2);
   ASSERT_EQ(result.first, 0xfffffffffffffffe);
   ASSERT_FALSE(result.second);
-}
\ No newline at end of file
+}
+
+TEST(ALUTest, FaultRngTest) {
+  // Known answers of Philox4x32-10 (Random123)
+  EXPECT_EQ(FaultRng::Philox({0, 0, 0, 0}, {0, 0}),
+            (FaultRng::Block{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+  EXPECT_EQ(FaultRng::Philox({0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff}),
+            (FaultRng::Block{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}));
+
+  FaultRng rng(42);
+  EXPECT_EQ(rng.Draw(1000), FaultRng(42).Draw(1000));
+  EXPECT_NE(rng.Draw(1000), rng.Draw(1001));
+  EXPECT_NE(rng.Draw(1000), FaultRng(43).Draw(1000));
+}
+
+TEST(ALUTest, InjectFlipTest) {
+  alu::FaultContext context;
+  context.Seed(7);
+  context.flip_probability = 0.5;
+  context.flip_bit_min = 4;
+  context.flip_bit_max = 7;
+  std::vector<uint64_t> values;
+  for (int i = 0; i < 200; ++i) {
+    auto [value, flipped] = alu::Alu::execute(alu::AluOp::kInjectFlip, 0, 0, context);
+    ASSERT_EQ(flipped, value!=0);
+    ASSERT_EQ(value & ~uint64_t{0xf0}, 0);
+    values.push_back(value);
+  }
+  EXPECT_EQ(context.draws, 200);
+  EXPECT_GT(context.flips, 50);
+  EXPECT_LT(context.flips, 150);
+
+  // Any position can be drawn again without replaying the ones before it
+  context.Seed(7);
+  context.draws = 150;
+  for (int i = 150; i < 200; ++i) {
+    ASSERT_EQ(alu::Alu::execute(alu::AluOp::kInjectFlip, 0, 0, context).first, values[i]);
+  }
+
+  // Without a context nothing flips
+  EXPECT_EQ(alu::Alu::execute(alu::AluOp::kInjectFlip, 5, 0), std::make_pair(uint64_t{5}, false));
+}
+
+TEST(ALUTest, FlipBitRangeTest) {
+  // The bounds can be set in either order, including through a range that is briefly empty
+  vm_config::config.modifyConfig("FaultInjection", "flip_bit_max", "40");
+  vm_config::config.modifyConfig("FaultInjection", "flip_bit_min", "35");
+  alu::FaultContext context;
+  context.Configure();
+  EXPECT_EQ(context.flip_bit_min, 35);
+  EXPECT_EQ(context.flip_bit_max, 40);
+
+  vm_config::config.modifyConfig("FaultInjection", "flip_bit_max", "2");
+  vm_config::config.modifyConfig("FaultInjection", "flip_bit_min", "1");
+  context.Configure();
+  EXPECT_EQ(context.flip_bit_min, 1);
+  EXPECT_EQ(context.flip_bit_max, 2);
+
+  // A range still empty when it is used falls back to the data bits
+  vm_config::config.modifyConfig("FaultInjection", "flip_bit_min", "3");
+  context.Configure();
+  EXPECT_EQ(context.flip_bit_min, 0);
+  EXPECT_EQ(context.flip_bit_max, 31);
+
+  EXPECT_THROW(vm_config::config.modifyConfig("FaultInjection", "flip_bit_max", "64"), std::invalid_argument);
+  vm_config::config.modifyConfig("FaultInjection", "flip_bit_min", "0");
+  vm_config::config.modifyConfig("FaultInjection", "flip_bit_max", "31");
+}
@@ -0,0 +1,415 @@
+/**
+ * File Name: test_cache.cpp
+ * Author: Vishank Singh
+ * Github: https://github.com/VishankSingh
+ */
+
+#include <gtest/gtest.h>
+#include "config.h"
+#include "vm/cache/cache.h"
+#include "vm/cache/cache_hierarchy.h"
+#include "vm/breakpoints.h"
+#include "vm/registers.h"
+#include "vm/memory_controller.h"
+
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// 4 sets of 2 ways, 16-byte lines: addresses 0x00, 0x40, 0x80... all map to set 0
+cache::Cache MakeCache(cache::ReplacementPolicy replacement,
+                       cache::WriteHitPolicy write_hit = cache::WriteHitPolicy::WriteBack,
+                       cache::WriteMissPolicy write_miss = cache::WriteMissPolicy::WriteAllocate) {
+  cache::CacheConfig config = cache::CacheConfig::FromSizes(128, 16, 2);
+  config.replacement_policy = replacement;
+  config.write_hit_policy = write_hit;
+  config.write_miss_policy = write_miss;
+  cache::Cache c;
+  EXPECT_EQ(c.Configure(true, config), "");
+  return c;
+}
+
+// Direct-mapped 2-line L1s over a 4-line 2-way L2, all with 16-byte lines
+cache::HierarchyConfig MakeHierarchy(cache::Inclusion inclusion) {
+  cache::HierarchyConfig config;
+  config.levels[static_cast<size_t>(cache::Level::L1I)] = {cache::CacheConfig::FromSizes(32, 16, 1), 1};
+  config.levels[static_cast<size_t>(cache::Level::L1D)] = {cache::CacheConfig::FromSizes(32, 16, 1), 2};
+  config.levels[static_cast<size_t>(cache::Level::L2)] = {cache::CacheConfig::FromSizes(64, 16, 2), 10};
+  config.levels[static_cast<size_t>(cache::Level::L1D)].cache.write_miss_policy = cache::WriteMissPolicy::WriteAllocate;
+  config.inclusion = inclusion;
+  config.memory_latency = 100;
+  return config;
+}
+
+// A 512-byte 2-way L1 data cache with 16-byte lines straight over memory
+cache::HierarchyConfig MakeL1(cache::AnyPrefetcher prefetcher, uint64_t memory_latency) {
+  cache::HierarchyConfig config;
+  config.levels[static_cast<size_t>(cache::Level::L1D)] = {cache::CacheConfig::FromSizes(512, 16, 2), 1};
+  config.memory_latency = memory_latency;
+  config.prefetcher = prefetcher;
+  return config;
+}
+
+} // namespace
+
+TEST(CacheTest, ValidateGeometry) {
+  EXPECT_EQ(cache::CacheConfig::FromSizes(32768, 64, 8).Validate(), "");
+  EXPECT_EQ(cache::CacheConfig::FromSizes(64, 64, 1).Validate(), "");
+  EXPECT_NE(cache::CacheConfig::FromSizes(0, 0, 0).Validate(), "");
+  EXPECT_NE(cache::CacheConfig::FromSizes(1024, 48, 1).Validate(), "");
+  EXPECT_NE(cache::CacheConfig::FromSizes(1024, 64, 3).Validate(), "");
+  EXPECT_NE(cache::CacheConfig::FromSizes(192 * 64, 64, 64).Validate(), "");
+
+  cache::Cache c;
+  EXPECT_NE(c.Configure(true, cache::CacheConfig::FromSizes(1000, 64, 1)), "");
+  EXPECT_FALSE(c.Enabled());
+  c.Access(0, 4, false);
+  EXPECT_EQ(c.Stats().accesses, 0);
+}
+
+TEST(CacheTest, LruAndFifoEvictDifferentLines) {
+  for (auto policy : {cache::ReplacementPolicy::LRU, cache::ReplacementPolicy::FIFO}) {
+    cache::Cache c = MakeCache(policy);
+    c.Access(0x00, 4, false);
+    c.Access(0x40, 4, false);
+    c.Access(0x00, 4, false); // LRU: 0x40 is now the oldest use; FIFO: 0x00 is still the oldest fill
+    c.Access(0x80, 4, false);
+    EXPECT_EQ(c.Contains(0x00), policy==cache::ReplacementPolicy::LRU);
+    EXPECT_EQ(c.Contains(0x40), policy==cache::ReplacementPolicy::FIFO);
+    EXPECT_TRUE(c.Contains(0x80));
+    EXPECT_EQ(c.Stats().hits, 1);
+    EXPECT_EQ(c.Stats().misses, 3);
+    EXPECT_EQ(c.Stats().evictions, 1);
+  }
+
+  // Random replacement is reproducible
+  cache::Cache a = MakeCache(cache::ReplacementPolicy::Random);
+  cache::Cache b = MakeCache(cache::ReplacementPolicy::Random);
+  for (uint64_t i = 0; i < 200; ++i) {
+    a.Access((i * 0x40) % 0x400, 4, false);
+    b.Access((i * 0x40) % 0x400, 4, false);
+  }
+  EXPECT_EQ(a.Stats().hits, b.Stats().hits);
+  EXPECT_EQ(a.Stats().evictions, 198);
+}
+
+TEST(CacheTest, WritePolicies) {
+  // Write-back: a write marks the line dirty and its eviction writes it back
+  cache::Cache back = MakeCache(cache::ReplacementPolicy::LRU);
+  back.Access(0x00, 4, true);
+  back.Access(0x40, 4, false);
+  EXPECT_TRUE(back.AccessLine(0x80 >> 4, false).writeback);
+  EXPECT_EQ(back.Stats().writebacks, 1);
+  EXPECT_EQ(back.Stats().write_throughs, 0);
+  EXPECT_EQ(back.Stats().write_misses, 1);
+
+  // Write-through, no allocation: every write reaches memory and a write miss fills nothing
+  cache::Cache through = MakeCache(cache::ReplacementPolicy::LRU, cache::WriteHitPolicy::WriteThrough,
+                                   cache::WriteMissPolicy::NoWriteAllocate);
+  through.Access(0x00, 4, true);
+  EXPECT_FALSE(through.Contains(0x00));
+  through.Access(0x00, 4, false);
+  through.Access(0x04, 4, true);
+  EXPECT_EQ(through.Stats().write_throughs, 2);
+  EXPECT_EQ(through.Stats().hits, 1);
+  through.Access(0x40, 4, false);
+  through.Access(0x80, 4, false);
+  EXPECT_EQ(through.Stats().writebacks, 0);
+
+  // An access straddling two lines touches both
+  cache::Cache straddle = MakeCache(cache::ReplacementPolicy::LRU);
+  straddle.Access(0x0C, 8, false);
+  EXPECT_EQ(straddle.Stats().accesses, 2);
+  EXPECT_TRUE(straddle.Contains(0x10));
+}
+
+TEST(CacheTest, MemoryControllerCountsLoadsAndStores) {
+  vm_config::VmConfig saved = vm_config::config;
+  vm_config::config.modifyConfig("Cache", "cache_enabled", "true");
+  vm_config::config.modifyConfig("Cache", "cache_size", "1024");
+  vm_config::config.modifyConfig("Cache", "cache_block_size", "64");
+  vm_config::config.modifyConfig("Cache", "cache_associativity", "2");
+  vm_config::config.modifyConfig("Cache", "cache_replacement_policy", "FIFO");
+  EXPECT_THROW(vm_config::config.modifyConfig("Cache", "cache_write_hit_policy", "write_around"), std::invalid_argument);
+
+  MemoryController controller;
+  ASSERT_TRUE(controller.GetCaches().Enabled());
+  EXPECT_FALSE(controller.GetCaches().Present(cache::Level::L1I));
+  EXPECT_EQ(controller.GetCaches().GetLevel(cache::Level::L1D).Config().lines, 16);
+  for (uint64_t address = 0x10000000; address < 0x10000100; address += 4) {
+    controller.WriteWord(address, static_cast<uint32_t>(address));
+  }
+  for (uint64_t address = 0x10000000; address < 0x10000100; address += 4) {
+    EXPECT_EQ(controller.ReadWord(address), static_cast<uint32_t>(address));
+  }
+  EXPECT_EQ(controller.ReadWord_d(0x10000000), 0x10000000u);
+  // Debugger edits and breakpoint conditions look at memory without touching the cache
+  controller.WriteDoubleWord_d(0x10001000, 7);
+  RegisterFile registers;
+  EXPECT_TRUE(BreakpointCondition::Parse("mem[0x10001000]", "==", "7").Evaluate(registers, controller));
+  const cache::CacheStats &stats = controller.GetCaches().GetLevel(cache::Level::L1D).Stats();
+  EXPECT_EQ(stats.accesses, 128);
+  EXPECT_EQ(stats.misses, 4);
+  EXPECT_EQ(stats.writes, 64);
+
+  std::ostringstream json;
+  controller.GetCaches().WriteJson(json);
+  EXPECT_NE(json.str().find("\"misses\": 4"), std::string::npos);
+  EXPECT_NE(json.str().find("\"dirty\": true"), std::string::npos);
+
+  vm_config::config = saved;
+  controller.Reset();
+  EXPECT_FALSE(controller.GetCaches().Enabled());
+}
+
+TEST(CacheTest, HierarchyLatencies) {
+  cache::CacheHierarchy caches;
+  EXPECT_EQ(caches.Configure(true, MakeHierarchy(cache::Inclusion::Inclusive)), "");
+  EXPECT_EQ(caches.Data(0x00, 4, false), 2 + 10 + 100); // Misses everywhere
+  EXPECT_EQ(caches.Data(0x04, 4, false), 2);            // L1D hit
+  EXPECT_EQ(caches.Fetch(0x00), 1 + 10);                // L1I miss, L2 hit on the line the data side brought in
+  EXPECT_EQ(caches.Fetch(0x04), 1);
+  EXPECT_EQ(caches.Stats().stall_cycles, 111 + 1 + 10);
+  EXPECT_EQ(caches.Stats().memory_reads, 1);
+  EXPECT_DOUBLE_EQ(caches.Stats().DataAmat(), 57.0);
+  EXPECT_DOUBLE_EQ(caches.Stats().Amat(), (114.0 + 12.0) / 4.0);
+
+  // L3 sits between L2 and memory
+  cache::HierarchyConfig config = MakeHierarchy(cache::Inclusion::Inclusive);
+  config.levels[static_cast<size_t>(cache::Level::L3)] = {cache::CacheConfig::FromSizes(256, 16, 4), 40};
+  EXPECT_EQ(caches.Configure(true, config), "");
+  EXPECT_EQ(caches.Data(0x00, 4, false), 2 + 10 + 40 + 100);
+
+  // Geometry the inclusion policy cannot keep
+  config.levels[static_cast<size_t>(cache::Level::L3)] = {cache::CacheConfig::FromSizes(256, 8, 4), 40};
+  EXPECT_NE(caches.Configure(true, config), "");
+  EXPECT_FALSE(caches.Enabled());
+  config.levels[static_cast<size_t>(cache::Level::L3)] = {cache::CacheConfig::FromSizes(256, 32, 4), 40};
+  EXPECT_EQ(caches.Configure(true, config), "");
+  config.inclusion = cache::Inclusion::Exclusive;
+  EXPECT_NE(caches.Configure(true, config), "");
+  EXPECT_EQ(caches.Fetch(0x00), 0);
+}
+
+TEST(CacheTest, InclusiveHierarchyBackInvalidates) {
+  cache::CacheHierarchy caches;
+  EXPECT_EQ(caches.Configure(true, MakeHierarchy(cache::Inclusion::Inclusive)), "");
+  const cache::Cache &l1d = caches.GetLevel(cache::Level::L1D);
+  const cache::Cache &l1i = caches.GetLevel(cache::Level::L1I);
+  const cache::Cache &l2 = caches.GetLevel(cache::Level::L2);
+
+  // 0x00, 0x20 and 0x40 all map to set 0 of every level
+  caches.Data(0x00, 4, true);
+  caches.Fetch(0x20);
+  EXPECT_TRUE(l2.Contains(0x00));
+  caches.Fetch(0x40); // L2 evicts 0x00, its least recently used line, dropping the dirty copy in L1D
+  EXPECT_FALSE(l1d.Contains(0x00));
+  EXPECT_FALSE(l2.Contains(0x00));
+  EXPECT_EQ(caches.Stats().back_invalidations, 1);
+  EXPECT_EQ(caches.Stats().memory_writes, 1);
+
+  for (uint64_t address : {0x00, 0x20, 0x40}) {
+    if (l1d.Contains(address) || l1i.Contains(address)) {
+      EXPECT_TRUE(l2.Contains(address)) << address;
+    }
+  }
+}
+
+TEST(CacheTest, ExclusiveHierarchyMovesVictimsDown) {
+  cache::CacheHierarchy caches;
+  EXPECT_EQ(caches.Configure(true, MakeHierarchy(cache::Inclusion::Exclusive)), "");
+  const cache::Cache &l1d = caches.GetLevel(cache::Level::L1D);
+  const cache::Cache &l2 = caches.GetLevel(cache::Level::L2);
+
+  caches.Data(0x00, 4, true);
+  EXPECT_TRUE(l1d.Contains(0x00));
+  EXPECT_FALSE(l2.Contains(0x00)); // Filled from memory straight into L1
+  caches.Data(0x20, 4, false);     // Same L1D set: 0x00 moves down to L2
+  EXPECT_FALSE(l1d.Contains(0x00));
+  EXPECT_TRUE(l2.Contains(0x00));
+  EXPECT_EQ(caches.Data(0x00, 4, false), 2 + 10); // Promoted back from L2, 0x20 moving down in its place
+  EXPECT_TRUE(l1d.Contains(0x00));
+  EXPECT_FALSE(l2.Contains(0x00));
+  EXPECT_TRUE(l2.Contains(0x20));
+  EXPECT_EQ(caches.Stats().memory_reads, 2);
+  EXPECT_EQ(caches.Stats().memory_writes, 0);
+
+  std::ostringstream json;
+  caches.WriteJson(json);
+  EXPECT_NE(json.str().find("\"inclusion\": \"exclusive\""), std::string::npos);
+  EXPECT_NE(json.str().find("\"dirty\": true"), std::string::npos); // 0x00 kept its dirty bit on the way up
+}
+
+TEST(CacheTest, ExclusiveHierarchyWritesAroundL1) {
+  cache::HierarchyConfig config = MakeHierarchy(cache::Inclusion::Exclusive);
+  config.levels[static_cast<size_t>(cache::Level::L1D)].cache.write_miss_policy = cache::WriteMissPolicy::NoWriteAllocate;
+  cache::CacheHierarchy caches;
+  EXPECT_EQ(caches.Configure(true, config), "");
+  const cache::Cache &l1d = caches.GetLevel(cache::Level::L1D);
+  const cache::Cache &l2 = caches.GetLevel(cache::Level::L2);
+
+  caches.Data(0x00, 4, false);
+  caches.Data(0x20, 4, false); // Same L1D set: 0x00 moves down to L2
+  ASSERT_TRUE(l2.Contains(0x00));
+
+  // An L1 write miss that is not allocated lands in the L2 line, which becomes dirty
+  caches.Data(0x00, 4, true);
+  EXPECT_FALSE(l1d.Contains(0x00));
+  EXPECT_EQ(l2.Stats().writes, 1);
+  EXPECT_EQ(l2.Stats().write_misses, 0);
+  EXPECT_EQ(caches.Stats().memory_writes, 0);
+  std::ostringstream json;
+  l2.WriteJson(json);
+  EXPECT_NE(json.str().find("\"dirty\": true"), std::string::npos);
+
+  // Held by no level, it goes to memory
+  caches.Data(0x40, 4, true);
+  EXPECT_EQ(l2.Stats().write_misses, 1);
+  EXPECT_FALSE(l2.Contains(0x40));
+  EXPECT_EQ(caches.Stats().memory_writes, 1);
+}
+
+TEST(CacheTest, SweepMatchesLruSimulation) {
+  cache::SweepConfig config{16, 64, 1024, 4, 2};
+  ASSERT_EQ(config.Validate(), "");
+  EXPECT_NE((cache::SweepConfig{16, 64, 1000, 4, 0}).Validate(), "");
+
+  // A loop over a small text, and data accesses mixing a hot array, a stride and random lines
+  cache::AccessTrace trace(16);
+  uint64_t state = 12345;
+  for (int i = 0; i < 4000; ++i) {
+    trace.Record(0x40 + (i % 37) * 4, 4, cache::Stream::Instruction);
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    const uint64_t pick = state >> 33;
+    const uint64_t address = pick % 3==0 ? 0x10000000 + (pick % 64) * 8
+        : pick % 3==1 ? 0x10010000 + (i % 300) * 16 : 0x10020000 + (pick % 4096) * 4;
+    trace.Record(address, 8, cache::Stream::Data);
+  }
+  const cache::SweepResult result = cache::Sweep(trace, config);
+  EXPECT_EQ(result.accesses[static_cast<size_t>(cache::Stream::Instruction)], 4000);
+
+  for (cache::Stream stream : {cache::Stream::Instruction, cache::Stream::Data}) {
+    for (uint64_t size = config.min_size; size <= config.max_size; size *= 2) {
+      for (uint64_t ways : {uint64_t{1}, uint64_t{2}, uint64_t{4}, size / 16}) {
+        cache::Cache lru;
+        ASSERT_EQ(lru.Configure(true, cache::CacheConfig::FromSizes(size, 16, ways)), "");
+        for (uint64_t entry : trace.Entries()) {
+          if ((entry & 1)==static_cast<uint64_t>(stream)) {
+            lru.AccessLine(entry >> 1, false);
+          }
+        }
+        EXPECT_DOUBLE_EQ(result.HitRate(stream, size, ways), lru.Stats().HitRate())
+            << cache::StreamName(stream) << " " << size << " B " << ways << "-way";
+      }
+    }
+  }
+  EXPECT_LT(result.HitRate(cache::Stream::Data, 32, 4), 0);
+
+  std::ostringstream csv;
+  result.WriteCsv(csv);
+  EXPECT_EQ(csv.str().substr(0, csv.str().find('\n')), "stream,size,accesses,1_way,2_way,4_way,fully_associative");
+  EXPECT_NE(csv.str().find("\ndata,64,"), std::string::npos);
+}
+
+TEST(CacheTest, Prefetchers) {
+  // Next-line on a sequential walk: only the first access misses
+  cache::CacheHierarchy next_line;
+  ASSERT_EQ(next_line.Configure(true, MakeL1(cache::NextLinePrefetcher{1}, 2)), "");
+  for (uint64_t address = 0; address < 1024; address += 4) {
+    next_line.Fetch(0x100);
+    next_line.Data(address, 4, false);
+  }
+  const cache::PrefetchStats &stats = next_line.Stats().prefetch;
+  EXPECT_EQ(next_line.GetLevel(cache::Level::L1D).Stats().misses, 1);
+  EXPECT_EQ(stats.issued, 64);
+  EXPECT_EQ(stats.useful, 63);
+  EXPECT_EQ(stats.late, 0);
+  EXPECT_DOUBLE_EQ(stats.Coverage(1), 63.0 / 64.0);
+
+  // With a slow memory the next line is needed long before it arrives; only the first prefetch,
+  // which overlaps the initial miss, is in time
+  ASSERT_EQ(next_line.Configure(true, MakeL1(cache::NextLinePrefetcher{1}, 100)), "");
+  for (uint64_t address = 0; address < 1024; address += 4) {
+    next_line.Fetch(0x100);
+    next_line.Data(address, 4, false);
+  }
+  EXPECT_EQ(next_line.Stats().prefetch.late, 62);
+  EXPECT_DOUBLE_EQ(next_line.Stats().prefetch.Timeliness(), 1.0 / 63.0);
+  EXPECT_LT(next_line.Stats().stall_cycles, 64 * 100);
+
+  // Stride: one load walking every fourth line; the third access is the first to prefetch
+  cache::CacheHierarchy stride;
+  cache::StridePrefetcher stride_prefetcher;
+  ASSERT_EQ(stride.Configure(true, MakeL1(stride_prefetcher, 2)), "");
+  for (uint64_t i = 0; i < 32; ++i) {
+    stride.Fetch(0x200);
+    stride.Data(0x10000000 + i * 64, 4, false);
+    stride.Fetch(0x204);
+    stride.Data(0x10010000, 4, false); // Another load, in its own table entry
+  }
+  EXPECT_EQ(stride.GetLevel(cache::Level::L1D).Stats().misses, 3 + 1);
+  EXPECT_EQ(stride.Stats().prefetch.useful, 29);
+
+  // Stream buffers follow two interleaved streams, but not with a single buffer
+  for (uint64_t buffers : {2, 1}) {
+    cache::CacheHierarchy streams;
+    ASSERT_EQ(streams.Configure(true, MakeL1(cache::MakePrefetcher(cache::PrefetcherType::StreamBuffer, 1, buffers, 4),
+                                             2)), "");
+    for (uint64_t line = 0; line < 32; ++line) {
+      streams.Fetch(0x300);
+      streams.Data(line * 16, 4, false);
+      streams.Fetch(0x304);
+      streams.Data(0x10000 + line * 16, 4, false);
+    }
+    const uint64_t misses = streams.GetLevel(cache::Level::L1D).Stats().misses;
+    if (buffers==2) {
+      EXPECT_EQ(misses, 2);
+      EXPECT_EQ(streams.Stats().prefetch.useful, 62);
+      std::ostringstream json;
+      streams.WriteJson(json);
+      EXPECT_NE(json.str().find("\"prefetcher\": \"stream_buffer\""), std::string::npos);
+      EXPECT_NE(json.str().find("\"useful\": 62"), std::string::npos);
+    } else {
+      EXPECT_GT(misses, 2);
+    }
+  }
+
+  vm_config::VmConfig saved = vm_config::config;
+  EXPECT_THROW(vm_config::config.modifyConfig("Cache", "cache_prefetcher", "markov"), std::invalid_argument);
+  vm_config::config.modifyConfig("Cache", "cache_prefetcher", "stride");
+  EXPECT_TRUE(std::holds_alternative<cache::StridePrefetcher>(vm_config::config.getCacheHierarchyConfig().prefetcher));
+  vm_config::config = saved;
+}
+
+TEST(CacheTest, StridePrefetcherConfidence) {
+  cache::StridePrefetcher prefetcher;
+  prefetcher.degree = 2;
+  std::vector<uint64_t> issued;
+  auto observe = [&](uint64_t pc, uint64_t address) {
+    issued.clear();
+    prefetcher.Observe({pc, address, address >> 6, true, false}, 6, [&](uint64_t line) { issued.push_back(line); });
+  };
+
+  // The first access allocates the entry and the second sets its stride; only the third, which
+  // repeats that stride, prefetches
+  observe(0x40, 0x1000);
+  EXPECT_TRUE(issued.empty());
+  observe(0x40, 0x1100);
+  EXPECT_TRUE(issued.empty());
+  observe(0x40, 0x1200);
+  EXPECT_EQ(issued, (std::vector<uint64_t>{0x1300 >> 6, 0x1400 >> 6}));
+
+  // An odd access costs the entry its confidence but not its stride, so it prefetches again as
+  // soon as the stride resumes
+  observe(0x40, 0x1208);
+  EXPECT_TRUE(issued.empty());
+  observe(0x40, 0x1308);
+  EXPECT_EQ(issued, (std::vector<uint64_t>{0x1408 >> 6, 0x1508 >> 6}));
+
+  // Strides within a line fetch the next lines in their direction
+  observe(0x80, 0x2040);
+  observe(0x80, 0x203c);
+  observe(0x80, 0x2038);
+  EXPECT_EQ(issued, (std::vector<uint64_t>{(0x2038 >> 6) - 1, (0x2038 >> 6) - 2}));
+}
@@ -0,0 +1,213 @@
+/**
+ * File Name: test_campaign.cpp
+ * Author: Vishank Singh
+ * Github: https://github.com/VishankSingh
+ */
+
+#include <gtest/gtest.h>
+#include "campaign/fault_campaign.h"
+#include "campaign/json.h"
+#include "campaign/work_stealing_pool.h"
+#include "../src/assembler/assembler.h"
+#include "../src/vm/rvss/rvss_vm.h"
+#include "utils.h"
+
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const char *kSumProgram = R"(.data
+arr: .word 1, 2, 3, 4, 5, 6, 7, 8, 9, 10
+.text
+  lui x5, 0x10000
+  addi x6, x0, 10
+  addi x10, x0, 0
+loop:
+  lw x7, 0(x5)
+  add x10, x10, x7
+  addi x5, x5, 4
+  addi x6, x6, -1
+  bne x6, x0, loop
+  addi x17, x0, 1
+  ecall
+)";
+
+AssembledProgram AssembleSum() {
+  setupVmStateDirectory();
+  std::filesystem::path path = std::filesystem::temp_directory_path() / "campaign_test_sum.s";
+  std::ofstream(path) << kSumProgram;
+  return assemble(path.string());
+}
+
+} // namespace
+
+TEST(CampaignTest, JsonParseTest) {
+  campaign::JsonValue json = campaign::JsonValue::Parse(
+      R"({"runs": 12, "name": "a\"b\u0041", "list": [true, false, null, -1.5e2], "nested": {}})");
+  EXPECT_EQ(json.Find("runs")->AsUint(), 12);
+  EXPECT_EQ(json.Find("name")->AsString(), "a\"bA");
+  const auto &list = json.Find("list")->AsArray();
+  ASSERT_EQ(list.size(), 4);
+  EXPECT_TRUE(list[0].AsBool());
+  EXPECT_FALSE(list[1].AsBool());
+  EXPECT_DOUBLE_EQ(list[3].AsDouble(), -150.0);
+  EXPECT_TRUE(json.Find("nested")->AsObject().empty());
+  EXPECT_EQ(json.Find("missing"), nullptr);
+
+  EXPECT_THROW(campaign::JsonValue::Parse("{\"a\": 1,}"), std::runtime_error);
+  EXPECT_THROW(campaign::JsonValue::Parse("[1] 2"), std::runtime_error);
+  EXPECT_THROW(campaign::JsonValue::Parse("\"\\uZZZZ\""), std::runtime_error);
+  EXPECT_THROW(campaign::JsonValue::Parse(std::string(100, '[')), std::runtime_error);
+  EXPECT_THROW((void)json.Find("runs")->AsString(), std::runtime_error);
+  EXPECT_THROW((void)campaign::JsonValue::Parse("-3").AsUint(), std::runtime_error);
+  EXPECT_THROW((void)campaign::JsonValue::Parse("1.2.3").AsDouble(), std::runtime_error);
+}
+
+TEST(CampaignTest, SpecTest) {
+  campaign::CampaignSpec spec = campaign::CampaignSpec::FromJson(
+      campaign::JsonValue::Parse(R"({"program": "p.s", "runs": 5, "models": ["pc", "inject_flip"],
+                                     "config": {"Memory": {"memory_ecc": "true"}}})"), "dir");
+  EXPECT_EQ(spec.program, std::filesystem::path("dir") / "p.s");
+  EXPECT_EQ(spec.runs, 5);
+  ASSERT_EQ(spec.models.size(), 2);
+  EXPECT_EQ(spec.models[1], campaign::FaultModel::kInjectFlip);
+  ASSERT_EQ(spec.config.size(), 1);
+  EXPECT_EQ(std::get<1>(spec.config[0]), "memory_ecc");
+
+  EXPECT_THROW(campaign::CampaignSpec::FromJson(campaign::JsonValue::Parse(R"({"runs": 5})")), std::runtime_error);
+  EXPECT_THROW(campaign::CampaignSpec::FromJson(campaign::JsonValue::Parse(R"({"program": "p.s", "model": []})")),
+               std::runtime_error);
+  EXPECT_THROW(campaign::CampaignSpec::FromJson(
+                   campaign::JsonValue::Parse(R"({"program": "p.s", "models": ["cosmic_ray"]})")),
+               std::runtime_error);
+}
+
+TEST(CampaignTest, WorkStealingPoolTest) {
+  campaign::WorkStealingPool pool(4);
+  ASSERT_EQ(pool.Threads(), 4);
+  std::vector<std::atomic<int>> calls(1000);
+  pool.ForEach(calls.size(), [&](size_t worker, size_t index) {
+    ASSERT_LT(worker, 4);
+    calls[index]++;
+  });
+  for (const std::atomic<int> &count : calls) {
+    EXPECT_EQ(count.load(), 1);
+  }
+
+  EXPECT_THROW(pool.ForEach(100, [](size_t, size_t index) {
+    if (index==37) {
+      throw std::runtime_error("task failed");
+    }
+  }), std::runtime_error);
+}
+
+TEST(CampaignTest, DeterminismTest) {
+  AssembledProgram program = AssembleSum();
+  campaign::CampaignSpec spec;
+  spec.runs = 300;
+  spec.seed = 7;
+
+  std::vector<std::string> csv;
+  for (size_t threads : {1, 3}) {
+    spec.threads = threads;
+    campaign::FaultCampaign fault_campaign(spec, program);
+    campaign::CampaignResults results = fault_campaign.Run();
+    ASSERT_EQ(results.Size(), 300);
+    EXPECT_EQ(fault_campaign.Golden().instructions, 55);
+
+    auto counts = results.Counts();
+    uint64_t total = 0;
+    for (uint64_t count : counts) {
+      total += count;
+    }
+    EXPECT_EQ(total, 300);
+    EXPECT_GT(counts[static_cast<size_t>(campaign::Outcome::kSdc)], 0);
+
+    std::ostringstream os;
+    results.WriteCsv(os);
+    csv.push_back(os.str());
+  }
+  EXPECT_EQ(csv[0], csv[1]);
+}
+
+TEST(CampaignTest, ClassifyTest) {
+  AssembledProgram program = AssembleSum();
+  campaign::CampaignSpec spec;
+  spec.runs = 0;
+  spec.threads = 1;
+  campaign::FaultCampaign fault_campaign(spec, program);
+  fault_campaign.Run();
+
+  RVSSVM vm;
+  EXPECT_EQ(fault_campaign.Classify(fault_campaign.Execute(vm, nullptr, 200)), campaign::Outcome::kMasked);
+
+  // The accumulator right before the exit: the sum is wrong
+  campaign::FaultPlan plan;
+  plan.model = campaign::FaultModel::kRegister;
+  plan.instruction = 53;
+  plan.target = 10;
+  plan.bit = 8;
+  EXPECT_EQ(fault_campaign.Classify(fault_campaign.Execute(vm, &plan, 200)), campaign::Outcome::kSdc);
+
+  // The loop counter: the loop runs far past the golden run's length
+  plan.instruction = 4;
+  plan.target = 6;
+  plan.bit = 20;
+  EXPECT_EQ(fault_campaign.Classify(fault_campaign.Execute(vm, &plan, 200)), campaign::Outcome::kHang);
+}
+
+TEST(CampaignTest, SandboxStopsScrubberTest) {
+  AssembledProgram program = AssembleSum();
+  vm_config::VmConfig saved = vm_config::config;
+  vm_config::config.modifyConfig("Memory", "memory_ecc", "true");
+  vm_config::config.modifyConfig("Memory", "scrub_rate", "1000000");
+  campaign::CampaignSpec spec;
+  spec.runs = 0;
+  spec.threads = 1;
+  campaign::FaultCampaign fault_campaign(spec, program);
+  fault_campaign.Run();
+
+  RVSSVM vm;
+  EXPECT_TRUE(vm.memory_controller_.Scrubbing());
+  fault_campaign.Prepare(vm);
+  EXPECT_FALSE(vm.memory_controller_.Scrubbing());
+  vm_config::config = saved;
+}
+
+TEST(CampaignTest, ForkTest) {
+  AssembledProgram program = AssembleSum();
+  for (uint64_t interval : {uint64_t{0}, uint64_t{1}}) {
+    campaign::CampaignSpec spec;
+    spec.runs = 0;
+    spec.threads = 1;
+    spec.snapshot_interval = interval;
+    campaign::FaultCampaign fault_campaign(spec, program);
+    fault_campaign.Run();
+    uint64_t golden = fault_campaign.Golden().instructions;
+    ASSERT_EQ(fault_campaign.Snapshots().size(),
+              (golden + fault_campaign.SnapshotInterval() - 1) / fault_campaign.SnapshotInterval());
+
+    // Forking from a snapshot and stopping at convergence must not change any outcome
+    RVSSVM forked;
+    RVSSVM fresh;
+    fault_campaign.Prepare(forked);
+    uint64_t budget = static_cast<uint64_t>(std::ceil(static_cast<double>(golden) * spec.hang_factor));
+    uint64_t converged = 0;
+    for (uint64_t i = 0; i < 300; ++i) {
+      campaign::FaultPlan plan = fault_campaign.Plan(i);
+      campaign::RunRecord run = fault_campaign.Fork(forked, plan);
+      converged += run.converged;
+      EXPECT_EQ(fault_campaign.Classify(run), fault_campaign.Classify(fault_campaign.Execute(fresh, &plan, budget)))
+          << "run " << i;
+    }
+    if (interval==1) {
+      EXPECT_GT(converged, 0);
+    }
+  }
+}
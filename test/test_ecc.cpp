@@ -0,0 +1,350 @@
+/**
+ * File Name: test_ecc.cpp
+ * Author: Vishank Singh
+ * Github: https://github.com/VishankSingh
+ */
+
+#include <gtest/gtest.h>
+
+#include "ecc_reference.h"
+#include "ecc/ecc_policy.h"
+#include "ecc/ecc_utils.h"
+#include "vm/ecc_telemetry.h"
+#include "vm/registers.h"
+
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+static_assert(ecc::compute_ecc(0)==0);
+static_assert(ecc::checkError(ecc::compute_ecc(0x12345678))==ecc::compute_ecc(0x12345678));
+static_assert(ecc::checkError(ecc::compute_ecc(0x12345678) ^ (1ULL << 7))==ecc::compute_ecc(0x12345678));
+
+TEST(EccTest, ComputeEccMatchesReference) {
+  for (uint32_t data : RandomWords(1 << 16)) {
+    ASSERT_EQ(ecc::compute_ecc(data), ReferenceComputeEcc(data)) << std::hex << data;
+  }
+  for (int i = 0; i < 32; ++i) {
+    ASSERT_EQ(ecc::compute_ecc(1U << i), ReferenceComputeEcc(1U << i)) << i;
+  }
+}
+
+TEST(EccTest, CheckErrorMatchesReferenceUnderBitFlips) {
+  std::vector<uint32_t> words = RandomWords(256);
+  for (uint32_t data : words) {
+    // Metadata above bit 38 must pass through unchanged exactly when the reference keeps it
+    uint64_t encoded = ecc::compute_ecc(data) | (0x2AULL << ecc::SIG_SHIFT);
+    ASSERT_EQ(ecc::checkError(encoded), ReferenceCheckError(encoded));
+    // Every single and double flip over the 39 data and check bits
+    for (int a = 0; a < 39; ++a) {
+      uint64_t single = encoded ^ (1ULL << a);
+      ASSERT_EQ(ecc::checkError(single), ReferenceCheckError(single)) << std::hex << data << " bit " << a;
+      for (int b = a + 1; b < 39; ++b) {
+        uint64_t pair = single ^ (1ULL << b);
+        ASSERT_EQ(ecc::checkError(pair), ReferenceCheckError(pair)) << std::hex << data << " bits " << a << "," << b;
+      }
+    }
+  }
+
+  // Arbitrary (not necessarily valid) codewords
+  std::mt19937_64 rng(42);
+  for (int i = 0; i < (1 << 16); ++i) {
+    uint64_t encoded = rng();
+    ASSERT_EQ(ecc::checkError(encoded), ReferenceCheckError(encoded)) << std::hex << encoded;
+  }
+}
+
+TEST(EccTest, MemoryCodeCorrectsSingleAndDetectsDoubleFlips) {
+  for (uint32_t data : RandomWords(64)) {
+    const uint8_t check = ecc::memory_check_byte(data);
+    auto flip = [&](uint32_t &word, uint8_t &bits, int bit) {
+      if (bit < 32) word ^= 1U << bit;
+      else bits ^= static_cast<uint8_t>(1 << (bit - 32));
+    };
+
+    uint32_t clean = data;
+    uint8_t clean_check = check;
+    EXPECT_EQ(ecc::correct_memory_word(clean, clean_check), ecc::WordCheck::kClean);
+
+    for (int a = 0; a < 39; ++a) {
+      uint32_t word = data;
+      uint8_t bits = check;
+      flip(word, bits, a);
+      ASSERT_EQ(ecc::correct_memory_word(word, bits), ecc::WordCheck::kCorrected) << std::hex << data << " bit " << a;
+      ASSERT_EQ(word, data);
+      ASSERT_EQ(bits, check);
+
+      for (int b = a + 1; b < 39; ++b) {
+        uint32_t pair = data;
+        uint8_t pair_bits = check;
+        flip(pair, pair_bits, a);
+        flip(pair, pair_bits, b);
+        uint32_t before = pair;
+        ASSERT_EQ(ecc::correct_memory_word(pair, pair_bits), ecc::WordCheck::kUncorrectable)
+            << std::hex << data << " bits " << a << "," << b;
+        ASSERT_EQ(pair, before);
+      }
+    }
+  }
+}
+
+TEST(EccTest, Secded64CorrectsSingleAndDetectsDoubleFlips) {
+  std::mt19937_64 rng(0x5eed);
+  std::vector<uint64_t> values = {0, 1, 1ULL << 63, ~0ULL, 0xAAAAAAAAAAAAAAAAULL};
+  while (values.size() < 16) {
+    values.push_back(rng());
+  }
+  for (uint64_t data : values) {
+    const uint8_t check = ecc::secded64_check_byte(data);
+    auto flip = [&](uint64_t &value, uint8_t &bits, int bit) {
+      if (bit < 64) value ^= 1ULL << bit;
+      else bits ^= static_cast<uint8_t>(1 << (bit - 64));
+    };
+
+    uint64_t clean = data;
+    uint8_t clean_check = check;
+    EXPECT_EQ(ecc::correct_secded64(clean, clean_check), ecc::WordCheck::kClean);
+
+    for (int a = 0; a < 72; ++a) {
+      uint64_t value = data;
+      uint8_t bits = check;
+      flip(value, bits, a);
+      ASSERT_EQ(ecc::correct_secded64(value, bits), ecc::WordCheck::kCorrected) << std::hex << data << " bit " << a;
+      ASSERT_EQ(value, data);
+      ASSERT_EQ(bits, check);
+
+      for (int b = a + 1; b < 72; ++b) {
+        uint64_t pair = data;
+        uint8_t pair_bits = check;
+        flip(pair, pair_bits, a);
+        flip(pair, pair_bits, b);
+        uint64_t before = pair;
+        ASSERT_EQ(ecc::correct_secded64(pair, pair_bits), ecc::WordCheck::kUncorrectable)
+            << std::hex << data << " bits " << a << "," << b;
+        ASSERT_EQ(pair, before);
+      }
+    }
+  }
+}
+
+TEST(EccTest, ShadowRegistersKeepFullWidthValues) {
+  RegisterFile registers;
+  registers.SetShadowEcc(true);
+  const uint64_t value = 0xDEADBEEF00001234ULL;
+  registers.WriteGpr(5, value);
+  EXPECT_EQ(registers.ReadGpr(5), value);
+  EXPECT_EQ(registers.ReadGprCheck(5), ecc::secded64_check_byte(value));
+  registers.WriteGpr(0, value);
+  EXPECT_EQ(registers.ReadGpr(0), 0);
+
+  // A flip in the upper half leaves the code stale, so the policy finds and corrects it
+  registers.FlipGprBit(5, 61);
+  EXPECT_EQ(registers.ReadGpr(5), value ^ (1ULL << 61));
+  uint64_t read = registers.ReadGpr(5);
+  uint8_t check = registers.ReadGprCheck(5);
+  uint8_t meta = ecc::shadow_meta(ecc::SIG_POINTER, 0);
+  ecc::PolicyEngine engine{ecc::AlwaysSecdedPolicy()};
+  EXPECT_EQ(engine.check_shadow(read, check, meta), ecc::CheckResult::kCorrected);
+  EXPECT_EQ(read, value);
+  EXPECT_EQ(ecc::shadow_sig(meta), ecc::SIG_POINTER);
+  EXPECT_EQ(ecc::shadow_hist(meta), 1);
+  EXPECT_EQ(engine.check_shadow(read, check, meta), ecc::CheckResult::kClean);
+
+  // Below the threshold nothing is checked, in the shadow layout as in the packed one
+  ecc::PolicyEngine significance{ecc::SignificanceThresholdPolicy()};
+  uint8_t temp = ecc::shadow_meta(ecc::SIG_TEMP, 0);
+  read ^= 1;
+  EXPECT_EQ(significance.check_shadow(read, check, temp), ecc::CheckResult::kSkipped);
+  EXPECT_EQ(read, value ^ 1);
+
+  registers.SetShadowEcc(false);
+  EXPECT_FALSE(registers.ShadowEcc());
+  EXPECT_EQ(registers.ReadGprCheck(5), 0);
+}
+
+TEST(EccTest, BatchKernelsMatchScalar) {
+  std::vector<uint32_t> words = RandomWords(1000);
+  std::mt19937_64 rng(7);
+
+  for (auto kernel : {ecc::BatchKernel::kScalar, ecc::BatchKernel::kAvx2, ecc::BatchKernel::kAvx512}) {
+    if (!ecc::batch_kernel_supported(kernel)) {
+      std::cout << "skipping " << ecc::batch_kernel_name(kernel) << " (not supported)\n";
+      continue;
+    }
+    // Odd lengths exercise the scalar tails
+    for (size_t count : {0, 1, 7, 8, 15, 16, 17, 33, 1000}) {
+      std::vector<uint64_t> encoded(count);
+      ecc::compute_ecc_batch(words.data(), encoded.data(), count, kernel);
+      for (size_t i = 0; i < count; ++i) {
+        ASSERT_EQ(encoded[i], ecc::compute_ecc(words[i])) << ecc::batch_kernel_name(kernel) << " " << i;
+      }
+
+      // Flip zero, one or two random code bits per word, sparsely enough that some groups stay clean
+      std::vector<uint64_t> damaged = encoded;
+      for (auto &word : damaged) {
+        word |= rng() & ecc::METADATA_MASK;
+        if (rng() % 8 == 0) word ^= 1ULL << (rng() % 39);
+        if (rng() % 32 == 0) word ^= 1ULL << (rng() % 39);
+      }
+      std::vector<uint64_t> expected(count);
+      size_t expected_changed = 0;
+      for (size_t i = 0; i < count; ++i) {
+        expected[i] = ecc::checkError(damaged[i]);
+        expected_changed += expected[i] != damaged[i];
+      }
+
+      std::vector<uint64_t> checked(count);
+      EXPECT_EQ(ecc::check_batch(damaged.data(), checked.data(), count, kernel), expected_changed);
+      EXPECT_EQ(checked, expected) << ecc::batch_kernel_name(kernel) << " count " << count;
+
+      // In place
+      EXPECT_EQ(ecc::check_batch(damaged.data(), damaged.data(), count, kernel), expected_changed);
+      EXPECT_EQ(damaged, expected) << ecc::batch_kernel_name(kernel) << " count " << count;
+    }
+  }
+}
+
+TEST(EccTest, MemoryCheckBatchMatchesScalar) {
+  std::vector<uint32_t> words = RandomWords(1000);
+  for (auto kernel : {ecc::BatchKernel::kScalar, ecc::BatchKernel::kAvx2, ecc::BatchKernel::kAvx512}) {
+    if (!ecc::batch_kernel_supported(kernel)) continue;
+    for (size_t count : {0, 3, 8, 16, 23, 1000}) {
+      std::vector<uint8_t> check(count + 1, 0xEE);
+      ecc::memory_check_batch(words.data(), check.data(), count, kernel);
+      for (size_t i = 0; i < count; ++i) {
+        ASSERT_EQ(check[i], ecc::memory_check_byte(words[i])) << ecc::batch_kernel_name(kernel) << " " << i;
+      }
+      EXPECT_EQ(check[count], 0xEE) << "wrote past the end";
+    }
+  }
+}
+
+TEST(EccTest, PoliciesCheckOrSkip) {
+  auto value = [](uint32_t data, uint8_t mode, uint8_t hist, uint16_t freq, uint8_t sig) {
+    return ecc::update_metadata(ecc::compute_ecc(data), mode, hist, freq, sig);
+  };
+  const uint64_t data = value(0x12345678, ecc::MODE_SEC, 0, 1, ecc::SIG_DATA);
+  const uint64_t pointer = value(0x1000, ecc::MODE_SEC, 0, 1, ecc::SIG_POINTER);
+  const uint64_t critical = value(0xCAFE, ecc::MODE_SEC, 0, 1, ecc::SIG_CRITICAL);
+  auto flipped = [](uint64_t v) { return v ^ (1ULL << 3); };
+
+  // Legacy behaviour: every value not marked MODE_NONE is checked, the mode follows significance
+  ecc::PolicyEngine adaptive;
+  EXPECT_STREQ(adaptive.name(), "adaptive");
+  uint64_t checked = adaptive.check(flipped(critical));
+  EXPECT_EQ(checked & ecc::DATA_ECC_MASK, critical & ecc::DATA_ECC_MASK);
+  EXPECT_EQ(ecc::get_mode(checked), ecc::MODE_SECDED);
+  EXPECT_EQ(ecc::get_hist(checked), 1);
+  EXPECT_EQ(ecc::get_freq(checked), 2);
+  EXPECT_EQ(adaptive.check(flipped(value(7, ecc::MODE_NONE, 0, 1, ecc::SIG_DATA))) & 0xFFFFFFFF, 7 ^ (1U << 3));
+  EXPECT_EQ(adaptive.stats().checked, 1);
+  EXPECT_EQ(adaptive.stats().skipped, 1);
+  EXPECT_EQ(adaptive.stats().corrected, 1);
+  EXPECT_EQ(adaptive.check(data), ecc::adaptive_check_error(data));
+
+  ecc::PolicyEngine always{ecc::AlwaysSecdedPolicy()};
+  EXPECT_EQ(always.check(flipped(value(7, ecc::MODE_NONE, 0, 1, ecc::SIG_TEMP))) & 0xFFFFFFFF, 7);
+  EXPECT_EQ(always.stats().corrected, 1);
+
+  ecc::SignificanceThresholdPolicy threshold;
+  threshold.threshold = ecc::SIG_POINTER;
+  ecc::PolicyEngine significance{threshold};
+  EXPECT_NE(significance.check(flipped(data)) & ecc::DATA_ECC_MASK, data & ecc::DATA_ECC_MASK);
+  EXPECT_EQ(significance.check(flipped(pointer)) & ecc::DATA_ECC_MASK, pointer & ecc::DATA_ECC_MASK);
+  EXPECT_EQ(significance.stats().skipped, 1);
+  EXPECT_EQ(significance.stats().checked, 1);
+
+  ecc::PolicyEngine none{ecc::NoEccPolicy()};
+  EXPECT_EQ(ecc::get_mode(none.check(flipped(critical))), ecc::MODE_NONE);
+  EXPECT_EQ(none.stats().skipped, 1);
+  EXPECT_EQ(none.stats().checked, 0);
+}
+
+TEST(EccTest, FrequencyDecayPolicyChecksPeriodically) {
+  ecc::FrequencyDecayPolicy decay;
+  decay.period = 4;
+  ecc::PolicyEngine engine{decay};
+
+  // A value read over and over is checked on every fourth read
+  uint64_t v = ecc::update_metadata(ecc::compute_ecc(99), ecc::MODE_SEC, 0, 0, ecc::SIG_DATA);
+  for (int i = 0; i < 40; ++i) {
+    v = engine.check(v);
+  }
+  EXPECT_EQ(engine.stats().checked, 10);
+  EXPECT_EQ(engine.stats().skipped, 30);
+
+  // A flip is found by the next periodic check; from then on the value is checked on every read,
+  // until clean checks have worn its history off
+  engine.reset_stats();
+  v ^= 1;
+  for (int i = 0; i < 3; ++i) {
+    v = engine.check(v);
+    EXPECT_EQ(v & 0xFFFFFFFF, 98);
+  }
+  v = engine.check(v);
+  EXPECT_EQ(v & 0xFFFFFFFF, 99);
+  EXPECT_EQ(ecc::get_hist(v), 1);
+  EXPECT_EQ(ecc::get_mode(v), ecc::MODE_SECDED);
+  v = engine.check(v);
+  EXPECT_EQ(ecc::get_hist(v), 0);
+  EXPECT_EQ(ecc::get_mode(v), ecc::MODE_SEC);
+  EXPECT_EQ(engine.stats().checked, 2);
+  EXPECT_EQ(engine.stats().skipped, 3);
+  EXPECT_EQ(engine.stats().corrected, 1);
+}
+
+TEST(EccTest, TelemetryCountsBySignificanceAndPc) {
+  EccTelemetry telemetry;
+  ecc::PolicyEngine engine;
+  auto check = [&](uint32_t data, uint8_t sig, uint64_t flip, uint64_t pc) {
+    uint64_t value = ecc::update_metadata(ecc::compute_ecc(data), ecc::MODE_SEC, 0, 100, sig) ^ flip;
+    ecc::CheckResult result;
+    engine.check(value, result);
+    telemetry.Record(value, result, pc);
+  };
+  check(1, ecc::SIG_TEMP, 0, 0x10);
+  check(2, ecc::SIG_DATA, 1ULL << 4, 0x20);
+  check(3, ecc::SIG_POINTER, (1ULL << 4) | (1ULL << 9), 0x20);
+  check(4, ecc::SIG_CRITICAL, 1ULL << 0, 0x30);
+  check(5, ecc::SIG_CRITICAL, 1ULL << 1, 0x30);
+
+  EccTelemetry::Snapshot stats = telemetry.Take(engine.name());
+  using Class = EccTelemetry::SignificanceClass;
+  auto count = [&](Class c, ecc::CheckResult r) { return stats.results[static_cast<size_t>(c)][static_cast<size_t>(r)]; };
+  EXPECT_EQ(count(Class::kTemp, ecc::CheckResult::kClean), 1);
+  EXPECT_EQ(count(Class::kData, ecc::CheckResult::kCorrected), 1);
+  EXPECT_EQ(count(Class::kPointer, ecc::CheckResult::kUncorrectable), 1);
+  EXPECT_EQ(count(Class::kCritical, ecc::CheckResult::kCorrected), 2);
+  EXPECT_EQ(stats.Checks(), 5);
+  EXPECT_EQ(stats.freq[100 >> EccTelemetry::kFreqBucketShift], 5);
+  EXPECT_EQ(engine.stats().uncorrectable, 1);
+
+  ASSERT_EQ(stats.errors_by_pc.size(), 2);
+  EXPECT_EQ(stats.errors_by_pc.at(0x20), (std::array<uint64_t, 2>{1, 1}));
+  EXPECT_EQ(stats.errors_by_pc.at(0x30), (std::array<uint64_t, 2>{2, 0}));
+
+  std::ostringstream json;
+  stats.WriteJson(json);
+  EXPECT_NE(json.str().find(R"("critical": {"skipped": 0, "clean": 0, "corrected": 2, "uncorrectable": 0})"),
+            std::string::npos);
+  EXPECT_NE(json.str().find(R"({"pc": "0x00000020", "corrected": 1, "uncorrectable": 1})"), std::string::npos);
+
+  stats.memory_ecc = true;
+  stats.memory.corrected = 3;
+  stats.memory.injected = 4;
+  stats.scrub.words_scrubbed = 1024;
+  stats.scrub.uncorrectable = 1;
+  json.str("");
+  stats.WriteJson(json);
+  EXPECT_NE(json.str().find(R"("memory": {"ecc": true, "corrected": 3, "uncorrectable": 0, "injected": 4, )"),
+            std::string::npos);
+  EXPECT_NE(json.str().find(R"("scrubber": {"running": false, "passes": 0, "words_scrubbed": 1024, "corrected": 0, "uncorrectable": 1})"),
+            std::string::npos);
+
+  telemetry.SetEnabled(false);
+  check(6, ecc::SIG_DATA, 0, 0x40);
+  EXPECT_EQ(telemetry.Take(engine.name()).Checks(), 5);
+  telemetry.Clear();
+  EXPECT_EQ(telemetry.Take(engine.name()).Checks(), 0);
+}
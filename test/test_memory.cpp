@@ -6,6 +6,11 @@
 
 #include <gtest/gtest.h>
 #include "../src/vm/main_memory.h"
+#include "vm/memory_scrubber.h"
+
+#include <algorithm>
+#include <thread>
+#include <chrono>
 
 TEST(MemoryTest, ReadWriteTest) {
   Memory memory;
@@ -88,3 +93,267 @@ TEST(MemoryTest, ReadWriteLargeDoubleTest) {
 }
 
 
+
+TEST(MemoryTest, SparseAddressSpaceTest) {
+  Memory memory;
+  memory.WriteDoubleWord(0x30000000, 0x1122334455667788);
+  memory.WriteDoubleWord(0xfffffffffffffff0, 0x0102030405060708);
+  memory.WriteWord(0x0ffe, 0xaabbccdd); // straddles a page boundary
+
+  EXPECT_EQ(memory.ReadDoubleWord(0x30000000), 0x1122334455667788);
+  EXPECT_EQ(memory.ReadDoubleWord(0xfffffffffffffff0), 0x0102030405060708);
+  EXPECT_EQ(memory.ReadWord(0x0ffe), 0xaabbccdd);
+  EXPECT_EQ(memory.ReadByte(0x1000), 0xbb);
+  EXPECT_EQ(memory.ReadDoubleWord(0x40000000), 0);
+
+  memory.Reset();
+  EXPECT_EQ(memory.ReadDoubleWord(0x30000000), 0);
+  EXPECT_EQ(memory.ReadWord(0x0ffe), 0);
+}
+
+TEST(MemoryTest, EccModeTest) {
+  Memory memory;
+  // Pages written before ECC is turned on get encoded when it is
+  memory.WriteWord(0x2000, 0xdeadbeef);
+  memory.SetEccEnabled(true);
+  ASSERT_TRUE(memory.EccEnabled());
+  EXPECT_EQ(memory.ReadWord(0x2000), 0xdeadbeef);
+  EXPECT_EQ(memory.GetEccStats().corrected, 0);
+
+  // Every single flip, data or check bit, is corrected on the next read and written back
+  for (unsigned int bit = 0; bit < 39; ++bit) {
+    memory.InjectBitFlip(0x2002, bit);
+    EXPECT_EQ(memory.ReadWord(0x2000), 0xdeadbeef) << bit;
+  }
+  EXPECT_EQ(memory.GetEccStats().corrected, 39);
+  EXPECT_EQ(memory.GetEccStats().injected, 39);
+  EXPECT_EQ(memory.ReadWord(0x2000), 0xdeadbeef);
+  EXPECT_EQ(memory.GetEccStats().corrected, 39);
+
+  // A byte store verifies the rest of its word before merging into it
+  memory.InjectBitFlip(0x2000, 30);
+  memory.WriteByte(0x2000, 0x11);
+  EXPECT_EQ(memory.GetEccStats().corrected, 40);
+  EXPECT_EQ(memory.ReadWord(0x2000), 0xdeadbe11);
+
+  // A full-word store simply replaces a damaged word
+  memory.InjectBitFlip(0x2004, 3);
+  memory.WriteWord(0x2004, 7);
+  EXPECT_EQ(memory.ReadWord(0x2004), 7);
+  EXPECT_EQ(memory.GetEccStats().corrected, 40);
+
+  // Double flips are detected and left alone
+  memory.InjectBitFlip(0x2000, 1);
+  memory.InjectBitFlip(0x2000, 35);
+  EXPECT_EQ(memory.ReadWord(0x2000), 0xdeadbe13);
+  EXPECT_EQ(memory.ReadByte(0x2001), 0xbe);
+  EXPECT_EQ(memory.GetEccStats().uncorrectable, 1);
+
+  // A rewritten word counts again if it goes bad again
+  memory.WriteWord(0x2000, 0xdeadbe11);
+  memory.InjectBitFlip(0x2000, 1);
+  memory.InjectBitFlip(0x2000, 2);
+  EXPECT_EQ(memory.ReadWord(0x2000), 0xdeadbe17);
+  EXPECT_EQ(memory.ReadWord(0x2000), 0xdeadbe17);
+  EXPECT_EQ(memory.GetEccStats().uncorrectable, 2);
+  memory.WriteWord(0x2000, 0xdeadbe11);
+
+  // Blocks spanning pages, with partial words at both ends
+  std::vector<uint8_t> block(3 * Memory::kPageSize + 6);
+  for (size_t i = 0; i < block.size(); ++i) block[i] = static_cast<uint8_t>(i * 7);
+  memory.WriteBlock(0x10000 + 2, block);
+  memory.InjectBitFlip(0x10000 + Memory::kPageSize + 8, 17);
+  for (size_t i = 0; i < block.size(); ++i) {
+    ASSERT_EQ(memory.ReadByte(0x10000 + 2 + i), block[i]) << i;
+  }
+  EXPECT_EQ(memory.GetEccStats().corrected, 41);
+  EXPECT_EQ(memory.GetEccStats().uncorrectable, 2);
+
+  // Restored pages come back with matching check bytes
+  memory.BeginEpoch();
+  memory.WriteWord(0x10000, 0x12345678);
+  memory.RestorePages(memory.BeginEpoch());
+  EXPECT_EQ(memory.ReadByte(0x10002), block[0]);
+  EXPECT_EQ(memory.GetEccStats().corrected, 41);
+
+  EXPECT_THROW(memory.InjectBitFlip(0x2000, 39), std::invalid_argument);
+  memory.SetEccEnabled(false);
+  EXPECT_THROW(memory.InjectBitFlip(0x2000, 32), std::invalid_argument);
+}
+
+TEST(MemoryTest, ImageTest) {
+  Memory memory;
+  memory.WriteWord(0x1000, 1);
+  memory.WriteWord(0x2000, 2);
+  memory.WriteWord(0x3000, 0); // resident but blank
+  Memory::Image first = memory.TakeImage();
+  EXPECT_EQ(first.pages.size(), 2);
+  EXPECT_TRUE(memory.MatchesImage(first));
+
+  // Only the page that changed is copied again
+  memory.WriteWord(0x2000, 3);
+  Memory::Image second = memory.TakeImage(&first);
+  ASSERT_EQ(second.pages.size(), 2);
+  EXPECT_EQ(second.pages[0].second, first.pages[0].second);
+  EXPECT_NE(second.pages[1].second, first.pages[1].second);
+  EXPECT_FALSE(memory.MatchesImage(first));
+  EXPECT_TRUE(memory.MatchesImage(second));
+
+  memory.WriteWord(0x9000, 4);
+  std::vector<uint64_t> written = memory.RestoreImage(first);
+  std::sort(written.begin(), written.end());
+  EXPECT_EQ(written, (std::vector<uint64_t>{0x2, 0x9}));
+  EXPECT_TRUE(memory.MatchesImage(first));
+  EXPECT_EQ(memory.ReadWord(0x2000), 2);
+  EXPECT_EQ(memory.ReadWord(0x9000), 0);
+  EXPECT_TRUE(memory.RestoreImage(first).empty());
+
+  // In ECC mode a flipped check bit is a difference too
+  memory.SetEccEnabled(true);
+  Memory::Image encoded = memory.TakeImage();
+  memory.InjectBitFlip(0x1000, 35);
+  EXPECT_FALSE(memory.MatchesImage(encoded));
+  memory.RestoreImage(encoded);
+  EXPECT_TRUE(memory.MatchesImage(encoded));
+  EXPECT_EQ(memory.ReadWord(0x1000), 1);
+  EXPECT_EQ(memory.GetEccStats().corrected, 0);
+}
+
+TEST(MemoryTest, ScrubberTest) {
+  Memory memory;
+  memory.SetEccEnabled(true);
+  for (uint64_t page = 0; page < 4; ++page) {
+    memory.WriteWord(0x40000 + page * Memory::kPageSize, 0x1000 + page);
+  }
+  memory.InjectBitFlip(0x40000, 5);
+  memory.InjectBitFlip(0x40000 + 2 * Memory::kPageSize, 3);
+  memory.InjectBitFlip(0x40000 + 2 * Memory::kPageSize, 34);
+
+  MemoryScrubber scrubber;
+  scrubber.Start(memory, 100000000);
+  ASSERT_TRUE(scrubber.Running());
+
+  // Writes from this thread race the scrubber on the same pages and must not look like errors
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  uint32_t value = 0;
+  while (scrubber.GetStats().passes < 3 && std::chrono::steady_clock::now() < deadline) {
+    memory.WriteWord(0x40000 + 3 * Memory::kPageSize + 4, value++);
+  }
+  scrubber.Stop();
+  EXPECT_FALSE(scrubber.Running());
+
+  MemoryScrubber::Stats stats = scrubber.GetStats();
+  EXPECT_GE(stats.passes, 3);
+  EXPECT_GE(stats.words_scrubbed, 3 * Memory::kPageSize);
+  EXPECT_EQ(stats.corrected, 1);
+  // Counted once, however many passes find it
+  EXPECT_EQ(stats.uncorrectable, 1);
+
+  // Once the word is rewritten, failing again counts again
+  scrubber.Start(memory, 100000000);
+  auto passes_from = [&](uint64_t passes) {
+    uint64_t until = scrubber.GetStats().passes + passes;
+    while (scrubber.GetStats().passes < until && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+    }
+  };
+  deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  passes_from(2);
+  EXPECT_EQ(scrubber.GetStats().uncorrectable, 1);
+  memory.WriteWord(0x40000 + 2 * Memory::kPageSize, 0x1002);
+  passes_from(2);
+  memory.InjectBitFlip(0x40000 + 2 * Memory::kPageSize, 7);
+  memory.InjectBitFlip(0x40000 + 2 * Memory::kPageSize, 36);
+  passes_from(2);
+  scrubber.Stop();
+  EXPECT_EQ(scrubber.GetStats().uncorrectable, 2);
+
+  // The single flip was fixed in memory, so reading it corrects nothing
+  EXPECT_EQ(memory.ReadWord(0x40000), 0x1000);
+  EXPECT_EQ(memory.GetEccStats().corrected, 0);
+  EXPECT_EQ(memory.ReadWord(0x40000 + 3 * Memory::kPageSize + 4), value - 1);
+
+  // A zero rate never starts the thread
+  scrubber.Start(memory, 0);
+  EXPECT_FALSE(scrubber.Running());
+}
+
+TEST(MemoryTest, WordAccessTest) {
+  Memory memory;
+  // Every offset in the last doubleword of a page, so the accesses that straddle the boundary are covered
+  const uint64_t page_end = 0x10000000 + Memory::kPageSize;
+  const uint64_t value = 0x8877665544332211;
+
+  for (uint64_t address = page_end - 8; address < page_end; ++address) {
+    memory.WriteDoubleWord(address, value);
+    for (size_t b = 0; b < 8; ++b) {
+      ASSERT_EQ(memory.ReadByte(address + b), static_cast<uint8_t>(value >> (8 * b)));
+    }
+    ASSERT_EQ(memory.ReadDoubleWord(address), value);
+    ASSERT_EQ(memory.ReadWord(address + 4), static_cast<uint32_t>(value >> 32));
+    ASSERT_EQ(memory.ReadHalfWord(address + 6), static_cast<uint16_t>(value >> 48));
+
+    memory.WriteWord(address + 2, 0xdeadbeef);
+    uint32_t word = 0;
+    for (size_t b = 0; b < 4; ++b) {
+      word |= static_cast<uint32_t>(memory.ReadByte(address + 2 + b)) << (8 * b);
+    }
+    ASSERT_EQ(word, 0xdeadbeef);
+    ASSERT_EQ(memory.ReadDoubleWord(address), (value & 0xffff00000000ffff) | (uint64_t{0xdeadbeef} << 16));
+
+    for (size_t b = 0; b < 8; ++b) {
+      memory.WriteByte(address + b, static_cast<uint8_t>(0xa0 + b));
+    }
+    ASSERT_EQ(memory.ReadDoubleWord(address), 0xa7a6a5a4a3a2a1a0);
+    ASSERT_EQ(memory.ReadWord(address + 1), 0xa4a3a2a1);
+  }
+}
+
+TEST(MemoryTest, WriteBlockTest) {
+  Memory memory;
+  std::vector<uint8_t> bytes(10000);
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    bytes[i] = static_cast<uint8_t>(i * 7);
+  }
+  memory.WriteBlock(0x10000ffa, bytes);
+
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    ASSERT_EQ(memory.ReadByte(0x10000ffa + i), bytes[i]);
+  }
+  EXPECT_EQ(memory.ReadByte(0x10000ff9), 0);
+  EXPECT_EQ(memory.ReadByte(0x10000ffa + bytes.size()), 0);
+}
+
+TEST(MemoryTest, CopyOnWriteEpochTest) {
+  Memory memory;
+  memory.WriteWord(0x1000, 1);
+  memory.BeginEpoch();
+
+  memory.WriteWord(0x1000, 2);
+  memory.WriteWord(0x1004, 3); // Same page: preserved only once
+  memory.WriteWord(0x900000, 4); // New page: preserved as zeros
+  Memory::PreservedPages first = memory.BeginEpoch();
+  ASSERT_EQ(first.size(), 2);
+  ASSERT_EQ(first.bytes.size(), 2 * Memory::kPageSize);
+
+  memory.WriteWord(0x1000, 5);
+  Memory::PreservedPages second = memory.BeginEpoch();
+  ASSERT_EQ(second.size(), 1);
+
+  // Newest epoch first, back to the state at the first BeginEpoch()
+  memory.RestorePages(second);
+  EXPECT_EQ(memory.ReadWord(0x1000), 2);
+  memory.RestorePages(first);
+  EXPECT_EQ(memory.ReadWord(0x1000), 1);
+  EXPECT_EQ(memory.ReadWord(0x1004), 0);
+  EXPECT_EQ(memory.ReadWord(0x900000), 0);
+
+  // A merged epoch may hold a page twice; the earlier copy wins
+  memory.WriteWord(0x1000, 6);
+  Memory::PreservedPages earlier = memory.BeginEpoch();
+  memory.WriteWord(0x1000, 7);
+  memory.MergeEpoch(std::move(earlier));
+  memory.WriteWord(0x1000, 8);
+  memory.RestorePages(memory.BeginEpoch());
+  EXPECT_EQ(memory.ReadWord(0x1000), 1);
+}
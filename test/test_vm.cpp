@@ -6,8 +6,12 @@
 
 #include <gtest/gtest.h>
 #include "../src/vm/rvss/rvss_vm.h"
+#include "../src/vm/rv5s/rv5s_vm.h"
 #include "../src/assembler/assembler.h"
 
+#include <algorithm>
+#include <memory>
+
 TEST(VmTest, ImmGenTest1) {
   RVSSVM vm;
   uint32_t lui_instruction = 0x100001b7;
@@ -209,4 +213,466 @@ TEST(VmTest, ExecutionTest11) {
   ASSERT_EQ(vm.registers_.ReadGpr(3), 0x0000000000100000);
   vm.Step();
   ASSERT_EQ(vm.registers_.ReadGpr(4), 0x0000000000100004);
-}
\ No newline at end of file
+}
+TEST(VmTest, DecodeCacheTest) {
+  RVSSVM vm;
+  AssembledProgram program;
+  program.text_buffer.push_back(0x01700513); // addi x10, x0, 23
+  program.text_buffer.push_back(0x00b50633); // add x12, x10, x11
+  vm.LoadProgram(program);
+
+  DecodedInstruction *addi = vm.decode_cache_.Lookup(0);
+  ASSERT_NE(addi, nullptr);
+  ASSERT_TRUE(addi->valid);
+  ASSERT_EQ(addi->exec_class, ExecClass::kInteger);
+  ASSERT_EQ(addi->rd, 10);
+  ASSERT_EQ(addi->imm, 23);
+  ASSERT_EQ(addi->alu_op, alu::AluOp::kAdd);
+  ASSERT_TRUE(addi->alu_src);
+  ASSERT_TRUE(addi->reg_write);
+
+  DecodedInstruction *add = vm.decode_cache_.Lookup(4);
+  ASSERT_NE(add, nullptr);
+  ASSERT_EQ(add->rs1, 10);
+  ASSERT_EQ(add->rs2, 11);
+  ASSERT_FALSE(add->alu_src);
+  ASSERT_EQ(vm.decode_cache_.Lookup(8), nullptr);
+
+  vm.decode_cache_.Invalidate(2, 4);
+  ASSERT_FALSE(addi->valid);
+  ASSERT_FALSE(add->valid);
+
+  vm.memory_controller_.WriteWord(0, 0x02a00513); // addi x10, x0, 42
+  vm.Run();
+  ASSERT_EQ(vm.registers_.ReadGpr(10) & 0xFFFFFFFF, 42);
+}
+
+TEST(VmTest, BlockCacheTest) {
+  RVSSVM vm;
+  AssembledProgram program;
+  program.text_buffer.push_back(0x02a00337); // lui x6, 0x02a00
+  program.text_buffer.push_back(0x39330313); // addi x6, x6, 0x393
+  program.text_buffer.push_back(0x00602623); // sw x6, 12(x0)
+  program.text_buffer.push_back(0x00100393); // addi x7, x0, 1
+  program.text_buffer.push_back(0x00138413); // addi x8, x7, 1
+  vm.LoadProgram(program);
+
+  TranslatedBlock *block = vm.TranslateBlock(0);
+  ASSERT_NE(block, nullptr);
+  ASSERT_EQ(block->entries.size(), 5);
+  ASSERT_EQ(vm.block_cache_.Lookup(0), block);
+  ASSERT_EQ(vm.block_cache_.Lookup(4), nullptr);
+
+  // The store rewrites x7's addi to "addi x7, x0, 42" inside the running block
+  vm.Run();
+  ASSERT_EQ(vm.registers_.ReadGpr(7) & 0xFFFFFFFF, 42);
+  ASSERT_EQ(vm.registers_.ReadGpr(8) & 0xFFFFFFFF, 43);
+  ASSERT_EQ(vm.instructions_retired_, 5);
+}
+
+TEST(VmTest, JitMatchesInterpreterTest) {
+  AssembledProgram program;
+  program.text_buffer = {
+    0x00000293, // addi x5, x0, 0
+    0x06400313, // addi x6, x0, 100
+    0x00544433, // xor x8, x8, x5
+    0x00329493, // slli x9, x5, 3
+    0x00550533, // add x10, x10, x5
+    0x005035b3, // sltu x11, x0, x5
+    0x00128293, // addi x5, x5, 1
+    0xfe6296e3, // bne x5, x6, -20
+  };
+
+  RVSSVM interpreted;
+  interpreted.LoadProgram(program);
+  interpreted.Run();
+
+  vm_config::config.setVmType(vm_config::VmTypes::JIT);
+  RVSSVM compiled;
+  compiled.LoadProgram(program);
+  compiled.Run();
+  vm_config::config.setVmType(vm_config::VmTypes::SINGLE_STAGE);
+
+  ASSERT_EQ(compiled.registers_.ReadGpr(10) & 0xFFFFFFFF, 4950);
+  ASSERT_EQ(compiled.registers_.GetGprValues(), interpreted.registers_.GetGprValues());
+  ASSERT_EQ(compiled.instructions_retired_, interpreted.instructions_retired_);
+  ASSERT_EQ(compiled.program_counter_, interpreted.program_counter_);
+}
+
+TEST(VmTest, PipelineMatchesSingleStageTest) {
+  AssembledProgram program;
+  program.text_buffer = {
+    0x00000293, // addi x5, x0, 0
+    0x06400313, // addi x6, x0, 100
+    0x00544433, // xor x8, x8, x5
+    0x00329493, // slli x9, x5, 3
+    0x00550533, // add x10, x10, x5
+    0x005035b3, // sltu x11, x0, x5
+    0x00128293, // addi x5, x5, 1
+    0xfe6296e3, // bne x5, x6, -20
+  };
+
+  RVSSVM single_stage;
+  single_stage.LoadProgram(program);
+  single_stage.Run();
+
+  RV5SVM pipelined;
+  pipelined.LoadProgram(program);
+  pipelined.Run();
+
+  ASSERT_EQ(pipelined.registers_.GetGprValues(), single_stage.registers_.GetGprValues());
+  ASSERT_EQ(pipelined.instructions_retired_, single_stage.instructions_retired_);
+  ASSERT_EQ(pipelined.program_counter_, single_stage.program_counter_);
+  ASSERT_EQ(pipelined.InFlight(), 0);
+
+  // Every taken bne costs two cycles; nothing was fetched behind it, as it ends the text
+  EXPECT_EQ(pipelined.branch_mispredictions_, 99);
+  EXPECT_EQ(pipelined.flushed_instructions_, 0);
+  EXPECT_EQ(pipelined.hazard_stall_cycles_, 0);
+  EXPECT_EQ(pipelined.cycle_s_, pipelined.instructions_retired_ + 4 + 2 * 99);
+}
+
+TEST(VmTest, PipelineHazardTest) {
+  AssembledProgram program;
+  program.text_buffer = {
+    0x10000293, // addi x5, x0, 256
+    0x0002b303, // ld x6, 0(x5)
+    0x00130393, // addi x7, x6, 1
+  };
+
+  // Full 64-bit registers, so the load address is x5 as it is
+  vm_config::config.setEccShadowRegisters(true);
+  auto run = [&program](bool hazard_detection, bool forwarding) {
+    vm_config::config.setHazardDetection(hazard_detection);
+    vm_config::config.setForwarding(forwarding);
+    auto vm = std::make_unique<RV5SVM>();
+    vm->LoadProgram(program, false);
+    vm->memory_controller_.WriteDoubleWord(256, 41);
+    vm->Run();
+    vm->UpdateCycleStats();
+    return vm;
+  };
+
+  // Forwarding leaves only the load's user to wait, for one cycle
+  auto forwarded = run(true, true);
+  EXPECT_EQ(forwarded->registers_.ReadGpr(7), 42);
+  EXPECT_EQ(forwarded->hazard_stall_cycles_, 1);
+  EXPECT_EQ(forwarded->TotalCycles(), 8);
+
+  // Without it, both users wait until their producer has written back
+  auto interlocked = run(true, false);
+  EXPECT_EQ(interlocked->registers_.ReadGpr(7), 42);
+  EXPECT_EQ(interlocked->hazard_stall_cycles_, 4);
+  EXPECT_EQ(interlocked->stall_cycles_, 4);
+
+  // Without hazard detection the add reads x6 before the load has written it
+  auto unchecked = run(false, true);
+  EXPECT_EQ(unchecked->registers_.ReadGpr(7), 1);
+  EXPECT_EQ(unchecked->hazard_stall_cycles_, 0);
+
+  vm_config::config.setHazardDetection(true);
+  vm_config::config.setForwarding(true);
+  vm_config::config.setEccShadowRegisters(false);
+}
+
+TEST(VmTest, DataImageTest) {
+  AssembledProgram program;
+  program.data_buffer = {uint8_t{1}, uint64_t{0x1122334455667788}, std::string("hi"), uint16_t{0x7777}, 2.5f};
+  program.data_image = BuildDataImage(program.data_buffer);
+  ASSERT_EQ(program.data_image.size(), 24);
+
+  RVSSVM vm;
+  vm.LoadProgram(program, false);
+  uint64_t data_start = vm_config::config.getDataSectionStart();
+  EXPECT_EQ(vm.memory_controller_.ReadByte(data_start), 1);
+  EXPECT_EQ(vm.memory_controller_.ReadDoubleWord(data_start + 8), 0x1122334455667788);
+  EXPECT_EQ(vm.memory_controller_.ReadHalfWord(data_start + 16), 'h' | ('i' << 8));
+  EXPECT_EQ(vm.memory_controller_.ReadHalfWord(data_start + 18), 0x7777);
+  EXPECT_EQ(vm.memory_controller_.ReadWord(data_start + 20), 0x40200000); // 2.5f
+
+  // An item list without an image is laid out the same way
+  program.data_image.clear();
+  RVSSVM from_items;
+  from_items.LoadProgram(program, false);
+  EXPECT_EQ(from_items.memory_controller_.ReadDoubleWord(data_start + 16),
+            vm.memory_controller_.ReadDoubleWord(data_start + 16));
+}
+
+TEST(VmTest, RunSkipsDeltasTest) {
+  AssembledProgram program;
+  program.text_buffer.push_back(0x02a00513); // addi x10, x0, 42
+  program.text_buffer.push_back(0x00a02623); // sw x10, 12(x0)
+  program.text_buffer.push_back(0x00100593); // addi x11, x0, 1
+
+  RVSSVM vm;
+  vm.LoadProgram(program, false);
+  vm.Step();
+  ASSERT_EQ(vm.undo_history_.UndoDepth(), 1);
+
+  vm.Run();
+  EXPECT_EQ(vm.undo_history_.UndoDepth(), 0);
+  EXPECT_EQ(vm.undo_history_.RedoDepth(), 0);
+  EXPECT_TRUE(vm.current_delta_.register_changes.empty());
+  EXPECT_TRUE(vm.current_delta_.memory_changes.empty());
+  EXPECT_EQ(vm.memory_controller_.ReadWord(12), 42);
+  EXPECT_EQ(vm.registers_.ReadGpr(11) & 0xFFFFFFFF, 1);
+}
+
+TEST(VmTest, UndoHistoryTest) {
+  UndoHistory history(256);
+  StepDelta delta{};
+  for (uint64_t i = 0; i < 4; ++i) {
+    delta.old_pc = i * 4;
+    delta.new_pc = i * 4 + 4;
+    delta.register_changes = {{10, 0, i, i + 1}, {0x300, 1, 0, i}};
+    delta.memory_changes = {{0x1000 + i, {uint8_t(i), 0}, {0xAA, uint8_t(i + 1)}}};
+    history.Push(delta);
+  }
+  // Each record is 82 bytes, so only the last three steps fit
+  ASSERT_EQ(history.UndoDepth(), 3);
+  ASSERT_LE(history.BytesUsed(), 256);
+
+  StepDelta out;
+  ASSERT_TRUE(history.Undo(out));
+  EXPECT_EQ(out.old_pc, 12);
+  ASSERT_EQ(out.register_changes.size(), 2);
+  EXPECT_EQ(out.register_changes[1].reg_index, 0x300);
+  EXPECT_EQ(out.register_changes[1].new_value, 3);
+  ASSERT_EQ(out.memory_changes.size(), 1);
+  EXPECT_EQ(out.memory_changes[0].address, 0x1003);
+  EXPECT_EQ(out.memory_changes[0].old_bytes_vec, (std::vector<uint8_t>{3, 0}));
+  EXPECT_EQ(out.memory_changes[0].new_bytes_vec, (std::vector<uint8_t>{0xAA, 4}));
+
+  ASSERT_TRUE(history.Undo(out));
+  ASSERT_TRUE(history.Undo(out));
+  EXPECT_EQ(out.old_pc, 4);
+  EXPECT_FALSE(history.Undo(out));
+
+  ASSERT_TRUE(history.Redo(out));
+  EXPECT_EQ(out.new_pc, 8);
+  ASSERT_EQ(history.RedoDepth(), 2);
+
+  // A new step drops whatever could still be redone
+  delta.old_pc = 100;
+  history.Push(delta);
+  EXPECT_EQ(history.RedoDepth(), 0);
+  EXPECT_FALSE(history.Redo(out));
+  ASSERT_TRUE(history.Undo(out));
+  EXPECT_EQ(out.old_pc, 100);
+}
+
+TEST(VmTest, StepUndoRedoTest) {
+  AssembledProgram program;
+  program.text_buffer.push_back(0x02a00513); // addi x10, x0, 42
+  program.text_buffer.push_back(0x00a02623); // sw x10, 12(x0)
+
+  RVSSVM vm;
+  vm.LoadProgram(program, false);
+  vm.Step();
+  vm.Step();
+  ASSERT_EQ(vm.memory_controller_.ReadWord(12), 42);
+
+  vm.Undo();
+  EXPECT_EQ(vm.memory_controller_.ReadWord(12), 0);
+  EXPECT_EQ(vm.program_counter_, 4);
+  vm.Undo();
+  EXPECT_EQ(vm.registers_.ReadGpr(10), 0);
+  EXPECT_EQ(vm.program_counter_, 0);
+
+  vm.Redo();
+  vm.Redo();
+  EXPECT_EQ(vm.memory_controller_.ReadWord(12), 42);
+  EXPECT_EQ(vm.program_counter_, 8);
+}
+
+TEST(VmTest, ReverseExecutionTest) {
+  AssembledProgram program;
+  program.text_buffer = {
+    0x00000293, // addi x5, x0, 0
+    0x02800313, // addi x6, x0, 40
+    0x00229393, // slli x7, x5, 2
+    0x2053a023, // sw x5, 512(x7)
+    0x00128293, // addi x5, x5, 1
+    0xfe629ae3, // bne x5, x6, -12
+  };
+  vm_config::config.setCheckpointInterval(10);
+
+  struct State {
+    uint64_t instruction;
+    std::vector<uint64_t> gpr;
+    uint64_t pc;
+    uint64_t last_store;
+  };
+  // addi leaves ECC bits above the low word, so the stores land wherever x7 + 512 points
+  auto last_store = [](RVSSVM &vm) {
+    return vm.memory_controller_.ReadWord(vm.registers_.ReadGpr(7) + 512);
+  };
+  auto capture = [&](RVSSVM &vm) {
+    return State{vm.instructions_retired_, vm.registers_.GetGprValues(), vm.program_counter_, last_store(vm)};
+  };
+
+  RVSSVM reference;
+  reference.LoadProgram(program, false);
+  std::vector<State> expected;
+  for (uint64_t target : {0, 3, 77, 120, 150, 157}) {
+    while (reference.instructions_retired_ < target) {
+      reference.Step();
+    }
+    expected.push_back(capture(reference));
+  }
+
+  RVSSVM vm;
+  vm.LoadProgram(program, false);
+  vm.Run();
+  ASSERT_EQ(vm.instructions_retired_, 162);
+  ASSERT_GT(vm.checkpoints_.size(), 10);
+
+  for (size_t i : {4, 2, 1, 3, 0}) {
+    vm.GotoInstruction(expected[i].instruction);
+    State actual = capture(vm);
+    EXPECT_EQ(actual.instruction, expected[i].instruction);
+    EXPECT_EQ(actual.gpr, expected[i].gpr);
+    EXPECT_EQ(actual.pc, expected[i].pc);
+    EXPECT_EQ(actual.last_store, expected[i].last_store);
+  }
+
+  vm.GotoInstruction(162);
+  ASSERT_EQ(last_store(vm), 39);
+  vm.ReverseStep(5);
+  EXPECT_EQ(last_store(vm), 38);
+  EXPECT_EQ(vm.registers_.GetGprValues(), expected[5].gpr);
+  EXPECT_EQ(vm.program_counter_, expected[5].pc);
+
+  vm.AddBreakpoint(16, false);
+  vm.GotoInstruction(162);
+  vm.ReverseContinue();
+  EXPECT_EQ(vm.instructions_retired_, 160);
+  EXPECT_EQ(vm.program_counter_, 16);
+  vm.ReverseContinue();
+  EXPECT_EQ(vm.instructions_retired_, 156);
+
+  // Hand edits cannot be replayed, so history restarts from them
+  vm.ModifyRegister("x5", 0);
+  vm.RebaseCheckpoints();
+  vm.GotoInstruction(100);
+  EXPECT_EQ(vm.instructions_retired_, 156);
+  EXPECT_EQ(vm.output_status_, "VM_GOTO_OUT_OF_RANGE");
+
+  // Undoing past a checkpoint drops it without losing the pages it preserved
+  for (int i = 0; i < 15; ++i) {
+    vm.Step();
+  }
+  State stepped = capture(vm);
+  for (int i = 0; i < 12; ++i) {
+    vm.Undo();
+  }
+  ASSERT_EQ(vm.instructions_retired_, 159);
+  vm.GotoInstruction(156);
+  vm.GotoInstruction(stepped.instruction);
+  EXPECT_EQ(vm.registers_.GetGprValues(), stepped.gpr);
+  EXPECT_EQ(last_store(vm), stepped.last_store);
+
+  vm_config::config.setCheckpointInterval(1000000);
+}
+
+TEST(VmTest, BreakpointSetTest) {
+  BreakpointSet breakpoints;
+  breakpoints.SetTextSize(64);
+  ASSERT_TRUE(breakpoints.Add({.address = 8, .condition = {}}));
+  ASSERT_FALSE(breakpoints.Add({.address = 8, .condition = {}}));
+  ASSERT_TRUE(breakpoints.Add({.address = 64, .condition = {}}));
+  EXPECT_TRUE(breakpoints.MaybeHit(8));
+  EXPECT_TRUE(breakpoints.MaybeHit(64));
+  EXPECT_FALSE(breakpoints.MaybeHit(12));
+  EXPECT_FALSE(breakpoints.MaybeHit(68));
+  EXPECT_THROW(breakpoints.Add({.address = 10, .condition = {}}), std::invalid_argument);
+  EXPECT_FALSE(breakpoints.Remove(10));
+  EXPECT_TRUE(breakpoints.MaybeHit(8));
+
+  // Addresses past the text section go to the hash set, which must survive growth and deletes
+  for (uint64_t address = 0x1000; address < 0x1000 + 4 * 100; address += 4) {
+    ASSERT_TRUE(breakpoints.Add({.address = address, .condition = {}}));
+  }
+  for (uint64_t address = 0x1000; address < 0x1000 + 4 * 100; address += 8) {
+    ASSERT_TRUE(breakpoints.Remove(address));
+  }
+  for (uint64_t address = 0x1000; address < 0x1000 + 4 * 100; address += 4) {
+    EXPECT_EQ(breakpoints.MaybeHit(address), address % 8!=0) << address;
+  }
+  EXPECT_EQ(breakpoints.Entries().size(), 52);
+
+  // Entries stay sorted by address whatever order they are added in
+  ASSERT_TRUE(breakpoints.Add({.address = 4, .condition = {}}));
+  EXPECT_TRUE(std::is_sorted(breakpoints.Entries().begin(), breakpoints.Entries().end(),
+                             [](const Breakpoint &a, const Breakpoint &b) { return a.address < b.address; }));
+  ASSERT_NE(breakpoints.Find(0x1004), nullptr);
+  EXPECT_EQ(breakpoints.Find(0x1004)->address, 0x1004);
+  EXPECT_EQ(breakpoints.Find(0x1008), nullptr);
+  EXPECT_TRUE(breakpoints.Remove(4));
+  EXPECT_EQ(breakpoints.Find(4), nullptr);
+
+  // Growing the text section moves 64 into the bitmap
+  breakpoints.SetTextSize(128);
+  EXPECT_TRUE(breakpoints.MaybeHit(64));
+  EXPECT_TRUE(breakpoints.Remove(64));
+  EXPECT_FALSE(breakpoints.MaybeHit(64));
+
+  EXPECT_THROW(BreakpointCondition::Parse("x32", "==", "0"), std::invalid_argument);
+  EXPECT_THROW(BreakpointCondition::Parse("x1", "=", "0"), std::invalid_argument);
+  EXPECT_THROW(BreakpointCondition::Parse("mem[0x10", "==", "0"), std::invalid_argument);
+  BreakpointCondition condition = BreakpointCondition::Parse("mem[0x10]", ">=", "0x20");
+  EXPECT_EQ(condition.source, BreakpointCondition::Source::kMemory);
+  EXPECT_EQ(condition.operand, 0x10);
+  EXPECT_EQ(condition.value, 0x20);
+}
+
+TEST(VmTest, ConditionalBreakpointTest) {
+  AssembledProgram program;
+  program.text_buffer = {
+    0x00000293, // addi x5, x0, 0
+    0x02800313, // addi x6, x0, 40
+    0x00229393, // slli x7, x5, 2
+    0x2053a023, // sw x5, 512(x7)
+    0x00128293, // addi x5, x5, 1
+    0xfe629ae3, // bne x5, x6, -12
+  };
+  vm_config::config.setRunStepDelay(0);
+
+  // x5 carries ECC bits, so take the value to compare against from a VM stepped to the 4th iteration
+  RVSSVM reference;
+  reference.LoadProgram(program, false);
+  while (reference.instructions_retired_ < 16) {
+    reference.Step();
+  }
+  ASSERT_EQ(reference.program_counter_, 16);
+  uint64_t x5 = reference.registers_.ReadGpr(5);
+
+  RVSSVM vm;
+  vm.LoadProgram(program, false);
+  Breakpoint conditional;
+  conditional.condition = BreakpointCondition::Parse("x5", "==", std::to_string(x5));
+  vm.AddBreakpoint(16, false, conditional);
+  vm.DebugRun();
+  EXPECT_EQ(vm.instructions_retired_, 16);
+  EXPECT_EQ(vm.breakpoints_.Find(16)->hit_count, 1);
+  vm.RemoveBreakpoint(16, false);
+
+  Breakpoint ignored;
+  ignored.ignore_count = 2;
+  vm.Reset();
+  vm.LoadProgram(program, false);
+  vm.AddBreakpoint(16, false, ignored);
+  vm.DebugRun();
+  EXPECT_EQ(vm.instructions_retired_, 12);
+  EXPECT_EQ(vm.breakpoints_.Find(16)->hit_count, 3);
+  vm.RemoveBreakpoint(16, false);
+
+  Breakpoint temporary;
+  temporary.temporary = true;
+  vm.AddBreakpoint(8, false, temporary);
+  vm.DebugRun();
+  EXPECT_EQ(vm.instructions_retired_, 14);
+  EXPECT_FALSE(vm.CheckBreakpoint(8));
+  vm.DebugRun();
+  EXPECT_EQ(vm.instructions_retired_, 162);
+}